@@ -0,0 +1,11 @@
+#!/bin/bash
+
+#compare frame delivery jitter of the acquisition modes
+#usage: ./bench.sh [config] [seconds] [poll cpu], as root for SCHED_FIFO
+cfg=${1:-config/shk_1bin_2tap_8bit.cfg}
+secs=${2:-30}
+cpu=${3:--1}
+
+for mode in irq batch poll; do
+    ./bin/watchdog -c$cfg -t$secs -a$mode -q$cpu 2>&1 | grep -E "JITTER|BATCH:|POLL:|Total frames"
+done
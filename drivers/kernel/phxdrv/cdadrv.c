@@ -45,16 +45,33 @@
 #include <linux/list.h>
 #include <linux/pci.h>
 #include <linux/interrupt.h>
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0) )
+#include <linux/uaccess.h>
+#else
 #include <asm/uaccess.h>
+#endif
 #if ( LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 0) )
 #include <linux/iobuf.h>
 #endif
 #if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) )
 #include <linux/workqueue.h>
 #include <linux/wait.h>
+#include <linux/seq_file.h>
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 21) )
+#include <linux/hrtimer.h>
+#endif
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 16) )
+#include <linux/ktime.h>
+#endif
 #include <linux/slab.h>
 #include <linux/pagemap.h>
 #include <linux/vmalloc.h>
+#include <linux/dma-mapping.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0) ) && defined CONFIG_MMU_NOTIFIER
+#include <linux/mmu_notifier.h>
+#endif
 #include <asm/page.h>
 #include <asm/pgtable.h>
 #endif
@@ -68,6 +85,8 @@
 #include <cda_buf.h>
 #include <cda_lib.h>
 #include "picc_dio.h"
+#define CREATE_TRACE_POINTS
+#include "phxdrv_trace.h"
 
 #if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) )
 MODULE_LICENSE("GPL");
@@ -110,8 +129,68 @@ static CDA_FProbe* const CDA_pfnProbeArray[] =
 #endif
 
 #ifndef CDA_EVENTQ
-#define CDA_EVENTQ 8            /* Size of event queue */
+#define CDA_EVENTQ 64           /* Default size of event queue, see event_queue */
+#endif
+#define CDA_EVENTQ_MIN 2
+#define CDA_EVENTQ_MAX 4096
+
+/* Event waiters woken every event_batch events, or event_batch_us after
+ * the first event they were not woken for */
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 21) )
+#define CDA_EVENT_MODERATION
+#endif
+#ifndef CDA_EVENT_BATCH_US
+#define CDA_EVENT_BATCH_US 1000         /* Default event_batch_us */
+#endif
+
+#ifndef CDA_SG_SEGMENT
+#define CDA_SG_SEGMENT 0x200000 /* Default sg_max_segment, one huge page */
+#endif
+
+/* Long term pins, and buffer mappings kept across unlock and relock */
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0) )
+#define CDA_PIN_USER
+#endif
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 10, 0) ) && defined CONFIG_MMU_NOTIFIER
+#define CDA_LOCK_CACHE
+#endif
+#ifndef CDA_LOCK_CACHE_SIZE
+#define CDA_LOCK_CACHE_SIZE 64  /* Default lock_cache */
+#endif
+
+/* Driver allocated buffers that user space can mmap, CDA_IOCTL_DMABUF_ALLOC */
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 6, 0) )
+#define CDA_DMABUF
 #endif
+#define CDA_DMABUF_PGOFF (0x40000000UL >> PAGE_SHIFT) /* mmap offset of the first buffer */
+
+/* Timing marker for external scope measurements, see marker */
+#ifndef CDA_NO_MARKER
+#define CDA_MARKER
+#if defined CONFIG_X86
+#define CDA_MARKER_DIO                  /* ISA DIO board ports */
+#endif
+#endif
+#ifndef CDA_MARKER_RING
+#define CDA_MARKER_RING 256             /* Timestamps kept per device, power of 2 */
+#endif
+enum { CDA_kMarkerOff, CDA_kMarkerDio, CDA_kMarkerGpio, CDA_kMarkerRing };
+
+/* Always on statistics in /proc/driver/phddrv/<device> */
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 26) )
+#define CDA_STATS
+#define CDA_PROC_DIR "driver/phddrv"
+#define CDA_STAT_INC( _p, _f)     atomic_long_inc( &(_p)->stats._f)
+#define CDA_STAT_ADD( _p, _f, _n) atomic_long_add( (_n), &(_p)->stats._f)
+#define CDA_STAT_SUB( _p, _f, _n) atomic_long_sub( (_n), &(_p)->stats._f)
+#else
+#define CDA_STAT_INC( _p, _f)     do {} while (0)
+#define CDA_STAT_ADD( _p, _f, _n) do {} while (0)
+#define CDA_STAT_SUB( _p, _f, _n) do {} while (0)
+#endif
+
+/* Device the DMA API maps buffers for */
+#define CDA_DMA_DEV( _pInst) (&((SPciInstance*)((_pInst)->pDevice))->pDev->dev)
 
 #define copy_to_user_ret(to, from, size, errcode) \
    if (copy_to_user((to), (from), (size))) return (errcode)
@@ -119,6 +198,11 @@ static CDA_FProbe* const CDA_pfnProbeArray[] =
    if (copy_from_user((to), (from), (size))) return (errcode)
 #define put_user_ret( l, p, e) \
    if (put_user((l), (p))) return(e)
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 0, 0) )
+#define CDA_ACCESS_OK_WRITE( p, n) access_ok( (p), (n))
+#else
+#define CDA_ACCESS_OK_WRITE( p, n) access_ok( VERIFY_WRITE, (p), (n))
+#endif
 #define get_user_ret( l, p, e) \
    if (get_user((l), (p))) return(e)
 
@@ -132,6 +216,7 @@ int g_iTraceLevel = 2;
 #endif
 
 typedef struct SLock SLock;     /* Locked buffer info */
+typedef struct CDA_SDmaBuf CDA_SDmaBuf; /* Driver allocated buffer */
 
 /* Device state */
 typedef enum EState
@@ -145,6 +230,48 @@ typedef enum EState
   kStateStopping
   } EState;
 
+#ifdef CDA_STATS
+/* Device statistics, updated without locks and read at any time */
+typedef struct CDA_SStats
+  {
+  atomic_long_t irqs;           /* IRQs raised by this device */
+  atomic_long_t irqsNotOurs;    /* Shared IRQs raised by another device */
+  atomic_long_t eventsQueued;
+  atomic_long_t eventsDropped;  /* Lost to a full event queue */
+  atomic_long_t eventsCoalesced; /* Merged into the newest event, see event_coalesce */
+  atomic_long_t queueHighWater; /* Most events queued at once */
+  atomic_long_t wakeups;        /* Wakeups issued to event waiters */
+  atomic_long_t wakeupsDeferred; /* Events that did not wake waiters, see event_batch */
+  atomic_long_t buffersLocked;  /* Buffers currently locked for DMA */
+  atomic_long_t pagesLocked;    /* Pages currently pinned for DMA */
+  atomic_long_t descriptorsLocked; /* SG entries describing those pages */
+  atomic_long_t buffersCached;  /* Unlocked buffers still pinned & mapped */
+  atomic_long_t lockCacheHits;  /* Locks served without pinning */
+  atomic_long_t dmaBufs;        /* Driver allocated buffers */
+  atomic_long_t dmaBufBytes;
+  atomic_long_t statusBits[ 32]; /* IRQs seen with each status bit set */
+  } CDA_SStats;
+#endif
+
+/* Queued device event */
+typedef struct CDA_SEvent
+  {
+  ui32 event;                   /* Device specific event ID */
+  ui32 data;                    /* Event specific data */
+  ui32 seq;                     /* uEventSeq when raised */
+  ui32 count;                   /* Events coalesced into this one, normally 1 */
+  ui64 timestamp;               /* CDA_TIME_NS when raised */
+  } CDA_SEvent;
+
+#ifdef CDA_MARKER
+/* Timing marker ring entry */
+typedef struct CDA_SMarker
+  {
+  ui64 timestamp;               /* CDA_TIME_NS when driven, 0 if unused */
+  ui32 on;
+  } CDA_SMarker;
+#endif
+
 /* Device instance */
 struct CDA_SInstance
   {
@@ -162,26 +289,43 @@ struct CDA_SInstance
   CDA_SDevice* pDevice;         /* Device context */
 
   /* Event queue */
-  spinlock_t lockEventQ;        /* IRQ lock to protect the eventArray, head & tail */
-  struct
-    {
-    ui32 event;                 /* Device specific event ID */
-    ui32 data;                  /* Event specific data */
-    } eventArray[ CDA_EVENTQ];
+  spinlock_t lockEventQ;        /* IRQ lock to protect the pEventArray, head & tail */
+  CDA_SEvent* pEventArray;      /* Allocated when the device is registered */
+  unsigned uEventQSize;         /* Entries in pEventArray */
   volatile unsigned uEventHead; /* Maybe written at IRQ time */
   unsigned uEventTail;          /* Written only at task time */
+  ui32 uEventSeq;               /* Next event sequence no., counts lost events too */
   wait_queue_head_t WaitQ;     /* Processes/threads waiting for an event */
+#ifdef CDA_EVENT_MODERATION
+  unsigned uUnwoken;            /* Events queued since waiters were last woken, under lockEventQ */
+  struct hrtimer batchTimer;    /* Wakes waiters event_batch_us after the first of those */
+#endif
 #if LINUX_VERSION_CODE >= 0x20600
   struct workqueue_struct * task; 
   struct work_struct work;        
 #else
   struct tq_struct task;        /* Deferred IRQ task that wakes processes on WaitQ */
 #endif
-#ifdef DEBUG
-  volatile unsigned uIrqOverflows; /* No. device events lost */
+#ifdef CDA_STATS
+  CDA_SStats stats;
+  struct proc_dir_entry* pProcEntry;
 #endif
 
   SLock* pLockHead;             /*  Linked list of locked buffers */
+#ifdef CDA_LOCK_CACHE
+  SLock* pCacheHead;            /* Unlocked buffers kept mapped, newest first */
+  unsigned uCached;
+#endif
+#ifdef CDA_DMABUF
+  struct mutex dmaBufMutex;     /* Protects pDmaBufHead, mmap runs beside ioctls */
+  CDA_SDmaBuf* pDmaBufHead;
+  u_int32_t uDmaBufId;          /* Last handle issued */
+  unsigned long ulDmaBufPgOff;  /* mmap offset of the next buffer, in pages */
+#endif
+#ifdef CDA_MARKER
+  CDA_SMarker* pMarkerRing;     /* CDA_MARKER_RING entries, maybe NULL */
+  atomic_t markerHead;          /* Entries written, wraps */
+#endif
   };
 
 
@@ -197,13 +341,42 @@ struct SLock
   unsigned int offset;
   unsigned int nr_pages;
   unsigned int direction;
-  unsigned int sglen;
+  unsigned int nents;           /* Entries in sglist, passed to dma_map_sg */
+  unsigned int sglen;           /* Entries after mapping, as given to the board */
   struct CDA_SInstance *pInst;
+  int bCounted;                 /* Included in stats.buffersLocked */
+#ifdef CDA_DMABUF
+  CDA_SDmaBuf* pDmaBuf;         /* Lock on a driver allocated buffer, no pages */
+#endif
+#ifdef CDA_LOCK_CACHE
+  struct mmu_interval_notifier notifier; /* Tells us the buffer was unmapped */
+  unsigned long ulSeq;          /* notifier sequence when the pages were pinned */
+  int bNotifier;                /* notifier inserted, the lock may be cached */
+#endif
 #else
   struct kiobuf *pkiobuf;
 #endif
   };
 
+#ifdef CDA_DMABUF
+/* DMA coherent buffer allocated by CDA_IOCTL_DMABUF_ALLOC */
+struct CDA_SDmaBuf
+  {
+  CDA_SDmaBuf* pNext;
+  CDA_SInstance* pInst;
+  u_int32_t id;                 /* Handle given to user space */
+  void* pvKernel;               /* Kernel mapping */
+  dma_addr_t dma;               /* Bus address of the first byte */
+  size_t size;                  /* Whole pages */
+  unsigned long ulPgOff;        /* mmap offset, in pages */
+  uiSG* pDesc;                  /* Address/length pairs covering the buffer */
+  unsigned uDesc;               /* Pairs in pDesc */
+  unsigned uSegment;            /* Bytes described by each pair but the last */
+  atomic_t iMaps;               /* VMAs mapping it */
+  atomic_t iLocks;              /* CDA_IOCTL_MEMORY_LOCKs on it */
+  };
+#endif
+
   
 /*
  * Prototypes
@@ -237,6 +410,11 @@ static long CDA_compat( struct file *, unsigned int, unsigned long);
 #endif
 static int CDA_open( struct inode *, struct file *);
 static int CDA_release( struct inode *, struct file *);
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0) )
+static __poll_t CDA_poll( struct file *, struct poll_table_struct *);
+#else
+static unsigned int CDA_poll( struct file *, struct poll_table_struct *);
+#endif
 
 int CDA_DeviceIdle( CDA_SInstance*);
 static int CDA_RemoveDevice( CDA_SInstance*);
@@ -246,12 +424,39 @@ static void CDA_IrqTask( struct work_struct *ws);
 #else
 static void CDA_IrqTask( void * pv);
 #endif
-static int CDA_WaitEvent( CDA_SInstance*, CDA_SIoctlEvent*);
+static int CDA_WaitEvent( CDA_SInstance*, CDA_SIoctlEventEx*);
+static int CDA_WaitEventBatch( CDA_SInstance*, CDA_SIoctlEventBatch*);
 static int CDA_LockBuffer( CDA_SInstance*, void*, uiSG*, int);
 static int CDA_FlushBuffer(SLock *pLock);
 static int CDA_UnlockBuffer(SLock *pLock);
+static int CDA_RetireLock( CDA_SInstance*, SLock*);
+#ifdef CDA_LOCK_CACHE
+static SLock* CDA_LockCacheTake( CDA_SInstance*, void*, size_t, unsigned int);
+static void CDA_LockCacheTrim( CDA_SInstance*, unsigned);
+#endif
+#ifdef CDA_DMABUF
+static int CDA_mmap( struct file *, struct vm_area_struct *);
+static int CDA_IoctlDmaBufAlloc( CDA_SInstance*, CDA_SIoctlDmaBuf*);
+static int CDA_IoctlDmaBufFree( CDA_SInstance*, u_int32_t);
+static int CDA_DmaBufLock( CDA_SInstance*, void*, uiSG*, ui32, unsigned long, unsigned long);
+static void CDA_DmaBufRelease( CDA_SInstance*, CDA_SDmaBuf*);
+#endif
 static int CDA_IoctlConfigRestore( CDA_SInstance*);
 static int CDA_IoctlPutEvent     ( CDA_SInstance*, CDA_SIoctlEvent*);
+static unsigned CDA_EventCount( CDA_SInstance*);
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) )
+static void CDA_WakeWaiters( CDA_SInstance*);
+#endif
+#ifdef CDA_EVENT_MODERATION
+static enum hrtimer_restart CDA_BatchTimer( struct hrtimer *);
+#endif
+#ifdef CDA_STATS
+static int CDA_ProcOpen( struct inode *, struct file *);
+#endif
+#ifdef CDA_MARKER
+static void CDA_MarkerInit( void);
+static void CDA_MarkerExit( void);
+#endif
 
 
 /*
@@ -262,6 +467,53 @@ static CDA_SInstance s_instArray[ CDA_MAX_UNITS];   /* Device instance data */
 
 static int major = CDA_MAJOR_NUM;
 static const char * name = CDA_BASE_NAME;
+static unsigned int event_queue = CDA_EVENTQ;   /* Event queue entries per device */
+static int event_coalesce = 0;                  /* Coalesce rather than drop on a full queue */
+static unsigned int event_batch = 1;            /* Events per wakeup of event waiters */
+static unsigned int event_batch_us = CDA_EVENT_BATCH_US; /* Longest wakeup deferral */
+static unsigned int sg_max_segment = CDA_SG_SEGMENT; /* Longest merged SG entry */
+static unsigned int lock_cache = CDA_LOCK_CACHE_SIZE; /* Unlocked buffers kept mapped */
+static int marker = CDA_kMarkerOff;             /* Timing marker, CDA_kMarker... */
+static unsigned int marker_dio = PICC_DIO_BASE; /* DIO board I/O base */
+static unsigned long marker_gpio = 0;           /* GPIO output register, physical */
+static unsigned int marker_gpio_bit = 0;        /* GPIO bit of device 0, +1 per device */
+
+#ifdef CDA_MARKER
+#ifdef CDA_MARKER_DIO
+/* DIO board port driven by each device */
+static const unsigned char s_markerDioPort[] =
+  {
+  [PICC_SHK_DEVNUM] = PICC_DIO_PORTC,
+  [PICC_LYT_DEVNUM] = PICC_DIO_PORTB
+  };
+static int s_bMarkerDio = 0;                    /* DIO ports claimed */
+#endif
+static void __iomem* s_pMarkerGpio = NULL;      /* Mapped marker_gpio */
+static DEFINE_SPINLOCK( s_markerLock);          /* Read-modify-write of s_pMarkerGpio */
+#endif
+
+#ifdef CDA_STATS
+static struct proc_dir_entry* s_pProcDir = NULL;
+
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0) )
+static const struct proc_ops s_procOps =
+  {
+  .proc_open    = CDA_ProcOpen,
+  .proc_read    = seq_read,
+  .proc_lseek   = seq_lseek,
+  .proc_release = single_release,
+  };
+#else
+static const struct file_operations s_procOps =
+  {
+  .owner   = THIS_MODULE,
+  .open    = CDA_ProcOpen,
+  .read    = seq_read,
+  .llseek  = seq_lseek,
+  .release = single_release,
+  };
+#endif
+#endif
 
 #if defined MODULE && LINUX_VERSION_CODE > 0x20115
  MODULE_AUTHOR( "Active Silicon Limited <cda.support@activesilicon.co.uk>");
@@ -271,9 +523,39 @@ static const char * name = CDA_BASE_NAME;
 #if ( LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 0) )
  MODULE_PARM( major, "i");
  MODULE_PARM( name,  "s");
+ MODULE_PARM( event_queue, "i");
+ MODULE_PARM( event_coalesce, "i");
+ MODULE_PARM( event_batch, "i");
+ MODULE_PARM( event_batch_us, "i");
+ MODULE_PARM( sg_max_segment, "i");
+ MODULE_PARM( lock_cache, "i");
+ MODULE_PARM( marker, "i");
+ MODULE_PARM( marker_dio, "i");
+ MODULE_PARM( marker_gpio, "l");
+ MODULE_PARM( marker_gpio_bit, "i");
 #else
  module_param( major, int,  0444 );
  module_param( name, charp, 0444 );
+ module_param( event_queue, uint, 0444 );
+ MODULE_PARM_DESC( event_queue, "Event queue entries per device (default 64)");
+ module_param( event_coalesce, int, 0644 );
+ MODULE_PARM_DESC( event_coalesce, "1 = when the event queue is full, merge an event identical to the newest one into it instead of dropping it");
+ module_param( event_batch, uint, 0644 );
+ MODULE_PARM_DESC( event_batch, "Wake event waiters only every N events, or event_batch_us after the first one, 2.6.21+ kernels (default 1 = every event)");
+ module_param( event_batch_us, uint, 0644 );
+ MODULE_PARM_DESC( event_batch_us, "Longest time an event may wait for its wakeup when event_batch > 1, in us (default 1000)");
+ module_param( sg_max_segment, uint, 0644 );
+ MODULE_PARM_DESC( sg_max_segment, "Longest scatter-gather entry built from physically contiguous pages, in bytes (default 2 MiB, PAGE_SIZE = no merging)");
+ module_param( lock_cache, uint, 0644 );
+ MODULE_PARM_DESC( lock_cache, "Unlocked buffers per device kept pinned and mapped for a fast relock, 5.10+ kernels (default 64, 0 = off)");
+ module_param( marker, int, 0644 );
+ MODULE_PARM_DESC( marker, "Timing marker set at IRQ time and cleared when the event is read: 0 = off (default), 1 = DIO board port (x86, ports claimed only if 1 at load), 2 = GPIO bit (needs marker_gpio), 3 = timestamp ring in /proc/driver/phddrv/<device>");
+ module_param( marker_dio, uint, 0444 );
+ MODULE_PARM_DESC( marker_dio, "DIO board I/O base, device 0 drives port C and device 1 port B (default 0x300)");
+ module_param( marker_gpio, ulong, 0444 );
+ MODULE_PARM_DESC( marker_gpio, "Physical address of a 32 bit GPIO output register, mapped at load if set");
+ module_param( marker_gpio_bit, uint, 0444 );
+ MODULE_PARM_DESC( marker_gpio_bit, "GPIO bit driven by device 0, device n drives bit + n (default 0)");
 #endif
 #ifdef DEBUG_TRACE_LEVEL
 #if ( LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 0) )
@@ -298,25 +580,9 @@ int init_module( void)
   #define BUILD ""
 #endif
   const char* tempName = "phddrv";
-  printk( "%s: LOADED Active Silicon %s driver version %lu.%02lu" BUILD " built at " __TIME__ " on " __DATE__ " --PICC irq hack--\n", tempName, name, CDA_DRV_VERSION / 0x10000, CDA_DRV_VERSION % 0x10000);
+  printk( "%s: LOADED Active Silicon %s driver version %lu.%02lu" BUILD " built at " __TIME__ " on " __DATE__ "\n", tempName, name, CDA_DRV_VERSION / 0x10000, CDA_DRV_VERSION % 0x10000);
 
   TRACE( 2, ( "CDA: trace level %d\n", DEBUG_TRACE_LEVEL));
-  
-  //PICC_DIO Code
-  #if PICC_DIO_ENABLE
-        //get the DIO region of memeory 
-	if(request_region(PICC_DIO_BASE, PICC_DIO_LENGTH, tempName) == NULL) {
-		printk("%s: request_region failed, base: 0x%03X\n", tempName, PICC_DIO_BASE);
-		return 1;
-	}
-	printk("%s: PICC_DIO ports allocated, base: 0x%03X\n", tempName, PICC_DIO_BASE);
-
-        //Set page to 1
-        outb_p(0x01,PICC_DIO_BASE+PICC_DIO_PAGE);
-        //Configure ports A,B,C as output
-        outb_p(0x80,PICC_DIO_BASE+PICC_DIO_CTRL);
-        
-  #endif
 
   /* Probe & register all card types */
   return CDA_Initialise();
@@ -332,14 +598,8 @@ void cleanup_module( void)
   const char* tempName = "phddrv";
   TRACE( 3, ("CDA: %s()\n", __FUNCTION__));
 
-  //PICC_DIO Code
-  #if PICC_DIO_ENABLE
-    //release the DIO region of memeory 
-    release_region(PICC_DIO_BASE, PICC_DIO_LENGTH);
-    printk("%s: PICC_DIO ports released, base: 0x%03X\n", tempName, PICC_DIO_BASE);
-  #endif
-    printk( "%s: UNLOADED Active Silicon %s driver version %lu.%02lu" BUILD " built at " __TIME__ " on " __DATE__ " --PICC irq hack--\n", tempName, name, CDA_DRV_VERSION / 0x10000, CDA_DRV_VERSION % 0x10000);
-    
+  printk( "%s: UNLOADED Active Silicon %s driver version %lu.%02lu" BUILD " built at " __TIME__ " on " __DATE__ "\n", tempName, name, CDA_DRV_VERSION / 0x10000, CDA_DRV_VERSION % 0x10000);
+
   CDA_Terminate();
   }
 #endif
@@ -378,6 +638,25 @@ void cleanup_module( void)
 int CDA_Initialise( void)
   {
   /* File operations */
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 36) )
+  static const struct file_operations s_fileOps =
+    {
+    .owner          = THIS_MODULE,
+    .llseek         = CDA_seek,
+    .read           = CDA_read,
+    .write          = CDA_write,
+    .poll           = CDA_poll,
+    .unlocked_ioctl = CDA_ioctl,
+#if defined _LP64
+    .compat_ioctl   = CDA_compat,
+#endif
+#ifdef CDA_DMABUF
+    .mmap           = CDA_mmap,
+#endif
+    .open           = CDA_open,
+    .release        = CDA_release,
+    };
+#else
   static struct file_operations s_fileOps =
     {
 #if LINUX_VERSION_CODE >= 0x20300
@@ -406,7 +685,7 @@ int CDA_Initialise( void)
 #endif /* LINUX_VERSION_CODE >= 0x20600 */
 
     0,            /* int (*readdir) (struct file *, void *, filldir_t) */
-    0,            /* unsigned int (*poll) (struct file *, struct poll_table_struct *) */
+    CDA_poll,     /* unsigned int (*poll) (struct file *, struct poll_table_struct *) */
 
 #if LINUX_VERSION_CODE >= 0x20624   /* 2.6.36 */
 /* *ioctl was removed in 2.6.36 */
@@ -477,6 +756,7 @@ int CDA_Initialise( void)
 #endif /* LINUX_VERSION_CODE >= 0x20300 */
     
     };
+#endif /* LINUX_VERSION_CODE >= 2.6.36 */
   int i;
 
   TRACE( 9, ("%s()\n", __FUNCTION__));
@@ -492,6 +772,15 @@ int CDA_Initialise( void)
   if ( 0 == major)
     major = i;
 
+#ifdef CDA_STATS
+  s_pProcDir = proc_mkdir( CDA_PROC_DIR, NULL);
+  if ( NULL == s_pProcDir)
+    TRACE( 1, ( "*** %s: cannot create /proc/%s\n", __FUNCTION__, CDA_PROC_DIR));
+#endif
+#ifdef CDA_MARKER
+  CDA_MarkerInit();
+#endif
+
   /* Call all declared init functions */
   for ( i = 0; i < lengthof( CDA_pfnProbeArray); ++i)
     {
@@ -533,6 +822,17 @@ int CDA_Terminate( void)
     CDA_RemoveDevice( pInst);
     }
 
+#ifdef CDA_STATS
+  if ( NULL != s_pProcDir)
+    {
+    remove_proc_entry( CDA_PROC_DIR, NULL);
+    s_pProcDir = NULL;
+    }
+#endif
+#ifdef CDA_MARKER
+  CDA_MarkerExit();
+#endif
+
   /* De-register the device */
 #if LINUX_VERSION_CODE < 0x20617 /* < 2.6.23 */
   iRet = unregister_chrdev( major, name);
@@ -575,6 +875,26 @@ int CDA_RegisterDevice(
     return -ENOMEM;
     }
   pInst = &s_instArray[ s_uDevices++];
+
+  /* Allocate the eventQ */
+  pInst->uEventQSize = event_queue;
+  if ( pInst->uEventQSize < CDA_EVENTQ_MIN)
+    pInst->uEventQSize = CDA_EVENTQ_MIN;
+  if ( pInst->uEventQSize > CDA_EVENTQ_MAX)
+    pInst->uEventQSize = CDA_EVENTQ_MAX;
+  pInst->pEventArray = (CDA_SEvent*) kmalloc( pInst->uEventQSize * sizeof( CDA_SEvent), GFP_KERNEL);
+  if ( NULL == pInst->pEventArray)
+    {
+    TRACE( 1, ("*** %s: Out of memory for %u events\n", __FUNCTION__, pInst->uEventQSize));
+    --s_uDevices;
+    return -ENOMEM;
+    }
+  memset( pInst->pEventArray, 0, pInst->uEventQSize * sizeof( CDA_SEvent));
+#ifdef CDA_MARKER
+  /* Without the ring the marker=3 mode does nothing */
+  pInst->pMarkerRing = (CDA_SMarker*) kzalloc( CDA_MARKER_RING * sizeof( CDA_SMarker), GFP_KERNEL);
+  atomic_set( &pInst->markerHead, 0);
+#endif
 #ifndef NDEBUG
   ASSERT( kMagic != pInst->eMagic);
 
@@ -594,7 +914,17 @@ int CDA_RegisterDevice(
   /* Empty the eventQ */
   spin_lock_init( &pInst->lockEventQ);
   pInst->uEventHead = pInst->uEventTail = 0;
+  pInst->uEventSeq = 0;
   init_waitqueue_head(&pInst->WaitQ);
+#ifdef CDA_EVENT_MODERATION
+  pInst->uUnwoken = 0;
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(6, 15, 0) )
+  hrtimer_setup( &pInst->batchTimer, CDA_BatchTimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+#else
+  hrtimer_init( &pInst->batchTimer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+  pInst->batchTimer.function = CDA_BatchTimer;
+#endif
+#endif
 #if LINUX_VERSION_CODE >= 0x20600
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 20)
   INIT_WORK(&pInst->work, CDA_IrqTask);
@@ -605,8 +935,15 @@ int CDA_RegisterDevice(
   pInst->task.routine = CDA_IrqTask;
   pInst->task.data = pInst;
 #endif
-#ifdef DEBUG
-  pInst->uIrqOverflows = 0;
+#ifdef CDA_DMABUF
+  mutex_init( &pInst->dmaBufMutex);
+  pInst->pDmaBufHead = NULL;
+  pInst->uDmaBufId = 0;
+  pInst->ulDmaBufPgOff = CDA_DMABUF_PGOFF;
+#endif
+#ifdef CDA_STATS
+  memset( &pInst->stats, 0, sizeof( pInst->stats));
+  pInst->pProcEntry = NULL;
 #endif
 
   TRACE( 2, ( "%s: ensure you've created the device file\n  e.g. mknod /dev/%s c %d %u\n",
@@ -618,6 +955,10 @@ int CDA_RegisterDevice(
   if ( 0 == iRet)
     {
     pInst->eState = kStateStarted;
+#ifdef CDA_STATS
+    if ( NULL != s_pProcDir)
+      pInst->pProcEntry = proc_create_data( pInst->szDeviceName, 0444, s_pProcDir, &s_procOps, pInst);
+#endif
     }
   else
     {
@@ -645,6 +986,14 @@ static int CDA_RemoveDevice(
 
   TRACE( 2, ("%s() removing '%s' (%p)\n", __FUNCTION__, pInst->szDeviceName, pInst));
 
+#ifdef CDA_STATS
+  if ( NULL != pInst->pProcEntry)
+    {
+    remove_proc_entry( pInst->szDeviceName, s_pProcDir);
+    pInst->pProcEntry = NULL;
+    }
+#endif
+
   /* De-allocate hardware resources */
   if ( kStateStarted == pInst->eState
     || kStateRemoving == pInst->eState
@@ -666,6 +1015,16 @@ static int CDA_RemoveDevice(
   /* Ensure all buffers unlocked */
   CDA_DeviceIdle( pInst);
 
+#ifdef CDA_EVENT_MODERATION
+  hrtimer_cancel( &pInst->batchTimer);
+#endif
+  kfree( pInst->pEventArray);
+  pInst->pEventArray = NULL;
+#ifdef CDA_MARKER
+  kfree( pInst->pMarkerRing);
+  pInst->pMarkerRing = NULL;
+#endif
+
 #ifndef NDEBUG
   pInst->eMagic = ~kMagic;
 #endif
@@ -829,6 +1188,9 @@ static int CDA_release(
 int CDA_DeviceIdle( CDA_SInstance* pInst)
   {
   SLock* pLock;
+#ifdef CDA_DMABUF
+  CDA_SDmaBuf* pBuf;
+#endif
   
   TRACE( 9, ( "%s(%p)\n", __FUNCTION__, pInst));
 
@@ -847,12 +1209,27 @@ int CDA_DeviceIdle( CDA_SInstance* pInst)
     pInst->pLockHead = pLock->pNext;
     kfree( pLock);
     }
+#ifdef CDA_LOCK_CACHE
+  CDA_LockCacheTrim( pInst, 0);
+#endif
 
-#ifdef DEBUG
-  if ( pInst->uIrqOverflows)
+#ifdef CDA_DMABUF
+  /* No file is open, so nothing maps them any more */
+  mutex_lock( &pInst->dmaBufMutex);
+  while ( NULL != (pBuf = pInst->pDmaBufHead) )
+    {
+    TRACE( 2, ("%s() Freeing DMA buffer %u, %Zd bytes\n", __FUNCTION__, pBuf->id, pBuf->size));
+    pInst->pDmaBufHead = pBuf->pNext;
+    CDA_DmaBufRelease( pInst, pBuf);
+    }
+  pInst->ulDmaBufPgOff = CDA_DMABUF_PGOFF;
+  mutex_unlock( &pInst->dmaBufMutex);
+#endif
+
+#ifdef CDA_STATS
+  if ( atomic_long_read( &pInst->stats.eventsDropped))
     {
-    TRACE( 2, ("%s() %u missed events\n", __FUNCTION__, pInst->uIrqOverflows));
-    pInst->uIrqOverflows = 0;
+    TRACE( 2, ("%s() %ld missed events since load\n", __FUNCTION__, atomic_long_read( &pInst->stats.eventsDropped)));
     }
 #endif
 
@@ -914,6 +1291,147 @@ static ssize_t CDA_write(
   } 
 
 
+/*
+ * Readable while the event queue holds an event, so the device can sit in
+ * an epoll set instead of a thread blocking in CDA_IOCTL_EVENT.
+ * Consuming the event is still done by CDA_IOCTL_EVENT or _EVENT_BATCH.
+ */
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0) )
+static __poll_t CDA_poll(
+#else
+static unsigned int CDA_poll(
+#endif
+  struct file * pFile,
+  struct poll_table_struct * pWait
+) {
+  CDA_SInstance* pInst;
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0) )
+  __poll_t mask = 0;
+#else
+  unsigned int mask = 0;
+#endif
+
+  TRACE( 9, ( "%s(%p,%p)\n", __FUNCTION__, pFile, pWait));
+  ASSERT( NULL != pFile);
+
+  pInst = pFile->private_data;
+  if ( NULL == pInst)
+    {
+    TRACE( 0, ( "!!! %s: invalid instance\n", __FUNCTION__));
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0) )
+    return EPOLLERR | EPOLLHUP;
+#else
+    return POLLERR | POLLHUP;
+#endif
+    }
+
+  /* Registers on the queue CDA_DeviceEventEx wakes */
+  poll_wait( pFile, &pInst->WaitQ, pWait);
+
+  if ( pInst->uEventHead != pInst->uEventTail)
+    {
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0) )
+    mask |= EPOLLIN | EPOLLRDNORM;
+#else
+    mask |= POLLIN | POLLRDNORM;
+#endif
+    }
+
+  return mask;
+  }
+
+
+#ifdef CDA_DMABUF
+/*
+ * VMAs mapping a driver allocated buffer are counted so that
+ * CDA_IOCTL_DMABUF_FREE cannot free it under them
+ */
+static void CDA_DmaBufVmOpen(
+  struct vm_area_struct * vma
+) {
+  CDA_SDmaBuf* pBuf = vma->vm_private_data;
+  atomic_inc( &pBuf->iMaps);
+  }
+
+static void CDA_DmaBufVmClose(
+  struct vm_area_struct * vma
+) {
+  CDA_SDmaBuf* pBuf = vma->vm_private_data;
+  atomic_dec( &pBuf->iMaps);
+  }
+
+static const struct vm_operations_struct s_dmaBufVmOps =
+  {
+  .open  = CDA_DmaBufVmOpen,
+  .close = CDA_DmaBufVmClose,
+  };
+
+
+/*
+ * Map a buffer from CDA_IOCTL_DMABUF_ALLOC, or part of it, at the offset
+ * the ioctl returned. Offsets below that range map the device registers.
+ */
+static int CDA_mmap(
+  struct file * pFile,
+  struct vm_area_struct * vma
+) {
+  CDA_SInstance* pInst;
+  CDA_SDmaBuf* pBuf;
+  unsigned long ulPgOff = vma->vm_pgoff;
+  int iRet = -EINVAL;
+
+  TRACE( 9, ( "%s(%p,%p)\n", __FUNCTION__, pFile, vma));
+  ASSERT( NULL != pFile);
+
+  pInst = pFile->private_data;
+  if ( NULL == pInst)
+    {
+    TRACE( 0, ( "!!! %s: invalid instance\n", __FUNCTION__));
+    return -EINVAL;
+    }
+
+  if ( ulPgOff < CDA_DMABUF_PGOFF)
+    {
+    if ( NULL == pInst->pVtable->pfnMmap)
+      return -ENODEV;
+    return (*pInst->pVtable->pfnMmap)( pInst->pDevice, pFile, vma);
+    }
+
+  mutex_lock( &pInst->dmaBufMutex);
+  for ( pBuf = pInst->pDmaBufHead; NULL != pBuf; pBuf = pBuf->pNext)
+    {
+    if ( ulPgOff >= pBuf->ulPgOff
+      && ulPgOff - pBuf->ulPgOff < (pBuf->size >> PAGE_SHIFT)
+    )
+      break;
+    }
+  if ( NULL != pBuf)
+    {
+    /* dma_mmap_coherent takes vm_pgoff as the offset into the buffer */
+    vma->vm_pgoff = ulPgOff - pBuf->ulPgOff;
+    iRet = dma_mmap_coherent( CDA_DMA_DEV( pInst), vma, pBuf->pvKernel, pBuf->dma, pBuf->size);
+    if ( 0 == iRet)
+      {
+      vma->vm_ops = &s_dmaBufVmOps;
+      vma->vm_private_data = pBuf;
+      atomic_inc( &pBuf->iMaps);
+      }
+    else
+      {
+      vma->vm_pgoff = ulPgOff;
+      }
+    }
+  mutex_unlock( &pInst->dmaBufMutex);
+
+  if ( 0 != iRet)
+    {
+    TRACE( 1, ( "*** %s: cannot map offset 0x%lx, %d\n", __FUNCTION__, ulPgOff << PAGE_SHIFT, iRet));
+    }
+  return iRet;
+  }
+#endif
+
+
 #if defined _LP64
 /*
  * Handle user32 ioctl calls in 64 bit driver
@@ -946,9 +1464,14 @@ static long CDA_compat(
     case 0x4004E006: iFunc = CDA_IOCTL_CLAIM;             break;
     case 0x8004E007:
     case 0x4004E007: iFunc = CDA_IOCTL_EVENT_PUT;         break;
+    case 0xC004E008: iFunc = CDA_IOCTL_EVENT_BATCH;       break;
+    case 0x4004E009:
+    case 0x8004E009: iFunc = CDA_IOCTL_EVENT_EX;          break;
     case 0xC004E00A: iFunc = CDA_IOCTL_MEMORY_LOCK_RISC;  break;
     case 0xC004E00C: iFunc = CDA_IOCTL_MEMORY_FLUSH_RISC; break;
     case 0xC004E00D: iFunc = CDA_IOCTL_MEMORY_FLUSH_DMA;  break;
+    case 0xC004E00E: iFunc = CDA_IOCTL_DMABUF_ALLOC;      break;
+    case 0x4004E00F: iFunc = CDA_IOCTL_DMABUF_FREE;       break;
     default:
        TRACE(1, ("%s: !!!WARNING!!! Unrecognised 32 bit Ioctl code 0x%08X\n", __FUNCTION__, iFunc));
        break;
@@ -1070,9 +1593,6 @@ static long CDA_compat(
 
         if ( pLock->pvBuffer == pvBuffer )
           {
-          /* Unlock the buffer */
-          iRet = CDA_UnlockBuffer(pLock);
-
           /* Remove from list */
           if ( NULL != pLock->pPrev)
             {
@@ -1090,7 +1610,8 @@ static long CDA_compat(
             pLock->pNext->pPrev = pLock->pPrev;
             }
 
-          kfree( pLock);
+          /* Unlock the buffer, or keep it mapped for the next lock */
+          iRet = CDA_RetireLock( pInst, pLock);
           break;
           }
         }
@@ -1320,9 +1841,6 @@ static long CDA_ioctl(
 
         if ( pLock->pvBuffer == pvBuffer )
           {
-          /* Unlock the buffer */
-          iRet = CDA_UnlockBuffer(pLock);
-
           /* Remove from list */
           if ( NULL != pLock->pPrev)
             {
@@ -1340,7 +1858,8 @@ static long CDA_ioctl(
             pLock->pNext->pPrev = pLock->pPrev;
             }
 
-          kfree( pLock);
+          /* Unlock the buffer, or keep it mapped for the next lock */
+          iRet = CDA_RetireLock( pInst, pLock);
           break;
           }
         }
@@ -1353,19 +1872,49 @@ static long CDA_ioctl(
     break;
 
   case CDA_IOCTL_EVENT:
+  case CDA_IOCTL_EVENT_EX:
     /* Wait for an event */
     if ( NULL != pInst->pFile)
       {
-      CDA_SIoctlEvent ev;
-      iRet = CDA_WaitEvent( pInst, &ev);
+      CDA_SIoctlEventEx evx;
+      iRet = CDA_WaitEvent( pInst, &evx);
+      if ( 0 <= iRet)
+        {
+         /* Clear the marker set at IRQ time */
+         CDA_DeviceMarker( pInst, 0);
+         if ( CDA_IOCTL_EVENT_EX == iFunc)
+           {
+           copy_to_user_ret( (void*)ulParam, &evx, sizeof( evx), -EFAULT );
+           }
+         else
+           {
+           CDA_SIoctlEvent ev;
+           ev.event = evx.event;
+           ev.data = evx.data;
+           copy_to_user_ret( (void*)ulParam, &ev, sizeof( ev), -EFAULT );
+           }
+        }
+      }
+    else
+      {
+      TRACE( 1, ( "*** %s: not device owner\n", __FUNCTION__));
+      iRet = -EINVAL;
+      }
+    break;
+
+  case CDA_IOCTL_EVENT_BATCH:
+    /* Wait for and drain several events */
+    if ( NULL != pInst->pFile)
+      {
+      CDA_SIoctlEventBatch batch;
+      copy_from_user_ret( &batch, (void*)ulParam, sizeof( batch), -EFAULT );
+      iRet = CDA_WaitEventBatch( pInst, &batch);
       if ( 0 <= iRet)
         {
-         //Unset the bit that was set in the IRQ top half (cdapci.c)
-         #if PICC_DIO_ENABLE
-         if(pInst->devicenum == PICC_SHK_DEVNUM) outb_p(0x00,PICC_DIO_BASE+PICC_DIO_PORTC); //UNSET DIO board PORTC bit C0
-         if(pInst->devicenum == PICC_LYT_DEVNUM) outb_p(0x00,PICC_DIO_BASE+PICC_DIO_PORTB); //UNSET DIO board PORTB bit B0 
-         #endif
-         copy_to_user_ret( (void*)ulParam, &ev, sizeof( ev), -EFAULT );
+         /* Clear the marker set at IRQ time */
+         if ( 0 < batch.count)
+           CDA_DeviceMarker( pInst, 0);
+         put_user_ret( batch.count, &((CDA_SIoctlEventBatch*)ulParam)->count, -EFAULT );
         }
       }
     else
@@ -1389,6 +1938,41 @@ static long CDA_ioctl(
       }
     break;
 
+#ifdef CDA_DMABUF
+  case CDA_IOCTL_DMABUF_ALLOC:
+    if ( NULL != pInst->pFile)
+      {
+      CDA_SIoctlDmaBuf buf;
+      copy_from_user_ret( &buf, (void*)ulParam, sizeof( buf), -EFAULT );
+      iRet = CDA_IoctlDmaBufAlloc( pInst, &buf);
+      if ( 0 == iRet && copy_to_user( (void*)ulParam, &buf, sizeof( buf)))
+        {
+        CDA_IoctlDmaBufFree( pInst, buf.id);
+        iRet = -EFAULT;
+        }
+      }
+    else
+      {
+      TRACE( 1, ( "*** %s: not device owner\n", __FUNCTION__));
+      iRet = -EINVAL;
+      }
+    break;
+
+  case CDA_IOCTL_DMABUF_FREE:
+    if ( NULL != pInst->pFile)
+      {
+      u_int32_t id;
+      get_user_ret( id, &((CDA_SIoctlDmaBuf*)ulParam)->id, -EFAULT );
+      iRet = CDA_IoctlDmaBufFree( pInst, id);
+      }
+    else
+      {
+      TRACE( 1, ( "*** %s: not device owner\n", __FUNCTION__));
+      iRet = -EINVAL;
+      }
+    break;
+#endif
+
   case CDA_IOCTL_CONFIG_RESTORE:
     if ( NULL != pInst->pFile)
       {
@@ -1506,39 +2090,111 @@ static int CDA_IoctlRegList(
 
 
 /*
- * Wait for a device event (IRQ)
+ * Copy a queued event to its ioctl form
  */
-static int CDA_WaitEvent(
+static void CDA_EventToIoctl(
+  const CDA_SEvent* pEvent,
+  CDA_SIoctlEventEx* pIoctl
+) {
+  pIoctl->event = pEvent->event;
+  pIoctl->data = pEvent->data;
+  pIoctl->seq = pEvent->seq;
+  pIoctl->count = pEvent->count;
+  pIoctl->timestamp = pEvent->timestamp;
+  }
+
+
+/*
+ * Take up to uMax of the oldest events off the queue.
+ * Done under lockEventQ so that an event cannot be coalesced into one
+ * that is already on its way to user space.
+ */
+static unsigned CDA_EventDequeue(
   CDA_SInstance* pInst,
-  CDA_SIoctlEvent* pEvent
+  CDA_SEvent* pEvents,
+  unsigned uMax
 ) {
-  sigset_t pending, shpending;
-  unsigned long p0,p1,shp0,shp1;
+  unsigned long flags;
+  unsigned uCount = 0;
   unsigned uIndex;
 
-  TRACE( 9, ( "%s(%p,%p)\n", __FUNCTION__, pInst, pEvent));
-  ASSERT( NULL != pInst);
-  ASSERT( NULL != pEvent);
+  spin_lock_irqsave( &pInst->lockEventQ, flags);
+  uIndex = pInst->uEventTail;
+  while ( uCount < uMax && uIndex != pInst->uEventHead)
+    {
+    pEvents[ uCount++] = pInst->pEventArray[ uIndex];
+    if ( ++uIndex >= pInst->uEventQSize)
+      uIndex = 0;
+    }
+  pInst->uEventTail = uIndex;
+  trace_phx_event_dequeue( pInst->devicenum, uCount, uCount ? pEvents[ 0].seq : pInst->uEventSeq, CDA_EventCount( pInst));
+  spin_unlock_irqrestore( &pInst->lockEventQ, flags);
 
-  if (1 > atomic_read(&pInst->openCount))
-  {
-  TRACE( 2, ( "%s: Device not open\n", __FUNCTION__));
-  return -ENOENT;
+  return uCount;
   }
 
-#if ( LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 0) )
-  /* interruptible_sleep_on is deprecated, there is a race condition */
 
-  /* Lock the eventQ */
-  spin_lock_irq( &pInst->lockEventQ);
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) )
+/*
+ * Put uCount events taken by CDA_EventDequeue back at the tail, oldest
+ * still first. Events raised meanwhile may have filled the queue; what
+ * does not fit is counted as dropped. Returns the no. requeued.
+ */
+static unsigned CDA_EventRequeue(
+  CDA_SInstance* pInst,
+  const CDA_SEvent* pEvents,
+  unsigned uCount
+) {
+  unsigned long flags;
+  unsigned uBack = 0;
+  unsigned uIndex;
 
-  /* Check for an event */
-  while ( pInst->uEventHead == (uIndex = pInst->uEventTail))
+  spin_lock_irqsave( &pInst->lockEventQ, flags);
+  while ( uBack < uCount)
     {
+    uIndex = (0 == pInst->uEventTail ? pInst->uEventQSize : pInst->uEventTail) - 1;
+    if ( uIndex == pInst->uEventHead)
+      break;    /* Full */
+    pInst->pEventArray[ uIndex] = pEvents[ uCount - 1 - uBack];
+    pInst->uEventTail = uIndex;
+    ++uBack;
+    }
+  spin_unlock_irqrestore( &pInst->lockEventQ, flags);
 
-    /* No events so release spinlock */
-    spin_unlock_irq( &pInst->lockEventQ);
-    
+  if ( uBack < uCount)
+    CDA_STAT_ADD( pInst, eventsDropped, uCount - uBack);
+  return uBack;
+  }
+#endif
+
+
+/*
+ * Wait for a device event (IRQ)
+ */
+static int CDA_WaitEvent(
+  CDA_SInstance* pInst,
+  CDA_SIoctlEventEx* pEvent
+) {
+  sigset_t pending, shpending;
+  unsigned long p0,p1,shp0,shp1;
+  CDA_SEvent event;
+
+  TRACE( 9, ( "%s(%p,%p)\n", __FUNCTION__, pInst, pEvent));
+  ASSERT( NULL != pInst);
+  ASSERT( NULL != pEvent);
+
+  if (1 > atomic_read(&pInst->openCount))
+  {
+  TRACE( 2, ( "%s: Device not open\n", __FUNCTION__));
+  return -ENOENT;
+  }
+
+#if ( LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 0) )
+  /* interruptible_sleep_on is deprecated, there is a race condition */
+
+  /* Check for an event */
+  while ( 0 == CDA_EventDequeue( pInst, &event, 1))
+    {
     /* Put the current process to sleep.
      * Execution will be resumed after a call to module_wake_up
      * or when a signal, such as Ctrl-C, is sent to the process
@@ -1561,58 +2217,167 @@ static int CDA_WaitEvent(
       TRACE( 2, ( "%s: woken by device close\n", __FUNCTION__));
       return -ENOENT;    /* Device closed */
       }
-
-    /* re-acquire lock before testing for an event */
-    spin_lock_irq( &pInst->lockEventQ);
     }
 
 #else
 
-  wait_event_interruptible( pInst->WaitQ, (pInst->uEventHead != (uIndex = pInst->uEventTail)) );
-  if ( NULL == pInst->pFile)
-    {
-    TRACE( 2, ( "%s: woken by device close (pFile is NULL)\n", __FUNCTION__));
-    return -ENOENT;    /* Device closed */
-    }
-  else if ( 0 == atomic_read(&pInst->openCount))
+  /* Another reader may take the event first, in which case wait again */
+  do
     {
-    TRACE( 2, ( "%s: woken by device close (openCount is NULL)\n", __FUNCTION__));
-    return -ENOENT;    /* Device closed */
+    wait_event_interruptible( pInst->WaitQ, (pInst->uEventHead != pInst->uEventTail) );
+    if ( NULL == pInst->pFile)
+      {
+      TRACE( 2, ( "%s: woken by device close (pFile is NULL)\n", __FUNCTION__));
+      return -ENOENT;    /* Device closed */
+      }
+    else if ( 0 == atomic_read(&pInst->openCount))
+      {
+      TRACE( 2, ( "%s: woken by device close (openCount is NULL)\n", __FUNCTION__));
+      return -ENOENT;    /* Device closed */
+      }
+    /* Test if woken by a signal */
+    else if (signal_pending(current))
+      {
+      pending = current->pending.signal;
+      p0 = pending.sig[0];
+      p1 = pending.sig[1];
+      shpending = current->signal->shared_pending.signal;
+      shp0 = shpending.sig[0];
+      shp1 = shpending.sig[1];
+      TRACE( 2, ( "%s: woken by signal p0=%x,p1=%x,shp0=%x,shp1=%x, oc=%d\n",__FUNCTION__,p0,p1,shp0,shp1, atomic_read(&pInst->openCount)));
+      return -EINTR;
+     }
     }
-  /* Test if woken by a signal */
-  else if (signal_pending(current))
-    {
-    pending = current->pending.signal;
-    p0 = pending.sig[0];
-    p1 = pending.sig[1];
-    shpending = current->signal->shared_pending.signal;
-    shp0 = shpending.sig[0];
-    shp1 = shpending.sig[1];
-    TRACE( 2, ( "%s: woken by signal p0=%x,p1=%x,shp0=%x,shp1=%x, oc=%d\n",__FUNCTION__,p0,p1,shp0,shp1, atomic_read(&pInst->openCount)));
-    return -EINTR;
-   }
+  while ( 0 == CDA_EventDequeue( pInst, &event, 1));
 
 #endif
 
-  ASSERT( uIndex < lengthof( pInst->eventArray) );
+  CDA_EventToIoctl( &event, pEvent);
 
-  /* Get oldest event */
-  pEvent->event = pInst->eventArray[ uIndex].event;
-  pEvent->data = pInst->eventArray[ uIndex].data;
+  TRACE( 3, ( "%s: event %u, data %u\n", __FUNCTION__, pEvent->event, pEvent->data));
+  return 0;
+  }
 
-  /* Bump event Q tail */
-  if ( ++uIndex >= lengthof( pInst->eventArray))
-    uIndex = 0;
-  pInst->uEventTail = uIndex;
 
-#if ( LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 0) )
-  /* Unlock the eventQ */
-  spin_unlock_irq( &pInst->lockEventQ);
-#else
-#endif
+/*
+ * No. events in the queue
+ */
+static unsigned CDA_EventCount(
+  CDA_SInstance* pInst
+) {
+  unsigned uHead = pInst->uEventHead;
+  unsigned uTail = pInst->uEventTail;
 
-  TRACE( 3, ( "%s: event %u, data %u\n", __FUNCTION__, pEvent->event, pEvent->data));
+  if ( uHead >= uTail)
+    return uHead - uTail;
+  return uHead + pInst->uEventQSize - uTail;
+  }
+
+
+/*
+ * Wait for minEvents device events and return up to maxEvents of them.
+ * The whole pEvents array is checked before anything is dequeued. Should
+ * a copy still fault, the events copied so far are returned in count and
+ * the rest of that chunk goes back on the queue.
+ */
+static int CDA_WaitEventBatch(
+  CDA_SInstance* pInst,
+  CDA_SIoctlEventBatch* pBatch
+) {
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) )
+  CDA_SEvent events[ 8];
+  char __user * pUser;
+  size_t size;
+  unsigned uMin, uCount;
+  long lRet = 1;
+
+  TRACE( 9, ( "%s(%p,%p)\n", __FUNCTION__, pInst, pBatch));
+  ASSERT( NULL != pInst);
+  ASSERT( NULL != pBatch);
+
+  pBatch->count = 0;
+  if (1 > atomic_read(&pInst->openCount))
+  {
+  TRACE( 2, ( "%s: Device not open\n", __FUNCTION__));
+  return -ENOENT;
+  }
+  if ( 0 != (pBatch->flags & ~CDA_EVENT_BATCH_EX) || 0 == pBatch->maxEvents)
+    return -EINVAL;
+  pUser = (char __user *)(unsigned long)pBatch->pEvents;
+  if ( pBatch->flags & CDA_EVENT_BATCH_EX)
+    size = sizeof( CDA_SIoctlEventEx);
+  else
+    size = sizeof( CDA_SIoctlEvent);
+  if ( pBatch->maxEvents > (size_t)-1 / size
+   || !CDA_ACCESS_OK_WRITE( pUser, pBatch->maxEvents * size))
+    return -EFAULT;
+
+  /* The queue holds at most uEventQSize - 1 events */
+  uMin = pBatch->minEvents;
+  if ( uMin > pInst->uEventQSize - 1)
+    uMin = pInst->uEventQSize - 1;
+  if ( uMin > pBatch->maxEvents)
+    uMin = pBatch->maxEvents;
+
+  if ( 0 < uMin)
+    {
+    if ( 0 == pBatch->timeoutMs)
+      lRet = wait_event_interruptible( pInst->WaitQ,
+        CDA_EventCount( pInst) >= uMin || NULL == pInst->pFile);
+    else
+      lRet = wait_event_interruptible_timeout( pInst->WaitQ,
+        CDA_EventCount( pInst) >= uMin || NULL == pInst->pFile,
+        msecs_to_jiffies( pBatch->timeoutMs));
+
+    if ( NULL == pInst->pFile || 0 == atomic_read(&pInst->openCount))
+      {
+      TRACE( 2, ( "%s: woken by device close\n", __FUNCTION__));
+      return -ENOENT;    /* Device closed */
+      }
+    if ( 0 > lRet)
+      {
+      TRACE( 2, ( "%s: woken by signal\n", __FUNCTION__));
+      return -EINTR;
+      }
+    }
+
+  /* Oldest first */
+  uCount = 0;
+  while ( uCount < pBatch->maxEvents)
+    {
+    unsigned uChunk = pBatch->maxEvents - uCount;
+    unsigned i, n;
+
+    if ( uChunk > lengthof( events))
+      uChunk = lengthof( events);
+    n = CDA_EventDequeue( pInst, events, uChunk);
+    for ( i = 0; i < n; ++i, ++uCount)
+      {
+      CDA_SIoctlEventEx evx;
+      CDA_EventToIoctl( &events[ i], &evx);
+      /* CDA_SIoctlEvent is the leading part of CDA_SIoctlEventEx */
+      if ( copy_to_user( pUser + uCount * size, &evx, size))
+        {
+        unsigned uBack = CDA_EventRequeue( pInst, &events[ i], n - i);
+        TRACE( 1, ( "*** %s: fault after %u events, %u requeued, %u lost\n", __FUNCTION__, uCount, uBack, n - i - uBack));
+        if ( 0 == uCount)
+          return -EFAULT;
+        goto Done;
+        }
+      }
+    if ( n < uChunk)
+      break;
+    }
+Done:
+  pBatch->count = uCount;
+
+  TRACE( 3, ( "%s: %u events%s\n", __FUNCTION__, uCount, 0 == lRet ? " (timeout)" : ""));
   return 0;
+#else
+  (void)pInst;
+  (void)pBatch;
+  return -ENOSYS;
+#endif
   }
 
 
@@ -1624,10 +2389,27 @@ void CDA_DeviceEvent(
   CDA_SInstance* pInst,
   ui32 ev,
   ui32 data
+) {
+  CDA_DeviceEventEx( pInst, ev, data, CDA_TIME_NS());
+  }
+
+
+/*
+ * Queue a device event raised at timestamp
+ * IRQ time, or task time from the IRQ thread and CDA_IOCTL_EVENT_PUT
+ */
+void CDA_DeviceEventEx(
+  CDA_SInstance* pInst,
+  ui32 ev,
+  ui32 data,
+  ui64 timestamp
 ) {
   /*Top half of IRQ Handler */
   
-  size_t uIndex;
+  size_t uIndex, uNext;
+  unsigned long flags;
+  int iResult = PHX_TRACE_EVENT_QUEUED;
+  int bWake = 1;
 
   TRACE( 9, ("%s(%p,%u,%u)\n",__FUNCTION__,pInst,ev,data));
   ASSERT( NULL != pInst);
@@ -1636,29 +2418,75 @@ void CDA_DeviceEvent(
 #endif
 
   /* Push event info onto event Q */
-  spin_lock( &pInst->lockEventQ);
+  spin_lock_irqsave( &pInst->lockEventQ, flags);
 
   uIndex = pInst->uEventHead;
-  pInst->eventArray[ uIndex].event = ev;
-  pInst->eventArray[ uIndex].data = data;
+  uNext = uIndex + 1;
+  if ( uNext >= pInst->uEventQSize)
+    uNext = 0;
 
-  if ( ++uIndex >= lengthof( pInst->eventArray))
-    uIndex = 0;
-  if ( uIndex != pInst->uEventTail)
-    pInst->uEventHead = uIndex;
-  else
+  if ( uNext != pInst->uEventTail)
     {
-    TRACE( 2, ("%s: event 0x%08x lost\n", __FUNCTION__, ev));
-#ifdef DEBUG
-    ++(pInst->uIrqOverflows);
+    CDA_SEvent* pEvent = &pInst->pEventArray[ uIndex];
+    pEvent->event = ev;
+    pEvent->data = data;
+    pEvent->seq = pInst->uEventSeq++;
+    pEvent->count = 1;
+    pEvent->timestamp = timestamp;
+
+    pInst->uEventHead = uNext;
+    CDA_STAT_INC( pInst, eventsQueued);
+#ifdef CDA_STATS
+    /* Only ever raised here, under lockEventQ */
+    if ( CDA_EventCount( pInst) > atomic_long_read( &pInst->stats.queueHighWater))
+      atomic_long_set( &pInst->stats.queueHighWater, CDA_EventCount( pInst));
 #endif
     }
+  else
+    {
+    /* Full. The newest event is not yet dequeued as readers hold the lock */
+    CDA_SEvent* pNewest = &pInst->pEventArray[ (0 == uIndex ? pInst->uEventQSize : uIndex) - 1];
 
-  spin_unlock( &pInst->lockEventQ);
+    if ( event_coalesce && pNewest->event == ev && pNewest->data == data)
+      {
+      ++pNewest->count;
+      CDA_STAT_INC( pInst, eventsCoalesced);
+      iResult = PHX_TRACE_EVENT_COALESCED;
+      }
+    else
+      {
+      TRACE( 2, ("%s: event 0x%08x lost\n", __FUNCTION__, ev));
+      CDA_STAT_INC( pInst, eventsDropped);
+      iResult = PHX_TRACE_EVENT_DROPPED;
+      }
+    ++pInst->uEventSeq;
+    }
+  trace_phx_event_enqueue( pInst->devicenum, ev, data, pInst->uEventSeq - 1, CDA_EventCount( pInst), iResult);
+
+#ifdef CDA_EVENT_MODERATION
+  /* Defer the wakeup unless the batch is complete or the queue full */
+  if ( 1 < event_batch && PHX_TRACE_EVENT_QUEUED == iResult
+    && ++pInst->uUnwoken < event_batch
+  ) {
+    bWake = 0;
+    if ( 1 == pInst->uUnwoken)
+      hrtimer_start( &pInst->batchTimer, ns_to_ktime( (u64)event_batch_us * 1000), HRTIMER_MODE_REL);
+    CDA_STAT_INC( pInst, wakeupsDeferred);
+    }
+  else if ( 0 != pInst->uUnwoken)
+    {
+    /* Can't wait for a running CDA_BatchTimer here, it only wakes again */
+    hrtimer_try_to_cancel( &pInst->batchTimer);
+    pInst->uUnwoken = 0;
+    }
+#endif
+
+  spin_unlock_irqrestore( &pInst->lockEventQ, flags);
 
   /* Schedule bottom half task to run */
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(2,6,0)
-  wake_up_interruptible( &pInst->WaitQ); 
+  if ( bWake)
+    CDA_WakeWaiters( pInst);
   //schedule_work(&pInst->work);
 #elif LINUX_VERSION_CODE > 0x20200
   queue_task( &pInst->task, &tq_immediate);
@@ -1670,6 +2498,253 @@ void CDA_DeviceEvent(
   }
 
 
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) )
+/*
+ * Wake the processes waiting for an event
+ * IRQ time
+ */
+static void CDA_WakeWaiters(
+  CDA_SInstance* pInst
+) {
+  trace_phx_wakeup( pInst->devicenum, waitqueue_active( &pInst->WaitQ));
+  if ( waitqueue_active( &pInst->WaitQ))
+    CDA_STAT_INC( pInst, wakeups);
+  wake_up_interruptible( &pInst->WaitQ);
+  }
+#endif
+
+
+#ifdef CDA_EVENT_MODERATION
+/*
+ * Wake the waiters for events held back by event_batch
+ * Timer IRQ time
+ */
+static enum hrtimer_restart CDA_BatchTimer(
+  struct hrtimer* pTimer
+) {
+  CDA_SInstance* pInst = container_of( pTimer, CDA_SInstance, batchTimer);
+  unsigned long flags;
+
+  spin_lock_irqsave( &pInst->lockEventQ, flags);
+  pInst->uUnwoken = 0;
+  spin_unlock_irqrestore( &pInst->lockEventQ, flags);
+
+  CDA_WakeWaiters( pInst);
+  return HRTIMER_NORESTART;
+  }
+#endif
+
+
+/*
+ * Account for an IRQ on this device's line, status 0 if not ours
+ * IRQ time
+ */
+void CDA_DeviceIrq(
+  CDA_SInstance* pInst,
+  int isInterrupt,
+  ui32 status
+) {
+#ifdef CDA_STATS
+  if ( isInterrupt)
+    {
+    CDA_STAT_INC( pInst, irqs);
+    while ( status)
+      {
+      int iBit = __ffs( status);
+      CDA_STAT_INC( pInst, statusBits[ iBit]);
+      status &= status - 1;
+      }
+    }
+  else
+    {
+    CDA_STAT_INC( pInst, irqsNotOurs);
+    }
+#else
+  (void)pInst;
+  (void)isInterrupt;
+  (void)status;
+#endif
+  }
+
+
+#ifdef CDA_MARKER
+/*
+ * Claim the hardware for the timing marker
+ * Single threaded
+ */
+static void CDA_MarkerInit( void)
+  {
+#ifdef CDA_MARKER_DIO
+  /* The ports may belong to something else, so only take them if asked to */
+  if ( CDA_kMarkerDio == marker)
+    {
+    if ( NULL == request_region( marker_dio, PICC_DIO_LENGTH, name))
+      {
+      printk( KERN_WARNING "%s: DIO marker ports 0x%03x in use\n", name, marker_dio);
+      }
+    else
+      {
+      s_bMarkerDio = 1;
+      outb( 0x01, marker_dio + PICC_DIO_PAGE); /* Page 1 */
+      outb( 0x80, marker_dio + PICC_DIO_CTRL); /* Ports A, B & C output */
+      printk( KERN_INFO "%s: DIO marker ports at 0x%03x\n", name, marker_dio);
+      }
+    }
+#endif
+
+  if ( 0 != marker_gpio)
+    {
+    s_pMarkerGpio = ioremap( marker_gpio, sizeof( u32));
+    if ( NULL == s_pMarkerGpio)
+      printk( KERN_WARNING "%s: cannot map GPIO marker at 0x%lx\n", name, marker_gpio);
+    }
+  }
+
+
+/*
+ * Release the timing marker hardware
+ * Single threaded
+ */
+static void CDA_MarkerExit( void)
+  {
+#ifdef CDA_MARKER_DIO
+  if ( s_bMarkerDio)
+    {
+    release_region( marker_dio, PICC_DIO_LENGTH);
+    s_bMarkerDio = 0;
+    }
+#endif
+  if ( NULL != s_pMarkerGpio)
+    {
+    iounmap( s_pMarkerGpio);
+    s_pMarkerGpio = NULL;
+    }
+  }
+
+
+/*
+ * Drive the timing marker, set at IRQ time and cleared when the event is read
+ * IRQ or task time
+ */
+void CDA_DeviceMarker(
+  CDA_SInstance* pInst,
+  int on
+) {
+  switch ( marker)
+    {
+#ifdef CDA_MARKER_DIO
+    case CDA_kMarkerDio:
+      /* outb not outb_p, there's no need for an I/O delay here */
+      if ( s_bMarkerDio && pInst->devicenum < lengthof( s_markerDioPort)
+        && 0 != s_markerDioPort[ pInst->devicenum]
+      ) {
+        outb( on ? 0x01 : 0x00, marker_dio + s_markerDioPort[ pInst->devicenum]);
+        }
+      break;
+#endif
+
+    case CDA_kMarkerGpio:
+      if ( NULL != s_pMarkerGpio)
+        {
+        u32 const ulBit = 1u << ((marker_gpio_bit + pInst->devicenum) & 31);
+        unsigned long flags;
+        u32 ul;
+
+        spin_lock_irqsave( &s_markerLock, flags);
+        ul = readl( s_pMarkerGpio);
+        writel( on ? (ul | ulBit) : (ul & ~ulBit), s_pMarkerGpio);
+        spin_unlock_irqrestore( &s_markerLock, flags);
+        }
+      break;
+
+    case CDA_kMarkerRing:
+      if ( NULL != pInst->pMarkerRing)
+        {
+        unsigned u = (unsigned)atomic_inc_return( &pInst->markerHead) - 1;
+        CDA_SMarker* pMarker = &pInst->pMarkerRing[ u & (CDA_MARKER_RING - 1)];
+
+        pMarker->on = on;
+        pMarker->timestamp = CDA_TIME_NS();
+        }
+      break;
+
+    default:
+      break;
+    }
+  }
+#endif
+
+
+#ifdef CDA_STATS
+/*
+ * /proc/driver/phddrv/<device>, one "name value" pair per line
+ */
+static int CDA_ProcShow(
+  struct seq_file* m,
+  void* v
+) {
+  CDA_SInstance* pInst = m->private;
+  CDA_SStats* pStats = &pInst->stats;
+  int i;
+
+  (void)v;
+  seq_printf( m, "irqs %ld\n", atomic_long_read( &pStats->irqs));
+  seq_printf( m, "irqs_not_ours %ld\n", atomic_long_read( &pStats->irqsNotOurs));
+  seq_printf( m, "events_queued %ld\n", atomic_long_read( &pStats->eventsQueued));
+  seq_printf( m, "events_dropped %ld\n", atomic_long_read( &pStats->eventsDropped));
+  seq_printf( m, "events_coalesced %ld\n", atomic_long_read( &pStats->eventsCoalesced));
+  seq_printf( m, "queue_size %u\n", pInst->uEventQSize - 1);
+  seq_printf( m, "queue_now %u\n", CDA_EventCount( pInst));
+  seq_printf( m, "queue_high_water %ld\n", atomic_long_read( &pStats->queueHighWater));
+  seq_printf( m, "wakeups %ld\n", atomic_long_read( &pStats->wakeups));
+  seq_printf( m, "wakeups_deferred %ld\n", atomic_long_read( &pStats->wakeupsDeferred));
+  seq_printf( m, "buffers_locked %ld\n", atomic_long_read( &pStats->buffersLocked));
+  seq_printf( m, "pages_locked %ld\n", atomic_long_read( &pStats->pagesLocked));
+  seq_printf( m, "descriptors_locked %ld\n", atomic_long_read( &pStats->descriptorsLocked));
+  seq_printf( m, "buffers_cached %ld\n", atomic_long_read( &pStats->buffersCached));
+  seq_printf( m, "lock_cache_hits %ld\n", atomic_long_read( &pStats->lockCacheHits));
+  seq_printf( m, "dmabufs %ld\n", atomic_long_read( &pStats->dmaBufs));
+  seq_printf( m, "dmabuf_bytes %ld\n", atomic_long_read( &pStats->dmaBufBytes));
+  for ( i = 0; i < lengthof( pStats->statusBits); ++i)
+    {
+    long n = atomic_long_read( &pStats->statusBits[ i]);
+    if ( n)
+      seq_printf( m, "status_0x%08x %ld\n", 1u << i, n);
+    }
+#ifdef CDA_MARKER
+  /* Timing marker ring, oldest first */
+  if ( NULL != pInst->pMarkerRing)
+    {
+    unsigned uHead = (unsigned)atomic_read( &pInst->markerHead);
+    unsigned u = uHead > CDA_MARKER_RING ? uHead - CDA_MARKER_RING : 0;
+
+    for ( ; u != uHead; ++u)
+      {
+      const CDA_SMarker* pMarker = &pInst->pMarkerRing[ u & (CDA_MARKER_RING - 1)];
+      if ( pMarker->timestamp)
+        seq_printf( m, "%s %llu\n", pMarker->on ? "marker_on" : "marker_off",
+          (unsigned long long)pMarker->timestamp);
+      }
+    }
+#endif
+  return 0;
+  }
+
+static int CDA_ProcOpen(
+  struct inode* pnode,
+  struct file* pFile
+) {
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0) )
+  return single_open( pFile, CDA_ProcShow, pde_data( pnode));
+#elif ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 10, 0) )
+  return single_open( pFile, CDA_ProcShow, PDE_DATA( pnode));
+#else
+  return single_open( pFile, CDA_ProcShow, PDE( pnode)->data);
+#endif
+  }
+#endif
+
+
 /*
  * Deferred IRQ handler
  * This routine is called by the kernel as soon as it's safe to resume
@@ -1750,10 +2825,27 @@ static int CDA_IoctlPutEvent(
  * Lock & create a DMA scatter list for a user space buffer
  */
 #if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) )
-/* kernel 2.6.n */
+/* kernel 2.6.n
+ * Physically contiguous pages, e.g. from a huge page, share one entry of
+ * up to sg_max_segment bytes.
+ */
 static int CDA_pages_to_sg(struct SLock *pLock)
 {
    int i = 0;
+   unsigned int n = 0;
+   unsigned int uMax = sg_max_segment & PAGE_MASK;
+   size_t remaining = pLock->len;
+
+   if (uMax < PAGE_SIZE)
+      uMax = PAGE_SIZE;
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 1, 0) )
+   /* Without an IOMMU a bounced entry must fit the bounce buffer */
+   {
+      size_t uMap = dma_max_mapping_size(&((SPciInstance*)(pLock->pInst->pDevice))->pDev->dev);
+      if (uMap < uMax)
+         uMax = uMap > PAGE_SIZE ? uMap & PAGE_MASK : PAGE_SIZE;
+   }
+#endif
 
    if (NULL == pLock->pages[0])
    {
@@ -1768,35 +2860,40 @@ static int CDA_pages_to_sg(struct SLock *pLock)
    }
    memset(pLock->sglist, 0, sizeof(*pLock->sglist) * pLock->nr_pages);
 
-   if (NULL == pLock->pages[0])
-           goto nopage;
-   if (PageHighMem(pLock->pages[0]))
-           /* DMA to highmem pages might not work */
-           goto highmem;
-#if LINUX_VERSION_CODE < 0x20618 /* < 2.6.24 */
-   pLock->sglist[0].page   = pLock->pages[0];
-   pLock->sglist[0].offset = pLock->offset;
-   pLock->sglist[0].length = PAGE_SIZE - pLock->offset;
-#else
-   sg_set_page( &pLock->sglist[0], pLock->pages[0], PAGE_SIZE - pLock->offset, pLock->offset );
-#endif
-   for (i = 1; i < pLock->nr_pages; i++) {
+   for (i = 0; i < pLock->nr_pages; i++) {
+      unsigned int uOffset = (0 == i) ? pLock->offset : 0;
+      unsigned int uLen = PAGE_SIZE - uOffset;
+
+      if (uLen > remaining)
+         uLen = remaining;
       if (NULL == pLock->pages[i])
          goto nopage;
-       if (PageHighMem(pLock->pages[i]))
-          goto highmem;
 #if LINUX_VERSION_CODE < 0x20618 /* < 2.6.24 */
-      pLock->sglist[i].page   = pLock->pages[i];
-      pLock->sglist[i].length = PAGE_SIZE;
+      if (PageHighMem(pLock->pages[i]))
+         /* DMA to highmem pages might not work */
+         goto highmem;
+#endif
+
+      if (n > 0
+       && page_to_pfn(pLock->pages[i]) == page_to_pfn(pLock->pages[i - 1]) + 1
+       && pLock->sglist[n - 1].length + uLen <= uMax) {
+         /* Continues the previous entry */
+         pLock->sglist[n - 1].length += uLen;
+      } else {
+#if LINUX_VERSION_CODE < 0x20618 /* < 2.6.24 */
+         pLock->sglist[n].page   = pLock->pages[i];
+         pLock->sglist[n].offset = uOffset;
+         pLock->sglist[n].length = uLen;
 #else
-   sg_set_page( &pLock->sglist[i], pLock->pages[i], PAGE_SIZE, 0 );
+         sg_set_page( &pLock->sglist[n], pLock->pages[i], uLen, uOffset );
 #endif
+         n++;
+      }
+      remaining -= uLen;
    }
-   pLock->sglist[pLock->nr_pages - 1].length = (pLock->len - (PAGE_SIZE - pLock->offset)) % PAGE_SIZE;
-   if( !pLock->sglist[pLock->nr_pages - 1].length )
-      pLock->sglist[pLock->nr_pages - 1].length = PAGE_SIZE;
-   for (i = 0; i < pLock->nr_pages; i++) {
-      TRACE( 9, ( "%s: pagelen[%d] = 0x%08X\n", __FUNCTION__, i, pLock->sglist[i].length));
+   pLock->nents = n;
+   for (i = 0; i < n; i++) {
+      TRACE( 9, ( "%s: sglen[%d] = 0x%08X\n", __FUNCTION__, i, pLock->sglist[i].length));
    }
    return 0;
 
@@ -1806,13 +2903,43 @@ nopage:
    pLock->sglist = NULL;
    return -EINVAL;
 
+#if LINUX_VERSION_CODE < 0x20618 /* < 2.6.24 */
 highmem:
    TRACE( 1, ( "*** %s: highmem pages\n", __FUNCTION__));
    vfree(pLock->sglist);
    pLock->sglist = NULL;
    return -EINVAL;
+#endif
+}
+
+#ifdef CDA_LOCK_CACHE
+/*
+ * The buffer's mapping changed, a cached lock on it must not be reused.
+ * Protection changes (mprotect, NUMA hinting) leave the pinned pages in
+ * place and are ignored.
+ */
+static bool CDA_LockInvalidate(struct mmu_interval_notifier *pNotifier,
+                               const struct mmu_notifier_range *pRange,
+                               unsigned long ulSeq)
+{
+   switch (pRange->event) {
+   case MMU_NOTIFY_PROTECTION_VMA:
+   case MMU_NOTIFY_PROTECTION_PAGE:
+   case MMU_NOTIFY_SOFT_DIRTY:
+      break;
+   default:
+      mmu_interval_set_seq(pNotifier, ulSeq);
+      break;
+   }
+   return true;
 }
 
+static const struct mmu_interval_notifier_ops s_lockNotifierOps =
+{
+   .invalidate = CDA_LockInvalidate,
+};
+#endif
+
 /* kernel 2.6.n */
 static int CDA_dma_lock_user(struct SLock *pLock)
 
@@ -1825,9 +2952,9 @@ static int CDA_dma_lock_user(struct SLock *pLock)
    TRACE(4, ("%s: %p/%Zd\n", __FUNCTION__, pLock->pvBuffer, pLock->len));
 
    switch (pLock->direction) {
-   case PCI_DMA_FROMDEVICE: rw = READ;  break;
-   case PCI_DMA_TODEVICE:   rw = WRITE; break;
-   default:                 BUG();
+   case DMA_FROM_DEVICE: rw = READ;  break;
+   case DMA_TO_DEVICE:   rw = WRITE; break;
+   default:              BUG();
    }
    data = (unsigned long)pLock->pvBuffer;
    first = (data          & PAGE_MASK) >> PAGE_SHIFT;
@@ -1841,14 +2968,46 @@ static int CDA_dma_lock_user(struct SLock *pLock)
       return -ENOMEM;
    }
 
+#ifdef CDA_LOCK_CACHE
+   /* Watch the range from before the pin so no change can be missed */
+   if (lock_cache
+    && 0 == mmu_interval_notifier_insert(&pLock->notifier, current->mm,
+                                         data & PAGE_MASK,
+                                         (unsigned long)pLock->nr_pages << PAGE_SHIFT,
+                                         &s_lockNotifierOps)) {
+      pLock->bNotifier = 1;
+      pLock->ulSeq = mmu_interval_read_begin(&pLock->notifier);
+   }
+#endif
+
+#ifdef CDA_PIN_USER
+   /* Held for the whole acquisition, so keep the pages out of movable zones */
+   err = pin_user_pages_fast(data & PAGE_MASK,
+                             pLock->nr_pages,
+                             (rw == READ ? FOLL_WRITE : 0) | FOLL_LONGTERM,
+                             pLock->pages);
+#else
    down_read(&current->mm->mmap_sem);
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(4, 9, 0) )
+   err = get_user_pages(data & PAGE_MASK,
+                        pLock->nr_pages,
+                        (rw == READ ? FOLL_WRITE : 0) | FOLL_FORCE,
+                        pLock->pages, NULL);
+#elif ( LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0) )
+   err = get_user_pages(data & PAGE_MASK,
+                        pLock->nr_pages,
+                        rw == READ, 1, /* force */
+                        pLock->pages, NULL);
+#else
    err = get_user_pages(current,
                         current->mm,
                         data & PAGE_MASK,
                         pLock->nr_pages,
                         rw == READ, 1, /* force */
                         pLock->pages, NULL);
+#endif
    up_read(&current->mm->mmap_sem);
+#endif
    TRACE(1, ("%s - nr_pages=%d, err=%d, data=%p/0x%ZX\n", __FUNCTION__, pLock->nr_pages, err, pLock->pvBuffer, pLock->len));
    if (err != pLock->nr_pages) {
            pLock->nr_pages = (err >= 0) ? err : 0;
@@ -1867,6 +3026,7 @@ static int CDA_LockBuffer(CDA_SInstance* pInst, void* pTable, uiSG* pSgl, int iD
   ui32 dwPage;
   struct scatterlist *sgEntry;
   uiSG dwBytesRemaining;
+  int iSource = PHX_TRACE_LOCK_PINNED;
 
   TRACE( 4, ( "%s(%p,%p,%p)\n", __FUNCTION__, pInst,pTable,pSgl));
   ASSERT( NULL != pTable);
@@ -1890,6 +3050,25 @@ static int CDA_LockBuffer(CDA_SInstance* pInst, void* pTable, uiSG* pSgl, int iD
 
   /* Calculate address/length for first (possibly fragmented) page */
   size = _CDA_SGTable_Get_MemorySize( pTable);
+
+#ifdef CDA_DMABUF
+  /* A driver allocated buffer has nothing to pin or map */
+  iError = CDA_DmaBufLock( pInst, pTable, pSgl, maxentries, buffer, size);
+  if ( -ENOENT != iError)
+    return iError;
+#endif
+
+#ifdef CDA_LOCK_CACHE
+  /* Same buffer as a previous run, already pinned & mapped */
+  pLock = CDA_LockCacheTake( pInst, (void*)buffer, size,
+                             iDma ? DMA_FROM_DEVICE : DMA_TO_DEVICE);
+  if ( NULL != pLock)
+    {
+    iSource = PHX_TRACE_LOCK_CACHED;
+    goto mapped;
+    }
+#endif
+
   /* Allocate a lock */
   pLock = (SLock*) kmalloc( sizeof(*pLock), GFP_KERNEL);
   if ( NULL == pLock)
@@ -1902,9 +3081,9 @@ static int CDA_LockBuffer(CDA_SInstance* pInst, void* pTable, uiSG* pSgl, int iD
   TRACE( 2, ("%s: pLock->pvBuffer = %p\n", __FUNCTION__, pLock->pvBuffer));
   pLock->len = size;
   if(iDma)  /* DMA buffer */
-    pLock->direction = PCI_DMA_FROMDEVICE;
+    pLock->direction = DMA_FROM_DEVICE;
   else      /* RISC buffer */
-    pLock->direction = PCI_DMA_TODEVICE;
+    pLock->direction = DMA_TO_DEVICE;
   pLock->pInst = pInst;
   iError = CDA_dma_lock_user(pLock);
   if (iError)
@@ -1922,16 +3101,27 @@ static int CDA_LockBuffer(CDA_SInstance* pInst, void* pTable, uiSG* pSgl, int iD
     kfree(pLock);
     return iError;
   }
-  pLock->sglen = pci_map_sg(((SPciInstance*)(pInst->pDevice))->pDev, pLock->sglist, pLock->nr_pages, pLock->direction);
+  pLock->sglen = dma_map_sg(CDA_DMA_DEV(pInst), pLock->sglist, pLock->nents, pLock->direction);
   if (0 == pLock->sglen)
   {
-    TRACE( 1, ( "*** %s: pci_map_sg failed\n", __FUNCTION__));
+    TRACE( 1, ( "*** %s: dma_map_sg failed\n", __FUNCTION__));
     CDA_UnlockBuffer(pLock);
     kfree(pLock);
     return -EFAULT;
   }
+#ifdef CDA_LOCK_CACHE
+mapped:
+#endif
+  if (pLock->sglen > maxentries)
+  {
+    TRACE( 1, ( "*** %s: %u descriptors, table holds %u\n", __FUNCTION__, pLock->sglen, maxentries));
+    CDA_UnlockBuffer(pLock);
+    kfree(pLock);
+    return -ENOSPC;
+  }
+  TRACE( 2, ( "%s: %Zd bytes, %u pages, %u descriptors\n", __FUNCTION__, pLock->len, pLock->nr_pages, pLock->sglen));
 #if defined DEBUG
-  TRACE( 2, ("%s: pci_map_sg returned %d\n",__FUNCTION__, pLock->sglen));
+  TRACE( 2, ("%s: dma_map_sg returned %d\n",__FUNCTION__, pLock->sglen));
   {
      int i;
      sgEntry = pLock->sglist;
@@ -1969,9 +3159,137 @@ static int CDA_LockBuffer(CDA_SInstance* pInst, void* pTable, uiSG* pSgl, int iD
      pLock->pNext->pPrev = pLock;
   }
   pInst->pLockHead = pLock;
+
+  if ( !pLock->bCounted)
+  {
+    pLock->bCounted = 1;
+    CDA_STAT_INC( pInst, buffersLocked);
+    CDA_STAT_ADD( pInst, pagesLocked, pLock->nr_pages);
+    CDA_STAT_ADD( pInst, descriptorsLocked, pLock->sglen);
+  }
+  trace_phx_lock( pInst->devicenum, buffer, pLock->len, pLock->nr_pages, pLock->sglen, iSource);
   return 0;
 }  
 
+#ifdef CDA_LOCK_CACHE
+/* kernel 5.10+
+ * Reuse a cached lock on pvBuffer if its mapping has not changed since
+ */
+static SLock* CDA_LockCacheTake(CDA_SInstance* pInst, void* pvBuffer, size_t len, unsigned int direction)
+{
+  SLock* pLock;
+
+  for (pLock = pInst->pCacheHead; NULL != pLock; pLock = pLock->pNext)
+  {
+    if (pLock->pvBuffer == pvBuffer && pLock->len == len
+     && pLock->direction == direction && pLock->notifier.mm == current->mm)
+      break;
+  }
+  if (NULL == pLock)
+    return NULL;
+
+  if (NULL != pLock->pPrev)
+    pLock->pPrev->pNext = pLock->pNext;
+  else
+    pInst->pCacheHead = pLock->pNext;
+  if (NULL != pLock->pNext)
+    pLock->pNext->pPrev = pLock->pPrev;
+  pLock->pPrev = pLock->pNext = NULL;
+  --pInst->uCached;
+  CDA_STAT_SUB( pInst, buffersCached, 1);
+
+  if (mmu_interval_check_retry(&pLock->notifier, pLock->ulSeq))
+  {
+    TRACE( 2, ( "%s: %p was remapped, locking afresh\n", __FUNCTION__, pvBuffer));
+    CDA_UnlockBuffer(pLock);
+    kfree(pLock);
+    return NULL;
+  }
+
+  /* Hand ownership back to the board */
+  dma_sync_sg_for_device(CDA_DMA_DEV(pInst), pLock->sglist, pLock->nents, pLock->direction);
+  CDA_STAT_INC( pInst, lockCacheHits);
+  TRACE( 2, ( "%s: %p reused, %u descriptors\n", __FUNCTION__, pvBuffer, pLock->sglen));
+  return pLock;
+}
+
+/* kernel 5.10+
+ * Release cached locks, oldest first, until uKeep remain
+ */
+static void CDA_LockCacheTrim(CDA_SInstance* pInst, unsigned uKeep)
+{
+  SLock* pLock = pInst->pCacheHead;
+  unsigned u;
+
+  for (u = 1; u < uKeep && NULL != pLock; ++u)
+    pLock = pLock->pNext;
+  if (0 == uKeep)
+    pInst->pCacheHead = NULL;
+  else if (NULL != pLock)
+  {
+    SLock* pLast = pLock;
+    pLock = pLast->pNext;
+    pLast->pNext = NULL;
+  }
+
+  while (NULL != pLock)
+  {
+    SLock* pNext = pLock->pNext;
+    CDA_UnlockBuffer(pLock);
+    kfree(pLock);
+    --pInst->uCached;
+    CDA_STAT_SUB( pInst, buffersCached, 1);
+    pLock = pNext;
+  }
+}
+#endif
+
+/* kernel 2.6.n
+ * Unlock a buffer taken off the lock list. With lock_cache it stays pinned
+ * & mapped instead, unless its mapping changed while it was locked.
+ */
+static int CDA_RetireLock(CDA_SInstance* pInst, SLock* pLock)
+{
+  int iRet;
+
+#ifdef CDA_LOCK_CACHE
+  if (lock_cache && pLock->bNotifier && pLock->sglen
+   && !mmu_interval_check_retry(&pLock->notifier, pLock->ulSeq))
+  {
+    trace_phx_unlock( pInst->devicenum, (unsigned long)pLock->pvBuffer, pLock->len, pLock->nr_pages, pLock->sglen, 1);
+
+    /* As dma_unmap_sg would, give the data to the CPU */
+    dma_sync_sg_for_cpu(CDA_DMA_DEV(pInst), pLock->sglist, pLock->nents, pLock->direction);
+
+    /* Pinned still, but no longer locked for the board */
+    if (pLock->bCounted)
+    {
+      CDA_STAT_SUB( pInst, buffersLocked, 1);
+      CDA_STAT_SUB( pInst, pagesLocked, pLock->nr_pages);
+      CDA_STAT_SUB( pInst, descriptorsLocked, pLock->sglen);
+      pLock->bCounted = 0;
+    }
+
+    pLock->pPrev = NULL;
+    pLock->pNext = pInst->pCacheHead;
+    if (NULL != pLock->pNext)
+      pLock->pNext->pPrev = pLock;
+    pInst->pCacheHead = pLock;
+    ++pInst->uCached;
+    CDA_STAT_INC( pInst, buffersCached);
+
+    if (pInst->uCached > lock_cache)
+      CDA_LockCacheTrim(pInst, lock_cache);
+    return 0;
+  }
+#endif
+
+  trace_phx_unlock( pInst->devicenum, (unsigned long)pLock->pvBuffer, pLock->len, pLock->nr_pages, pLock->sglen, 0);
+  iRet = CDA_UnlockBuffer(pLock);
+  kfree(pLock);
+  return iRet;
+}
+
 /* kernel 2.6.n */
 static int CDA_FlushBuffer(SLock *pLock)
 {
@@ -1979,10 +3297,10 @@ static int CDA_FlushBuffer(SLock *pLock)
    TRACE( 4, ( "%s(%p,%Zd,%p)\n", __FUNCTION__, pLock->pInst,pLock->len,pLock->sglist));
    if (pLock->sglist)
    {
-     if( PCI_DMA_FROMDEVICE == pLock->direction)  /* DMA buffer */
-       pci_dma_sync_sg_for_cpu(   ((SPciInstance*)(pLock->pInst->pDevice))->pDev, pLock->sglist, pLock->nr_pages, pLock->direction);
-     else      /* PCI_DMA_TODEVICE : RISC buffer */
-       pci_dma_sync_sg_for_device(((SPciInstance*)(pLock->pInst->pDevice))->pDev, pLock->sglist, pLock->nr_pages, pLock->direction);
+     if( DMA_FROM_DEVICE == pLock->direction)  /* DMA buffer */
+       dma_sync_sg_for_cpu(   CDA_DMA_DEV(pLock->pInst), pLock->sglist, pLock->nents, pLock->direction);
+     else      /* DMA_TO_DEVICE : RISC buffer */
+       dma_sync_sg_for_device(CDA_DMA_DEV(pLock->pInst), pLock->sglist, pLock->nents, pLock->direction);
    }
    return 0;
 }  
@@ -1992,24 +3310,57 @@ static int CDA_UnlockBuffer(SLock *pLock)
 {
    if (pLock == NULL) return -EFAULT;
    TRACE( 4, ( "%s(%p,%Zd,%p)\n", __FUNCTION__, pLock->pInst,pLock->len,pLock->sglist));
+   if (pLock->bCounted)
+   {
+     CDA_STAT_SUB( pLock->pInst, buffersLocked, 1);
+     CDA_STAT_SUB( pLock->pInst, pagesLocked, pLock->nr_pages);
+     CDA_STAT_SUB( pLock->pInst, descriptorsLocked, pLock->sglen);
+     pLock->bCounted = 0;
+   }
+#ifdef CDA_DMABUF
+   if (pLock->pDmaBuf)
+   {
+      /* Coherent, nothing to sync or unmap */
+      atomic_dec(&pLock->pDmaBuf->iLocks);
+      pLock->pDmaBuf = NULL;
+      pLock->sglen = 0;
+   }
+#endif
    if (pLock->sglist)
    {
      if (pLock->sglen)
      {
-        pci_unmap_sg(((SPciInstance*)(pLock->pInst->pDevice))->pDev, pLock->sglist, pLock->nr_pages, pLock->direction);
+        dma_unmap_sg(CDA_DMA_DEV(pLock->pInst), pLock->sglist, pLock->nents, pLock->direction);
         pLock->sglen = 0;
      }
 
       vfree(pLock->sglist);
       pLock->sglist = NULL;
    }
+#ifdef CDA_LOCK_CACHE
+   if (pLock->bNotifier)
+   {
+      mmu_interval_notifier_remove(&pLock->notifier);
+      pLock->bNotifier = 0;
+   }
+#endif
    if (pLock->pages)
    {
+#ifdef CDA_PIN_USER
+      /* The board wrote to DMA buffers behind the page tables' back */
+      unpin_user_pages_dirty_lock(pLock->pages, pLock->nr_pages,
+                                  DMA_FROM_DEVICE == pLock->direction);
+#else
       int iPage;
       for (iPage=0; iPage < pLock->nr_pages; iPage++)
       {
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(4, 6, 0) )
+         put_page(pLock->pages[iPage]);
+#else
          page_cache_release(pLock->pages[iPage]);
+#endif
       }
+#endif
       vfree(pLock->pages);
       pLock->pages = NULL;
       pLock->nr_pages = 0;
@@ -2017,6 +3368,237 @@ static int CDA_UnlockBuffer(SLock *pLock)
    return 0;
 }  
 
+#ifdef CDA_DMABUF
+/* kernel 3.6+
+ * Allocate a DMA coherent buffer and describe it to the board once.
+ * Large buffers come from the CMA area when the kernel has one.
+ */
+static int CDA_IoctlDmaBufAlloc(CDA_SInstance* pInst, CDA_SIoctlDmaBuf* pInfo)
+{
+  CDA_SDmaBuf* pBuf;
+  size_t size;
+  unsigned u;
+
+  if (0 == pInfo->size || pInfo->size > INT_MAX || 0 != pInfo->flags)
+  {
+    TRACE( 1, ( "*** %s: bad size %llu or flags 0x%x\n", __FUNCTION__, (unsigned long long)pInfo->size, pInfo->flags));
+    return -EINVAL;
+  }
+  size = PAGE_ALIGN((size_t)pInfo->size);
+
+  pBuf = kzalloc(sizeof(*pBuf), GFP_KERNEL);
+  if (NULL == pBuf)
+    return -ENOMEM;
+  pBuf->pInst = pInst;
+  pBuf->size = size;
+  atomic_set(&pBuf->iMaps, 0);
+  atomic_set(&pBuf->iLocks, 0);
+  pBuf->pvKernel = dma_alloc_coherent(CDA_DMA_DEV(pInst), size, &pBuf->dma, GFP_KERNEL);
+  if (NULL == pBuf->pvKernel)
+  {
+    TRACE( 1, ( "*** %s: dma_alloc_coherent failed for %Zd bytes\n", __FUNCTION__, size));
+    kfree(pBuf);
+    return -ENOMEM;
+  }
+
+  /* Contiguous, so only sg_max_segment splits it */
+  pBuf->uSegment = sg_max_segment & PAGE_MASK;
+  if (pBuf->uSegment < PAGE_SIZE)
+    pBuf->uSegment = PAGE_SIZE;
+  pBuf->uDesc = DIV_ROUND_UP(size, pBuf->uSegment);
+  pBuf->pDesc = vmalloc(pBuf->uDesc * CDA_SGTABLE_BYTES_PER_ENTRY);
+  if (NULL == pBuf->pDesc)
+  {
+    dma_free_coherent(CDA_DMA_DEV(pInst), size, pBuf->pvKernel, pBuf->dma);
+    kfree(pBuf);
+    return -ENOMEM;
+  }
+  for (u = 0; u < pBuf->uDesc; u++)
+  {
+    size_t offset = (size_t)u * pBuf->uSegment;
+    pBuf->pDesc[2 * u]     = pBuf->dma + offset;
+    pBuf->pDesc[2 * u + 1] = min_t(size_t, size - offset, pBuf->uSegment);
+  }
+
+  mutex_lock(&pInst->dmaBufMutex);
+  pBuf->id = ++pInst->uDmaBufId;
+  pBuf->ulPgOff = pInst->ulDmaBufPgOff;
+  pInst->ulDmaBufPgOff += size >> PAGE_SHIFT;
+  pBuf->pNext = pInst->pDmaBufHead;
+  pInst->pDmaBufHead = pBuf;
+  mutex_unlock(&pInst->dmaBufMutex);
+
+  CDA_STAT_INC( pInst, dmaBufs);
+  CDA_STAT_ADD( pInst, dmaBufBytes, size);
+  TRACE( 2, ( "%s: buffer %u, %Zd bytes at 0x%llx, %u descriptors\n", __FUNCTION__, pBuf->id, size, (unsigned long long)pBuf->dma, pBuf->uDesc));
+
+  pInfo->size = size;
+  pInfo->offset = (u_int64_t)pBuf->ulPgOff << PAGE_SHIFT;
+  pInfo->busAddr = pBuf->dma;
+  pInfo->id = pBuf->id;
+  return 0;
+}
+
+/* kernel 3.6+
+ * Free a driver allocated buffer that is neither mapped nor locked
+ */
+static int CDA_IoctlDmaBufFree(CDA_SInstance* pInst, u_int32_t id)
+{
+  CDA_SDmaBuf** ppBuf;
+  CDA_SDmaBuf* pBuf;
+  int iRet = 0;
+
+  mutex_lock(&pInst->dmaBufMutex);
+  for (ppBuf = &pInst->pDmaBufHead; NULL != (pBuf = *ppBuf); ppBuf = &pBuf->pNext)
+  {
+    if (pBuf->id == id)
+      break;
+  }
+  if (NULL == pBuf)
+    iRet = -EINVAL;
+  else if (atomic_read(&pBuf->iMaps))
+    iRet = -EBUSY;
+  else
+  {
+    /* Locks are only taken through a mapping, so look after it is gone */
+    smp_rmb();
+    if (atomic_read(&pBuf->iLocks))
+      iRet = -EBUSY;
+    else
+      *ppBuf = pBuf->pNext;
+  }
+  mutex_unlock(&pInst->dmaBufMutex);
+
+  if (0 != iRet)
+  {
+    TRACE( 1, ( "*** %s: buffer %u %s\n", __FUNCTION__, id, -EBUSY == iRet ? "in use" : "not found"));
+    return iRet;
+  }
+  CDA_DmaBufRelease(pInst, pBuf);
+  return 0;
+}
+
+/* kernel 3.6+ */
+static void CDA_DmaBufRelease(CDA_SInstance* pInst, CDA_SDmaBuf* pBuf)
+{
+  CDA_STAT_SUB( pInst, dmaBufs, 1);
+  CDA_STAT_SUB( pInst, dmaBufBytes, pBuf->size);
+  dma_free_coherent(CDA_DMA_DEV(pInst), pBuf->size, pBuf->pvKernel, pBuf->dma);
+  vfree(pBuf->pDesc);
+  kfree(pBuf);
+}
+
+/* kernel 3.6+
+ * Lock [buffer, buffer + size) if it lies in a mapping made by CDA_mmap.
+ * The descriptors built at allocation are copied out as they are, with the
+ * first and last trimmed to the range. Returns -ENOENT for other buffers.
+ */
+static int CDA_DmaBufLock(CDA_SInstance* pInst, void* pTable, uiSG* pSgl, ui32 maxentries,
+                          unsigned long buffer, unsigned long size)
+{
+  struct mm_struct* mm = current->mm;
+  struct vm_area_struct* vma;
+  CDA_SDmaBuf* pBuf = NULL;
+  unsigned long ulOffset = 0;
+  unsigned uFirst, uLast;
+  uiSG entry[2];
+  SLock* pLock;
+  int iRet;
+
+  if (0 == size || NULL == mm)
+    return -ENOENT;
+
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0) )
+  mmap_read_lock(mm);
+#else
+  down_read(&mm->mmap_sem);
+#endif
+  vma = find_vma(mm, buffer);
+  if (NULL != vma && &s_dmaBufVmOps == vma->vm_ops
+   && vma->vm_start <= buffer && size <= vma->vm_end - buffer)
+  {
+    pBuf = vma->vm_private_data;
+    ulOffset = (vma->vm_pgoff << PAGE_SHIFT) + (buffer - vma->vm_start);
+    /* Pins the buffer once the mapping goes */
+    atomic_inc(&pBuf->iLocks);
+  }
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 8, 0) )
+  mmap_read_unlock(mm);
+#else
+  up_read(&mm->mmap_sem);
+#endif
+  if (NULL == pBuf)
+    return -ENOENT;
+
+  if (pBuf->pInst != pInst)
+  {
+    TRACE( 1, ( "*** %s: %p belongs to another device\n", __FUNCTION__, (void*)buffer));
+    iRet = -EINVAL;
+    goto fail;
+  }
+
+  uFirst = ulOffset / pBuf->uSegment;
+  uLast = (ulOffset + size - 1) / pBuf->uSegment;
+  if (uLast - uFirst + 1 > maxentries)
+  {
+    TRACE( 1, ( "*** %s: %u descriptors, table holds %u\n", __FUNCTION__, uLast - uFirst + 1, maxentries));
+    iRet = -ENOSPC;
+    goto fail;
+  }
+
+  iRet = -EFAULT;
+  if (copy_to_user(pSgl, &pBuf->pDesc[2 * uFirst], (uLast - uFirst + 1) * CDA_SGTABLE_BYTES_PER_ENTRY))
+    goto fail;
+  entry[0] = pBuf->dma + ulOffset;
+  entry[1] = min_t(unsigned long, size, (unsigned long)(uFirst + 1) * pBuf->uSegment - ulOffset);
+  if (copy_to_user(pSgl, entry, sizeof(entry)))
+    goto fail;
+  if (uLast != uFirst)
+  {
+    entry[0] = pBuf->pDesc[2 * uLast];
+    entry[1] = ulOffset + size - (unsigned long)uLast * pBuf->uSegment;
+    if (copy_to_user(pSgl + 2 * (uLast - uFirst), entry, sizeof(entry)))
+      goto fail;
+  }
+
+  pLock = (SLock*) kmalloc( sizeof(*pLock), GFP_KERNEL);
+  if ( NULL == pLock)
+  {
+    TRACE( 1, ( "*** %s: Out of memory for lock info\n", __FUNCTION__));
+    iRet = -ENOMEM;
+    goto fail;
+  }
+  memset(pLock, 0, sizeof(*pLock));
+  pLock->pvBuffer = (void*)buffer;
+  pLock->len = size;
+  pLock->pInst = pInst;
+  pLock->pDmaBuf = pBuf;
+  pLock->sglen = uLast - uFirst + 1;
+  _CDA_SGTable_Set_NumEntries( pTable, pLock->sglen );
+  TRACE( 2, ( "%s: %Zd bytes of buffer %u, %u descriptors\n", __FUNCTION__, pLock->len, pBuf->id, pLock->sglen));
+
+  /* Add to list of pending locks */
+  pLock->pPrev = NULL;
+  pLock->pNext = pInst->pLockHead;
+  if ( NULL != pLock->pNext)
+  {
+     ASSERT( NULL == pLock->pNext->pPrev);
+     pLock->pNext->pPrev = pLock;
+  }
+  pInst->pLockHead = pLock;
+
+  pLock->bCounted = 1;
+  CDA_STAT_INC( pInst, buffersLocked);
+  CDA_STAT_ADD( pInst, descriptorsLocked, pLock->sglen);
+  trace_phx_lock( pInst->devicenum, buffer, size, 0, pLock->sglen, PHX_TRACE_LOCK_DMABUF);
+  return 0;
+
+fail:
+  atomic_dec(&pBuf->iLocks);
+  return iRet;
+}
+#endif
+
 #else
 /* kernel 2.4.n */
 static int CDA_LockBuffer(
@@ -2168,6 +3750,17 @@ static int CDA_UnlockBuffer(SLock *pLock)
    pLock->pkiobuf = NULL;
    return 0;
 }
+
+/* kernel2.4.n */
+static int CDA_RetireLock(CDA_SInstance* pInst, SLock* pLock)
+{
+   int iRet;
+
+   (void)pInst;
+   iRet = CDA_UnlockBuffer(pLock);
+   kfree(pLock);
+   return iRet;
+}
 #endif
 
 /*
@@ -64,6 +64,15 @@ extern "C" {
 #define lengthof( _a) (sizeof( _a) / sizeof( (_a)[0]) )
 #endif
 
+/* Monotonic time in ns for event timestamps, safe at IRQ time */
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 17, 0) )
+#define CDA_TIME_NS() ((ui64)ktime_get_ns())
+#elif ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 16) )
+#define CDA_TIME_NS() ((ui64)ktime_to_ns( ktime_get()))
+#else
+#define CDA_TIME_NS() ((ui64)jiffies * (1000000000 / HZ))
+#endif
+
 /* CDA lib compatible types */
 typedef u_int64_t ui64;
 typedef u_int32_t ui32;
@@ -77,6 +86,7 @@ typedef struct CDA_SInstance CDA_SInstance; /* Opaque device instance data */
 struct CDA_SIoctlDeviceInfo; /* in linuxdrv.h */
 struct file;  /* in <linux/fs.h> */
 struct inode; /* in <linux/fs.h> */
+struct vm_area_struct; /* in <linux/mm_types.h> */
 
 
 /* Device specific methods */
@@ -91,6 +101,7 @@ typedef int CDA_FRead( CDA_SDevice*, struct file*, ui32*, uint32_t offset, int b
 typedef int CDA_FWrite( CDA_SDevice*, struct file*, ui32 data, ui32 offset, int bits);
 typedef int CDA_FReconfig( CDA_SDevice*);
 typedef int CDA_FPutEvent( CDA_SDevice*, CDA_SIoctlEvent*);
+typedef int CDA_FMmap( CDA_SDevice*, struct file*, struct vm_area_struct*);
 
 /* Device function table */
 typedef struct CDA_SVtable
@@ -105,6 +116,7 @@ typedef struct CDA_SVtable
   CDA_FFinal*   pfnFinal;               /* Maybe 0 - device being destoyed */
   CDA_FReconfig* pfnReconfig;           /* Maybe 0 - restore device config */
   CDA_FPutEvent* pfnPutEvent;           /* Maybe 0 - put an event          */
+  CDA_FMmap*    pfnMmap;                /* Maybe 0 - map registers to user space */
   } CDA_SVtable;
 
 
@@ -116,6 +128,33 @@ extern void CDA_DeviceEvent(
   ui32 data
 );
 
+/* Account for an IRQ, isInterrupt 0 if raised by another device */
+extern void CDA_DeviceIrq(
+  CDA_SInstance*,                       /* As passed to CDA_FStart */
+  int isInterrupt,
+  ui32 status                           /* Device IRQ status bits */
+);
+
+/* Timing marker, on 1 when the IRQ is taken and 0 when its event is read.
+ * Drives a DIO port, a GPIO bit or a timestamp ring, chosen by the marker
+ * module parameter. Compiled out with CDA_NO_MARKER */
+#ifdef CDA_NO_MARKER
+#define CDA_DeviceMarker( _pInst, _on) do {} while (0)
+#else
+extern void CDA_DeviceMarker(
+  CDA_SInstance*,                       /* As passed to CDA_FStart */
+  int on
+);
+#endif
+
+/* Device event with the time it was raised, from CDA_TIME_NS */
+extern void CDA_DeviceEventEx(
+  CDA_SInstance*,                       /* As passed to CDA_FStart */
+  ui32 ev,
+  ui32 data,
+  ui64 timestamp
+);
+
 /* Device registration */
 extern int CDA_RegisterDevice(
   const CDA_SVtable*,                   /* -> function table */
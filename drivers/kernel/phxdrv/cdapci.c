@@ -48,12 +48,20 @@
 #include <linux/ioport.h>
 #include <linux/list.h>
 #include <linux/pci.h>
+#include <linux/mm.h>
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 16) )
+#include <linux/ktime.h>
+#endif
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0) )
+#include <linux/uaccess.h>
+#else
 #include <asm/uaccess.h>
+#endif
 #include "linuxdrv.h"           /* For CDA_SIoctlDeviceInfo */
 
 #include "cdapci.h"
 #include "debug.h"
-#include "picc_dio.h"
+#include "phxdrv_trace.h"
 
 
 /*
@@ -78,6 +86,8 @@ typedef struct SPciInstance
   struct pci_dev * pDev;
   PCI_SDevInfo info;                    /* Card info */
   int bIrqInstalled;
+  int iIrq;                             /* IRQ number in use */
+  int iIrqMode;                         /* Always PCI_kIrqIntx */
   u32 shadowConfig[ 64];                /* PCI config space snapshot */
 
   /* Registers */
@@ -102,6 +112,9 @@ static CDA_FWrite    PCI_Write;
 static CDA_FFinal    PCI_Final;
 static CDA_FReconfig PCI_Reconfig;
 static CDA_FPutEvent PCI_PutEvent;
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 6, 0) )
+static CDA_FMmap     PCI_Mmap;
+#endif
 #if LINUX_VERSION_CODE >= 0x20613   /* 2.6.19 */
 static irqreturn_t PCI_IrqHandler( int irq, void * pv);
 #elif ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) )
@@ -109,10 +122,30 @@ static irqreturn_t PCI_IrqHandler( int irq, void * pv, struct pt_regs * regs);
 #else /* < 2.6.0 */
 static void PCI_IrqHandler( int irq, void * pv, struct pt_regs * regs);
 #endif
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 30) )
+static irqreturn_t PCI_IrqThread( int irq, void * pv);
+#endif
+static void PCI_IrqVectors( SPciInstance*);
+static void PCI_IrqVectorsFree( SPciInstance*);
 
 /*
  * Module data
  */
+static int use_msi = 1;                 /* Prefer MSI-X / MSI to INTx */
+static int threaded_irq = 0;            /* Queue events from an IRQ thread */
+static int irq_cpu = -1;                /* CPU to steer the IRQ to, -1 = any */
+static int bar_mmap = 0;                /* Allow read-only mmap of the registers */
+
+#if defined MODULE && ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) )
+ module_param( use_msi, int, 0444 );
+ MODULE_PARM_DESC( use_msi, "1 = use MSI-X or MSI when the board supports it, 0 = always INTx (default 1)");
+ module_param( threaded_irq, int, 0444 );
+ MODULE_PARM_DESC( threaded_irq, "1 = the hard IRQ handler only clears and captures the status, events are queued from the IRQ thread");
+ module_param( irq_cpu, int, 0444 );
+ MODULE_PARM_DESC( irq_cpu, "CPU the IRQ (and IRQ thread) is steered to, -1 = leave to the kernel (default)");
+ module_param( bar_mmap, int, 0644 );
+ MODULE_PARM_DESC( bar_mmap, "1 = mmap offset 0 of the device maps the register BAR read-only, 3.6+ kernels (default 0)");
+#endif
 
 /* The dispatch table */
 static CDA_SVtable const PCI_vtable =
@@ -126,7 +159,12 @@ static CDA_SVtable const PCI_vtable =
   &PCI_Write,
   &PCI_Final,
   &PCI_Reconfig,
-  &PCI_PutEvent
+  &PCI_PutEvent,
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 6, 0) )
+  &PCI_Mmap
+#else
+  0
+#endif
 };
 
 
@@ -254,6 +292,8 @@ static int PCI_Start( CDA_SDevice* pDevice,
 
   /* Save the caller's context for CDA_DeviceEvent */
   pPci->pInst = pInst;
+  pPci->iIrq = pPci->pDev->irq;
+  pPci->iIrqMode = PCI_kIrqIntx;
 
   /* Scan base addresses looking for a memory mapping */
   for ( i = 0; i < 6; ++i)
@@ -317,6 +357,14 @@ static int PCI_Start( CDA_SDevice* pDevice,
             iRet = -ENODEV; break;
       }
 #endif
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0) )
+      /* Streaming mappings are made with the DMA API on pDev->dev */
+      if (dma_set_mask(&pPci->pDev->dev, DMA_BIT_MASK(32)))
+      {
+            TRACE(1, ("%s: dma_set_mask failed", __FUNCTION__));
+            iRet = -EIO; break;
+      }
+#else
 #ifndef DMA_32BIT_MASK
 #define DMA_32BIT_MASK 0xffffffffULL
 #endif
@@ -325,6 +373,7 @@ static int PCI_Start( CDA_SDevice* pDevice,
             TRACE(1, ("%s: pci_set_dma_mask failed", __FUNCTION__));
             iRet = -EIO; break;
       }
+#endif
       if (!request_mem_region(bar_start, bar_end - bar_start, "phx"))
       {
             TRACE(1, ("%s: request_mem_region failed", __FUNCTION__));
@@ -355,7 +404,11 @@ static int PCI_Start( CDA_SDevice* pDevice,
        */
     
       /* Get a non-cacheable logical mapping - ignore PCI prefetchable flag */
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0) )
+      pPci->pvBase = ioremap( bar_start, bar_end - bar_start); /* Uncached */
+#else
       pPci->pvBase = ioremap_nocache( bar_start, bar_end - bar_start); 
+#endif
 
       /* printk("  cda card remapped start address is  %x\n", (int)pPci->pvBase ); */
 
@@ -379,6 +432,10 @@ static int PCI_Start( CDA_SDevice* pDevice,
     }
   ASSERT( NULL != pPci->pvBase);
 
+  /* Pick MSI-X, MSI or INTx before the handler goes in */
+  if ( pPci->info.pfnIrqHandler)
+    PCI_IrqVectors( pPci);
+
   /* Init the device, ensure interrupts are off & DMA disabled */
   if ( (pPci->info.pfnInitialise
       && !(*pPci->info.pfnInitialise)( pPci->pDev, pPci->pvBase))
@@ -389,24 +446,65 @@ static int PCI_Start( CDA_SDevice* pDevice,
     iRet = -EFAULT;
     }
   else if ( pPci->info.pfnIrqHandler
-    && pPci->pDev->irq > 0
+    && pPci->iIrq > 0
   ) {
+    unsigned long ulFlags = 0;
+
+    /* Only a line interrupt can be shared, MSI vectors are ours alone */
+    if ( PCI_kIrqIntx == pPci->iIrqMode)
+#if LINUX_VERSION_CODE >= 0x20612   /* 2.6.18 */
+      ulFlags = IRQF_SHARED;   /* IRQF_SHARED means we're willing to have other handlers on this IRQ */
+#else
+      ulFlags = SA_SHIRQ;      /* SA_SHIRQ means we're willing to have other handlers on this IRQ */
+#endif
+
     /* Register the interrupt handler */
     TRACE( 3, ("%s() installing IRQ handler\n", __FUNCTION__));
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 30) )
+    if ( threaded_irq)
+      {
+      /* Set first, a shared line may call the handler straight away */
+      pPci->uIrqHead = pPci->uIrqTail = 0;
+      pPci->bIrqThreaded = 1;
+      iRet = request_threaded_irq(
+        pPci->iIrq,
+        &PCI_IrqHandler,  /* Clears and captures the status */
+        &PCI_IrqThread,   /* Queues the events */
+        ulFlags,
+        pszDeviceName,
+        pPci
+      );
+      if ( iRet)
+        pPci->bIrqThreaded = 0;
+      }
+    else
+#endif
     iRet = request_irq(
-      pPci->pDev->irq,    /* The IRQ number */ 
+      pPci->iIrq,         /* The IRQ number */ 
       &PCI_IrqHandler,    /* our handler */
-#if LINUX_VERSION_CODE >= 0x20612   /* 2.6.18 */
-      IRQF_SHARED,        /* IRQF_SHARED means we're willing to have other handlers on this IRQ */
-#else
-      SA_SHIRQ,           /* SA_SHIRQ means we're willing to have other handlers on this IRQ */
-#endif
+      ulFlags,
       pszDeviceName,      /* Name for /proc/interrupts */
       pPci                /* Device id */
     );
     if ( 0 == iRet)
       {
       pPci->bIrqInstalled = 1;
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 35) )
+      if ( irq_cpu >= 0 && irq_cpu < nr_cpu_ids && cpu_online( irq_cpu))
+        {
+        /* The IRQ thread, if any, follows the IRQ's affinity */
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0) )
+        if ( 0 == irq_set_affinity_and_hint( pPci->iIrq, cpumask_of( irq_cpu)))
+#else
+        if ( 0 == irq_set_affinity_hint( pPci->iIrq, cpumask_of( irq_cpu)))
+#endif
+          pPci->bIrqAffinity = 1;
+        }
+#endif
+      printk( KERN_INFO "%s: irq %d, %s%s\n", pszDeviceName, pPci->iIrq,
+        PCI_kIrqMsix == pPci->iIrqMode ? "MSI-X"
+          : PCI_kIrqMsi == pPci->iIrqMode ? "MSI" : "INTx",
+        pPci->bIrqThreaded ? ", threaded" : "");
       }
     else
       {
@@ -476,8 +574,26 @@ static int PCI_Stop( CDA_SDevice* pDevice )
     {
     TRACE( 3, ( "%s() removing IRQ handler\n", __FUNCTION__ ));
     pPci->bIrqInstalled = 0;
-    free_irq( pPci->pDev->irq, pPci);
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 35) )
+    if ( pPci->bIrqAffinity)
+      {
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(5, 17, 0) )
+      irq_update_affinity_hint( pPci->iIrq, NULL);
+#else
+      irq_set_affinity_hint( pPci->iIrq, NULL);
+#endif
+      pPci->bIrqAffinity = 0;
+      }
+#endif
+    free_irq( pPci->iIrq, pPci);
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 30) )
+    if ( pPci->ulIrqOverruns)
+      printk( KERN_WARNING "%s: %lu interrupts lost waiting for the IRQ thread\n",
+        pci_name( pPci->pDev), pPci->ulIrqOverruns);
+    pPci->bIrqThreaded = 0;
+#endif
     }
+  PCI_IrqVectorsFree( pPci);
 
   /* Free register mapping */
   if ( NULL != pPci->pvBase)
@@ -521,12 +637,59 @@ static int PCI_GetInfo( CDA_SDevice*                 pDevice,
 
   ASSERT( pPci->iMapping < 6 );
   pInfo->dwBase = pci_resource_start(pPci->pDev, pPci->iMapping);
-  pInfo->dwInterrupt = pPci->pDev->irq;
+  pInfo->dwInterrupt = pPci->iIrq;
 
   return 0;
 }
 
 
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 6, 0) )
+/*
+ * Map the register BAR into user space so that status registers can be
+ * polled with a plain load. Read-only: writes still go through
+ * CDA_IOCTL_REGLIST. Refused unless bar_mmap is set.
+ */
+static int PCI_Mmap( CDA_SDevice*           pDevice,
+                     struct file*           pFile,
+                     struct vm_area_struct* vma )
+{
+  SPciInstance* const pPci = (SPciInstance*)pDevice;
+  resource_size_t start, len;
+
+  TRACE( 9, ( "%s(%p,%p,%p)\n", __FUNCTION__, pDevice, pFile, vma));
+  ASSERT( NULL != pDevice);
+  (void)pFile;
+
+  if ( !bar_mmap)
+    return -EPERM;
+  if ( vma->vm_flags & VM_WRITE)
+    {
+    TRACE( 1, ("*** %s: registers can only be mapped read-only\n", __FUNCTION__));
+    return -EPERM;
+    }
+
+  /* Nor may mprotect make it writable later */
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0) )
+  vm_flags_clear( vma, VM_MAYWRITE);
+#else
+  vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+  vma->vm_page_prot = pgprot_noncached( vma->vm_page_prot);
+
+  start = pci_resource_start( pPci->pDev, pPci->iMapping);
+  len = pci_resource_len( pPci->pDev, pPci->iMapping);
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 10, 0) )
+  return vm_iomap_memory( vma, start, len);
+#else
+  if ( (vma->vm_pgoff << PAGE_SHIFT) + (vma->vm_end - vma->vm_start) > PAGE_ALIGN( len))
+    return -EINVAL;
+  return io_remap_pfn_range( vma, vma->vm_start, (start >> PAGE_SHIFT) + vma->vm_pgoff,
+                             vma->vm_end - vma->vm_start, vma->vm_page_prot);
+#endif
+}
+#endif
+
+
 /*
  * Device open
  */
@@ -665,6 +828,52 @@ static int PCI_Write( CDA_SDevice* pDevice,
 }
 
 
+/*
+ * Allocate one MSI-X or MSI vector if use_msi, else stay on INTx
+ */
+static void PCI_IrqVectors( SPciInstance* pPci)
+{
+  TRACE( 9, ( "%s(%p)\n", __FUNCTION__, pPci));
+
+  if ( !use_msi)
+    return;
+
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0) )
+  if ( pci_alloc_irq_vectors( pPci->pDev, 1, 1, PCI_IRQ_MSIX | PCI_IRQ_MSI) > 0)
+    {
+    pPci->iIrq = pci_irq_vector( pPci->pDev, 0);
+    pPci->iIrqMode = pPci->pDev->msix_enabled ? PCI_kIrqMsix : PCI_kIrqMsi;
+    }
+#elif ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 8) )
+  if ( 0 == pci_enable_msi( pPci->pDev))
+    {
+    pPci->iIrq = pPci->pDev->irq;
+    pPci->iIrqMode = PCI_kIrqMsi;
+    }
+#endif
+
+  if ( PCI_kIrqIntx == pPci->iIrqMode)
+    TRACE( 2, ("%s: no MSI, using INTx\n", __FUNCTION__));
+}
+
+
+static void PCI_IrqVectorsFree( SPciInstance* pPci)
+{
+  TRACE( 9, ( "%s(%p)\n", __FUNCTION__, pPci));
+
+  if ( PCI_kIrqIntx == pPci->iIrqMode)
+    return;
+
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0) )
+  pci_free_irq_vectors( pPci->pDev);
+#elif ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 8) )
+  pci_disable_msi( pPci->pDev);
+#endif
+  pPci->iIrqMode = PCI_kIrqIntx;
+  pPci->iIrq = pPci->pDev->irq;
+}
+
+
 /*
  * IRQ handler
  */
@@ -682,21 +891,19 @@ static void PCI_IrqHandler( int const             irq,
 #endif
 {
   SPciInstance* const pPci = (SPciInstance*)pv;
+  ui64 const timestamp = CDA_TIME_NS(); /* Before anything else */
   ui32 ulEvent, ulData;
   int isInterrupt;
   (void)irq;
 #if LINUX_VERSION_CODE < 0x20613   /* 2.6.19 */
   (void)regs;
 #endif
+  trace_phx_irq_enter( CDA_GetDeviceNum( pPci->pInst), irq);
+  CDA_DeviceMarker( pPci->pInst, 1);
 
-  #if PICC_DIO_ENABLE
-  if(CDA_GetDeviceNum(pPci->pInst) == PICC_SHK_DEVNUM) outb_p(0x01,PICC_DIO_BASE+PICC_DIO_PORTC); //SET DIO board PORTC bit C0
-  if(CDA_GetDeviceNum(pPci->pInst) == PICC_LYT_DEVNUM) outb_p(0x01,PICC_DIO_BASE+PICC_DIO_PORTB); //SET DIO board PORTB bit B0 
-  #endif
-  
   TRACE( 10, ( "%s(%d,%p)\n", __FUNCTION__, irq, pv));
   ASSERT( NULL != pPci);
-  ASSERT( irq == pPci->pDev->irq);
+  ASSERT( irq == pPci->iIrq);
   
   /* Check if IRQ is from the device */
   ASSERT( pPci->info.pfnIrqHandler);
@@ -705,13 +912,45 @@ static void PCI_IrqHandler( int const             irq,
   isInterrupt = (*pPci->info.pfnIrqHandler)( pPci->pvBase, &ulEvent, &ulData);
   /*This is the bottom of the top half.*/ 
 
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 30) )
+  if ( pPci->bIrqThreaded)
+    {
+    unsigned uHead = pPci->uIrqHead;
+
+    if ( !isInterrupt)
+      {
+      CDA_DeviceIrq( pPci->pInst, 0, 0);
+      trace_phx_irq_exit( CDA_GetDeviceNum( pPci->pInst), 0, 0, 0);
+      return IRQ_NONE;
+      }
+
+    /* Hand the status over, everything else is done in PCI_IrqThread */
+    if ( uHead - pPci->uIrqTail < PCI_IRQ_RING)
+      {
+      pPci->irqRing[ uHead & (PCI_IRQ_RING - 1)].event = ulEvent;
+      pPci->irqRing[ uHead & (PCI_IRQ_RING - 1)].data = ulData;
+      pPci->irqRing[ uHead & (PCI_IRQ_RING - 1)].timestamp = timestamp;
+      smp_wmb();
+      pPci->uIrqHead = uHead + 1;
+      }
+    else
+      {
+      ++pPci->ulIrqOverruns;
+      }
+    trace_phx_irq_exit( CDA_GetDeviceNum( pPci->pInst), 1, ulEvent, ulData);
+    return IRQ_WAKE_THREAD;
+    }
+#endif
+
+  CDA_DeviceIrq( pPci->pInst, isInterrupt, isInterrupt ? ulEvent : 0);
+
   if ( isInterrupt)
     {
     /* Signal an event */
     TRACE( 3, ("%s: PCI interrupt 0x%08X 0x%08X\n", __FUNCTION__, ulEvent, ulData));
-    CDA_DeviceEvent( pPci->pInst, ulEvent, ulData);
+    CDA_DeviceEventEx( pPci->pInst, ulEvent, ulData, timestamp);
     }
-  else
+  else if ( PCI_kIrqIntx == pPci->iIrqMode)
     {
     u8 pci_status = 0;
 
@@ -724,6 +963,8 @@ static void PCI_IrqHandler( int const             irq,
       TRACE( 1, ("*** %s: PCI status IRQ 0x%02x\n", __FUNCTION__, pci_status));
       }
     }
+  trace_phx_irq_exit( CDA_GetDeviceNum( pPci->pInst), isInterrupt,
+                      isInterrupt ? ulEvent : 0, isInterrupt ? ulData : 0);
   
 #if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 0) )
   return (IRQ_RETVAL(isInterrupt));
@@ -731,6 +972,44 @@ static void PCI_IrqHandler( int const             irq,
 }
 
 
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(2, 6, 30) )
+/*
+ * IRQ thread, queues the statuses captured by PCI_IrqHandler
+ */
+static irqreturn_t PCI_IrqThread( int const irq,
+                                  void*     pv )
+{
+  SPciInstance* const pPci = (SPciInstance*)pv;
+  unsigned uTail = pPci->uIrqTail;
+  (void)irq;
+
+  TRACE( 10, ( "%s(%d,%p)\n", __FUNCTION__, irq, pv));
+  ASSERT( NULL != pPci);
+
+  while ( uTail != pPci->uIrqHead)
+    {
+    ui32 ulEvent, ulData;
+    ui64 timestamp;
+
+    smp_rmb(); /* Pairs with smp_wmb in PCI_IrqHandler */
+    ulEvent = pPci->irqRing[ uTail & (PCI_IRQ_RING - 1)].event;
+    ulData = pPci->irqRing[ uTail & (PCI_IRQ_RING - 1)].data;
+    timestamp = pPci->irqRing[ uTail & (PCI_IRQ_RING - 1)].timestamp;
+
+    /* The slot may be refilled once the tail moves on */
+    smp_mb();
+    pPci->uIrqTail = ++uTail;
+
+    CDA_DeviceIrq( pPci->pInst, 1, ulEvent);
+    TRACE( 3, ("%s: PCI interrupt 0x%08X 0x%08X\n", __FUNCTION__, ulEvent, ulData));
+    CDA_DeviceEventEx( pPci->pInst, ulEvent, ulData, timestamp);
+    }
+
+  return IRQ_HANDLED;
+}
+#endif
+
+
 /*
  * Restore PCI config space
  */
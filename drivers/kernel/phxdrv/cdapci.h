@@ -87,6 +87,16 @@ typedef struct PCI_SDevInfo
 /* Functions */
 extern void CDA_PCI_Probe( PCI_SDevInfo const*);
 
+/* Interrupt delivery */
+enum
+  {
+  PCI_kIrqIntx = 0,                     /* Shared line interrupt */
+  PCI_kIrqMsi,
+  PCI_kIrqMsix
+  };
+
+#define PCI_IRQ_RING 64                 /* Hard IRQ to IRQ thread, power of 2 */
+
 #if LINUX_VERSION_CODE >= 0x20600
 /* PCI device instance */
 typedef struct SPciInstance
@@ -95,6 +105,10 @@ typedef struct SPciInstance
   struct pci_dev * pDev;
   PCI_SDevInfo info;                    /* Card info */
   int bIrqInstalled;
+  int iIrq;                             /* IRQ number in use */
+  int iIrqMode;                         /* PCI_kIrqIntx, _Msi or _Msix */
+  int bIrqThreaded;                     /* Events queued by PCI_IrqThread */
+  int bIrqAffinity;                     /* irq_cpu applied */
   u32 shadowConfig[ 64];                /* PCI config space snapshot */
 
   /* Registers */
@@ -102,6 +116,17 @@ typedef struct SPciInstance
   void* pvBase;                         /* Card virtal base address */
 
   CDA_SInstance* pInst;                 /* Context for CDA_DeviceEvent */
+
+  /* Status captured by the hard IRQ handler for the IRQ thread */
+  volatile unsigned uIrqHead;           /* Written only at IRQ time */
+  volatile unsigned uIrqTail;           /* Written only by the IRQ thread */
+  unsigned long ulIrqOverruns;          /* Statuses lost to a full ring */
+  struct
+    {
+    ui32 event;
+    ui32 data;
+    ui64 timestamp;
+    } irqRing[ PCI_IRQ_RING];
 } SPciInstance;
 #endif
 
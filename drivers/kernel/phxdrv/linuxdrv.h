@@ -99,6 +99,36 @@ typedef struct CDA_SIoctlEvent
   } CDA_SIoctlEvent;
 #define CDA_IOCTL_EVENT _IOR( CDA_IOCTL_CODE, 4, CDA_SIoctlEvent *)
 
+/* Events with the time the IRQ was taken and a per-device sequence number.
+ * seq advances once per raised event, so the next event has seq + count
+ * unless the queue overflowed and events were dropped */
+typedef struct CDA_SIoctlEventEx
+  {
+  u_int32_t event;              /* OUT: Device specific event ID */
+  u_int32_t data;               /* OUT: Event specific data */
+  u_int32_t seq;                /* OUT: Event sequence no., starts at 0 when loaded */
+  u_int32_t count;              /* OUT: Identical events coalesced into this one, normally 1 */
+  u_int64_t timestamp;          /* OUT: CLOCK_MONOTONIC ns at IRQ time */
+  } CDA_SIoctlEventEx;
+#define CDA_IOCTL_EVENT_EX _IOR( CDA_IOCTL_CODE, 9, CDA_SIoctlEventEx *)
+
+/* Drain up to maxEvents queued events in one call.
+ * minEvents = 0 returns at once with whatever is queued, otherwise the call
+ * waits until minEvents are queued or timeoutMs expires (0 = no timeout).
+ * The layout is the same for 32 and 64 bit callers */
+typedef struct CDA_SIoctlEventBatch
+  {
+  u_int32_t maxEvents;          /* IN: Capacity of the pEvents array */
+  u_int32_t minEvents;          /* IN: Events to wait for, clipped to the queue size */
+  u_int32_t timeoutMs;          /* IN: Max wait for minEvents, 0 = forever */
+  u_int32_t flags;              /* IN: CDA_EVENT_BATCH_... */
+  u_int32_t count;              /* OUT: No. events returned */
+  u_int32_t reserved;
+  u_int64_t pEvents;            /* IN: -> CDA_SIoctlEvent array, oldest first on return */
+  } CDA_SIoctlEventBatch;
+#define CDA_EVENT_BATCH_EX 0x1  /* pEvents -> CDA_SIoctlEventEx array */
+#define CDA_IOCTL_EVENT_BATCH _IOWR( CDA_IOCTL_CODE, 8, CDA_SIoctlEventBatch *)
+
 /* Restore PCI config registers to state when driver loaded */
 #define CDA_IOCTL_CONFIG_RESTORE _IOW( CDA_IOCTL_CODE, 5, void *)
 
@@ -112,6 +142,27 @@ typedef struct CDA_SIoctlEvent
 #define CDA_IOCTL_MEMORY_FLUSH_RISC _IOWR( CDA_IOCTL_CODE, 0xC, void *)
 #define CDA_IOCTL_MEMORY_FLUSH_DMA  _IOWR( CDA_IOCTL_CODE, 0xD, void *)
 
+/* Physically contiguous, DMA coherent buffers allocated by the driver, 3.6+.
+ * mmap offset to use one, then lock the mapping with CDA_IOCTL_MEMORY_LOCK
+ * as any other buffer: it is described by a few descriptors and nothing is
+ * pinned. A buffer is freed by _DMABUF_FREE once it is neither mapped nor
+ * locked, or when the device is closed.
+ * The layout is the same for 32 and 64 bit callers */
+typedef struct CDA_SIoctlDmaBuf
+  {
+  u_int64_t size;               /* IN: Bytes, rounded up to whole pages */
+  u_int64_t offset;             /* OUT: mmap offset of the buffer */
+  u_int64_t busAddr;            /* OUT: Bus address of the first byte */
+  u_int32_t id;                 /* OUT: Buffer handle, IN for _DMABUF_FREE */
+  u_int32_t flags;              /* IN: Reserved, 0 */
+  } CDA_SIoctlDmaBuf;
+#define CDA_IOCTL_DMABUF_ALLOC _IOWR( CDA_IOCTL_CODE, 0xE, CDA_SIoctlDmaBuf *)
+#define CDA_IOCTL_DMABUF_FREE  _IOW(  CDA_IOCTL_CODE, 0xF, CDA_SIoctlDmaBuf *)
+
+/* mmap offset of the register BAR, mapped read-only when the driver is
+ * loaded with bar_mmap=1 (3.6+) */
+#define CDA_MMAP_REGISTERS 0
+
 #ifdef __cplusplus
 }
 #endif
@@ -46,7 +46,11 @@
 #include <linux/ioport.h>
 #include <linux/list.h>
 #include <linux/pci.h>
+#if ( LINUX_VERSION_CODE >= KERNEL_VERSION(3, 0, 0) )
+#include <linux/uaccess.h>
+#else
 #include <asm/uaccess.h>
+#endif
 
 #include "linuxdrv.h"
 #include "cdadrv.h"
@@ -0,0 +1,217 @@
+/****************************************************************************
+ *
+ * File name   : phxdrv_trace.h
+ * Function    : Static tracepoints for the Linux CDA driver
+ *
+ ****************************************************************************
+ *
+ * Comments:
+ * --------
+ * Tracepoints in the "phxdrv" trace system, for the IRQ, event queue and
+ * buffer lock paths. They cost a patched-out branch until enabled, e.g.
+ *   trace-cmd record -e phxdrv
+ *   perf record -e 'phxdrv:*' -a
+ * cdadrv.c defines CREATE_TRACE_POINTS before including this file.
+ * Kernels before 2.6.32 get empty stubs.
+ *
+ ****************************************************************************
+ */
+
+#include <linux/version.h>
+
+/* phx_lock source */
+#ifndef PHX_TRACE_LOCK_PINNED
+#define PHX_TRACE_LOCK_PINNED 0         /* Pages pinned and mapped */
+#define PHX_TRACE_LOCK_CACHED 1         /* Served by the lock cache */
+#define PHX_TRACE_LOCK_DMABUF 2         /* Driver allocated buffer */
+
+/* phx_event_enqueue result */
+#define PHX_TRACE_EVENT_QUEUED    0
+#define PHX_TRACE_EVENT_COALESCED 1
+#define PHX_TRACE_EVENT_DROPPED   2
+#endif
+
+#if ( LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 32) )
+#ifndef _PHXDRV_TRACE_H
+#define _PHXDRV_TRACE_H
+#define trace_phx_irq_enter( ...)     do {} while (0)
+#define trace_phx_irq_exit( ...)      do {} while (0)
+#define trace_phx_event_enqueue( ...) do {} while (0)
+#define trace_phx_event_dequeue( ...) do {} while (0)
+#define trace_phx_wakeup( ...)        do {} while (0)
+#define trace_phx_lock( ...)          do {} while (0)
+#define trace_phx_unlock( ...)        do {} while (0)
+#endif
+
+#else
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM phxdrv
+
+#if !defined _PHXDRV_TRACE_H || defined TRACE_HEADER_MULTI_READ
+#define _PHXDRV_TRACE_H
+
+#include <linux/tracepoint.h>
+
+/* Hard IRQ handler entry */
+TRACE_EVENT( phx_irq_enter,
+  TP_PROTO( int dev, int irq),
+  TP_ARGS( dev, irq),
+  TP_STRUCT__entry(
+    __field( int, dev)
+    __field( int, irq)
+  ),
+  TP_fast_assign(
+    __entry->dev = dev;
+    __entry->irq = irq;
+  ),
+  TP_printk( "phx%d irq=%d", __entry->dev, __entry->irq)
+);
+
+/* Hard IRQ handler exit, handled 0 if the IRQ was raised by another device */
+TRACE_EVENT( phx_irq_exit,
+  TP_PROTO( int dev, int handled, u32 status, u32 data),
+  TP_ARGS( dev, handled, status, data),
+  TP_STRUCT__entry(
+    __field( int, dev)
+    __field( int, handled)
+    __field( u32, status)
+    __field( u32, data)
+  ),
+  TP_fast_assign(
+    __entry->dev = dev;
+    __entry->handled = handled;
+    __entry->status = status;
+    __entry->data = data;
+  ),
+  TP_printk( "phx%d handled=%d status=0x%08x data=0x%08x",
+    __entry->dev, __entry->handled, __entry->status, __entry->data)
+);
+
+/* Event raised, depth is the queue length afterwards */
+TRACE_EVENT( phx_event_enqueue,
+  TP_PROTO( int dev, u32 event, u32 data, u32 seq, unsigned depth, int result),
+  TP_ARGS( dev, event, data, seq, depth, result),
+  TP_STRUCT__entry(
+    __field( int, dev)
+    __field( u32, event)
+    __field( u32, data)
+    __field( u32, seq)
+    __field( unsigned, depth)
+    __field( int, result)
+  ),
+  TP_fast_assign(
+    __entry->dev = dev;
+    __entry->event = event;
+    __entry->data = data;
+    __entry->seq = seq;
+    __entry->depth = depth;
+    __entry->result = result;
+  ),
+  TP_printk( "phx%d event=0x%08x data=0x%08x seq=%u depth=%u %s",
+    __entry->dev, __entry->event, __entry->data, __entry->seq, __entry->depth,
+    __print_symbolic( __entry->result,
+      { PHX_TRACE_EVENT_QUEUED,    "queued" },
+      { PHX_TRACE_EVENT_COALESCED, "coalesced" },
+      { PHX_TRACE_EVENT_DROPPED,   "dropped" }))
+);
+
+/* Events taken by a reader, seq of the oldest, depth left behind */
+TRACE_EVENT( phx_event_dequeue,
+  TP_PROTO( int dev, unsigned count, u32 seq, unsigned depth),
+  TP_ARGS( dev, count, seq, depth),
+  TP_STRUCT__entry(
+    __field( int, dev)
+    __field( unsigned, count)
+    __field( u32, seq)
+    __field( unsigned, depth)
+  ),
+  TP_fast_assign(
+    __entry->dev = dev;
+    __entry->count = count;
+    __entry->seq = seq;
+    __entry->depth = depth;
+  ),
+  TP_printk( "phx%d count=%u seq=%u depth=%u",
+    __entry->dev, __entry->count, __entry->seq, __entry->depth)
+);
+
+/* Event waiters woken, waiters 0 if none was sleeping */
+TRACE_EVENT( phx_wakeup,
+  TP_PROTO( int dev, int waiters),
+  TP_ARGS( dev, waiters),
+  TP_STRUCT__entry(
+    __field( int, dev)
+    __field( int, waiters)
+  ),
+  TP_fast_assign(
+    __entry->dev = dev;
+    __entry->waiters = waiters;
+  ),
+  TP_printk( "phx%d waiters=%d", __entry->dev, __entry->waiters)
+);
+
+/* Buffer locked for DMA */
+TRACE_EVENT( phx_lock,
+  TP_PROTO( int dev, unsigned long buffer, size_t len, unsigned pages,
+            unsigned descriptors, int source),
+  TP_ARGS( dev, buffer, len, pages, descriptors, source),
+  TP_STRUCT__entry(
+    __field( int, dev)
+    __field( unsigned long, buffer)
+    __field( size_t, len)
+    __field( unsigned, pages)
+    __field( unsigned, descriptors)
+    __field( int, source)
+  ),
+  TP_fast_assign(
+    __entry->dev = dev;
+    __entry->buffer = buffer;
+    __entry->len = len;
+    __entry->pages = pages;
+    __entry->descriptors = descriptors;
+    __entry->source = source;
+  ),
+  TP_printk( "phx%d buffer=0x%lx len=%zu pages=%u descriptors=%u %s",
+    __entry->dev, __entry->buffer, __entry->len, __entry->pages,
+    __entry->descriptors,
+    __print_symbolic( __entry->source,
+      { PHX_TRACE_LOCK_PINNED, "pinned" },
+      { PHX_TRACE_LOCK_CACHED, "cached" },
+      { PHX_TRACE_LOCK_DMABUF, "dmabuf" }))
+);
+
+/* Buffer unlocked, cached 1 if it stays pinned & mapped in the lock cache */
+TRACE_EVENT( phx_unlock,
+  TP_PROTO( int dev, unsigned long buffer, size_t len, unsigned pages,
+            unsigned descriptors, int cached),
+  TP_ARGS( dev, buffer, len, pages, descriptors, cached),
+  TP_STRUCT__entry(
+    __field( int, dev)
+    __field( unsigned long, buffer)
+    __field( size_t, len)
+    __field( unsigned, pages)
+    __field( unsigned, descriptors)
+    __field( int, cached)
+  ),
+  TP_fast_assign(
+    __entry->dev = dev;
+    __entry->buffer = buffer;
+    __entry->len = len;
+    __entry->pages = pages;
+    __entry->descriptors = descriptors;
+    __entry->cached = cached;
+  ),
+  TP_printk( "phx%d buffer=0x%lx len=%zu pages=%u descriptors=%u cached=%d",
+    __entry->dev, __entry->buffer, __entry->len, __entry->pages,
+    __entry->descriptors, __entry->cached)
+);
+
+#endif /* _PHXDRV_TRACE_H */
+
+/* Outside the guard, define_trace.h reads this file again */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE phxdrv_trace
+#include <trace/define_trace.h>
+#endif
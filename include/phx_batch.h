@@ -0,0 +1,71 @@
+/*! \file phx_batch.h
+    \brief Batched frame completion for consumers that work on groups of
+    frames.
+    \details In batch mode the BUFFER_READY callback only time-stamps the
+    frame and counts it. A consumer thread is woken every dwBatch frames,
+    or dwTimeoutMs after it last ran, asks the board how many buffers are
+    ready (PHX_BUFFER_READY_COUNT) and gets, processes and releases them in
+    one go. Load the driver with event_batch to also cut the wakeups of the
+    Phoenix event thread to one per batch.*/
+
+#ifndef _BATCH
+#define _BATCH
+
+#include <pthread.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+/* Callback times kept for the consumer, must be a power of 2 and larger
+ * than any batch */
+#ifndef PHX_BATCH_RING
+#define PHX_BATCH_RING 64
+#endif
+
+#ifndef PHX_BATCH_DEFAULT
+#define PHX_BATCH_DEFAULT 8 /* Frames per batch for -abatch without -m */
+#endif
+
+#ifndef PHX_BATCH_TIMEOUT_MS
+#define PHX_BATCH_TIMEOUT_MS 10 /* Longest a ready frame waits for a drain */
+#endif
+
+/* Called by the consumer for each frame, before the buffer is released.
+ * pBuffer is NULL if PHX_BUFFER_GET failed. */
+typedef void (*PhxBatchFrameFn)(tHandle, stImageBuff *, ui32, ui64, void *);
+
+/*!	\typedef
+  \struct PhxBatch
+  \brief Consumer thread state.
+  \details dwPending and qwReady are written by the callback under lock, the
+  times in qwTimeNs are read by the consumer for frames it has been told
+  about.*/
+typedef struct
+{
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    tHandle hCamera;
+    ui32 dwBatch;                  /**< Frames per wakeup */
+    ui32 dwTimeoutMs;              /**< Drain at least this often */
+    PhxBatchFrameFn pfnFrame;
+    void *pvParams;                /**< Passed to pfnFrame */
+    int bRunning;                  /**< Thread started */
+    int bStop;
+    ui32 dwPending;                /**< Callbacks since the consumer woke */
+    ui32 dwMask;                   /**< Interrupt bits of those callbacks */
+    ui64 qwReady;                  /**< Callbacks in all */
+    ui64 qwDone;                   /**< Frames drained */
+    ui64 qwTimeNs[PHX_BATCH_RING]; /**< Callback CLOCK_MONOTONIC, by qwReady */
+
+    /* Statistics */
+    ui64 qwWakeups;
+    ui64 qwTimeouts;               /**< Wakeups with less than a batch */
+    ui32 dwMaxBatch;               /**< Most frames drained at once */
+} PhxBatch;
+
+etStat PhxBatch_Start(PhxBatch *, tHandle, ui32, ui32, PhxBatchFrameFn,
+                      void *);
+void PhxBatch_Ready(PhxBatch *, ui32);
+void PhxBatch_Stop(PhxBatch *);
+
+#endif /* _BATCH */
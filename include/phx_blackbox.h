@@ -0,0 +1,140 @@
+/*! \file phx_blackbox.h
+    \brief Black box recorder: the frames around an event, kept in RAM.
+    \details Every frame is copied with its metadata into a ring sized for
+    PHX_SYS_BLACKBOX_PRE_MS before and PHX_SYS_BLACKBOX_POST_MS after a
+    trigger, in hugepages if the kernel has them reserved. A trigger comes
+    from PhxBlackBox_Trigger (safe from a signal handler, main uses
+    SIGUSR1), a FIFO overflow or sync lost interrupt, or a rule on the
+    frame's stats (PHX_SYS_BLACKBOX_SATURATED, _MEAN_MIN, _MEAN_MAX). Once
+    the post-trigger frames are in, the ring freezes and a writer thread
+    flushes it to data/blackbox_<name>_<frame>.bin, oldest frame first:
+    a PhxBlackBoxHeader, dwFrames PhxBlackBoxMeta and then the frames.
+    Capture never stops, frames that arrive while the ring is frozen are
+    only not recorded. A trigger raised during a dump is kept and served
+    as soon as the ring records again.*/
+
+#ifndef _BLACKBOX
+#define _BLACKBOX
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#include "phx_proc.h"
+
+#ifndef PHX_BLACKBOX_MAX_MB
+#define PHX_BLACKBOX_MAX_MB 1024 /* Largest ring, PHX_SYS_BLACKBOX_MAX_MB */
+#endif
+
+#define PHX_BLACKBOX_MAGIC   0x42584850 /* "PHXB" */
+#define PHX_BLACKBOX_VERSION 1
+#define PHX_BLACKBOX_HUGE    (2 * 1024 * 1024) /* Hugepage size assumed */
+
+/*!	\typedef
+  \enum PhxBlackBoxReason
+  \brief What triggered a dump.*/
+typedef enum
+{
+    PHX_BLACKBOX_NONE = 0,
+    PHX_BLACKBOX_API,       /**< PhxBlackBox_Trigger from the application */
+    PHX_BLACKBOX_SIGNAL,    /**< SIGUSR1 */
+    PHX_BLACKBOX_EVENT,     /**< FIFO overflow or sync lost */
+    PHX_BLACKBOX_SATURATED, /**< More saturated pixels than allowed */
+    PHX_BLACKBOX_MEAN       /**< Mean outside its limits */
+} PhxBlackBoxReason;
+
+/*!	\typedef
+  \enum PhxBlackBoxState
+  \brief Ring state, only the frame path moves it out of RECORDING.*/
+typedef enum
+{
+    PHX_BLACKBOX_RECORDING = 0,
+    PHX_BLACKBOX_ARMED,     /**< Triggered, recording the post window */
+    PHX_BLACKBOX_FROZEN     /**< Full, being written out */
+} PhxBlackBoxState;
+
+/*!	\typedef
+  \struct PhxBlackBoxMeta
+  \brief Per-frame metadata, in the ring and in the file.*/
+typedef struct
+{
+    ui64 qwFrame;     /**< Frame number in the run */
+    ui64 qwTimeNs;    /**< CLOCK_MONOTONIC at delivery */
+    ui32 dwStatus;    /**< Interrupt mask of the frame */
+    ui32 dwMin;       /**< Stats, 0 if the stats stage is off */
+    ui32 dwMax;
+    ui32 dwSaturated;
+    double dMean;
+} PhxBlackBoxMeta;
+
+/*!	\typedef
+  \struct PhxBlackBoxHeader
+  \brief Start of a dump file.*/
+typedef struct
+{
+    ui32 dwMagic;          /**< PHX_BLACKBOX_MAGIC */
+    ui32 dwVersion;        /**< PHX_BLACKBOX_VERSION */
+    ui32 dwWidth;
+    ui32 dwHeight;
+    ui32 dwBits;
+    ui32 dwBytesPerPixel;
+    ui32 dwFrames;         /**< Frames in the file */
+    ui32 dwReason;         /**< PhxBlackBoxReason */
+    ui64 qwTriggerFrame;   /**< Frame the trigger was taken on */
+    ui64 qwTriggerTimeNs;
+} PhxBlackBoxHeader;
+
+/*!	\typedef
+  \struct PhxBlackBox
+  \brief Recorder configuration and state.*/
+typedef struct
+{
+    /* PHX_SYS_BLACKBOX_* */
+    ui32 dwPreMs;             /**< 0 = recorder off */
+    ui32 dwPostMs;
+    ui32 dwSaturated;         /**< 0 = no rule */
+    double dMeanMin;          /**< 0 = no rule */
+    double dMeanMax;          /**< 0 = no rule */
+    ui32 dwMaxMb;
+
+    int bEnabled;             /**< Ring allocated */
+    int bHuge;                /**< Ring is in hugepages */
+    ui8 *pbFrames;
+    PhxBlackBoxMeta *pMeta;
+    void *pvMap;
+    size_t lenMap;
+    size_t lenFrame;
+    ui32 dwSlots;
+    ui32 dwPost;              /**< Frames recorded after a trigger */
+    PhxImage geometry;
+    char szName[64];          /**< For the file names */
+
+    ui64 qwHead;              /**< Frames recorded */
+    ui64 qwStop;              /**< qwHead at which an armed ring freezes */
+    PhxBlackBoxState eState;
+    PhxBlackBoxReason ePending; /**< Set by PhxBlackBox_Trigger */
+    PhxBlackBoxReason eReason;
+    ui64 qwTriggerFrame;
+    ui64 qwTriggerTimeNs;
+
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int bRunning;
+    int bStop;
+
+    /* Statistics */
+    ui64 qwDumps;
+    ui64 qwSkipped;           /**< Frames not recorded while frozen */
+} PhxBlackBox;
+
+etStat PhxBlackBox_LoadFile(char *, PhxBlackBox *);
+etStat PhxBlackBox_Create(PhxBlackBox *, PhxImage *, ui32, char *);
+void PhxBlackBox_Frame(PhxBlackBox *, void *, ui64, ui64, ui32,
+                       PhxFrameStats *);
+void PhxBlackBox_Trigger(PhxBlackBox *, PhxBlackBoxReason);
+void PhxBlackBox_Flush(PhxBlackBox *);
+void PhxBlackBox_Destroy(PhxBlackBox *);
+
+#endif /* _BLACKBOX */
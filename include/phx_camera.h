@@ -0,0 +1,94 @@
+/*! \file phx_camera.h
+    \brief One camera: its board, config, buffers and frame pipeline.
+    \details Everything a board needs lives in its PhxCamera, so several
+    cameras (SHK and LYT) can capture concurrently from one process, each
+    with its own handle, config file, shared frame ring, callback context,
+    marker, batch or poll thread, black box, stream recovery and processing
+    stages. The name and board
+    come from PHX_SYS_CAMERA and PHX_SYS_BOARD in the [system] section and
+    default to the PICC wiring, SHK on the first board and LYT on the
+    second. Frame times of all cameras are CLOCK_MONOTONIC, and each camera
+    also keeps the epoch the supervisor started them at, so frames from the
+    two streams can be matched by time.*/
+
+#ifndef _CAMERA
+#define _CAMERA
+
+#include <stdint.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#include "phx_batch.h"
+#include "phx_blackbox.h"
+#include "phx_config.h"
+#include "phx_jitter.h"
+#include "phx_marker.h"
+#include "phx_poll.h"
+#include "phx_proc.h"
+#include "phx_recover.h"
+#include "phx_rt.h"
+#include "phx_run.h"
+#include "phx_server.h"
+#include "phx_shm.h"
+#include "phx_trigger.h"
+
+/*!	\typedef
+  \struct PhxCamera
+  \brief Per-camera state, also the Phoenix event context.*/
+typedef struct
+{
+    tHandle handle;
+    ui32 dwIndex;            /**< Position on the command line */
+    ui32 dwBoard;            /**< Board number, PHX_SYS_BOARD */
+    char szCamera[16];       /**< PHX_SYS_CAMERA, log and file prefix */
+    char name[64];           /**< szCamera and start time, for file names */
+    char *pszConfigFileName;
+    int bRun;                /**< run initialised */
+    int bRunning;            /**< Acquisition started */
+    ui64 qwEpochNs;          /**< CLOCK_MONOTONIC shared by all cameras */
+
+    uint16_t wid;
+    uint16_t hei;
+    uint16_t bits;
+    uint64_t frames;
+    char first_irq;
+    char saved;
+
+    PhxRun run;
+    PhxRt rt;
+    PhxMarker marker;
+    PhxShm frame_shm;
+    PhxServer frame_server;
+    PhxBatch frame_batch;
+    PhxPoll frame_poll;
+    PhxBlackBox blackbox;    /**< PHX_SYS_BLACKBOX_*, off without them */
+    PhxRecover recover;      /**< PHX_SYS_RECOVER*, on by default */
+    PhxShm *shm;             /**< &frame_shm once set up, else NULL */
+    PhxServer *server;       /**< &frame_server once started, else NULL */
+    PhxBatch *batch;         /**< &frame_batch in batch mode */
+    char poll;               /**< Poll mode, the callback leaves buffers */
+    PhxAcqMode eAcqMode;
+    PhxTriggerPath eTrigger;  /**< PHX_SYS_TRIGGER, used with -r */
+    PhxTrigger *trigger;      /**< Set while triggered, for the latency */
+    ui32 dwTriggerUs;         /**< -r, 0 = free running */
+    ui32 frmtime;             /**< Frame time set, us, reapplied on reset */
+
+    ui32 stages;
+    ui32 grid;
+    ui32 threshold;
+    uint64_t stats_frames;
+    double mean_sum;
+    PhxFrameStats stats;
+    PhxCentroids cent;
+    PhxJitter jitter;
+    PhxJitter latency;        /**< Trigger to frame delivery */
+} PhxCamera;
+
+void PhxCamera_Init(PhxCamera *);
+etStat PhxCamera_Open(PhxCamera *, PhxSettings *, ui32, ui64);
+etStat PhxCamera_Start(PhxCamera *, PhxSettings *);
+void PhxCamera_Stop(PhxCamera *);
+void PhxCamera_Report(PhxCamera *);
+void PhxCamera_Close(PhxCamera *);
+
+#endif /* _CAMERA */
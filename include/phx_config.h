@@ -3,17 +3,32 @@
 
 #include "phx_cheetah.h"
 #include <phx_api.h>
+#include <stdio.h>
 
 #define PHX_MAX_FILE_LENGTH 128
 #define PHX_CONFIG_MAX_LINE 255
+
+#ifndef PHX_MAX_CAMERAS
+#define PHX_MAX_CAMERAS 2 /* Boards captured from at once, SHK and LYT */
+#endif
+
+/* How frames get from the board to the processing stages, -a */
+typedef enum
+{
+    PHX_ACQ_IRQ = 0, /* Per-frame BUFFER_READY callback */
+    PHX_ACQ_BATCH,   /* Consumer thread woken every -m frames, phx_batch.h */
+    PHX_ACQ_POLL     /* Busy-poll thread on CPU -q, phx_poll.h */
+} PhxAcqMode;
+
 typedef struct
 {
     ui32 dwBoardNumber;
     etParamValue eBoardNumber;
     etCamConfigLoad eCamConfigLoad;
-    char bConfigFileName[PHX_MAX_FILE_LENGTH];
+    char bConfigFileName[PHX_MAX_CAMERAS][PHX_MAX_FILE_LENGTH];
     char bOutputFileName[PHX_MAX_FILE_LENGTH];
-    char *pszConfigFileName;
+    char *pszConfigFileName[PHX_MAX_CAMERAS]; /* One per camera */
+    ui32 dwCameras;
     char *pszOutputFileName;
     ui32 dwBayerOption;
     ui32 dwGridSize;
@@ -24,14 +39,22 @@ typedef struct
     ui32 dwTimeOption;
     ui32 dwSlowOption;
     ui32 dwServerPort;
+    ui32 dwStageMask;
+    ui32 dwBatchOption;
+    PhxAcqMode eAcqMode;
+    int nPollCpu;
+    ui32 dwTriggerUs; /* Trigger period, 0 = free running */
 } PhxSettings;
 
 #define DEFAULT_CFG_FILENAME                                                   \
-    "Imperx_Cheetah_0620CL-8bit-1tap.pcf" /* Application constants */
+    "config/shk_1bin_2tap_8bit.cfg" /* Application constants */
 
 etStat PhxConfig_ParseCmdLine(int, char *[], PhxSettings *);
 
+const char *PhxConfig_AcqModeName(PhxAcqMode);
+etStat PhxConfig_BoardParam(ui32, etParamValue *);
 int PhxConfig_str_to_region(char *, CheetahRoi *);
 etStat PhxConfig_RunFile(tHandle, char *);
+etStat PhxConfig_RunStream(tHandle, FILE *);
 
 #endif /* _CONFIG */
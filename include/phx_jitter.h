@@ -0,0 +1,29 @@
+/*! \file phx_jitter.h
+    \brief Frame delivery jitter, the spread of the interval between frames
+    reaching the processing stages, or of any other time fed to
+    PhxJitter_Sample, such as trigger-to-frame latency.*/
+
+#ifndef _JITTER
+#define _JITTER
+
+#include <phx_api.h> /* Main Phoenix library */
+
+/*!	\typedef
+  \struct PhxJitter
+  \brief Running statistics of the delivery interval or sample, in ns.*/
+typedef struct
+{
+    ui64 qwLast;   /**< Previous delivery, CLOCK_MONOTONIC */
+    ui64 qwCount;  /**< Intervals or samples seen */
+    ui64 qwMin;
+    ui64 qwMax;
+    double dMean;  /**< Welford running mean and sum of squares */
+    double dM2;
+} PhxJitter;
+
+void PhxJitter_Init(PhxJitter *);
+void PhxJitter_Add(PhxJitter *, ui64);
+void PhxJitter_Sample(PhxJitter *, ui64);
+void PhxJitter_Report(PhxJitter *, const char *);
+
+#endif /* _JITTER */
@@ -0,0 +1,92 @@
+/*! \file phx_log.h
+    \brief Low-overhead logging for the acquisition and control paths.
+    \details Producers copy the format pointer and arguments into a fixed-size
+    record in a per-thread lock-free ring; a background thread formats and
+    prints the records. Nothing in PhxLog_Write blocks, allocates (after the
+    first call in a thread) or touches stdio. When a ring is full the record
+    is dropped and counted.*/
+
+#ifndef _LOG
+#define _LOG
+
+#include <pthread.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#define PHX_LOG_LEVEL_ERROR 0
+#define PHX_LOG_LEVEL_WARN  1
+#define PHX_LOG_LEVEL_INFO  2
+#define PHX_LOG_LEVEL_DEBUG 3
+
+/* Records above this level are compiled out */
+#ifndef PHX_LOG_LEVEL
+#define PHX_LOG_LEVEL PHX_LOG_LEVEL_INFO
+#endif
+
+/* Default minimum interval between records from one rate-limited call site */
+#ifndef PHX_LOG_RATE_MS
+#define PHX_LOG_RATE_MS 1000
+#endif
+
+/* Records per thread ring, must be a power of 2 */
+#ifndef PHX_LOG_RING
+#define PHX_LOG_RING 256
+#endif
+
+#define PHX_LOG_MAX_ARGS  8  /* Arguments captured per record */
+#define PHX_LOG_STR_BYTES 64 /* Bytes for copies of %s arguments */
+
+/*!	\typedef
+  \struct PhxLogRecord
+  \brief One log call. The format string must have static storage.*/
+typedef struct
+{
+    ui64 qwTime;        /**< CLOCK_MONOTONIC in ns */
+    const char *pszFmt; /**< printf format */
+    ui32 dwLevel;       /**< PHX_LOG_LEVEL_* */
+    ui32 dwArgs;        /**< Arguments captured */
+    union
+    {
+        ui64 q;
+        double d;
+    } args[PHX_LOG_MAX_ARGS];     /**< %s stores an offset into str */
+    char str[PHX_LOG_STR_BYTES]; /**< Inline copies of %s arguments */
+} PhxLogRecord;
+
+etStat PhxLog_Start(void);
+void PhxLog_Stop(void);
+ui64 PhxLog_Now(void);
+ui64 PhxLog_Dropped(void);
+int PhxLog_Writer(pthread_t *);
+void PhxLog_Write(ui32, const char *, ...)
+    __attribute__((format(printf, 2, 3)));
+
+#define PHX_LOG(level, ...)                                                    \
+    do                                                                         \
+    {                                                                          \
+        if ((level) <= PHX_LOG_LEVEL)                                          \
+            PhxLog_Write((level), __VA_ARGS__);                                \
+    } while (0)
+
+/* Log at most once per ms milliseconds from this call site */
+#define PHX_LOG_RATE(level, ms, ...)                                           \
+    do                                                                         \
+    {                                                                          \
+        static ui64 _qwLast;                                                   \
+        if ((level) <= PHX_LOG_LEVEL)                                          \
+        {                                                                      \
+            ui64 _qwNow = PhxLog_Now();                                        \
+            if (_qwNow - _qwLast >= (ui64)(ms)*1000000ull || !_qwLast)         \
+            {                                                                  \
+                _qwLast = _qwNow;                                              \
+                PhxLog_Write((level), __VA_ARGS__);                            \
+            }                                                                  \
+        }                                                                      \
+    } while (0)
+
+#define PHX_LOG_ERROR(...) PHX_LOG(PHX_LOG_LEVEL_ERROR, __VA_ARGS__)
+#define PHX_LOG_WARN(...)  PHX_LOG(PHX_LOG_LEVEL_WARN, __VA_ARGS__)
+#define PHX_LOG_INFO(...)  PHX_LOG(PHX_LOG_LEVEL_INFO, __VA_ARGS__)
+#define PHX_LOG_DEBUG(...) PHX_LOG(PHX_LOG_LEVEL_DEBUG, __VA_ARGS__)
+
+#endif /* _LOG */
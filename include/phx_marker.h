@@ -0,0 +1,75 @@
+/*! \file phx_marker.h
+    \brief Frame timing marker for external scope measurements.
+    \details The frame callback drives the marker high on even frames and low
+    on odd ones. It can be a DIO board port bit (x86, built with
+    PICC_DIO_ENABLE), a bit of a memory-mapped GPIO register, or a ring of
+    timestamps written to a file when the marker is closed. The mode and
+    target come from PHX_SYS_MARKER* keys in the [system] section; without
+    them the marker is off and PhxMarker_Set costs a single compare.*/
+
+#ifndef _MARKER
+#define _MARKER
+
+#include <stddef.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#include "picc_dio.h"
+
+/* Timestamps kept in ring mode, must be a power of 2 */
+#ifndef PHX_MARKER_ENTRIES
+#define PHX_MARKER_ENTRIES 4096
+#endif
+
+/*!	\typedef
+  \enum PhxMarkerMode
+  \brief Where the marker goes, PHX_SYS_MARKER.*/
+typedef enum
+{
+    PHX_MARKER_OFF = 0,
+    PHX_MARKER_DIO,  /**< DIO board port, PHX_SYS_MARKER_DIO base */
+    PHX_MARKER_GPIO, /**< GPIO register through /dev/mem, PHX_SYS_MARKER_GPIO */
+    PHX_MARKER_RING  /**< Timestamp ring, no hardware */
+} PhxMarkerMode;
+
+/*!	\typedef
+  \struct PhxMarkerEntry
+  \brief One ring entry.*/
+typedef struct
+{
+    ui64 qwTimeNs; /**< CLOCK_MONOTONIC when driven */
+    ui32 dwOn;
+} PhxMarkerEntry;
+
+/*!	\typedef
+  \struct PhxMarker
+  \brief Marker configuration and state.*/
+typedef struct
+{
+    PhxMarkerMode eMode;
+    ui32 dwDioBase;           /**< DIO board I/O base */
+    ui32 dwDioPort;           /**< Port offset from dwDioBase */
+    ui64 qwGpioAddr;          /**< Physical address of the GPIO register */
+    ui32 dwBit;               /**< Port or register bit driven */
+    volatile ui32 *pdwGpio;   /**< Mapped GPIO register */
+    void *pvMap;              /**< Page mapping pdwGpio lies in */
+    size_t lenMap;
+    PhxMarkerEntry *pRing;    /**< PHX_MARKER_ENTRIES in ring mode */
+    ui64 qwHead;              /**< Ring entries written */
+    char szRingFile[128];     /**< Ring written here on close, "" = log only */
+} PhxMarker;
+
+etStat PhxMarker_LoadFile(char *, PhxMarker *);
+etStat PhxMarker_Open(PhxMarker *);
+void PhxMarker_Drive(PhxMarker *, int);
+void PhxMarker_Close(PhxMarker *);
+
+/* Drive the marker, nothing but the mode check when it is off */
+#define PhxMarker_Set(_pMarker, _on)                                           \
+    do                                                                         \
+    {                                                                          \
+        if (PHX_MARKER_OFF != (_pMarker)->eMode)                               \
+            PhxMarker_Drive((_pMarker), (_on));                                \
+    } while (0)
+
+#endif /* _MARKER */
@@ -0,0 +1,67 @@
+/*! \file phx_model.h
+    \brief Predictive throughput model for a parsed camera configuration.*/
+
+#ifndef _MODEL
+#define _MODEL
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#include "phx_cheetah.h"
+
+/* Capacity assumptions used by the model. Override with -D at build time to
+ * match the flight hardware. */
+#ifndef PHX_MODEL_CL_CLOCK_HZ
+#define PHX_MODEL_CL_CLOCK_HZ 85.0e6 /* Camera Link pixel clock, per tap */
+#endif
+
+#ifndef PHX_MODEL_DMA_BPS
+#define PHX_MODEL_DMA_BPS 200.0e6 /* Sustained PCIe DMA, bytes/s (x1) */
+#endif
+
+#ifndef PHX_MODEL_DISK_BPS
+#define PHX_MODEL_DISK_BPS 40.0e6 /* Sustained recorder writes, bytes/s */
+#endif
+
+#ifndef PHX_MODEL_CALLBACK_US
+#define PHX_MODEL_CALLBACK_US 25.0 /* IRQ to callback dispatch, per frame */
+#endif
+
+#ifndef PHX_MODEL_PROC_NS_PER_PIXEL
+#define PHX_MODEL_PROC_NS_PER_PIXEL 1.0 /* One processing stage, per pixel */
+#endif
+
+/*!	\typedef
+  \struct PhxModel
+  \brief Inputs and results of the throughput model.
+  \details Inputs are filled by PhxModel_LoadFile and may be overridden by the
+  caller (e.g. with the frame time read back from the camera) before
+  PhxModel_Compute fills in the results.*/
+typedef struct
+{
+    /* Inputs */
+    CheetahRoi roi;          /**< PHX_CHEETAH_ROI */
+    ui32 dwBitDepth;         /**< PHX_CHEETAH_BIT_DEPTH in bits */
+    ui32 dwTaps;             /**< PHX_CHEETAH_TAPS */
+    ui32 dwFrameTimeUs;      /**< CHEETAH_PRG_FRMTIME, 0 = free running */
+    etParamValue eDstFormat; /**< PHX_DST_FORMAT_* */
+    ui64 qwRecordBytes;      /**< Black box dump size, 0 = no recorder */
+    ui32 dwRecordMs;         /**< Longest a dump may take to write */
+    ui32 dwProcStages;       /**< Per-pixel processing stages enabled */
+
+    /* Results */
+    ui32 dwBytesPerPixel;    /**< Destination bytes per pixel */
+    ui64 qwBytesPerFrame;    /**< Destination bytes per frame */
+    double dLinkFrameRate;   /**< Max frames/s the Camera Link can carry */
+    double dFrameRate;       /**< Expected frames/s */
+    double dFramePeriodUs;   /**< Wall time available per frame */
+    double dDmaBandwidth;    /**< PCIe DMA bytes/s */
+    double dDiskBandwidth;   /**< Recorder bytes/s to meet dwRecordMs */
+    double dCallbackUs;      /**< Callback dispatch cost per frame */
+    double dProcUs;          /**< Processing cost per frame */
+} PhxModel;
+
+etStat PhxModel_LoadFile(char *, PhxModel *);
+void PhxModel_Compute(PhxModel *);
+int PhxModel_Report(PhxModel *);
+
+#endif /* _MODEL */
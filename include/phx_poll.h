@@ -0,0 +1,46 @@
+/*! \file phx_poll.h
+    \brief Busy-poll acquisition, for the lowest and steadiest frame latency.
+    \details A thread pinned to one CPU, ideally isolated with isolcpus= or
+    a cpuset, spins on PHX_BUFFER_READY_COUNT at SCHED_FIFO priority and
+    gets, processes and releases each frame as soon as the board reports
+    it. Frame delivery then depends on neither the interrupt wakeup nor the
+    Phoenix callback thread, at the price of one CPU kept fully busy. The
+    BUFFER_READY callback must leave the buffers alone in this mode.*/
+
+#ifndef _POLL
+#define _POLL
+
+#include <pthread.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#include "phx_batch.h"
+
+#ifndef PHX_POLL_PRIORITY
+#define PHX_POLL_PRIORITY 80 /* SCHED_FIFO priority of the poll thread */
+#endif
+
+/*!	\typedef
+  \struct PhxPoll
+  \brief Poll thread state.*/
+typedef struct
+{
+    pthread_t thread;
+    tHandle hCamera;
+    int nCpu;                 /**< CPU the thread is pinned to, -1 = none */
+    int nPriority;            /**< SCHED_FIFO priority, 0 = SCHED_OTHER */
+    PhxBatchFrameFn pfnFrame; /**< Called for every frame */
+    void *pvParams;           /**< Passed to pfnFrame */
+    int bRunning;             /**< Thread started */
+    int bStop;
+
+    /* Statistics, written by the poll thread only */
+    ui64 qwPolls;             /**< PHX_BUFFER_READY_COUNT queries */
+    ui64 qwFrames;
+    ui32 dwMaxReady;          /**< Most frames ready at once */
+} PhxPoll;
+
+etStat PhxPoll_Start(PhxPoll *, tHandle, int, int, PhxBatchFrameFn, void *);
+void PhxPoll_Stop(PhxPoll *);
+
+#endif /* _POLL */
@@ -0,0 +1,59 @@
+/*! \file phx_proc.h
+    \brief Per-frame processing stages run from the acquisition callback.*/
+
+#ifndef _PROC
+#define _PROC
+
+#include <phx_api.h> /* Main Phoenix library */
+
+/* Processing stages, selected with -e<stages> / -x<stages> */
+#define PHX_STAGE_STATS    0x00000001 /* min/max/mean/saturated pixels */
+#define PHX_STAGE_CENT     0x00000002 /* centroid per grid cell */
+#define PHX_STAGE_BMP      0x00000004 /* save the first frame as BMP */
+#define PHX_STAGE_ALL      0x00000007
+#define PHX_STAGE_DEFAULT  PHX_STAGE_BMP
+
+#define PHX_PROC_MAX_CELLS 4096
+
+/*!	\typedef
+  \struct PhxImage
+  \brief A frame as delivered in a destination buffer.*/
+typedef struct
+{
+    void *pvData;         /**< First pixel */
+    ui32 dwWidth;         /**< Pixels per line */
+    ui32 dwHeight;        /**< Lines */
+    ui32 dwBytesPerPixel; /**< 1 (Y8) or 2 (Y10/Y12) */
+    ui32 dwBits;          /**< Significant bits per pixel */
+} PhxImage;
+
+/*!	\typedef
+  \struct PhxFrameStats
+  \brief Output of the stats stage.*/
+typedef struct
+{
+    ui32 dwMin;       /**< Minimum pixel value */
+    ui32 dwMax;       /**< Maximum pixel value */
+    double dMean;     /**< Mean pixel value */
+    ui32 dwSaturated; /**< Pixels at full scale */
+} PhxFrameStats;
+
+/*!	\typedef
+  \struct PhxCentroids
+  \brief Output of the centroid stage, one entry per grid cell in row order.*/
+typedef struct
+{
+    ui32 dwCellsX;                 /**< Cells per row */
+    ui32 dwCellsY;                 /**< Cell rows */
+    ui32 dwValid;                  /**< Cells with signal above threshold */
+    float fX[PHX_PROC_MAX_CELLS];  /**< x in pixels, -1 if no signal */
+    float fY[PHX_PROC_MAX_CELLS];  /**< y in pixels, -1 if no signal */
+} PhxCentroids;
+
+void PhxProc_Stats(PhxImage *, PhxFrameStats *);
+void PhxProc_Centroids(PhxImage *, ui32, ui32, PhxCentroids *);
+int PhxProc_SaveBmp(PhxImage *, char *);
+
+int PhxProc_str_to_stages(char *, ui32 *);
+
+#endif /* _PROC */
@@ -0,0 +1,124 @@
+/*! \file phx_recover.h
+    \brief Stream recovery after sync loss, capture timeouts and FIFO
+    overflows.
+    \details The event callback only flags a fault with PhxRecover_Fault.
+    A recovery thread then escalates until a frame comes through again:
+    PHX_BUFFER_ABORT of the frame in flight, then a PHX_STOP and PHX_START
+    of the stream, then a Cheetah soft reset with the config reapplied
+    from the copy cached at PhxRecover_LoadFile, so a file edited since
+    start is not picked up. The reset is retried PHX_SYS_RECOVER_RETRIES
+    times before the run is stopped. A fault within the wait of the last
+    recovery starts one step higher. The thread also treats a stream
+    without frames for PHX_SYS_RECOVER_STALL_MS as a timeout, whether or
+    not the board raised one.
+
+    Time to recover runs from the fault to the first frame delivered after
+    it. The shared ring, server, batch or poll thread and black box are
+    left running throughout, and frame numbers carry on. PHX_SYS_RECOVER
+    = 0 turns it all off.*/
+
+#ifndef _RECOVER
+#define _RECOVER
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#include "phx_jitter.h"
+
+/* Interrupts that start a recovery */
+#define PHX_RECOVER_FAULTS                                                     \
+    (PHX_INTRPT_SYNC_LOST | PHX_INTRPT_TIMEOUT | PHX_INTRPT_FIFO_OVERFLOW)
+
+#ifndef PHX_RECOVER_WAIT_MS
+#define PHX_RECOVER_WAIT_MS 200 /* For a frame after each step */
+#endif
+
+#ifndef PHX_RECOVER_STALL_MS
+#define PHX_RECOVER_STALL_MS 1000 /* Without frames counts as a timeout */
+#endif
+
+#ifndef PHX_RECOVER_RETRIES
+#define PHX_RECOVER_RETRIES 3 /* Resets before giving up */
+#endif
+
+#ifndef PHX_RECOVER_RESET_MS
+#define PHX_RECOVER_RESET_MS 2000 /* Camera boot after a soft reset */
+#endif
+
+/*!	\typedef
+  \enum PhxRecoverStep
+  \brief Recovery steps, in escalation order.*/
+typedef enum
+{
+    PHX_RECOVER_NONE = 0,
+    PHX_RECOVER_ABORT,   /**< PHX_BUFFER_ABORT, capture carries on */
+    PHX_RECOVER_RESTART, /**< PHX_STOP and PHX_START */
+    PHX_RECOVER_RESET,   /**< Soft reset, config reapplied, PHX_START */
+    PHX_RECOVER_FAILED,  /**< Given up, stop the run */
+    PHX_RECOVER_STEPS
+} PhxRecoverStep;
+
+/* Carries out one step, called from the recovery thread */
+typedef etStat (*PhxRecoverFn)(PhxRecoverStep, void *);
+
+/*!	\typedef
+  \struct PhxRecover
+  \brief Recovery configuration and state.
+  \details dwFaults and qwFaultNs are set by the event callback under lock,
+  qwFrames and qwFirstNs by the frame path with atomic builtins, so the
+  frame path never takes the lock.*/
+typedef struct
+{
+    /* PHX_SYS_RECOVER* */
+    int bEnabled;
+    ui32 dwWaitMs;
+    ui32 dwStallMs;           /**< 0 = no stall check */
+    ui32 dwRetries;
+    char *pszConfig;          /**< Config file as read at start */
+    size_t lenConfig;
+    char *pszName;            /**< Log prefix */
+
+    PhxRecoverFn pfnStep;
+    void *pvParams;           /**< Passed to pfnStep */
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int bRunning;
+    int bStop;
+
+    ui32 dwFaults;            /**< Interrupt bits not handled yet */
+    ui64 qwFaultNs;           /**< CLOCK_MONOTONIC of the first of them */
+    ui64 qwFrames;            /**< Frames delivered */
+    ui64 qwFirstNs;           /**< First frame since armed, 0 = none yet */
+    ui64 qwRecoveredNs;       /**< End of the last recovery */
+    PhxRecoverStep eLast;     /**< Step that last recovered */
+
+    /* Statistics */
+    ui64 qwIncidents;
+    ui64 qwSteps[PHX_RECOVER_STEPS]; /**< Times each step was taken */
+    PhxJitter ttr;            /**< Time to recover */
+} PhxRecover;
+
+etStat PhxRecover_LoadFile(char *, PhxRecover *);
+etStat PhxRecover_Subscribe(tHandle);
+etStat PhxRecover_Reapply(PhxRecover *, tHandle);
+etStat PhxRecover_Start(PhxRecover *, char *, ui32, PhxRecoverFn, void *);
+void PhxRecover_Fault(PhxRecover *, ui32);
+void PhxRecover_Stop(PhxRecover *);
+void PhxRecover_Destroy(PhxRecover *);
+
+/* Count a delivered frame, from the frame path */
+#define PhxRecover_Frame(_pRec, _qwTimeNs)                                     \
+    do                                                                         \
+    {                                                                          \
+        ui64 _qwNone = 0;                                                      \
+        __atomic_add_fetch(&(_pRec)->qwFrames, 1, __ATOMIC_RELAXED);           \
+        if (!__atomic_load_n(&(_pRec)->qwFirstNs, __ATOMIC_RELAXED))           \
+            __atomic_compare_exchange_n(&(_pRec)->qwFirstNs, &_qwNone,         \
+                                        (_qwTimeNs), 0, __ATOMIC_RELEASE,      \
+                                        __ATOMIC_RELAXED);                     \
+    } while (0)
+
+#endif /* _RECOVER */
@@ -0,0 +1,88 @@
+/*! \file phx_rt.h
+    \brief Real-time setup of the pipeline threads and memory.
+    \details Each pipeline thread class gets a CPU set, a scheduling policy
+    and a priority from PHX_SYS_RT_* keys in the [system] section, e.g.
+
+        PHX_SYS_RT_LOCK               = 1
+        PHX_SYS_RT_CALLBACK_CPUS      = 2
+        PHX_SYS_RT_CALLBACK_POLICY    = SCHED_FIFO
+        PHX_SYS_RT_CALLBACK_PRIORITY  = 80
+        PHX_SYS_RT_PROC_CPUS          = 3
+        PHX_SYS_RT_TELEMETRY_CPUS     = 0-1
+
+    Classes without keys are left alone. The PROC settings win over -q:
+    PHX_SYS_RT_PROC_CPUS replaces the per-camera CPU (-q plus the camera
+    index) that PhxCamera_Start pins each poll thread to, so cameras that
+    share a config busy-poll on the same CPU set. Leave it out, or give
+    each camera its own config, to keep one poll CPU per camera.
+
+    PHX_SYS_RT_LOCK locks all present and future memory with mlockall, so
+    the frame path does not page fault once the buffers have been
+    prefaulted. Every setting is read back after it is applied and logged,
+    with a warning if the kernel did not take it (usually missing
+    CAP_SYS_NICE or CAP_IPC_LOCK).*/
+
+#ifndef _RT
+#define _RT
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#ifndef PHX_RT_PRIORITY
+#define PHX_RT_PRIORITY 50 /* For SCHED_FIFO and SCHED_RR without a priority */
+#endif
+
+#ifndef PHX_RT_STACK
+#define PHX_RT_STACK (256 * 1024) /* Stack prefaulted by PhxRt_ApplySelf */
+#endif
+
+#define PHX_RT_MAX_CPUS 64 /* CPUs a CPU set can name */
+
+/*!	\typedef
+  \enum PhxRtThread
+  \brief Pipeline thread classes.*/
+typedef enum
+{
+    PHX_RT_CALLBACK = 0, /**< Phoenix event thread running image_cb */
+    PHX_RT_PROC,         /**< Batch or poll thread, unused in irq mode */
+    PHX_RT_WRITER,       /**< Log writer */
+    PHX_RT_TELEMETRY,    /**< Monitoring server */
+    PHX_RT_TRIGGER,      /**< Trigger timer, -r */
+    PHX_RT_RECOVER,      /**< Stream recovery */
+    PHX_RT_THREADS
+} PhxRtThread;
+
+/*!	\typedef
+  \struct PhxRtSched
+  \brief Settings of one thread class.*/
+typedef struct
+{
+    ui64 qwCpus;   /**< CPU mask, 0 = leave the affinity alone */
+    int bPolicy;   /**< nPolicy and nPriority were given */
+    int nPolicy;   /**< SCHED_OTHER, SCHED_FIFO or SCHED_RR */
+    int nPriority;
+} PhxRtSched;
+
+/*!	\typedef
+  \struct PhxRt
+  \brief Real-time settings and page fault accounting.*/
+typedef struct
+{
+    int bLock;                          /**< PHX_SYS_RT_LOCK */
+    int bLocked;                        /**< mlockall succeeded */
+    PhxRtSched threads[PHX_RT_THREADS];
+    long lMinFlt;                       /**< Faults at PhxRt_FaultsStart */
+    long lMajFlt;
+} PhxRt;
+
+etStat PhxRt_LoadFile(char *, PhxRt *);
+etStat PhxRt_Lock(PhxRt *);
+void PhxRt_Prefault(void *, size_t);
+etStat PhxRt_Apply(PhxRt *, PhxRtThread, pthread_t);
+etStat PhxRt_ApplySelf(PhxRt *, PhxRtThread);
+void PhxRt_FaultsStart(PhxRt *);
+void PhxRt_FaultsReport(PhxRt *);
+
+#endif /* _RT */
@@ -0,0 +1,49 @@
+/*! \file phx_run.h
+    \brief Run controller: stop acquisition after a frame count or duration.*/
+
+#ifndef _RUN
+#define _RUN
+
+#include <pthread.h>
+#include <time.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+/*!	\typedef
+  \enum PhxRunStop
+  \brief Why PhxRun_Wait returned.*/
+typedef enum
+{
+    PHX_RUN_FRAMES = 1, /**< Frame limit reached */
+    PHX_RUN_TIMEOUT,    /**< Duration elapsed */
+    PHX_RUN_STOPPED     /**< PhxRun_Stop called */
+} PhxRunStop;
+
+/*!	\typedef
+  \struct PhxRun
+  \brief State shared between the frame path and the waiting thread.
+  \details qwFrames is only touched with atomic builtins so the frame path
+  never takes the mutex, except once to signal the frame limit.*/
+typedef struct
+{
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    ui64 qwFrames;          /**< Frames accepted so far */
+    ui64 qwFrameLimit;      /**< 0 = no frame limit */
+    ui32 dwSeconds;         /**< 0 = no time limit */
+    struct timespec tStart; /**< CLOCK_MONOTONIC at PhxRun_Start */
+    struct timespec tStop;  /**< CLOCK_MONOTONIC when the run ended */
+    PhxRunStop eStop;       /**< 0 while running */
+    int bRequested;         /**< PhxRun_Request called */
+} PhxRun;
+
+etStat PhxRun_Init(PhxRun *, ui32, ui32);
+void PhxRun_Start(PhxRun *);
+ui64 PhxRun_Frame(PhxRun *);
+void PhxRun_Stop(PhxRun *);
+void PhxRun_Request(PhxRun *);
+PhxRunStop PhxRun_Wait(PhxRun *);
+double PhxRun_Elapsed(PhxRun *);
+void PhxRun_Destroy(PhxRun *);
+
+#endif /* _RUN */
@@ -0,0 +1,112 @@
+/*! \file phx_server.h
+    \brief TCP frame and telemetry streaming server for live monitoring.
+    \details A single epoll thread serves every client. The frame path only
+    posts a small event into a lock-free ring and pokes an eventfd, so no
+    client can hold up acquisition. Clients send one subscription word per
+    line ("raw", "quick", "cent", "stats", prefixed with '-' to unsubscribe)
+    and receive PhxServerMsg records, each followed by its payload and a
+    32-bit trailer equal to dwSeq when the payload was sent intact.*/
+
+#ifndef _SERVER
+#define _SERVER
+
+#include <pthread.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#include "phx_proc.h"
+#include "phx_shm.h"
+
+#ifndef PHX_SERVER_ADDR
+#define PHX_SERVER_ADDR "127.0.0.1" /* Listen address */
+#endif
+
+#ifndef PHX_SERVER_CLIENTS
+#define PHX_SERVER_CLIENTS 8 /* Simultaneous clients */
+#endif
+
+#ifndef PHX_SERVER_QUEUE
+#define PHX_SERVER_QUEUE 8 /* Messages queued per client before dropping */
+#endif
+
+#ifndef PHX_SERVER_QUICK_BIN
+#define PHX_SERVER_QUICK_BIN 4 /* Quicklook binning in x and y */
+#endif
+
+#define PHX_SERVER_EVENTS 32 /* Frame path to server ring, power of 2 */
+#define PHX_SERVER_POOL   16 /* Quicklook and telemetry buffers */
+
+#define PHX_SERVER_MAGIC  0x53585850 /* "PHXS" */
+
+/* Subscriptions and message types */
+#define PHX_SERVER_RAW   0x1 /* Every frame, straight from the shared ring */
+#define PHX_SERVER_QUICK 0x2 /* Every -s'th frame, binned to 8 bit */
+#define PHX_SERVER_CENT  0x4 /* Centroids, x/y float pairs */
+#define PHX_SERVER_STATS 0x8 /* PhxFrameStats */
+
+/*!	\typedef
+  \struct PhxServerMsg
+  \brief Header sent ahead of every payload, little endian.*/
+typedef struct
+{
+    ui32 dwMagic;         /**< PHX_SERVER_MAGIC */
+    ui32 dwType;          /**< PHX_SERVER_RAW/QUICK/CENT/STATS */
+    ui64 qwFrame;         /**< Frame number in the run */
+    ui64 qwTimeNs;        /**< CLOCK_MONOTONIC at delivery */
+    ui32 dwSeq;           /**< Matches the trailer if the payload is intact */
+    ui32 dwWidth;         /**< Image width, or centroid cells per row */
+    ui32 dwHeight;        /**< Image height, or centroid rows */
+    ui32 dwBytesPerPixel; /**< Image bytes per pixel, 0 otherwise */
+    ui32 dwLength;        /**< Payload bytes */
+    ui32 dwDropped;       /**< Messages dropped for this client so far */
+} __attribute__((packed)) PhxServerMsg;
+
+/*!	\typedef
+  \struct PhxServerEvent
+  \brief One frame as posted by the frame path.*/
+typedef struct
+{
+    ui64 qwFrame;
+    ui64 qwTimeNs;
+    ui32 dwFlags;  /**< PHX_SERVER_STATS/CENT/QUICK if present */
+    ui32 dwGen;    /**< Pool generation, server side */
+    PhxFrameStats stats;
+    ui32 dwCellsX;
+    ui32 dwCellsY;
+    float fXY[2 * PHX_PROC_MAX_CELLS];
+} PhxServerEvent;
+
+typedef struct _PhxServerClient PhxServerClient;
+
+/*!	\typedef
+  \struct PhxServer
+  \brief Server state. Only PhxServer_Frame runs outside the server thread.*/
+typedef struct
+{
+    int fdListen;
+    int fdEpoll;
+    int fdEvent;
+    pthread_t thread;
+    int bRunning;
+    ui32 dwPort;
+    ui32 dwDecimation;  /**< Quicklook every Nth frame (-s) */
+    PhxShm *pShm;       /**< Frame source for raw and quicklook */
+    ui32 dwSubs;        /**< Union of client subscriptions */
+    ui32 dwEventHead;   /**< Frame path only */
+    ui32 dwEventTail;   /**< Server thread only */
+    ui64 qwEventDrops;  /**< Events lost to a full ring */
+    PhxServerEvent *pEvents;
+    PhxServerEvent *pPool;
+    ui8 *pbQuick;       /**< Quicklook image per pool entry */
+    ui32 dwQuickWidth;
+    ui32 dwQuickHeight;
+    ui32 dwPoolNext;
+    ui32 dwGen;
+    PhxServerClient *pClients;
+} PhxServer;
+
+etStat PhxServer_Start(PhxServer *, ui32, PhxShm *, ui32);
+void PhxServer_Frame(PhxServer *, ui64, ui64, PhxFrameStats *, PhxCentroids *);
+void PhxServer_Stop(PhxServer *);
+
+#endif /* _SERVER */
@@ -0,0 +1,132 @@
+/*! \file phx_shm.h
+    \brief Shared-memory frame ring for other processes on the flight computer.
+    \details The frame buffers in the shared segment are handed to the Phoenix
+    as user destination buffers, so the board DMAs straight into memory other
+    processes can map. Each slot has a seqlock: the writer makes it odd
+    before the slot can be refilled and even once a frame is published, and
+    never waits for readers. Readers map the segment read-only, use the frame
+    in place and call PhxShm_Valid afterwards to check it was not overwritten
+    meanwhile.
+
+    PHX_ACQ_BLOCKING is left as the config sets it; with it disabled a
+    slow frame path lets the board overwrite frames rather than stall. On
+    every publish the writer therefore invalidates the slots the board may
+    be filling: the frames already captured but not yet published, from
+    PHX_BUFFER_READY_COUNT, plus PHX_SHM_GUARD. After a stream restart
+    every slot is invalidated.
+
+    A writer that (re)creates the ring unlinks the old object and makes a
+    new one, so readers that still map the old one never see its size
+    change. It also bumps the generation in the old object, and the reader
+    calls then return PHX_SHM_REOPEN: close and PhxShm_Open again.*/
+
+#ifndef _SHM
+#define _SHM
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#include "phx_proc.h"
+
+#ifndef PHX_SHM_PREFIX
+#define PHX_SHM_PREFIX "/phx_" /* Followed by the lower case camera name */
+#endif
+
+#ifndef PHX_SHM_SLOTS
+#define PHX_SHM_SLOTS 16 /* Frames in the ring */
+#endif
+
+/* Slots ahead of the newest frame that the board may already be filling.
+ * They are marked invalid on every publish and are never offered as
+ * history. */
+#ifndef PHX_SHM_GUARD
+#define PHX_SHM_GUARD 2
+#endif
+
+/* Reader calls, the ring was recreated or its writer is gone */
+#define PHX_SHM_REOPEN (-1)
+
+#define PHX_SHM_MAGIC     0x46584850 /* "PHXF" */
+#define PHX_SHM_VERSION   1
+#define PHX_SHM_MAX_SLOTS 64
+
+/*!	\typedef
+  \struct PhxShmSlot
+  \brief Per-frame metadata, guarded by dwSeq.*/
+typedef struct
+{
+    ui32 dwSeq;      /**< Seqlock, odd while the slot is not valid */
+    ui32 dwStatus;   /**< Interrupt mask the frame was delivered with */
+    ui64 qwFrame;    /**< Frame number in the run, 1-based */
+    ui64 qwTimeNs;   /**< CLOCK_MONOTONIC when the frame was delivered */
+    ui64 qwOffset;   /**< Frame data offset from the start of the segment */
+    ui8 pad[32];
+} __attribute__((aligned(64))) PhxShmSlot;
+
+/*!	\typedef
+  \struct PhxShmHeader
+  \brief Start of the shared segment.*/
+typedef struct
+{
+    ui32 dwMagic;         /**< PHX_SHM_MAGIC once initialised */
+    ui32 dwVersion;       /**< PHX_SHM_VERSION */
+    ui64 qwGeneration;    /**< Bumped every time a writer (re)creates it */
+    ui32 dwSlots;         /**< Slots in use */
+    ui32 dwGuard;         /**< PHX_SHM_GUARD of the writer */
+    ui32 dwWidth;         /**< Pixels per line */
+    ui32 dwHeight;        /**< Lines */
+    ui32 dwStride;        /**< Bytes per line */
+    ui32 dwBytesPerPixel; /**< 1 or 2 */
+    ui32 dwBits;          /**< Significant bits per pixel */
+    ui32 dwSlotBytes;     /**< Bytes between frames, page aligned */
+    ui64 qwDataOffset;    /**< Offset of slot 0 frame data */
+    ui64 qwHead;          /**< Newest published frame number, 0 = none */
+    ui32 dwHeadSlot;      /**< Slot holding qwHead */
+    i32 nWriterPid;       /**< Capture process */
+    PhxShmSlot slots[PHX_SHM_MAX_SLOTS];
+} PhxShmHeader;
+
+/*!	\typedef
+  \struct PhxShm
+  \brief Process-local handle on the segment.*/
+typedef struct
+{
+    char szName[64];
+    int fd;
+    size_t len;
+    PhxShmHeader *pHeader;
+    stImageBuff *pBuffers; /**< Writer: destination list handed to Phoenix */
+    int bWriter;
+    ui64 qwGeneration;     /**< Of the object as opened or created */
+} PhxShm;
+
+/*!	\typedef
+  \struct PhxShmFrame
+  \brief A frame as seen by a reader. pvData points into the segment.*/
+typedef struct
+{
+    PhxImage image;
+    ui64 qwFrame;
+    ui64 qwTimeNs;
+    ui32 dwStatus;
+    ui32 dwSlot;
+    ui32 dwSeq;
+} PhxShmFrame;
+
+/* Writer side, used by the capture process */
+etStat PhxShm_Create(PhxShm *, char *, ui32, PhxImage *, ui32);
+etStat PhxShm_Attach(PhxShm *, tHandle);
+void PhxShm_Publish(PhxShm *, void *, ui64, ui64, ui32, ui32);
+void PhxShm_Invalidate(PhxShm *);
+void PhxShm_Destroy(PhxShm *);
+
+/* Reader side */
+etStat PhxShm_Open(PhxShm *, char *);
+int PhxShm_Latest(PhxShm *, PhxShmFrame *);
+int PhxShm_Get(PhxShm *, ui64, PhxShmFrame *);
+int PhxShm_Valid(PhxShm *, PhxShmFrame *);
+void PhxShm_Close(PhxShm *);
+
+#endif /* _SHM */
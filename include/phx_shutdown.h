@@ -0,0 +1,26 @@
+/*! \file phx_shutdown.h
+    \brief Signal handling that leaves the shutdown to a normal thread.
+    \details The handlers for SIGINT, SIGTERM and SIGUSR1 only note the
+    signal and write to an eventfd, which is all a handler may safely do
+    while the Phoenix event thread or the frame path is in the middle of a
+    call. A coordinator thread reads the eventfd and hands each signal to
+    the application, which can take locks, log and stop acquisition from
+    there. PhxShutdown_Init blocks the signals in the calling thread, so
+    threads created after it never see them and only the coordinator runs
+    the handlers. A second SIGINT or SIGTERM while a shutdown is under way
+    exits at once.*/
+
+#ifndef _SHUTDOWN
+#define _SHUTDOWN
+
+#include <phx_api.h> /* Main Phoenix library */
+
+/* Called by the coordinator for every signal received */
+typedef void (*PhxShutdownFn)(int, void *);
+
+etStat PhxShutdown_Init(void);
+etStat PhxShutdown_Start(PhxShutdownFn, void *);
+int PhxShutdown_Requested(void);
+void PhxShutdown_Stop(void);
+
+#endif /* _SHUTDOWN */
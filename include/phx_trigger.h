@@ -0,0 +1,86 @@
+/*! \file phx_trigger.h
+    \brief Software-timed triggers for time-aligned exposures.
+    \details A timer thread sleeps with clock_nanosleep to absolute
+    CLOCK_MONOTONIC deadlines and triggers every camera at each one. The
+    deadlines fall on whole multiples of the period in CLOCK_REALTIME, so
+    instruments with synchronised clocks and the same period expose
+    together. Each camera is triggered by the fastest path its config
+    allows, PHX_SYS_TRIGGER in [system]:
+
+    PHX_TRIGGER_CC1     a pulse on Camera Link CC1 written through the
+                        board (CHEETAHPARAM_TRIG_COMPUTER), microseconds
+    PHX_TRIGGER_SERIAL  the CHEETAH_SOFT_TRIGGER register over the serial
+                        link (CHEETAHPARAM_TRIG_SOFT), ~100 ms per trigger
+                        as every serial write waits for the camera's ACK
+
+    The time each trigger was issued is kept so the frame path can measure
+    trigger-to-frame latency. A frame is matched to the last trigger issued
+    at least a minimum latency before its timestamp rather than by count,
+    so a trigger the camera missed, a dropped frame or a restarted stream
+    does not shift every later pairing. The minimum is the frame time, plus
+    PHX_TRIGGER_SERIAL_WRITE_US on the serial path as the trigger time is
+    taken before the register write. Latencies are only right while they
+    stay within a period of that minimum; longer ones are paired with a
+    later trigger and come out a period short.*/
+
+#ifndef _TRIGGER
+#define _TRIGGER
+
+#include <pthread.h>
+
+#include <phx_api.h> /* Main Phoenix library */
+
+#include "phx_config.h"
+
+/* Trigger times kept for the latency, must be a power of 2 */
+#ifndef PHX_TRIGGER_RING
+#define PHX_TRIGGER_RING 256
+#endif
+
+#ifndef PHX_TRIGGER_SERIAL_US
+#define PHX_TRIGGER_SERIAL_US 150000 /* Shortest period on the serial path */
+#endif
+
+#ifndef PHX_TRIGGER_SERIAL_WRITE_US
+#define PHX_TRIGGER_SERIAL_WRITE_US 100000 /* Serial write before the camera
+                                              sees the trigger */
+#endif
+
+/*!	\typedef
+  \enum PhxTriggerPath
+  \brief How a camera is triggered, PHX_SYS_TRIGGER.*/
+typedef enum
+{
+    PHX_TRIGGER_CC1 = 0, /**< CC1 pulse over Camera Link */
+    PHX_TRIGGER_SERIAL   /**< CHEETAH_SOFT_TRIGGER register */
+} PhxTriggerPath;
+
+/*!	\typedef
+  \struct PhxTrigger
+  \brief Timer thread state.*/
+typedef struct
+{
+    pthread_t thread;
+    tHandle hCameras[PHX_MAX_CAMERAS];
+    PhxTriggerPath ePaths[PHX_MAX_CAMERAS];
+    ui32 dwCameras;
+    ui64 qwPeriodNs;
+    int bRunning;                     /**< Thread started */
+    int bStop;
+    ui64 qwIssued;                    /**< Triggers issued */
+    ui64 qwTimeNs[PHX_TRIGGER_RING];  /**< CLOCK_MONOTONIC of each, by number */
+
+    /* Statistics, written by the timer thread only */
+    ui64 qwLateNs;                    /**< Worst wakeup after a deadline */
+    ui64 qwMissed;                    /**< Deadlines skipped, thread too late */
+} PhxTrigger;
+
+int PhxTrigger_str_to_path(char *, PhxTriggerPath *);
+etStat PhxTrigger_Setup(tHandle, PhxTriggerPath);
+void PhxTrigger_Init(PhxTrigger *);
+etStat PhxTrigger_Add(PhxTrigger *, tHandle, PhxTriggerPath);
+etStat PhxTrigger_Start(PhxTrigger *, ui32);
+ui64 PhxTrigger_Before(PhxTrigger *, ui64, ui64);
+void PhxTrigger_Stop(PhxTrigger *);
+
+#endif /* _TRIGGER */
@@ -1,4 +1,3 @@
-#define _XOPEN_SOURCE 500 // for sigset
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
@@ -10,404 +9,166 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <sys/io.h>
 #include <termios.h>
 #include <unistd.h>
 
-#include <math.h>
-
-#include <libbmp/libbmp.h>
-
 /* piccflight headers */
+#include "phx_camera.h"
 #include "phx_config.h"
-#include "picc_dio.h"
-
-/* SHK board number */
-#define SHK_BOARD_NUMBER PHX_BOARD_NUMBER_1
+#include "phx_log.h"
+#include "phx_shutdown.h"
 
-#define ONE_MILLION      1000000ull
-
-/* Global Variables */
-tHandle cheetah_camera = 0; /* Camera Handle   */
-typedef struct _CamreaContext
-{
-    uint16_t wid;
-    uint16_t hei;
-    uint16_t bitshift;
-    uint64_t frames;
-    char name[64];
-} CameraContext;
+/* Cameras of this process, SHK first. Only the supervisor and the signal
+ * coordinator touch this, the frame paths get their own PhxCamera */
+static PhxCamera s_cameras[PHX_MAX_CAMERAS];
+static ui32 s_dwCameras;
+static PhxTrigger s_trigger; /* Triggers all cameras, -r */
 
 /**************************************************************/
-/* SHKCTRLC                                                   */
-/*  - SIGINT function                                         */
+/* SHKEXIT                                                    */
+/*  - Release everything and exit, from the main thread       */
 /**************************************************************/
-void shkctrlC(int sig)
+void shkexit(int status)
 {
-    fflush(stdout);
-    if (cheetah_camera)
-    {
-        PHX_StreamRead(cheetah_camera, PHX_ABORT,
-                       NULL); /* Now cease all captures */
-    }
+    ui32 i;
 
-    if (cheetah_camera)
-    {                                 /* Release the Phoenix board */
-        PHX_Close(&cheetah_camera);   /* Close the Phoenix board */
-        PHX_Destroy(&cheetah_camera); /* Destroy the Phoenix handle */
+    PhxShutdown_Stop();
+    PhxTrigger_Stop(&s_trigger);
+    for (i = 0; i < s_dwCameras; i++)
+    {
+        PhxCamera_Stop(&s_cameras[i]);
+        PhxCamera_Close(&s_cameras[i]);
     }
 
-// Unset DIO bit C1
-#if PICC_DIO_ENABLE
-    outb(0x00, PICC_DIO_BASE + PICC_DIO_PORTC);
-#endif
-
 #if MSG_CTRLC
-    printf("SHK: exiting\n");
+    PHX_LOG_INFO("SHK: exiting\n");
 #endif
 
-    exit(sig);
+    exit(status);
 }
 
 /**************************************************************/
-/* SHK_CALLBACK                                               */
-/*  - Exposure ISR callback function                          */
+/* SHKSIGNAL                                                  */
+/*  - Signals, on the coordinator thread, not in a handler    */
 /**************************************************************/
-static void image_cb(tHandle cam, ui32 dwInterruptMask, void *pvParams)
+static void shksignal(int sig, void *pvParams)
 {
-    static uint64_t frame_count = 0;
-    static char first_frame     = 1;
-    static char first_irq       = 1;
+    ui32 i;
 
-    if (first_irq)
+    if (sig == SIGUSR1)
     {
-        first_irq = 0;
-        printf("SHK: First IRQ\n");
+        /* Dump every camera's black box */
+        for (i = 0; i < s_dwCameras; i++)
+            PhxBlackBox_Trigger(&s_cameras[i].blackbox, PHX_BLACKBOX_SIGNAL);
+        return;
     }
 
-    if (dwInterruptMask & PHX_INTRPT_BUFFER_READY)
+    /* usually ^C, main stops the cameras once their waits return */
+    PHX_LOG_INFO("SHK: Signal %d, shutting down\n", sig);
+    for (i = 0; i < s_dwCameras; i++)
     {
-        stImageBuff stBuffer;
-        CameraContext *evtCtx = (CameraContext *)pvParams;
-        frame_count++;
-        evtCtx->frames = frame_count;
-// Set DIO bit C1
-#if PICC_DIO_ENABLE
-        // outb(0x02, PICC_DIO_BASE + PICC_DIO_PORTC);
-        if (frame_count % 2 == 0)
-        {
-            outb(0x02, PICC_DIO_BASE + PICC_DIO_PORTC);
-        }
-        else
-        {
-            outb(0x00, PICC_DIO_BASE + PICC_DIO_PORTC);
-        }
-#endif
-
-        etStat eStat = PHX_StreamRead(cam, PHX_BUFFER_GET, &stBuffer);
-        if (PHX_OK == eStat && first_frame)
-        {
-            // do stuff with image
-            uint16_t wid      = evtCtx->wid;
-            uint16_t hei      = evtCtx->hei;
-            uint16_t bitshift = evtCtx->bitshift;
-            printf("SHK: First frame: [%u x %u][%u]\n", wid, hei, bitshift);
-            Bitmap *img = bm_create(wid, hei);
-            if (img == NULL)
-            {
-                printf("SHK: Failed to create image\n");
-            }
-            else
-            {
-                printf("SHK: Created image\n");
-                for (int i = 0; i < wid; i++)
-                {
-                    for (int j = 0; j < hei; j++)
-                    {
-                        uint16_t val;
-                        if (bitshift >= 8)
-                        {
-                            val = ((uint8_t *)stBuffer.pvAddress)[i + j * wid];
-                        }
-                        else
-                        {
-                            val =
-                                ((uint16_t *)stBuffer.pvAddress)[i + j * wid] >>
-                                bitshift;
-                        }
-                        uint32_t argb = 0xff000000;
-                        argb |= (0x000000ff & val);
-                        argb |= (0x000000ff & val) << 8;
-                        argb |= (0x000000ff & val) << 16;
-                        bm_set(img, i, j, argb);
-                    }
-                }
-                printf("SHK: Loaded image\n");
-                char filename[1024];
-                snprintf(filename, sizeof(filename),
-                         "data/image_%s_%" PRIu64 ".bmp", evtCtx->name,
-                         frame_count);
-                int ret = bm_save(img, filename);
-                printf("SHK: Saved image to %s [%d]\n", filename, ret);
-            }
-            first_frame = 0;
-        }
-        PHX_StreamRead(cam, PHX_BUFFER_RELEASE, NULL);
+        if (s_cameras[i].bRun)
+            PhxRun_Request(&s_cameras[i].run);
     }
 }
 
 /**************************************************************/
 /* SHK_PROC                                                   */
-/*  - Main SHK camera process                                 */
+/*  - Main process, supervises every camera                   */
 /**************************************************************/
-int main(int argc, const char *argv[])
+int main(int argc, char *argv[])
 {
-// Unset DIO bit C1
-#if PICC_DIO_ENABLE
-    printf("SHK: Setting up IO permissions...\t");
-    fflush(stdout);
-    if (ioperm(PICC_DIO_BASE, PICC_DIO_LENGTH, 1))
-    {
-        printf("\n\nFailed to set ioperm: %s\n", strerror(errno));
-        exit(1);
-    }
-    printf("Done.\n");
-    printf("SHK: Selecting DIO page...\t");
-    fflush(stdout);
-    outb(0x1, PICC_DIO_BASE + PICC_DIO_PAGE);
-    printf("Done.\n");
-    printf("SHK: Enabling DIO...\t");
-    fflush(stdout);
-    outb(0x80, PICC_DIO_BASE + PICC_DIO_CTRL);
-    printf("Done.\n");
-    printf("SHK: Unsetting DIO...\t");
-    fflush(stdout);
-    outb(0x00, PICC_DIO_BASE + PICC_DIO_PORTC);
-    printf("Done.\n");
-#endif
-    char *configFileName = "config/shk_1bin_2tap_8bit.cfg";
-    if (argc != 2)
-    {
-        printf("SHK: Using default config file: %s\n", configFileName);
-    }
-    else
-    {
-        configFileName = (char *)argv[1];
-        printf("SHK: Using config file: %s\n", configFileName);
-    }
-    etStat eStat = PHX_OK;
-    etParamValue eParamValue;
-    CheetahParamValue bParamValue, expmin, expmax, expcmd, frmmin, frmcmd,
-        lnmin;
-    int nLastEventCount = 0;
-    ui64 dwParamValue;
-    etParamValue roiWidth, roiHeight, bufferWidth, bufferHeight;
-    int camera_running = 0;
-
-    /* Set soft interrupt handler */
-    sigset(SIGINT, shkctrlC); /* usually ^C */
-
-    /* Create a Phoenix handle */
-    eStat = PHX_Create(&cheetah_camera, PHX_ErrHandlerDefault);
-    if (PHX_OK != eStat)
-    {
-        printf("SHK: Error PHX_Create\n");
-        shkctrlC(0);
-    }
-
-    /* Set the board number */
-    eParamValue = PHX_BOARD_NUMBER_AUTO;
-    eStat = PHX_ParameterSet(cheetah_camera, PHX_BOARD_NUMBER, &eParamValue);
+    PhxSettings settings;
+    etStat eStat;
+    ui64 qwEpochNs;
+    ui32 i;
+
+    /* Before any thread exists, so none of them gets the signals */
+    eStat = PhxShutdown_Init();
+    PhxLog_Start();
     if (PHX_OK != eStat)
     {
-        printf("SHK: Error PHX_ParameterSet --> Board Number\n");
-        shkctrlC(0);
+        PHX_LOG_ERROR("SHK: Failed to set up the signal handlers\n");
+        exit(1);
     }
 
-    /* Open the Phoenix board */
-    eStat = PHX_Open(cheetah_camera);
-    if (PHX_OK != eStat)
+    if (PHX_OK != PhxConfig_ParseCmdLine(argc, argv, &settings))
     {
-        printf("SHK: Error PHX_Open\n");
-        shkctrlC(0);
-    }
-
-    /* Run the config file */
-    eStat = PhxConfig_RunFile(cheetah_camera, configFileName);
-    if (PHX_OK != eStat)
-    {
-        printf("SHK: Error PhxConfig_RunFile\n");
-        shkctrlC(0);
+        PHX_LOG_ERROR("SHK: Invalid command line\n");
+        exit(1);
     }
-
-    /* Setup our own event context */
-    CameraContext eventContext;
-    time_t timer;
-    char buffer[26];
-    struct tm *tm_info;
-
-    timer   = time(NULL);
-    tm_info = localtime(&timer);
-    strftime(eventContext.name, sizeof(eventContext.name), "%Y%m%d_%H%M%S",
-             tm_info);
-
-    eStat = PHX_ParameterSet(cheetah_camera, PHX_EVENT_CONTEXT,
-                             (void *)&eventContext);
-    if (PHX_OK != eStat)
+    if (settings.dwCameras == 0)
     {
-        printf("SHK: Error PHX_ParameterSet --> PHX_EVENT_CONTEXT\n");
-        shkctrlC(0);
+        PHX_LOG_ERROR("SHK: No config file given\n");
+        exit(1);
     }
 
-    /* Get debugging info */
-    eStat = PHX_ParameterGet(cheetah_camera, PHX_ROI_XLENGTH, &roiWidth);
-    eStat = PHX_ParameterGet(cheetah_camera, PHX_ROI_YLENGTH, &roiHeight);
-    printf("SHK: roi                     : [%d x %d]\n", roiWidth, roiHeight);
-    eStat = PHX_ParameterGet(cheetah_camera, PHX_BUF_DST_XLENGTH, &bufferWidth);
-    eStat =
-        PHX_ParameterGet(cheetah_camera, PHX_BUF_DST_YLENGTH, &bufferHeight);
-    printf("SHK: destination buffer size : [%d x %d]\n", bufferWidth,
-           bufferHeight);
-    eStat = Cheetah_ParameterGet(cheetah_camera, CHEETAH_INFO_MIN_MAX_XLENGTHS,
-                                 &bParamValue);
-    printf("SHK: Camera x size (width)      : [%d to %d]\n",
-           (bParamValue & 0x0000FFFF), (bParamValue & 0xFFFF0000) >> 16);
-    eStat = Cheetah_ParameterGet(cheetah_camera, CHEETAH_INFO_MIN_MAX_YLENGTHS,
-                                 &bParamValue);
-    printf("SHK: Camera y size (height)     : [%d to %d]\n",
-           (bParamValue & 0x0000FFFF), (bParamValue & 0xFFFF0000) >> 16);
-    eStat = Cheetah_ParameterGet(cheetah_camera, CHEETAH_INFO_XYLENGTHS,
-                                 &bParamValue);
-    printf("SHK: Camera current size        : [%d x %d]\n",
-           (bParamValue & 0x0000FFFF), (bParamValue & 0xFFFF0000) >> 16);
-    eventContext.hei = (bParamValue & 0xFFFF0000) >> 16;
-    eventContext.wid = (bParamValue & 0x0000FFFF);
-
-    eStat =
-        Cheetah_ParameterGet(cheetah_camera, CHEETAH_A2D_BITS, &bParamValue);
-    switch (bParamValue)
+    /* Signals are handled from here on */
+    for (i = 0; i < settings.dwCameras; i++)
+        PhxCamera_Init(&s_cameras[i]);
+    PhxTrigger_Init(&s_trigger);
+    s_dwCameras = settings.dwCameras;
+    if (PHX_OK != PhxShutdown_Start(shksignal, NULL))
     {
-    case CHEETAHPARAM_A2D_8B:
-        printf("SHK: Camera A2D bits            : 8\n");
-        eventContext.bitshift = 8;
-        break;
-    case CHEETAHPARAM_A2D_10B:
-        printf("SHK: Camera A2D bits            : 10\n");
-        eventContext.bitshift = 6;
-        break;
-    case CHEETAHPARAM_A2D_12B:
-        printf("SHK: Camera A2D bits            : 12\n");
-        eventContext.bitshift = 4;
-        break;
-    default:
-        printf("SHK: Camera A2D bits            : Unknown [%d]\n", bParamValue);
-        shkctrlC(0);
-        break;
+        PHX_LOG_ERROR("SHK: Failed to start the signal coordinator\n");
+        exit(1);
     }
 
-    eStat =
-        Cheetah_ParameterGet(cheetah_camera, CHEETAH_MAOI_STATE, &bParamValue);
-    printf("SHK: Camera MAOI state          : %d [%d]\n", bParamValue, eStat);
-    if (bParamValue == 0)
+    /* One clock for every stream, so their frames can be matched */
+    qwEpochNs = PhxLog_Now();
+    for (i = 0; i < s_dwCameras; i++)
     {
-        printf("SHK: Setting MAOI state to 1\n");
-        eStat = Cheetah_ParameterSet(cheetah_camera, CHEETAH_MAOI_STATE, 1);
-
-        if (PHX_OK != eStat)
+        if (PHX_OK != PhxCamera_Open(&s_cameras[i], &settings, i, qwEpochNs))
         {
-            printf("SHK: Cheetah_ParameterSet --> CHEETAH_MAOI_STATE 1\n");
-            fflush(stdout);
-            // shkctrlC(0);
+            PHX_LOG_ERROR("SHK: Failed to open camera %u (%s)\n", i,
+                          s_cameras[i].szCamera);
+            shkexit(0);
         }
-        sleep(1);
-        printf("SHK: Checking camera MAOI state...\n");
-        eStat = Cheetah_ParameterGet(cheetah_camera, CHEETAH_MAOI_STATE,
-                                     &bParamValue);
-        printf("SHK: Camera MAOI state          : %d [%d]\n", bParamValue,
-               eStat);
+        if (PhxShutdown_Requested())
+            shkexit(0);
     }
 
-    eStat =
-        Cheetah_ParameterGet(cheetah_camera, CHEETAH_TRGMODE_EN, &bParamValue);
-    printf("SHK: Camera trigger mode        : %d\n", bParamValue);
+    /* ----------------------- Enter Exposure Loop ----------------------- */
 
-    /* STOP Capture to put camera in known state */
-    eStat = PHX_StreamRead(cheetah_camera, PHX_STOP, (void *)image_cb);
-    if (PHX_OK != eStat)
+    /* Start them together, once all are set up */
+    for (i = 0; i < s_dwCameras; i++)
     {
-        printf("SHK: PHX_StreamRead --> PHX_STOP\n");
-        shkctrlC(0);
+        if (PHX_OK != PhxCamera_Start(&s_cameras[i], &settings))
+            shkexit(0);
     }
-    camera_running = 0;
-    printf("SHK: Camera stopped\n");
 
-    /* Setup exposure */
-    usleep(500000);
-    // Get minimum frame time and check against command
-    eStat = Cheetah_ParameterGet(cheetah_camera, CHEETAH_INFO_MIN_FRM_TIME,
-                                 &frmmin);
-    frmmin &= 0x00FFFFFF; // 16 us
-    printf("SHK: Min ln = %d | frm = %d\n", lnmin, frmmin);
-    frmcmd = lround(0.2e-3 * ONE_MILLION); // 200 us
-    frmcmd = frmcmd < frmmin ? frmmin : frmcmd;
-    // Set the frame time
-    eStat = Cheetah_ParameterSet(cheetah_camera, CHEETAH_PRG_FRMTIME, &frmcmd);
-    if (PHX_OK != eStat)
+    /* One timer triggers every camera, once they all wait for it */
+    if (settings.dwTriggerUs)
     {
-        printf("SHK: Cheetah_ParameterSet --> CHEETAH_FRM_TIME %d\n", frmcmd);
-        shkctrlC(0);
+        for (i = 0; i < s_dwCameras; i++)
+        {
+            PhxTrigger_Add(&s_trigger, s_cameras[i].handle,
+                           s_cameras[i].eTrigger);
+            s_cameras[i].trigger = &s_trigger;
+        }
+        if (PHX_OK != PhxTrigger_Start(&s_trigger, settings.dwTriggerUs))
+        {
+            PHX_LOG_ERROR("SHK: Failed to start the trigger timer\n");
+            shkexit(0);
+        }
+        PhxRt_Apply(&s_cameras[0].rt, PHX_RT_TRIGGER, s_trigger.thread);
     }
-    // Get minimum and maximum exposure time and check against command
-    usleep(500000);
-    eStat =
-        Cheetah_ParameterGet(cheetah_camera, CHEETAH_INFO_EXP_TIME, &expmin);
-    eStat = Cheetah_ParameterGet(cheetah_camera, CHEETAH_INFO_MAX_EXP_TIME,
-                                 &expmax);
-    expmin &= 0xFF00000;
-    expmin = ((ui32)expmin) >> 24;
-    expmax &= 0x00FFFFFF;
-    printf("SHK: Min exp = %d | Max exp = %d\n", expmin, expmax);
-    expcmd = lround(ONE_MILLION);
-    expcmd = expcmd > expmax ? expmax - 10 * expmin : expcmd;
-    expcmd = expcmd < expmin ? expmin : expcmd;
-    // eStat = Cheetah_ParameterSet(cheetah_camera, CHEETAH_EXP_TIME_ABS,
-    // &expcmd); if (PHX_OK != eStat)
-    // {
-    //     printf("SHK: Cheetah_ParameterSet --> CHEETAH_EXP_TIME %d\n",
-    //     expcmd); shkctrlC(0);
-    // }
-    // Get set exposure and frame times
-    eStat =
-        Cheetah_ParameterGet(cheetah_camera, CHEETAH_INFO_EXP_TIME, &expcmd);
-    eStat =
-        Cheetah_ParameterGet(cheetah_camera, CHEETAH_INFO_FRM_TIME, &frmcmd);
-    expcmd &= 0x00FFFFFF;
-    frmcmd &= 0x00FFFFFF;
-    printf("SHK: Set frm = %d | exp = %d\n", frmcmd, expcmd);
 
-    // Get CCD temperature
-    // We only do this once now because it fails often
-    printf("SHK: Get temp = %.2f\n", Cheetah_GetTemp(cheetah_camera));
-
-    /* ----------------------- Enter Exposure Loop ----------------------- */
-
-    /* Check if camera should start */
-    if (!camera_running)
+    /* Wait for the frame or time limit of every camera, or a signal */
+    for (i = 0; i < s_dwCameras; i++)
+        PhxRun_Wait(&s_cameras[i].run);
+    PhxTrigger_Stop(&s_trigger);
+    for (i = 0; i < s_dwCameras; i++)
     {
-        eStat = PHX_StreamRead(cheetah_camera, PHX_START, (void *)image_cb);
-        if (PHX_OK != eStat)
-        {
-            printf("SHK: PHX_StreamRead --> PHX_START\n");
-            shkctrlC(0);
-        }
-        camera_running = 1;
-        printf("SHK: Camera started\n");
+        s_cameras[i].trigger = NULL;
+        PhxCamera_Stop(&s_cameras[i]);
     }
 
-    sleep(4); // run for 10 seconds
+    for (i = 0; i < s_dwCameras; i++)
+        PhxCamera_Report(&s_cameras[i]);
 
-    printf("SHK: Exiting. Total frames: %" PRIu64 "\n", eventContext.frames);
+    PHX_LOG_INFO("SHK: Exiting\n");
     /* Exit */
-    shkctrlC(0);
+    shkexit(0);
     return 0;
 }
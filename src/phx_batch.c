@@ -0,0 +1,187 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "phx_batch.h"
+#include "phx_log.h"
+
+static ui64 PhxBatch_Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* PhxBatch_Drain
+ * Get, process and release every buffer the board has ready. Each frame
+ * gets the time of its callback, unless the ring has already been
+ * overwritten, in which case it gets the time it is drained.
+ */
+static void PhxBatch_Drain(PhxBatch *pBatch, ui32 dwPending, ui32 dwMask)
+{
+    ui32 dwReady = 0;
+    ui32 i;
+
+    if (PHX_OK != PHX_ParameterGet(pBatch->hCamera, PHX_BUFFER_READY_COUNT,
+                                   &dwReady))
+        dwReady = dwPending;
+
+    for (i = 0; i < dwReady; i++)
+    {
+        stImageBuff stBuffer;
+        ui64 qwTimeNs =
+            pBatch->qwTimeNs[pBatch->qwDone & (PHX_BATCH_RING - 1)];
+        etStat eStat =
+            PHX_StreamRead(pBatch->hCamera, PHX_BUFFER_GET, &stBuffer);
+
+        if (__atomic_load_n(&pBatch->qwReady, __ATOMIC_ACQUIRE) -
+                pBatch->qwDone >
+            PHX_BATCH_RING)
+            qwTimeNs = PhxBatch_Now();
+
+        (*pBatch->pfnFrame)(pBatch->hCamera,
+                            PHX_OK == eStat ? &stBuffer : NULL, dwMask,
+                            qwTimeNs, pBatch->pvParams);
+        PHX_StreamRead(pBatch->hCamera, PHX_BUFFER_RELEASE, NULL);
+        pBatch->qwDone++;
+    }
+    if (dwReady > pBatch->dwMaxBatch)
+        pBatch->dwMaxBatch = dwReady;
+}
+
+static void *PhxBatch_Thread(void *pv)
+{
+    PhxBatch *pBatch = (PhxBatch *)pv;
+
+    pthread_mutex_lock(&pBatch->lock);
+    while (!pBatch->bStop)
+    {
+        struct timespec tDeadline;
+        ui32 dwPending, dwMask;
+
+        clock_gettime(CLOCK_MONOTONIC, &tDeadline);
+        tDeadline.tv_sec += pBatch->dwTimeoutMs / 1000;
+        tDeadline.tv_nsec += (pBatch->dwTimeoutMs % 1000) * 1000000;
+        if (tDeadline.tv_nsec >= 1000000000)
+        {
+            tDeadline.tv_sec++;
+            tDeadline.tv_nsec -= 1000000000;
+        }
+        while (!pBatch->bStop && pBatch->dwPending < pBatch->dwBatch)
+        {
+            if (ETIMEDOUT == pthread_cond_timedwait(&pBatch->cond,
+                                                    &pBatch->lock, &tDeadline))
+                break;
+        }
+        if (pBatch->bStop)
+            break;
+        if (0 == pBatch->dwPending)
+            continue;
+
+        dwPending = pBatch->dwPending;
+        dwMask    = pBatch->dwMask;
+        pBatch->qwWakeups++;
+        if (dwPending < pBatch->dwBatch)
+            pBatch->qwTimeouts++;
+        pBatch->dwPending = 0;
+        pBatch->dwMask    = 0;
+        pthread_mutex_unlock(&pBatch->lock);
+
+        PhxBatch_Drain(pBatch, dwPending, dwMask);
+
+        pthread_mutex_lock(&pBatch->lock);
+    }
+    pthread_mutex_unlock(&pBatch->lock);
+    return NULL;
+}
+
+/* PhxBatch_Start
+ * Start the consumer for hCamera, calling pfnFrame for every frame. The
+ * batch is clipped to PHX_BATCH_RING / 2; it should also stay well below
+ * the number of capture buffers, or the board runs out of them before the
+ * consumer wakes.
+ */
+etStat PhxBatch_Start(PhxBatch *pBatch, tHandle hCamera, ui32 dwBatch,
+                      ui32 dwTimeoutMs, PhxBatchFrameFn pfnFrame,
+                      void *pvParams)
+{
+    pthread_condattr_t attr;
+
+    memset(pBatch, 0, sizeof(PhxBatch));
+    if (dwBatch > PHX_BATCH_RING / 2)
+    {
+        PHX_LOG_WARN("BATCH: %u frames per batch, clipped to %u\n", dwBatch,
+                     PHX_BATCH_RING / 2);
+        dwBatch = PHX_BATCH_RING / 2;
+    }
+    pBatch->hCamera     = hCamera;
+    pBatch->dwBatch     = dwBatch ? dwBatch : 1;
+    pBatch->dwTimeoutMs = dwTimeoutMs ? dwTimeoutMs : PHX_BATCH_TIMEOUT_MS;
+    pBatch->pfnFrame    = pfnFrame;
+    pBatch->pvParams    = pvParams;
+
+    if (pthread_mutex_init(&pBatch->lock, NULL))
+        return PHX_ERROR_MALLOC_FAILED;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&pBatch->cond, &attr))
+    {
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_destroy(&pBatch->lock);
+        return PHX_ERROR_MALLOC_FAILED;
+    }
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&pBatch->thread, NULL, PhxBatch_Thread, pBatch))
+    {
+        pthread_cond_destroy(&pBatch->cond);
+        pthread_mutex_destroy(&pBatch->lock);
+        return PHX_ERROR_MALLOC_FAILED;
+    }
+    pBatch->bRunning = 1;
+    PHX_LOG_INFO("BATCH: %u frames per wakeup, %u ms timeout\n",
+                 pBatch->dwBatch, pBatch->dwTimeoutMs);
+    return PHX_OK;
+}
+
+/* PhxBatch_Ready
+ * Called from the BUFFER_READY callback instead of processing the frame.
+ * Only the frame that completes a batch signals the consumer.
+ */
+void PhxBatch_Ready(PhxBatch *pBatch, ui32 dwInterruptMask)
+{
+    ui64 qwTimeNs = PhxBatch_Now();
+
+    pthread_mutex_lock(&pBatch->lock);
+    pBatch->qwTimeNs[pBatch->qwReady & (PHX_BATCH_RING - 1)] = qwTimeNs;
+    __atomic_store_n(&pBatch->qwReady, pBatch->qwReady + 1, __ATOMIC_RELEASE);
+    pBatch->dwMask |= dwInterruptMask;
+    if (++pBatch->dwPending == pBatch->dwBatch)
+        pthread_cond_signal(&pBatch->cond);
+    pthread_mutex_unlock(&pBatch->lock);
+}
+
+/* PhxBatch_Stop
+ * Stop and join the consumer. Frames still ready are left to the caller,
+ * which is about to stop or abort the acquisition anyway.
+ */
+void PhxBatch_Stop(PhxBatch *pBatch)
+{
+    if (!pBatch->bRunning)
+        return;
+
+    pthread_mutex_lock(&pBatch->lock);
+    pBatch->bStop = 1;
+    pthread_cond_signal(&pBatch->cond);
+    pthread_mutex_unlock(&pBatch->lock);
+    pthread_join(pBatch->thread, NULL);
+    pBatch->bRunning = 0;
+
+    PHX_LOG_INFO("BATCH: %" PRIu64 " frames in %" PRIu64 " wakeups, %" PRIu64
+                 " on timeout, largest batch %u\n",
+                 pBatch->qwDone, pBatch->qwWakeups, pBatch->qwTimeouts,
+                 pBatch->dwMaxBatch);
+    pthread_cond_destroy(&pBatch->cond);
+    pthread_mutex_destroy(&pBatch->lock);
+}
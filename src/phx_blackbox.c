@@ -0,0 +1,396 @@
+#define _GNU_SOURCE /* MAP_HUGETLB, MAP_POPULATE */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "phx_blackbox.h"
+#include "phx_config.h"
+#include "phx_log.h"
+
+static const char *PhxBlackBox_ReasonName(PhxBlackBoxReason eReason)
+{
+    switch (eReason)
+    {
+    case PHX_BLACKBOX_API:
+        return "request";
+    case PHX_BLACKBOX_SIGNAL:
+        return "signal";
+    case PHX_BLACKBOX_EVENT:
+        return "board event";
+    case PHX_BLACKBOX_SATURATED:
+        return "saturation";
+    case PHX_BLACKBOX_MEAN:
+        return "mean";
+    default:
+        return "none";
+    }
+}
+
+/* PhxBlackBox_LoadFile
+ * Read the PHX_SYS_BLACKBOX_* keys from the [system] section of a config
+ * file. Without PHX_SYS_BLACKBOX_PRE_MS the recorder stays off.
+ */
+etStat PhxBlackBox_LoadFile(char *pszConfigFileName, PhxBlackBox *pBox)
+{
+    etStat eStat = PHX_OK;
+
+    FILE *fp;
+    char strLine[PHX_CONFIG_MAX_LINE];
+    char delimit[] = "= \t\r\n\v\f";
+    char fsystem = 0;
+    char *strParam, *strParamValue;
+
+    memset(pBox, 0, sizeof(PhxBlackBox));
+    pBox->dwMaxMb = PHX_BLACKBOX_MAX_MB;
+
+    fp = fopen(pszConfigFileName, "r");
+    if (fp == NULL)
+    {
+        PHX_LOG_ERROR("BLACKBOX: Cannot open %s: %s\n", pszConfigFileName,
+                      strerror(errno));
+        eStat = PHX_ERROR_BAD_PARAM;
+        goto Error;
+    }
+
+    while (fgets(strLine, PHX_CONFIG_MAX_LINE, fp))
+    {
+        if (strLine[0] == '[')
+        {
+            fsystem = strstr(strLine, "[system]") != NULL;
+            continue;
+        }
+        if (!fsystem)
+            continue;
+
+        strParam      = strtok(strLine, delimit);
+        strParamValue = strtok(NULL, delimit);
+        if (strParam == NULL || strParamValue == NULL)
+            continue;
+
+        if (strcmp(strParam, "PHX_SYS_BLACKBOX_PRE_MS") == 0)
+            pBox->dwPreMs = strtoul(strParamValue, NULL, 0);
+        else if (strcmp(strParam, "PHX_SYS_BLACKBOX_POST_MS") == 0)
+            pBox->dwPostMs = strtoul(strParamValue, NULL, 0);
+        else if (strcmp(strParam, "PHX_SYS_BLACKBOX_SATURATED") == 0)
+            pBox->dwSaturated = strtoul(strParamValue, NULL, 0);
+        else if (strcmp(strParam, "PHX_SYS_BLACKBOX_MEAN_MIN") == 0)
+            pBox->dMeanMin = strtod(strParamValue, NULL);
+        else if (strcmp(strParam, "PHX_SYS_BLACKBOX_MEAN_MAX") == 0)
+            pBox->dMeanMax = strtod(strParamValue, NULL);
+        else if (strcmp(strParam, "PHX_SYS_BLACKBOX_MAX_MB") == 0)
+            pBox->dwMaxMb = strtoul(strParamValue, NULL, 0);
+    }
+    fclose(fp);
+Error:
+    return eStat;
+}
+
+static void PhxBlackBox_Write(PhxBlackBox *pBox)
+{
+    PhxBlackBoxHeader header;
+    char filename[256];
+    ui64 qwHead = pBox->qwHead;
+    ui64 qwFirst, qw;
+    ui32 dwFrames;
+    FILE *fp;
+
+    dwFrames = qwHead < pBox->dwSlots ? (ui32)qwHead : pBox->dwSlots;
+    qwFirst  = qwHead - dwFrames;
+
+    snprintf(filename, sizeof(filename), "data/blackbox_%s_%" PRIu64 ".bin",
+             pBox->szName, pBox->qwTriggerFrame);
+    fp = fopen(filename, "wb");
+    if (fp == NULL)
+    {
+        PHX_LOG_ERROR("BLACKBOX: Cannot create %s: %s\n", filename,
+                      strerror(errno));
+        return;
+    }
+
+    memset(&header, 0, sizeof(header));
+    header.dwMagic         = PHX_BLACKBOX_MAGIC;
+    header.dwVersion       = PHX_BLACKBOX_VERSION;
+    header.dwWidth         = pBox->geometry.dwWidth;
+    header.dwHeight        = pBox->geometry.dwHeight;
+    header.dwBits          = pBox->geometry.dwBits;
+    header.dwBytesPerPixel = pBox->geometry.dwBytesPerPixel;
+    header.dwFrames        = dwFrames;
+    header.dwReason        = pBox->eReason;
+    header.qwTriggerFrame  = pBox->qwTriggerFrame;
+    header.qwTriggerTimeNs = pBox->qwTriggerTimeNs;
+    fwrite(&header, sizeof(header), 1, fp);
+    for (qw = qwFirst; qw < qwHead; qw++)
+        fwrite(&pBox->pMeta[qw % pBox->dwSlots], sizeof(PhxBlackBoxMeta), 1,
+               fp);
+    for (qw = qwFirst; qw < qwHead; qw++)
+        fwrite(pBox->pbFrames + (qw % pBox->dwSlots) * pBox->lenFrame,
+               pBox->lenFrame, 1, fp);
+    if (fclose(fp))
+    {
+        PHX_LOG_ERROR("BLACKBOX: Writing %s failed: %s\n", filename,
+                      strerror(errno));
+        return;
+    }
+    PHX_LOG_INFO("BLACKBOX: %u frames around frame %" PRIu64 " (%s) saved to "
+                 "%s\n",
+                 dwFrames, pBox->qwTriggerFrame,
+                 PhxBlackBox_ReasonName(pBox->eReason), filename);
+}
+
+static void *PhxBlackBox_Thread(void *pv)
+{
+    PhxBlackBox *pBox = (PhxBlackBox *)pv;
+
+    pthread_mutex_lock(&pBox->lock);
+    for (;;)
+    {
+        /* A frozen ring is written out even when stopping */
+        if (PHX_BLACKBOX_FROZEN !=
+            __atomic_load_n(&pBox->eState, __ATOMIC_ACQUIRE))
+        {
+            if (pBox->bStop)
+                break;
+            pthread_cond_wait(&pBox->cond, &pBox->lock);
+            continue;
+        }
+        pthread_mutex_unlock(&pBox->lock);
+
+        PhxBlackBox_Write(pBox);
+        pBox->qwDumps++;
+        /* A trigger raised meanwhile is still pending, the next frame
+         * recorded takes it */
+        __atomic_store_n(&pBox->eState, PHX_BLACKBOX_RECORDING,
+                         __ATOMIC_RELEASE);
+
+        pthread_mutex_lock(&pBox->lock);
+    }
+    pthread_mutex_unlock(&pBox->lock);
+    return NULL;
+}
+
+/* PhxBlackBox_Freeze
+ * Hand a full ring to the writer.
+ */
+static void PhxBlackBox_Freeze(PhxBlackBox *pBox)
+{
+    pthread_mutex_lock(&pBox->lock);
+    __atomic_store_n(&pBox->eState, PHX_BLACKBOX_FROZEN, __ATOMIC_RELEASE);
+    pthread_cond_signal(&pBox->cond);
+    pthread_mutex_unlock(&pBox->lock);
+}
+
+/* PhxBlackBox_Create
+ * Size the ring for the configured windows at dwFrameTimeUs per frame,
+ * within PHX_SYS_BLACKBOX_MAX_MB, map and prefault it and start the
+ * writer. Falls back to normal pages without hugepages reserved
+ * (vm.nr_hugepages).
+ */
+etStat PhxBlackBox_Create(PhxBlackBox *pBox, PhxImage *pGeometry,
+                          ui32 dwFrameTimeUs, char *pszName)
+{
+    ui64 qwPre, qwPost, qwSlots, qwMax;
+    size_t lenMeta;
+
+    if (pBox->dwPreMs == 0)
+        return PHX_OK;
+    if (dwFrameTimeUs == 0)
+        dwFrameTimeUs = 1;
+
+    pBox->geometry        = *pGeometry;
+    pBox->geometry.pvData = NULL;
+    pBox->lenFrame = (size_t)pGeometry->dwWidth * pGeometry->dwHeight *
+                     pGeometry->dwBytesPerPixel;
+    snprintf(pBox->szName, sizeof(pBox->szName), "%s", pszName);
+
+    qwPre   = pBox->dwPreMs * 1000ull / dwFrameTimeUs;
+    qwPost  = pBox->dwPostMs * 1000ull / dwFrameTimeUs;
+    qwSlots = qwPre + qwPost + 1;
+    qwMax   = pBox->dwMaxMb * 1024ull * 1024 /
+            (pBox->lenFrame + sizeof(PhxBlackBoxMeta));
+    if (qwSlots > qwMax)
+    {
+        PHX_LOG_WARN("BLACKBOX: %" PRIu64 " frames do not fit in %u MB, "
+                     "keeping %" PRIu64 "\n",
+                     qwSlots, pBox->dwMaxMb, qwMax);
+        qwPost  = qwPost * qwMax / qwSlots;
+        qwSlots = qwMax;
+    }
+    if (qwSlots < 2)
+    {
+        PHX_LOG_ERROR("BLACKBOX: No room for a ring\n");
+        return PHX_ERROR_BAD_PARAM_VALUE;
+    }
+    pBox->dwSlots = (ui32)qwSlots;
+    pBox->dwPost  = (ui32)qwPost;
+
+    /* Metadata first, frames from the next page on */
+    lenMeta       = (pBox->dwSlots * sizeof(PhxBlackBoxMeta) + 4095) & ~4095ul;
+    pBox->lenMap  = lenMeta + pBox->dwSlots * pBox->lenFrame;
+    pBox->lenMap  = (pBox->lenMap + PHX_BLACKBOX_HUGE - 1) &
+                   ~(size_t)(PHX_BLACKBOX_HUGE - 1);
+    pBox->pvMap = mmap(NULL, pBox->lenMap, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE,
+                       -1, 0);
+    pBox->bHuge = pBox->pvMap != MAP_FAILED;
+    if (!pBox->bHuge)
+        pBox->pvMap = mmap(NULL, pBox->lenMap, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+    if (pBox->pvMap == MAP_FAILED)
+    {
+        PHX_LOG_ERROR("BLACKBOX: Cannot map %zu bytes: %s\n", pBox->lenMap,
+                      strerror(errno));
+        pBox->pvMap = NULL;
+        return PHX_ERROR_MALLOC_FAILED;
+    }
+    /* MAP_POPULATE may have left zero pages behind, write them all */
+    memset(pBox->pvMap, 0, pBox->lenMap);
+    pBox->pMeta    = (PhxBlackBoxMeta *)pBox->pvMap;
+    pBox->pbFrames = (ui8 *)pBox->pvMap + lenMeta;
+
+    if (pthread_mutex_init(&pBox->lock, NULL))
+        goto Error;
+    if (pthread_cond_init(&pBox->cond, NULL))
+    {
+        pthread_mutex_destroy(&pBox->lock);
+        goto Error;
+    }
+    if (pthread_create(&pBox->thread, NULL, PhxBlackBox_Thread, pBox))
+    {
+        pthread_cond_destroy(&pBox->cond);
+        pthread_mutex_destroy(&pBox->lock);
+        goto Error;
+    }
+    pBox->bRunning = 1;
+    pBox->bEnabled = 1;
+    PHX_LOG_INFO("BLACKBOX: %u frames, %u after a trigger, %zu MB in %s "
+                 "pages\n",
+                 pBox->dwSlots, pBox->dwPost, pBox->lenMap >> 20,
+                 pBox->bHuge ? "huge" : "normal");
+    return PHX_OK;
+
+Error:
+    munmap(pBox->pvMap, pBox->lenMap);
+    pBox->pvMap = NULL;
+    return PHX_ERROR_MALLOC_FAILED;
+}
+
+/* PhxBlackBox_Trigger
+ * Ask for a dump around the next frame. Only an atomic store, so it can be
+ * called from any thread or a signal handler. While a dump is recorded or
+ * written the trigger stays pending, and is taken on the first frame
+ * recorded after it; triggers pending together make one dump.
+ */
+void PhxBlackBox_Trigger(PhxBlackBox *pBox, PhxBlackBoxReason eReason)
+{
+    if (pBox->bEnabled)
+        __atomic_store_n(&pBox->ePending, eReason, __ATOMIC_RELEASE);
+}
+
+/* PhxBlackBox_Frame
+ * Called from the frame path for every frame: record it and check the
+ * triggers. pStats is NULL when the stats stage is off.
+ */
+void PhxBlackBox_Frame(PhxBlackBox *pBox, void *pvData, ui64 qwFrame,
+                       ui64 qwTimeNs, ui32 dwStatus, PhxFrameStats *pStats)
+{
+    PhxBlackBoxState eState;
+    PhxBlackBoxMeta *pMeta;
+    ui32 dwSlot;
+
+    if (!pBox->bEnabled)
+        return;
+    eState = __atomic_load_n(&pBox->eState, __ATOMIC_ACQUIRE);
+    if (eState == PHX_BLACKBOX_FROZEN)
+    {
+        pBox->qwSkipped++;
+        return;
+    }
+
+    dwSlot = pBox->qwHead % pBox->dwSlots;
+    pMeta  = &pBox->pMeta[dwSlot];
+    memcpy(pBox->pbFrames + dwSlot * pBox->lenFrame, pvData, pBox->lenFrame);
+    memset(pMeta, 0, sizeof(PhxBlackBoxMeta));
+    pMeta->qwFrame  = qwFrame;
+    pMeta->qwTimeNs = qwTimeNs;
+    pMeta->dwStatus = dwStatus;
+    if (pStats)
+    {
+        pMeta->dwMin       = pStats->dwMin;
+        pMeta->dwMax       = pStats->dwMax;
+        pMeta->dwSaturated = pStats->dwSaturated;
+        pMeta->dMean       = pStats->dMean;
+    }
+    pBox->qwHead++;
+
+    if (eState == PHX_BLACKBOX_RECORDING)
+    {
+        PhxBlackBoxReason eReason = __atomic_exchange_n(
+            &pBox->ePending, PHX_BLACKBOX_NONE, __ATOMIC_ACQUIRE);
+
+        if (eReason == PHX_BLACKBOX_NONE && pStats)
+        {
+            if (pBox->dwSaturated && pStats->dwSaturated > pBox->dwSaturated)
+                eReason = PHX_BLACKBOX_SATURATED;
+            else if ((pBox->dMeanMin && pStats->dMean < pBox->dMeanMin) ||
+                     (pBox->dMeanMax && pStats->dMean > pBox->dMeanMax))
+                eReason = PHX_BLACKBOX_MEAN;
+        }
+        if (eReason == PHX_BLACKBOX_NONE)
+            return;
+        pBox->eReason         = eReason;
+        pBox->qwTriggerFrame  = qwFrame;
+        pBox->qwTriggerTimeNs = qwTimeNs;
+        pBox->qwStop          = pBox->qwHead + pBox->dwPost;
+        eState                = PHX_BLACKBOX_ARMED;
+        __atomic_store_n(&pBox->eState, eState, __ATOMIC_RELAXED);
+    }
+
+    if (eState == PHX_BLACKBOX_ARMED && pBox->qwHead >= pBox->qwStop)
+        PhxBlackBox_Freeze(pBox);
+}
+
+/* PhxBlackBox_Flush
+ * Called once no more frames will come. A trigger still recording its post
+ * window is written out with the frames it has.
+ */
+void PhxBlackBox_Flush(PhxBlackBox *pBox)
+{
+    if (pBox->bRunning &&
+        PHX_BLACKBOX_ARMED == __atomic_load_n(&pBox->eState, __ATOMIC_ACQUIRE))
+        PhxBlackBox_Freeze(pBox);
+}
+
+/* PhxBlackBox_Destroy
+ * Stop the writer, after it finishes a dump in progress, and free the
+ * ring. Without PhxBlackBox_Flush, a trigger whose post window is still
+ * being recorded is lost.
+ */
+void PhxBlackBox_Destroy(PhxBlackBox *pBox)
+{
+    if (pBox->bRunning)
+    {
+        pthread_mutex_lock(&pBox->lock);
+        pBox->bStop = 1;
+        pthread_cond_signal(&pBox->cond);
+        pthread_mutex_unlock(&pBox->lock);
+        pthread_join(pBox->thread, NULL);
+        pBox->bRunning = 0;
+        pthread_cond_destroy(&pBox->cond);
+        pthread_mutex_destroy(&pBox->lock);
+
+        PHX_LOG_INFO("BLACKBOX: %" PRIu64 " dumps, %" PRIu64 " frames not "
+                     "recorded while frozen\n",
+                     pBox->qwDumps, pBox->qwSkipped);
+    }
+    pBox->bEnabled = 0;
+    if (pBox->pvMap)
+    {
+        munmap(pBox->pvMap, pBox->lenMap);
+        pBox->pvMap    = NULL;
+        pBox->pMeta    = NULL;
+        pBox->pbFrames = NULL;
+    }
+}
@@ -0,0 +1,876 @@
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "phx_camera.h"
+#include "phx_cheetah.h"
+#include "phx_log.h"
+#include "phx_model.h"
+#include "phx_phoenix_cheetah.h"
+#include "picc_dio.h"
+
+#define ONE_MILLION 1000000ull
+
+/* PhxCamera_LoadFile
+ * Read PHX_SYS_CAMERA, PHX_SYS_BOARD and PHX_SYS_TRIGGER from the [system]
+ * section of a config file, keeping the defaults for keys that are not
+ * there.
+ */
+static etStat PhxCamera_LoadFile(char *pszConfigFileName, PhxCamera *pCam)
+{
+    etStat eStat = PHX_OK;
+
+    FILE *fp;
+    char strLine[PHX_CONFIG_MAX_LINE];
+    char delimit[] = "= \t\r\n\v\f";
+    char fsystem = 0;
+    char *strParam, *strParamValue;
+
+    fp = fopen(pszConfigFileName, "r");
+    if (fp == NULL)
+    {
+        PHX_LOG_ERROR("CAMERA: Cannot open %s: %s\n", pszConfigFileName,
+                      strerror(errno));
+        eStat = PHX_ERROR_BAD_PARAM;
+        goto Error;
+    }
+
+    while (fgets(strLine, PHX_CONFIG_MAX_LINE, fp))
+    {
+        if (strLine[0] == '[')
+        {
+            fsystem = strstr(strLine, "[system]") != NULL;
+            continue;
+        }
+        if (!fsystem)
+            continue;
+
+        strParam      = strtok(strLine, delimit);
+        strParamValue = strtok(NULL, delimit);
+        if (strParam == NULL || strParamValue == NULL)
+            continue;
+
+        if (strcmp(strParam, "PHX_SYS_CAMERA") == 0)
+        {
+            strncpy(pCam->szCamera, strParamValue, sizeof(pCam->szCamera) - 1);
+            pCam->szCamera[sizeof(pCam->szCamera) - 1] = '\0';
+        }
+        else if (strcmp(strParam, "PHX_SYS_BOARD") == 0)
+            pCam->dwBoard = strtoul(strParamValue, NULL, 0);
+        else if (strcmp(strParam, "PHX_SYS_TRIGGER") == 0)
+        {
+            if (!PhxTrigger_str_to_path(strParamValue, &pCam->eTrigger))
+                eStat = PHX_ERROR_BAD_PARAM_VALUE;
+        }
+    }
+    fclose(fp);
+Error:
+    return eStat;
+}
+
+/**************************************************************/
+/* CAMERA_FRAME                                               */
+/*  - Everything done with one captured frame                 */
+/**************************************************************/
+static void PhxCamera_Frame(tHandle cam, stImageBuff *pstBuffer,
+                            ui32 dwInterruptMask, ui64 time_ns,
+                            void *pvParams)
+{
+    PhxCamera *pCam      = (PhxCamera *)pvParams;
+    uint64_t frame_count;
+    struct timespec ts;
+
+    /* Any frame shows the stream is alive, even past the limit */
+    PhxRecover_Frame(&pCam->recover, time_ns);
+    frame_count = PhxRun_Frame(&pCam->run);
+    if (frame_count == 0)
+    {
+        /* Past the frame limit, the caller just hands the buffer back */
+        return;
+    }
+    pCam->frames = frame_count;
+    if (frame_count == 1)
+    {
+        PHX_LOG_INFO("%s: First frame %.3f ms after the epoch\n",
+                     pCam->szCamera, (time_ns - pCam->qwEpochNs) / 1e6);
+    }
+
+    /* When the frame reaches the stages, whichever thread delivered it */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    PhxJitter_Add(&pCam->jitter, ts.tv_sec * 1000000000ull + ts.tv_nsec);
+    if (pCam->trigger)
+    {
+        /* No frame can answer a trigger sooner than this */
+        ui64 qwMinNs = pCam->frmtime * 1000ull;
+        ui64 qwTrigNs;
+
+        if (pCam->eTrigger == PHX_TRIGGER_SERIAL)
+            qwMinNs += PHX_TRIGGER_SERIAL_WRITE_US * 1000ull;
+        qwTrigNs = PhxTrigger_Before(pCam->trigger, time_ns, qwMinNs);
+        if (qwTrigNs && time_ns > qwTrigNs)
+            PhxJitter_Sample(&pCam->latency, time_ns - qwTrigNs);
+    }
+    PhxMarker_Set(&pCam->marker, frame_count % 2 == 0);
+
+    if (pstBuffer && pCam->blackbox.bEnabled)
+    {
+        PhxBlackBox_Frame(&pCam->blackbox, pstBuffer->pvAddress, frame_count,
+                          time_ns, dwInterruptMask,
+                          (pCam->stages & PHX_STAGE_STATS) ? &pCam->stats
+                                                           : NULL);
+    }
+    if (pstBuffer && pCam->shm && pstBuffer->pvContext)
+    {
+        /* Captured behind this one, the board may be refilling past them */
+        ui32 dwAhead = 0;
+        PHX_ParameterGet(cam, PHX_BUFFER_READY_COUNT, &dwAhead);
+        PhxShm_Publish(pCam->shm, pstBuffer->pvContext, frame_count, time_ns,
+                       dwInterruptMask, dwAhead);
+    }
+
+    if (pstBuffer)
+    {
+        PhxImage image;
+        image.pvData          = pstBuffer->pvAddress;
+        image.dwWidth         = pCam->wid;
+        image.dwHeight        = pCam->hei;
+        image.dwBits          = pCam->bits;
+        image.dwBytesPerPixel = pCam->bits > 8 ? 2 : 1;
+
+        if (pCam->stages & PHX_STAGE_STATS)
+        {
+            PhxProc_Stats(&image, &pCam->stats);
+            pCam->mean_sum += pCam->stats.dMean;
+            pCam->stats_frames++;
+        }
+        if (pCam->stages & PHX_STAGE_CENT)
+        {
+            PhxProc_Centroids(&image, pCam->grid, pCam->threshold,
+                              &pCam->cent);
+        }
+        if ((pCam->stages & PHX_STAGE_BMP) && !pCam->saved)
+        {
+            char filename[1024];
+            PHX_LOG_INFO("%s: First frame: [%u x %u][%u]\n", pCam->szCamera,
+                         image.dwWidth, image.dwHeight, image.dwBits);
+            snprintf(filename, sizeof(filename),
+                     "data/image_%s_%" PRIu64 ".bmp", pCam->name, frame_count);
+            int ret = PhxProc_SaveBmp(&image, filename);
+            PHX_LOG_INFO("%s: Saved image to %s [%d]\n", pCam->szCamera,
+                         filename, ret);
+            pCam->saved = 1;
+        }
+        if (pCam->server)
+        {
+            PhxServer_Frame(
+                pCam->server, frame_count, time_ns,
+                (pCam->stages & PHX_STAGE_STATS) ? &pCam->stats : NULL,
+                (pCam->stages & PHX_STAGE_CENT) ? &pCam->cent : NULL);
+        }
+    }
+}
+
+/**************************************************************/
+/* CAMERA_CALLBACK                                            */
+/*  - Exposure ISR callback function                          */
+/**************************************************************/
+static void PhxCamera_Callback(tHandle cam, ui32 dwInterruptMask,
+                               void *pvParams)
+{
+    PhxCamera *pCam = (PhxCamera *)pvParams;
+
+    if (pCam->first_irq)
+    {
+        pCam->first_irq = 0;
+        PHX_LOG_INFO("%s: First IRQ\n", pCam->szCamera);
+        PhxRt_ApplySelf(&pCam->rt, PHX_RT_CALLBACK);
+    }
+
+    /* Keep the frames around a lost or corrupted frame */
+    if (dwInterruptMask & (PHX_INTRPT_FIFO_OVERFLOW | PHX_INTRPT_SYNC_LOST))
+        PhxBlackBox_Trigger(&pCam->blackbox, PHX_BLACKBOX_EVENT);
+    if (dwInterruptMask & PHX_RECOVER_FAULTS)
+        PhxRecover_Fault(&pCam->recover, dwInterruptMask & PHX_RECOVER_FAULTS);
+
+    if (dwInterruptMask & PHX_INTRPT_BUFFER_READY)
+    {
+        PhxBatch *pBatch = __atomic_load_n(&pCam->batch, __ATOMIC_ACQUIRE);
+        stImageBuff stBuffer;
+        struct timespec ts;
+        etStat eStat;
+
+        /* Batch mode, the consumer thread gets the buffers */
+        if (pBatch)
+        {
+            PhxBatch_Ready(pBatch, dwInterruptMask);
+            return;
+        }
+        /* Poll mode, the poll thread does */
+        if (__atomic_load_n(&pCam->poll, __ATOMIC_ACQUIRE))
+            return;
+
+        eStat = PHX_StreamRead(cam, PHX_BUFFER_GET, &stBuffer);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        PhxCamera_Frame(cam, PHX_OK == eStat ? &stBuffer : NULL,
+                        dwInterruptMask, ts.tv_sec * 1000000000ull + ts.tv_nsec,
+                        pvParams);
+        PHX_StreamRead(cam, PHX_BUFFER_RELEASE, NULL);
+    }
+}
+
+/* PhxCamera_Recover
+ * One recovery step, from the recovery thread. Only the acquisition is
+ * touched, the frame ring, server and batch or poll thread stay up.
+ */
+static etStat PhxCamera_Recover(PhxRecoverStep eStep, void *pvParams)
+{
+    PhxCamera *pCam = (PhxCamera *)pvParams;
+    etStat eStat    = PHX_OK;
+
+    switch (eStep)
+    {
+    case PHX_RECOVER_ABORT:
+        return PHX_StreamRead(pCam->handle, PHX_BUFFER_ABORT, NULL);
+
+    case PHX_RECOVER_RESTART:
+        PHX_StreamRead(pCam->handle, PHX_STOP, NULL);
+        break;
+
+    case PHX_RECOVER_RESET:
+        PHX_StreamRead(pCam->handle, PHX_STOP, NULL);
+        eStat = Cheetah_SoftReset(pCam->handle);
+        if (PHX_OK != eStat)
+            return eStat;
+        usleep(PHX_RECOVER_RESET_MS * 1000);
+        if (PHX_OK != (eStat = PhxRecover_Reapply(&pCam->recover,
+                                                  pCam->handle)))
+            return eStat;
+        /* What PhxCamera_Open set on top of the config */
+        eStat = Cheetah_ParameterSet(pCam->handle, CHEETAH_PRG_FRMTIME,
+                                     &pCam->frmtime);
+        if (PHX_OK != eStat)
+            return eStat;
+        if (pCam->dwTriggerUs &&
+            PHX_OK != (eStat = PhxTrigger_Setup(pCam->handle, pCam->eTrigger)))
+            return eStat;
+        break;
+
+    case PHX_RECOVER_FAILED:
+        PhxRun_Stop(&pCam->run);
+        return PHX_OK;
+
+    default:
+        return PHX_OK;
+    }
+
+    /* The board starts again from the first buffer */
+    if (pCam->shm)
+        PhxShm_Invalidate(pCam->shm);
+    return PHX_StreamRead(pCam->handle, PHX_START,
+                          (void *)PhxCamera_Callback);
+}
+
+/* PhxCamera_Init
+ * Make a camera safe to PhxCamera_Close whatever happens to PhxCamera_Open.
+ */
+void PhxCamera_Init(PhxCamera *pCam)
+{
+    memset(pCam, 0, sizeof(PhxCamera));
+    pCam->frame_shm.fd          = -1;
+    pCam->frame_server.fdListen = -1;
+    pCam->frame_server.fdEpoll  = -1;
+    pCam->frame_server.fdEvent  = -1;
+    pCam->first_irq             = 1;
+}
+
+/* PhxCamera_Open
+ * Open and configure camera dwIndex of the command line, set up its frame
+ * ring, server and marker and check its timing, leaving acquisition
+ * stopped. qwEpochNs is the common CLOCK_MONOTONIC epoch of all cameras.
+ */
+etStat PhxCamera_Open(PhxCamera *pCam, PhxSettings *pSettings, ui32 dwIndex,
+                      ui64 qwEpochNs)
+{
+    etStat eStat = PHX_OK;
+    etParamValue eParamValue;
+    CheetahParamValue bParamValue, expmin, expmax, expcmd, frmmin, frmcmd;
+    etParamValue roiWidth, roiHeight, bufferWidth, bufferHeight;
+    char *configFileName = pSettings->pszConfigFileName[dwIndex];
+    char *pszCamera;
+
+    pCam->dwIndex           = dwIndex;
+    pCam->qwEpochNs         = qwEpochNs;
+    pCam->pszConfigFileName = configFileName;
+    pCam->eAcqMode          = pSettings->eAcqMode;
+    pCam->stages            = pSettings->dwStageMask;
+    pCam->grid              = pSettings->dwGridSize;
+    pCam->threshold         = pSettings->dwThresholdOption;
+    pCam->dwTriggerUs       = pSettings->dwTriggerUs;
+    PhxJitter_Init(&pCam->jitter);
+    PhxJitter_Init(&pCam->latency);
+
+    /* PICC wiring unless the config says otherwise */
+    if (dwIndex == PICC_SHK_DEVNUM)
+        snprintf(pCam->szCamera, sizeof(pCam->szCamera), "SHK");
+    else if (dwIndex == PICC_LYT_DEVNUM)
+        snprintf(pCam->szCamera, sizeof(pCam->szCamera), "LYT");
+    else
+        snprintf(pCam->szCamera, sizeof(pCam->szCamera), "CAM%u", dwIndex);
+    if (pSettings->dwBoardNumber)
+        pCam->dwBoard = pSettings->dwBoardNumber + dwIndex;
+    else if (pSettings->dwCameras > 1)
+        pCam->dwBoard = dwIndex + 1;
+    if (PHX_OK != (eStat = PhxCamera_LoadFile(configFileName, pCam)))
+        goto Error;
+    pszCamera = pCam->szCamera;
+    PHX_LOG_INFO("%s: Using config file: %s, board %u\n", pszCamera,
+                 configFileName, pCam->dwBoard);
+
+    if (PHX_OK != (eStat = PhxRun_Init(&pCam->run, pSettings->dwFrameOption,
+                                       pSettings->dwTimeOption)))
+    {
+        PHX_LOG_ERROR("%s: Failed to set up run control\n", pszCamera);
+        goto Error;
+    }
+    pCam->bRun = 1;
+
+    /* Timing marker, PHX_SYS_MARKER* in [system] */
+    if (PHX_OK != (eStat = PhxMarker_LoadFile(configFileName, &pCam->marker)) ||
+        PHX_OK != (eStat = PhxMarker_Open(&pCam->marker)))
+    {
+        PHX_LOG_ERROR("%s: Failed to set up the timing marker\n", pszCamera);
+        goto Error;
+    }
+
+    /* Real-time settings, PHX_SYS_RT_* in [system]. Lock memory before the
+     * board and the buffers are set up, so all of it is covered */
+    if (PHX_OK != (eStat = PhxRt_LoadFile(configFileName, &pCam->rt)))
+    {
+        PHX_LOG_ERROR("%s: Failed to read the real-time settings\n",
+                      pszCamera);
+        goto Error;
+    }
+    PhxRt_Lock(&pCam->rt);
+    if (PHX_OK != (eStat = PhxBlackBox_LoadFile(configFileName,
+                                                &pCam->blackbox)))
+    {
+        PHX_LOG_ERROR("%s: Failed to read the black box settings\n",
+                      pszCamera);
+        goto Error;
+    }
+    if (PHX_OK != (eStat = PhxRecover_LoadFile(configFileName,
+                                               &pCam->recover)))
+    {
+        PHX_LOG_ERROR("%s: Failed to read the recovery settings\n",
+                      pszCamera);
+        goto Error;
+    }
+    if (dwIndex == 0)
+    {
+        /* The log writer is shared, the first camera's config has it */
+        pthread_t writer;
+        if (PhxLog_Writer(&writer))
+            PhxRt_Apply(&pCam->rt, PHX_RT_WRITER, writer);
+    }
+
+    /* Create a Phoenix handle */
+    eStat = PHX_Create(&pCam->handle, PHX_ErrHandlerDefault);
+    if (PHX_OK != eStat)
+    {
+        PHX_LOG_ERROR("%s: Error PHX_Create\n", pszCamera);
+        goto Error;
+    }
+
+    /* Set the board number */
+    if (PHX_OK != (eStat = PhxConfig_BoardParam(pCam->dwBoard, &eParamValue)))
+    {
+        PHX_LOG_ERROR("%s: Bad board number %u\n", pszCamera, pCam->dwBoard);
+        goto Error;
+    }
+    eStat = PHX_ParameterSet(pCam->handle, PHX_BOARD_NUMBER, &eParamValue);
+    if (PHX_OK != eStat)
+    {
+        PHX_LOG_ERROR("%s: Error PHX_ParameterSet --> Board Number\n",
+                      pszCamera);
+        goto Error;
+    }
+
+    /* Open the Phoenix board */
+    eStat = PHX_Open(pCam->handle);
+    if (PHX_OK != eStat)
+    {
+        PHX_LOG_ERROR("%s: Error PHX_Open\n", pszCamera);
+        goto Error;
+    }
+
+    /* Run the config file */
+    eStat = PhxConfig_RunFile(pCam->handle, configFileName);
+    if (PHX_OK != eStat)
+    {
+        PHX_LOG_ERROR("%s: Error PhxConfig_RunFile\n", pszCamera);
+        goto Error;
+    }
+    if (pCam->recover.bEnabled)
+        PhxRecover_Subscribe(pCam->handle);
+
+    /* The camera is its own event context */
+    {
+        time_t timer;
+        struct tm *tm_info;
+        char szTime[32];
+
+        timer   = time(NULL);
+        tm_info = localtime(&timer);
+        strftime(szTime, sizeof(szTime), "%Y%m%d_%H%M%S", tm_info);
+        snprintf(pCam->name, sizeof(pCam->name), "%s_%s", pszCamera, szTime);
+        snprintf(pCam->marker.szRingFile, sizeof(pCam->marker.szRingFile),
+                 "data/marker_%s.txt", pCam->name);
+    }
+
+    eStat = PHX_ParameterSet(pCam->handle, PHX_EVENT_CONTEXT, (void *)pCam);
+    if (PHX_OK != eStat)
+    {
+        PHX_LOG_ERROR("%s: Error PHX_ParameterSet --> PHX_EVENT_CONTEXT\n",
+                      pszCamera);
+        goto Error;
+    }
+
+    /* Get debugging info */
+    eStat = PHX_ParameterGet(pCam->handle, PHX_ROI_XLENGTH, &roiWidth);
+    eStat = PHX_ParameterGet(pCam->handle, PHX_ROI_YLENGTH, &roiHeight);
+    PHX_LOG_INFO("%s: roi                     : [%d x %d]\n", pszCamera,
+                 roiWidth, roiHeight);
+    eStat = PHX_ParameterGet(pCam->handle, PHX_BUF_DST_XLENGTH, &bufferWidth);
+    eStat = PHX_ParameterGet(pCam->handle, PHX_BUF_DST_YLENGTH, &bufferHeight);
+    PHX_LOG_INFO("%s: destination buffer size : [%d x %d]\n", pszCamera,
+                 bufferWidth, bufferHeight);
+    eStat = Cheetah_ParameterGet(pCam->handle, CHEETAH_INFO_MIN_MAX_XLENGTHS,
+                                 &bParamValue);
+    PHX_LOG_INFO("%s: Camera x size (width)      : [%d to %d]\n", pszCamera,
+                 (bParamValue & 0x0000FFFF), (bParamValue & 0xFFFF0000) >> 16);
+    eStat = Cheetah_ParameterGet(pCam->handle, CHEETAH_INFO_MIN_MAX_YLENGTHS,
+                                 &bParamValue);
+    PHX_LOG_INFO("%s: Camera y size (height)     : [%d to %d]\n", pszCamera,
+                 (bParamValue & 0x0000FFFF), (bParamValue & 0xFFFF0000) >> 16);
+    eStat = Cheetah_ParameterGet(pCam->handle, CHEETAH_INFO_XYLENGTHS,
+                                 &bParamValue);
+    PHX_LOG_INFO("%s: Camera current size        : [%d x %d]\n", pszCamera,
+                 (bParamValue & 0x0000FFFF), (bParamValue & 0xFFFF0000) >> 16);
+    pCam->hei = (bParamValue & 0xFFFF0000) >> 16;
+    pCam->wid = (bParamValue & 0x0000FFFF);
+
+    eStat = Cheetah_ParameterGet(pCam->handle, CHEETAH_A2D_BITS, &bParamValue);
+    switch (bParamValue)
+    {
+    case CHEETAHPARAM_A2D_8B:
+        PHX_LOG_INFO("%s: Camera A2D bits            : 8\n", pszCamera);
+        pCam->bits = 8;
+        break;
+    case CHEETAHPARAM_A2D_10B:
+        PHX_LOG_INFO("%s: Camera A2D bits            : 10\n", pszCamera);
+        pCam->bits = 10;
+        break;
+    case CHEETAHPARAM_A2D_12B:
+        PHX_LOG_INFO("%s: Camera A2D bits            : 12\n", pszCamera);
+        pCam->bits = 12;
+        break;
+    default:
+        PHX_LOG_ERROR("%s: Camera A2D bits            : Unknown [%d]\n",
+                      pszCamera, bParamValue);
+        eStat = PHX_ERROR_BAD_PARAM_VALUE;
+        goto Error;
+        break;
+    }
+
+    eStat =
+        Cheetah_ParameterGet(pCam->handle, CHEETAH_MAOI_STATE, &bParamValue);
+    PHX_LOG_INFO("%s: Camera MAOI state          : %d [%d]\n", pszCamera,
+                 bParamValue, eStat);
+    if (bParamValue == 0)
+    {
+        PHX_LOG_INFO("%s: Setting MAOI state to 1\n", pszCamera);
+        bParamValue = CHEETAHPARAM_ENABLE;
+        eStat = Cheetah_ParameterSet(pCam->handle, CHEETAH_MAOI_STATE,
+                                     &bParamValue);
+
+        if (PHX_OK != eStat)
+        {
+            PHX_LOG_ERROR("%s: Cheetah_ParameterSet --> CHEETAH_MAOI_STATE 1\n",
+                          pszCamera);
+        }
+        sleep(1);
+        PHX_LOG_INFO("%s: Checking camera MAOI state...\n", pszCamera);
+        eStat = Cheetah_ParameterGet(pCam->handle, CHEETAH_MAOI_STATE,
+                                     &bParamValue);
+        PHX_LOG_INFO("%s: Camera MAOI state          : %d [%d]\n", pszCamera,
+                     bParamValue, eStat);
+    }
+
+    /* Triggered capture, -r */
+    if (pSettings->dwTriggerUs &&
+        PHX_OK != (eStat = PhxTrigger_Setup(pCam->handle, pCam->eTrigger)))
+    {
+        PHX_LOG_ERROR("%s: Failed to set up triggering\n", pszCamera);
+        goto Error;
+    }
+
+    eStat =
+        Cheetah_ParameterGet(pCam->handle, CHEETAH_TRGMODE_EN, &bParamValue);
+    PHX_LOG_INFO("%s: Camera trigger mode        : %d\n", pszCamera,
+                 bParamValue);
+
+    /* STOP Capture to put camera in known state */
+    eStat = PHX_StreamRead(pCam->handle, PHX_STOP, (void *)PhxCamera_Callback);
+    if (PHX_OK != eStat)
+    {
+        PHX_LOG_ERROR("%s: PHX_StreamRead --> PHX_STOP\n", pszCamera);
+        goto Error;
+    }
+    PHX_LOG_INFO("%s: Camera stopped\n", pszCamera);
+
+    /* Capture straight into the shared frame ring, one per camera */
+    {
+        PhxImage geometry;
+        char szShm[32];
+        char *p;
+
+        snprintf(szShm, sizeof(szShm), PHX_SHM_PREFIX "%s", pszCamera);
+        for (p = szShm; *p; p++)
+            *p = tolower((unsigned char)*p);
+        geometry.pvData          = NULL;
+        geometry.dwWidth         = pCam->wid;
+        geometry.dwHeight        = pCam->hei;
+        geometry.dwBits          = pCam->bits;
+        geometry.dwBytesPerPixel = pCam->bits > 8 ? 2 : 1;
+        if (PHX_OK == PhxShm_Create(&pCam->frame_shm, szShm, PHX_SHM_SLOTS,
+                                    &geometry, bufferWidth) &&
+            PHX_OK == PhxShm_Attach(&pCam->frame_shm, pCam->handle))
+        {
+            pCam->shm = &pCam->frame_shm;
+        }
+        else
+        {
+            PHX_LOG_WARN("%s: Shared frame ring unavailable, using driver "
+                         "buffers\n",
+                         pszCamera);
+            PhxShm_Destroy(&pCam->frame_shm);
+        }
+    }
+
+    /* Live monitoring, quicklook every -s'th frame, one port per camera */
+    if (pSettings->dwServerPort)
+    {
+        if (PHX_OK == PhxServer_Start(&pCam->frame_server,
+                                      pSettings->dwServerPort + dwIndex,
+                                      pCam->shm, pSettings->dwSlowOption))
+        {
+            pCam->server = &pCam->frame_server;
+            PhxRt_Apply(&pCam->rt, PHX_RT_TELEMETRY, pCam->frame_server.thread);
+        }
+    }
+
+    /* Setup exposure */
+    usleep(500000);
+    // Get minimum frame time and check against command
+    eStat =
+        Cheetah_ParameterGet(pCam->handle, CHEETAH_INFO_MIN_FRM_TIME, &frmmin);
+    frmmin &= 0x00FFFFFF; // 16 us
+    PHX_LOG_INFO("%s: Min frm = %d\n", pszCamera, frmmin);
+    frmcmd = lround(0.2e-3 * ONE_MILLION); // 200 us
+    frmcmd = frmcmd < frmmin ? frmmin : frmcmd;
+    // Set the frame time
+    eStat = Cheetah_ParameterSet(pCam->handle, CHEETAH_PRG_FRMTIME, &frmcmd);
+    if (PHX_OK != eStat)
+    {
+        PHX_LOG_ERROR("%s: Cheetah_ParameterSet --> CHEETAH_FRM_TIME %d\n",
+                      pszCamera, frmcmd);
+        goto Error;
+    }
+    pCam->frmtime = frmcmd;
+    // Get minimum and maximum exposure time and check against command
+    usleep(500000);
+    eStat = Cheetah_ParameterGet(pCam->handle, CHEETAH_INFO_EXP_TIME, &expmin);
+    eStat =
+        Cheetah_ParameterGet(pCam->handle, CHEETAH_INFO_MAX_EXP_TIME, &expmax);
+    expmin &= 0xFF00000;
+    expmin = ((ui32)expmin) >> 24;
+    expmax &= 0x00FFFFFF;
+    PHX_LOG_INFO("%s: Min exp = %d | Max exp = %d\n", pszCamera, expmin,
+                 expmax);
+    expcmd = lround(ONE_MILLION);
+    expcmd = expcmd > expmax ? expmax - 10 * expmin : expcmd;
+    expcmd = expcmd < expmin ? expmin : expcmd;
+    // eStat = Cheetah_ParameterSet(pCam->handle, CHEETAH_EXP_TIME_ABS,
+    // &expcmd); if (PHX_OK != eStat)
+    // {
+    //     printf("%s: Cheetah_ParameterSet --> CHEETAH_EXP_TIME %d\n",
+    //     pszCamera, expcmd); goto Error;
+    // }
+    // Get set exposure and frame times
+    eStat = Cheetah_ParameterGet(pCam->handle, CHEETAH_INFO_EXP_TIME, &expcmd);
+    eStat = Cheetah_ParameterGet(pCam->handle, CHEETAH_INFO_FRM_TIME, &frmcmd);
+    expcmd &= 0x00FFFFFF;
+    frmcmd &= 0x00FFFFFF;
+    PHX_LOG_INFO("%s: Set frm = %d | exp = %d\n", pszCamera, frmcmd, expcmd);
+
+    /* Black box ring, sized for the frame time just set */
+    if (pCam->blackbox.dwPreMs)
+    {
+        PhxImage geometry;
+        geometry.pvData          = NULL;
+        geometry.dwWidth         = pCam->wid;
+        geometry.dwHeight        = pCam->hei;
+        geometry.dwBits          = pCam->bits;
+        geometry.dwBytesPerPixel = pCam->bits > 8 ? 2 : 1;
+        if (PHX_OK == PhxBlackBox_Create(&pCam->blackbox, &geometry, frmcmd,
+                                         pCam->name))
+            PhxRt_Apply(&pCam->rt, PHX_RT_WRITER, pCam->blackbox.thread);
+        else
+            PHX_LOG_WARN("%s: Black box unavailable\n", pszCamera);
+    }
+
+    /* Check the pipeline can sustain this config before starting */
+    {
+        PhxModel model;
+        if (PHX_OK == PhxModel_LoadFile(configFileName, &model))
+        {
+            model.dwFrameTimeUs = frmcmd;
+            model.dwProcStages  = !!(pCam->stages & PHX_STAGE_STATS) +
+                                 !!(pCam->stages & PHX_STAGE_CENT);
+            /* The black box is the sustained writer, the BMP stage only
+             * saves one frame. A dump should be out before the ring has
+             * refilled its pre-trigger window, or the next event gets a
+             * short one */
+            if (pCam->blackbox.bEnabled)
+            {
+                model.qwRecordBytes =
+                    (ui64)pCam->blackbox.dwSlots *
+                    (pCam->blackbox.lenFrame + sizeof(PhxBlackBoxMeta));
+                model.dwRecordMs = pCam->blackbox.dwPreMs;
+            }
+            PhxModel_Compute(&model);
+            if (PhxModel_Report(&model))
+            {
+                PHX_LOG_WARN("%s: config exceeds pipeline capacity\n",
+                             pszCamera);
+            }
+        }
+    }
+
+    // Get CCD temperature
+    // We only do this once now because it fails often
+    PHX_LOG_INFO("%s: Get temp = %.2f\n", pszCamera,
+                 Cheetah_GetTemp(pCam->handle));
+    return PHX_OK;
+
+Error:
+    if (PHX_OK == eStat)
+        eStat = PHX_ERROR_BAD_PARAM;
+    return eStat;
+}
+
+/* PhxCamera_Start
+ * Start the batch or poll thread the settings ask for and the acquisition.
+ * Each camera's poll thread gets its own CPU, counting up from -q or down
+ * from the last CPU.
+ */
+etStat PhxCamera_Start(PhxCamera *pCam, PhxSettings *pSettings)
+{
+    char *pszCamera = pCam->szCamera;
+    etStat eStat;
+    int nCpu;
+
+    if (pCam->bRunning)
+        return PHX_OK;
+
+    if (pCam->eAcqMode == PHX_ACQ_BATCH)
+    {
+        eStat = PhxBatch_Start(&pCam->frame_batch, pCam->handle,
+                               pSettings->dwBatchOption, 0, PhxCamera_Frame,
+                               pCam);
+        if (PHX_OK != eStat)
+        {
+            PHX_LOG_ERROR("%s: Failed to start the batch consumer\n",
+                          pszCamera);
+            return eStat;
+        }
+        pCam->batch = &pCam->frame_batch;
+        PhxRt_Apply(&pCam->rt, PHX_RT_PROC, pCam->frame_batch.thread);
+    }
+    /* Poll mode keeps the callback, the library still counts ready
+     * buffers through it, but the callback leaves them alone */
+    pCam->poll = pCam->eAcqMode == PHX_ACQ_POLL;
+
+    /* Nothing the frame path touches may fault from here on */
+    if (pCam->shm)
+        PhxRt_Prefault(pCam->frame_shm.pHeader, pCam->frame_shm.len);
+    PhxRt_FaultsStart(&pCam->rt);
+
+    PhxRun_Start(&pCam->run);
+    eStat = PHX_StreamRead(pCam->handle, PHX_START, (void *)PhxCamera_Callback);
+    if (PHX_OK != eStat)
+    {
+        PHX_LOG_ERROR("%s: PHX_StreamRead --> PHX_START\n", pszCamera);
+        return eStat;
+    }
+    pCam->bRunning = 1;
+
+    if (pCam->poll)
+    {
+        nCpu = pSettings->nPollCpu >= 0
+                   ? pSettings->nPollCpu + (int)pCam->dwIndex
+                   : (int)sysconf(_SC_NPROCESSORS_ONLN) - 1 -
+                         (int)pCam->dwIndex;
+        eStat = PhxPoll_Start(&pCam->frame_poll, pCam->handle, nCpu,
+                              PHX_POLL_PRIORITY, PhxCamera_Frame, pCam);
+        if (PHX_OK != eStat)
+        {
+            PHX_LOG_ERROR("%s: Failed to start the poll thread\n", pszCamera);
+            return eStat;
+        }
+        PhxRt_Apply(&pCam->rt, PHX_RT_PROC, pCam->frame_poll.thread);
+    }
+
+    /* Faults are only acted on once the stream is up */
+    if (PHX_OK == PhxRecover_Start(&pCam->recover, pszCamera,
+                                   pCam->dwTriggerUs ? pCam->dwTriggerUs
+                                                     : pCam->frmtime,
+                                   PhxCamera_Recover, pCam) &&
+        pCam->recover.bRunning)
+        PhxRt_Apply(&pCam->rt, PHX_RT_RECOVER, pCam->recover.thread);
+    PHX_LOG_INFO("%s: Camera started\n", pszCamera);
+    return PHX_OK;
+}
+
+/* PhxCamera_Drain
+ * Put the frames still ready on the board through the frame path, once
+ * nothing else gets buffers.
+ */
+static void PhxCamera_Drain(PhxCamera *pCam)
+{
+    ui32 dwReady = 0;
+    ui32 i;
+
+    if (PHX_OK !=
+        PHX_ParameterGet(pCam->handle, PHX_BUFFER_READY_COUNT, &dwReady))
+        return;
+    for (i = 0; i < dwReady; i++)
+    {
+        stImageBuff stBuffer;
+        struct timespec ts;
+
+        if (PHX_OK != PHX_StreamRead(pCam->handle, PHX_BUFFER_GET, &stBuffer))
+            break;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        PhxCamera_Frame(pCam->handle, &stBuffer, PHX_INTRPT_BUFFER_READY,
+                        ts.tv_sec * 1000000000ull + ts.tv_nsec, pCam);
+        PHX_StreamRead(pCam->handle, PHX_BUFFER_RELEASE, NULL);
+    }
+    if (i)
+        PHX_LOG_INFO("%s: Drained %u frames after the stop\n", pCam->szCamera,
+                     i);
+}
+
+/* PhxCamera_Stop
+ * Stop the acquisition at the end of the frame being captured, put every
+ * frame already captured through the frame path, then end the run and
+ * flush the black box. Nothing captured is dropped, unless the run had
+ * already reached its frame or time limit.
+ */
+void PhxCamera_Stop(PhxCamera *pCam)
+{
+    if (!pCam->bRunning)
+        return;
+
+    /* Or it takes the stop for a stall */
+    PhxRecover_Stop(&pCam->recover);
+
+    /* No callback is in flight once PHX_STOP returns, so the batch can go.
+     * Any callback after that leaves the buffers to the drain. */
+    PHX_StreamRead(pCam->handle, PHX_STOP, NULL);
+    __atomic_store_n(&pCam->batch, NULL, __ATOMIC_RELEASE);
+    __atomic_store_n(&pCam->poll, 1, __ATOMIC_RELEASE);
+    PhxBatch_Stop(&pCam->frame_batch);
+    PhxPoll_Stop(&pCam->frame_poll);
+    PhxCamera_Drain(pCam);
+    pCam->bRunning = 0;
+
+    PhxRun_Stop(&pCam->run);
+    PhxBlackBox_Flush(&pCam->blackbox);
+    PhxRt_FaultsReport(&pCam->rt);
+}
+
+/* Log what the run did, after PhxCamera_Stop */
+void PhxCamera_Report(PhxCamera *pCam)
+{
+    char *pszCamera = pCam->szCamera;
+    PhxRunStop eStop = pCam->run.eStop;
+    double elapsed   = PhxRun_Elapsed(&pCam->run);
+
+    PHX_LOG_INFO("%s: Run ended (%s) after %.3f s\n", pszCamera,
+                 eStop == PHX_RUN_FRAMES    ? "frame limit"
+                 : eStop == PHX_RUN_TIMEOUT ? "time limit"
+                                            : "stopped",
+                 elapsed);
+    if (pCam->stats_frames)
+    {
+        PHX_LOG_INFO("%s: Last frame: min %u max %u mean %.1f saturated %u, "
+                     "run mean %.1f\n",
+                     pszCamera, pCam->stats.dwMin, pCam->stats.dwMax,
+                     pCam->stats.dMean, pCam->stats.dwSaturated,
+                     pCam->mean_sum / pCam->stats_frames);
+    }
+    if (pCam->stages & PHX_STAGE_CENT)
+    {
+        PHX_LOG_INFO("%s: Last frame: %u of %u cells above threshold\n",
+                     pszCamera, pCam->cent.dwValid,
+                     pCam->cent.dwCellsX * pCam->cent.dwCellsY);
+    }
+    PhxJitter_Report(&pCam->jitter, PhxConfig_AcqModeName(pCam->eAcqMode));
+    if (pCam->latency.qwCount)
+        PhxJitter_Report(&pCam->latency, "trigger latency");
+    PHX_LOG_INFO("%s: Total frames: %" PRIu64 " (%.1f fps)\n", pszCamera,
+                 pCam->frames, elapsed > 0 ? pCam->frames / elapsed : 0.0);
+}
+
+/* PhxCamera_Close
+ * Abort any capture and release everything the camera holds, in an order
+ * that keeps the board from DMAing into memory that is gone. Safe on a
+ * camera that was only PhxCamera_Init'ed or partly opened.
+ */
+void PhxCamera_Close(PhxCamera *pCam)
+{
+    /* Before the handle they use goes away */
+    PhxRecover_Destroy(&pCam->recover);
+    PhxBatch_Stop(&pCam->frame_batch);
+    PhxPoll_Stop(&pCam->frame_poll);
+
+    if (pCam->handle)
+    {
+        PHX_StreamRead(pCam->handle, PHX_ABORT,
+                       NULL);           /* Now cease all captures */
+        PHX_Close(&pCam->handle);       /* Close the Phoenix board */
+        PHX_Destroy(&pCam->handle);     /* Destroy the Phoenix handle */
+    }
+    pCam->bRunning = 0;
+
+    /* Only once the board can no longer DMA into it */
+    PhxServer_Stop(&pCam->frame_server);
+    PhxShm_Destroy(&pCam->frame_shm);
+    pCam->server = NULL;
+    pCam->shm    = NULL;
+
+    PhxBlackBox_Destroy(&pCam->blackbox);
+    PhxMarker_Close(&pCam->marker);
+    if (pCam->bRun)
+    {
+        PhxRun_Destroy(&pCam->run);
+        pCam->bRun = 0;
+    }
+}
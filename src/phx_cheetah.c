@@ -1,4 +1,5 @@
 #include "phx_cheetah.h"
+#include "phx_log.h"
 #include <phx_api.h> /* Main Phoenix library */
 
 // #define _VERBOSE
@@ -78,6 +79,34 @@ etStat Cheetah_ControlWrite(tHandle hCamera, ui8 *msgBuffer, ui8 msgLength)
 #define READ_CMD  0x52
 #define WRITE_CMD 0x57
 
+/* Error code returned by the camera after a NAK (0x15) */
+static const char *Cheetah_NakString(ui8 code)
+{
+    switch (code)
+    {
+    case 0:
+        return "No error";
+    case 1:
+        return "Invalid command";
+    case 2:
+        return "Time-out";
+    case 3:
+        return "Checksum error";
+    case 4:
+        return "Value less then minimum";
+    case 5:
+        return "Value higher than maximum";
+    case 6:
+        return "AGC error";
+    case 7:
+        return "Supervisor mode error";
+    case 8:
+        return "Mode not supported error";
+    default:
+        return "Unknown error";
+    }
+}
+
 etStat Cheetah_ParameterGet(tHandle hCamera, CheetahParam parameter,
                             ui32 *value)
 {
@@ -110,45 +139,9 @@ etStat Cheetah_ParameterGet(tHandle hCamera, CheetahParam parameter,
     }
     else if (rxMsgBuffer[0] == 0x15)
     { /* camera returns an error code */
-        int x;
-        printf(
-            "Camera error code returned for command : Cheetah_ParameterGet\n");
-        for (x = 0; x < txMsgLength; x++)
-            printf("[%02X]", txMsgBuffer[x]);
-        printf("\n");
-        printf("address  0x%02X%02X\n", txMsgBuffer[1], txMsgBuffer[2]);
-        printf("data     0x%02X%02X%02X%02X (%d)\n", rxMsgBuffer[3],
-               rxMsgBuffer[4], rxMsgBuffer[5], rxMsgBuffer[6], *(ui32 *)value);
-        switch (rxMsgBuffer[1])
-        {
-        case 0:
-            printf("No error\n");
-            break;
-        case 1:
-            printf("Invalid command\n");
-            break;
-        case 2:
-            printf("Time-out\n");
-            break;
-        case 3:
-            printf("Checksum error\n");
-            break;
-        case 4:
-            printf("Value less then minimum\n");
-            break;
-        case 5:
-            printf("Value higher than maximum\n");
-            break;
-        case 6:
-            printf("AGC error\n");
-            break;
-        case 7:
-            printf("Supervisor mode error\n");
-            break;
-        case 8:
-            printf("Mode not supported error\n");
-            break;
-        }
+        PHX_LOG_ERROR("CHEETAH: ParameterGet NAK: address 0x%02X%02X: %s\n",
+                      txMsgBuffer[1], txMsgBuffer[2],
+                      Cheetah_NakString(rxMsgBuffer[1]));
         eStat = PHX_ERROR_NOT_IMPLEMENTED;
         goto Return;
     }
@@ -195,45 +188,10 @@ etStat Cheetah_ParameterSet(tHandle hCamera, CheetahParam parameter,
     }
     else if (rxMsgBuffer[0] == 0x15)
     { /* camera returns an error code */
-        int x;
-        printf(
-            "Camera error code returned for command : Cheetah_ParameterSet \n");
-        for (x = 0; x < txMsgLength; x++)
-            printf("[%02X]", txMsgBuffer[x]);
-        printf("\n");
-        printf("address  0x%02X%02X\n", txMsgBuffer[1], txMsgBuffer[2]);
-        printf("data     0x%02X%02X%02X%02X (%d)\n", txMsgBuffer[3],
-               txMsgBuffer[4], txMsgBuffer[5], txMsgBuffer[6], *(ui32 *)value);
-        switch (rxMsgBuffer[1])
-        {
-        case 0:
-            printf("No error\n");
-            break;
-        case 1:
-            printf("Invalid command\n");
-            break;
-        case 2:
-            printf("Time-out\n");
-            break;
-        case 3:
-            printf("Checksum error\n");
-            break;
-        case 4:
-            printf("Value less then minimum\n");
-            break;
-        case 5:
-            printf("Value higher than maximum\n");
-            break;
-        case 6:
-            printf("AGC error\n");
-            break;
-        case 7:
-            printf("Supervisor mode error\n");
-            break;
-        case 8:
-            printf("Mode not supported error\n");
-            break;
-        }
+        PHX_LOG_ERROR("CHEETAH: ParameterSet NAK: address 0x%02X%02X data "
+                      "0x%08X: %s\n",
+                      txMsgBuffer[1], txMsgBuffer[2], *(ui32 *)value,
+                      Cheetah_NakString(rxMsgBuffer[1]));
         eStat = PHX_ERROR_NOT_IMPLEMENTED;
         goto Return;
     }
@@ -289,7 +247,7 @@ etStat Cheetah_SaveToUser2(tHandle hCamera)
     return Cheetah_ParameterSet(hCamera, parameter, &value);
 }
 
-etStat CHEETAH_SoftwareTriggerStart(tHandle hCamera)
+etStat Cheetah_SoftwareTriggerStart(tHandle hCamera)
 {
     CheetahParamValue value = 0x1;
     CheetahParam parameter  = CHEETAH_SOFT_TRIGGER;
@@ -540,7 +498,7 @@ float Cheetah_GetTemp(tHandle hCamera)
     eStat = Cheetah_ParameterGet(hCamera, CHEETAH_INFO_CCD_TEMP, &bParamValue);
     if (PHX_OK != eStat)
     {
-        printf("PHX: Error Cheetah_GetTemp\n");
+        PHX_LOG_WARN("PHX: Error Cheetah_GetTemp\n");
     }
     else
     {
@@ -1,17 +1,49 @@
+#include <errno.h>
 #include <string.h>
+#include <strings.h>
 
+#include "phx_batch.h"
 #include "phx_cheetah.h"
 #include "phx_config.h"
+#include "phx_log.h"
 #include "phx_phoenix.h"
 #include "phx_phoenix_cheetah.h"
+#include "phx_proc.h"
 
-// #define _VERBOSE
+
+/* Add a camera's config file. The first one given replaces the default,
+ * an empty name leaves no camera at all */
+static void PhxConfig_AddCamera(PhxSettings *ptPhxCmd, char *pszName,
+                                int *pbDefault)
+{
+    ui32 dwCamera;
+
+    if (*pbDefault)
+    {
+        ptPhxCmd->dwCameras = 0;
+        *pbDefault          = 0;
+    }
+    if (0 == strlen(pszName))
+        return;
+    if (ptPhxCmd->dwCameras == PHX_MAX_CAMERAS)
+    {
+        printf("Too many cameras, ignoring %s\n", pszName);
+        return;
+    }
+    dwCamera = ptPhxCmd->dwCameras++;
+    strncpy(ptPhxCmd->bConfigFileName[dwCamera], pszName,
+            PHX_MAX_FILE_LENGTH - 1);
+    ptPhxCmd->bConfigFileName[dwCamera][PHX_MAX_FILE_LENGTH - 1] = '\0';
+    ptPhxCmd->pszConfigFileName[dwCamera] =
+        ptPhxCmd->bConfigFileName[dwCamera];
+}
 
 /* PhxCommonParseCmd(ForBrief)
  * adapted from active silicons comand parser
  * Parse the command line parameters, and place results in a common structure
  * The command line parameters take the following form:
  * AppName -b<BoardNumber> -c<ConfigFileName> -o<OutputFileName>
+ * -e<Stages> -x<Stages>
  * -b<BoardNumber>    is an optional parameter which specifies which board to
  * use. The default value is board 1. -c<ConfigFileName> is an optional
  * parameter specifying the Phoenix Config File, The default value is an OS
@@ -21,14 +53,25 @@
  * Whilst all parameters may be specified, each example application only uses
  * appropriate parameters, for example "OutputFileName" will be ignored by the
  * phxinfo example.
+ * -e<Stages> and -x<Stages> enable and disable comma separated processing
+ * stages (stats, cent, bmp, all). -f<Frames> and -t<Seconds> limit the run,
+ * 0 meaning no limit. -m<Frames> processes frames in batches of that many,
+ * see phx_batch.h. -a<Mode> picks how frames are delivered: irq (default),
+ * batch (implied by -m) or poll, with -q<Cpu> the CPU the poll thread is
+ * pinned to, by default the last one, see phx_poll.h. -c may be given once
+ * per camera, up to PHX_MAX_CAMERAS, to capture from several boards at
+ * once, see phx_camera.h. -r<Us> triggers every camera with that period
+ * instead of letting them run free, see phx_trigger.h. A bare argument is
+ * taken as a config file name too.
  */
 etStat PhxConfig_ParseCmdLine(int argc, char *argv[], PhxSettings *ptPhxCmd)
 {
     etStat eStat = PHX_OK;
+    int bDefault = 1;
+    ui32 i;
 
     /* Initialise the PhxCmd structure with default values */
     ptPhxCmd->dwBoardNumber     = 1;
-    ptPhxCmd->pszConfigFileName = NULL;
     ptPhxCmd->pszOutputFileName = NULL;
     ptPhxCmd->dwBayerOption     = 11;
     ptPhxCmd->dwGridSize        = 66;
@@ -38,8 +81,14 @@ etStat PhxConfig_ParseCmdLine(int argc, char *argv[], PhxSettings *ptPhxCmd)
     ptPhxCmd->dwThresholdOption = 40;
     ptPhxCmd->dwTrackOption     = 50;
     ptPhxCmd->dwSlowOption      = 10;
-    ptPhxCmd->pszConfigFileName = DEFAULT_CFG_FILENAME;
+    ptPhxCmd->pszConfigFileName[0] = DEFAULT_CFG_FILENAME;
+    ptPhxCmd->dwCameras            = 1;
     ptPhxCmd->dwServerPort      = 8000;
+    ptPhxCmd->dwStageMask       = PHX_STAGE_DEFAULT;
+    ptPhxCmd->dwBatchOption     = 0;
+    ptPhxCmd->eAcqMode          = PHX_ACQ_IRQ;
+    ptPhxCmd->nPollCpu          = -1;
+    ptPhxCmd->dwTriggerUs       = 0;
 
     /* The first argument is always the function name itself */
     printf("\n*** %s ***\n", *argv);
@@ -63,11 +112,7 @@ etStat PhxConfig_ParseCmdLine(int argc, char *argv[], PhxSettings *ptPhxCmd)
             /* Config File */
             case 'c':
             case 'C':
-                strcpy(ptPhxCmd->bConfigFileName, *argv + 2);
-                if (0 != strlen(ptPhxCmd->bConfigFileName))
-                    ptPhxCmd->pszConfigFileName = ptPhxCmd->bConfigFileName;
-                else
-                    ptPhxCmd->pszConfigFileName = NULL;
+                PhxConfig_AddCamera(ptPhxCmd, *argv + 2, &bDefault);
                 break;
 
             /* griD size */
@@ -128,32 +173,113 @@ etStat PhxConfig_ParseCmdLine(int argc, char *argv[], PhxSettings *ptPhxCmd)
                 ptPhxCmd->dwSlowOption = atoi(*argv + 2);
                 break;
 
-            /* Slow motion subsample */
+            /* Moderation, frames per batch */
+            case 'm':
+            case 'M':
+                ptPhxCmd->dwBatchOption = atoi(*argv + 2);
+                break;
+
+            /* Acquisition mode */
+            case 'a':
+            case 'A':
+                if (strcasecmp(*argv + 2, "irq") == 0)
+                    ptPhxCmd->eAcqMode = PHX_ACQ_IRQ;
+                else if (strcasecmp(*argv + 2, "batch") == 0)
+                    ptPhxCmd->eAcqMode = PHX_ACQ_BATCH;
+                else if (strcasecmp(*argv + 2, "poll") == 0)
+                    ptPhxCmd->eAcqMode = PHX_ACQ_POLL;
+                else
+                    printf("Unrecognised mode in %s - Ignoring\n", *argv);
+                break;
+
+            /* Poll CPU */
+            case 'q':
+            case 'Q':
+                ptPhxCmd->nPollCpu = atoi(*argv + 2);
+                break;
+
+            /* tRigger period */
+            case 'r':
+            case 'R':
+                ptPhxCmd->dwTriggerUs = atoi(*argv + 2);
+                break;
+
+            /* Server port */
             case 'p':
             case 'P':
                 ptPhxCmd->dwServerPort = atoi(*argv + 2);
                 break;
 
+            /* Enable processing stages */
+            case 'e':
+            case 'E':
+            {
+                ui32 dwStages;
+                if (PhxProc_str_to_stages(*argv + 2, &dwStages))
+                    ptPhxCmd->dwStageMask |= dwStages;
+                else
+                    printf("Unrecognised stage in %s - Ignoring\n", *argv);
+                break;
+            }
+
+            /* eXclude processing stages */
+            case 'x':
+            case 'X':
+            {
+                ui32 dwStages;
+                if (PhxProc_str_to_stages(*argv + 2, &dwStages))
+                    ptPhxCmd->dwStageMask &= ~dwStages;
+                else
+                    printf("Unrecognised stage in %s - Ignoring\n", *argv);
+                break;
+            }
+
             default:
                 printf("Unrecognised parameter %c - Ignoring\n", *(*argv + 1));
                 break;
             }
         }
+        else
+        {
+            /* Bare config file name, as accepted before options existed */
+            PhxConfig_AddCamera(ptPhxCmd, *argv, &bDefault);
+        }
         argc--;
         argv++;
     }
 
+    /* -m alone selects batch mode, -abatch alone a default batch */
+    if (ptPhxCmd->eAcqMode == PHX_ACQ_IRQ && ptPhxCmd->dwBatchOption > 1)
+        ptPhxCmd->eAcqMode = PHX_ACQ_BATCH;
+    if (ptPhxCmd->eAcqMode == PHX_ACQ_BATCH && ptPhxCmd->dwBatchOption <= 1)
+        ptPhxCmd->dwBatchOption = PHX_BATCH_DEFAULT;
+
     printf("Using BoardNumber = %d\n", ptPhxCmd->dwBoardNumber);
     printf("      Config File = ");
-    if (NULL == ptPhxCmd->pszConfigFileName)
+    if (0 == ptPhxCmd->dwCameras)
         printf("<None>\n");
-    else
-        printf("%s\n", ptPhxCmd->pszConfigFileName);
+    for (i = 0; i < ptPhxCmd->dwCameras; i++)
+        printf("%s%s\n", i ? "                    " : "",
+               ptPhxCmd->pszConfigFileName[i]);
     printf("      Output File = ");
     if (NULL == ptPhxCmd->pszOutputFileName)
         printf("<None>\n");
     else
         printf("%s\n", ptPhxCmd->pszOutputFileName);
+    printf("      Frame limit = %u\n", ptPhxCmd->dwFrameOption);
+    printf("      Time limit  = %u s\n", ptPhxCmd->dwTimeOption);
+    printf("      Acquisition = %s", PhxConfig_AcqModeName(ptPhxCmd->eAcqMode));
+    if (ptPhxCmd->eAcqMode == PHX_ACQ_BATCH)
+        printf(", %u frames", ptPhxCmd->dwBatchOption);
+    else if (ptPhxCmd->eAcqMode == PHX_ACQ_POLL && ptPhxCmd->nPollCpu >= 0)
+        printf(", CPU %d", ptPhxCmd->nPollCpu);
+    printf("\n");
+    if (ptPhxCmd->dwTriggerUs)
+        printf("      Trigger     = every %u us\n", ptPhxCmd->dwTriggerUs);
+    printf("      Stages      = %s%s%s\n",
+           ptPhxCmd->dwStageMask & PHX_STAGE_STATS ? "stats " : "",
+           ptPhxCmd->dwStageMask & PHX_STAGE_CENT ? "cent " : "",
+           ptPhxCmd->dwStageMask & PHX_STAGE_BMP ? "bmp" : "");
     printf("\n");
 
     /* Create an eCamConfigLoad parameter by OR'ing the board number with the
@@ -162,31 +288,44 @@ etStat PhxConfig_ParseCmdLine(int argc, char *argv[], PhxSettings *ptPhxCmd)
         (etCamConfigLoad)(PHX_DIGITAL /*| PHX_NO_RECONFIGURE*/ |
                           ptPhxCmd->dwBoardNumber);
 
-    switch (ptPhxCmd->dwBoardNumber)
+    eStat = PhxConfig_BoardParam(ptPhxCmd->dwBoardNumber,
+                                 &ptPhxCmd->eBoardNumber);
+
+    return eStat;
+}
+
+/* PhxConfig_BoardParam
+ * PHX_BOARD_NUMBER value for a board number, 0 being PHX_BOARD_NUMBER_AUTO.
+ */
+etStat PhxConfig_BoardParam(ui32 dwBoardNumber, etParamValue *peBoardNumber)
+{
+    etStat eStat = PHX_OK;
+
+    switch (dwBoardNumber)
     {
     case 0:
-        ptPhxCmd->eBoardNumber = PHX_BOARD_NUMBER_AUTO;
+        *peBoardNumber = PHX_BOARD_NUMBER_AUTO;
         break;
     case 1:
-        ptPhxCmd->eBoardNumber = PHX_BOARD_NUMBER_1;
+        *peBoardNumber = PHX_BOARD_NUMBER_1;
         break;
     case 2:
-        ptPhxCmd->eBoardNumber = PHX_BOARD_NUMBER_2;
+        *peBoardNumber = PHX_BOARD_NUMBER_2;
         break;
     case 3:
-        ptPhxCmd->eBoardNumber = PHX_BOARD_NUMBER_3;
+        *peBoardNumber = PHX_BOARD_NUMBER_3;
         break;
     case 4:
-        ptPhxCmd->eBoardNumber = PHX_BOARD_NUMBER_4;
+        *peBoardNumber = PHX_BOARD_NUMBER_4;
         break;
     case 5:
-        ptPhxCmd->eBoardNumber = PHX_BOARD_NUMBER_5;
+        *peBoardNumber = PHX_BOARD_NUMBER_5;
         break;
     case 6:
-        ptPhxCmd->eBoardNumber = PHX_BOARD_NUMBER_6;
+        *peBoardNumber = PHX_BOARD_NUMBER_6;
         break;
     case 7:
-        ptPhxCmd->eBoardNumber = PHX_BOARD_NUMBER_7;
+        *peBoardNumber = PHX_BOARD_NUMBER_7;
         break;
     default:
         eStat = PHX_ERROR_BAD_PARAM_VALUE;
@@ -198,6 +337,19 @@ Error:
     return eStat;
 }
 
+const char *PhxConfig_AcqModeName(PhxAcqMode eMode)
+{
+    switch (eMode)
+    {
+    case PHX_ACQ_BATCH:
+        return "batch";
+    case PHX_ACQ_POLL:
+        return "poll";
+    default:
+        return "irq";
+    }
+}
+
 int PhxConfig_str_to_region(char *str, CheetahRoi *proi)
 {
     char *token;
@@ -259,11 +411,38 @@ int PhxConfig_str_to_region(char *str, CheetahRoi *proi)
     return 1;
 }
 
+/* PhxConfig_RunFile
+ * Load the factory settings and apply a config file to the board and the
+ * camera.
+ */
 etStat PhxConfig_RunFile(tHandle handle, char *pszConfigFileName)
+{
+    etStat eStat;
+    FILE *fp;
+
+    PHX_LOG_INFO("PHX: Opening config: %s\n", pszConfigFileName);
+    fp = fopen(pszConfigFileName, "r");
+    if (fp == NULL)
+    {
+        PHX_LOG_ERROR("PHX: Cannot open config %s: %s\n", pszConfigFileName,
+                      strerror(errno));
+        return PHX_ERROR_BAD_PARAM;
+    }
+    PHX_LOG_INFO("PHX: config file opened.\n");
+
+    eStat = PhxConfig_RunStream(handle, fp);
+    fclose(fp);
+    return eStat;
+}
+
+/* PhxConfig_RunStream
+ * PhxConfig_RunFile on an open config, e.g. one cached in memory and
+ * opened with fmemopen. The stream is left open.
+ */
+etStat PhxConfig_RunStream(tHandle handle, FILE *fp)
 {
     etStat eStat = PHX_OK;
 
-    FILE *fp;
     char strLine[PHX_CONFIG_MAX_LINE];
 
     char delimit[] = "= \t\r\n\v\f";
@@ -276,55 +455,35 @@ etStat PhxConfig_RunFile(tHandle handle, char *pszConfigFileName)
     char strParamValue[PHX_CONFIG_MAX_LINE];
 
     eStat = Cheetah_LoadFromFactory(handle);
-    printf("PHX: Opening config: %s\n", pszConfigFileName);
-
-    fp = fopen(pszConfigFileName, "r");
-    if (fp == NULL)
-    {
-        printf("Config file\r\n");
-        perror("fopen()");
-    }
-    else
-    {
-        printf("PHX: config file opened.\r\n");
-    }
 
     while (fgets(strLine, PHX_CONFIG_MAX_LINE, (FILE *)fp))
     {
         if (strstr(strLine, strPhoenix) != NULL)
         {
-#ifdef _VERBOSE
-            printf("PHX: phoenix block found\n");
-#endif
+            PHX_LOG_DEBUG("PHX: phoenix block found\n");
             fphx    = 1;
             fcheetah = 0;
             fsystem = 0;
         }
         else if (strstr(strLine, strSystem) != NULL)
         {
-#ifdef _VERBOSE
-            printf("PHX: system block found\n");
-#endif
+            PHX_LOG_DEBUG("PHX: system block found\n");
             fphx    = 0;
             fcheetah = 0;
             fsystem = 1;
         }
         else if (strstr(strLine, strCamera) != NULL)
         {
-#ifdef _VERBOSE
-            printf("PHX: cheetah block found\n");
-#endif
+            PHX_LOG_DEBUG("PHX: cheetah block found\n");
             fphx    = 0;
             fcheetah = 1;
             fsystem = 0;
         }
         else if (strLine[0] == '\n')
         {
-#ifdef _VERBOSE
-            printf("PHX: run PHX_ParameterSet( handle, (etParam)( "
-                   "PHX_DUMMY_PARAM | "
-                   "PHX_CACHE_FLUSH | PHX_FORCE_REWRITE ), NULL )\n");
-#endif
+            PHX_LOG_DEBUG("PHX: run PHX_ParameterSet( handle, (etParam)( "
+                          "PHX_DUMMY_PARAM | "
+                          "PHX_CACHE_FLUSH | PHX_FORCE_REWRITE ), NULL )\n");
             eStat =
                 PHX_ParameterSet(handle,
                                  (etParam)(PHX_DUMMY_PARAM | PHX_CACHE_FLUSH |
@@ -339,7 +498,12 @@ etStat PhxConfig_RunFile(tHandle handle, char *pszConfigFileName)
             token = strtok(NULL, delimit);
             strcpy(strParamValue, token);
 
-            if (fsystem)
+            if (fsystem && strncmp(strParam, "PHX_SYS_", 8) == 0)
+            {
+                /* Application settings, read by the modules they belong to */
+                PHX_LOG_DEBUG("PHX: skip %s\n", strParam);
+            }
+            else if (fsystem)
             {
                 PhxCheetahParam pbParam;
                 // RESET
@@ -361,19 +525,18 @@ etStat PhxConfig_RunFile(tHandle handle, char *pszConfigFileName)
                         }
                         else
                         {
-#ifdef _VERBOSE
-                            printf("PHX: run eStat = "
-                                   "Phx_Cheetah_Configure(handle, %s, roi = "
-                                   "[%d, %d, %d, %d, %s, %s])\n",
-                                   strParam, roi.x_offset, roi.y_offset,
-                                   roi.x_length, roi.y_length,
-                                   roi.x_binning == CHEETAHPARAM_BINNING_1X
-                                       ? "CHEETAHPARAM_BINNING_1X"
-                                       : "er",
-                                   roi.y_binning == CHEETAHPARAM_BINNING_1X
-                                       ? "CHEETAHPARAM_BINNING_1X"
-                                       : "er");
-#endif
+                            PHX_LOG_DEBUG(
+                                "PHX: run eStat = "
+                                "Phx_Cheetah_Configure(handle, %s, roi = "
+                                "[%d, %d, %d, %d, %s, %s])\n",
+                                strParam, roi.x_offset, roi.y_offset,
+                                roi.x_length, roi.y_length,
+                                roi.x_binning == CHEETAHPARAM_BINNING_1X
+                                    ? "CHEETAHPARAM_BINNING_1X"
+                                    : "er",
+                                roi.y_binning == CHEETAHPARAM_BINNING_1X
+                                    ? "CHEETAHPARAM_BINNING_1X"
+                                    : "er");
                             eStat = Phx_Cheetah_Configure(handle, pbParam, &roi);
                         }
                     }
@@ -387,11 +550,10 @@ etStat PhxConfig_RunFile(tHandle handle, char *pszConfigFileName)
                         }
                         else
                         {
-#ifdef _VERBOSE
-                            printf("PHX: run eStat = "
-                                   "Phx_Cheetah_Configure(handle, %s, %s)\n",
-                                   strParam, strParamValue);
-#endif
+                            PHX_LOG_DEBUG(
+                                "PHX: run eStat = "
+                                "Phx_Cheetah_Configure(handle, %s, %s)\n",
+                                strParam, strParamValue);
                             eStat = Phx_Cheetah_Configure(handle, pbParam,
                                                          &pbParamValue);
                         }
@@ -415,11 +577,9 @@ etStat PhxConfig_RunFile(tHandle handle, char *pszConfigFileName)
                     }
                     else
                     {
-#ifdef _VERBOSE
-                        printf("PHX: run eStat = Cheetah_ParameterSet(handle, "
-                               "%s, %s)\n",
-                               strParam, strParamValue);
-#endif
+                        PHX_LOG_DEBUG("PHX: run eStat = "
+                                      "Cheetah_ParameterSet(handle, %s, %s)\n",
+                                      strParam, strParamValue);
                         eStat =
                             Cheetah_ParameterSet(handle, bParam, &bParamValue);
                     }
@@ -442,11 +602,9 @@ etStat PhxConfig_RunFile(tHandle handle, char *pszConfigFileName)
                     }
                     else
                     {
-#ifdef _VERBOSE
-                        printf("PHX: run eStat = PHX_ParameterSet(handle, %s, "
-                               "%s)\n",
-                               strParam, strParamValue);
-#endif
+                        PHX_LOG_DEBUG("PHX: run eStat = "
+                                      "PHX_ParameterSet(handle, %s, %s)\n",
+                                      strParam, strParamValue);
                         eStat = PHX_ParameterSet(handle, pParam, &pParamValue);
                     }
                 }
@@ -455,20 +613,15 @@ etStat PhxConfig_RunFile(tHandle handle, char *pszConfigFileName)
     }
     if (feof(fp))
     {
-#ifdef _VERBOSE
-        printf("PHX: run eStat = PHX_ParameterSet( handle, (etParam)( "
-               "PHX_DUMMY_PARAM | PHX_CACHE_FLUSH | PHX_FORCE_REWRITE ), NULL "
-               ")\n");
-#endif
+        PHX_LOG_DEBUG("PHX: run eStat = PHX_ParameterSet( handle, (etParam)( "
+                      "PHX_DUMMY_PARAM | PHX_CACHE_FLUSH | PHX_FORCE_REWRITE ), "
+                      "NULL )\n");
         eStat = PHX_ParameterSet(
             handle,
             (etParam)(PHX_DUMMY_PARAM | PHX_CACHE_FLUSH | PHX_FORCE_REWRITE),
             NULL);
     }
 
-    fclose(fp);
-#ifdef _VERBOSE
-    printf("PHX: config done. Returning %d\n", eStat);
-#endif
+    PHX_LOG_DEBUG("PHX: config done. Returning %d\n", eStat);
     return eStat;
 }
@@ -0,0 +1,65 @@
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#include "phx_jitter.h"
+#include "phx_log.h"
+
+void PhxJitter_Init(PhxJitter *pJitter)
+{
+    memset(pJitter, 0, sizeof(PhxJitter));
+    pJitter->qwMin = UINT64_MAX;
+}
+
+/* PhxJitter_Add
+ * Account for a frame delivered at qwTimeNs. Called from the frame path,
+ * so it only does arithmetic.
+ */
+void PhxJitter_Add(PhxJitter *pJitter, ui64 qwTimeNs)
+{
+    ui64 qwLast = pJitter->qwLast;
+
+    pJitter->qwLast = qwTimeNs;
+    if (qwLast == 0 || qwTimeNs < qwLast)
+        return;
+    PhxJitter_Sample(pJitter, qwTimeNs - qwLast);
+}
+
+/* PhxJitter_Sample
+ * Account for a time qwNs directly, rather than an interval.
+ */
+void PhxJitter_Sample(PhxJitter *pJitter, ui64 qwNs)
+{
+    double dDelta;
+
+    if (qwNs < pJitter->qwMin)
+        pJitter->qwMin = qwNs;
+    if (qwNs > pJitter->qwMax)
+        pJitter->qwMax = qwNs;
+    pJitter->qwCount++;
+    dDelta = qwNs - pJitter->dMean;
+    pJitter->dMean += dDelta / pJitter->qwCount;
+    pJitter->dM2 += dDelta * (qwNs - pJitter->dMean);
+}
+
+/* PhxJitter_Report
+ * Log one line, in us. Peak-to-peak is max - min of the interval.
+ */
+void PhxJitter_Report(PhxJitter *pJitter, const char *pszName)
+{
+    double dStd;
+
+    if (pJitter->qwCount == 0)
+    {
+        PHX_LOG_INFO("JITTER: %s: no frames\n", pszName);
+        return;
+    }
+    dStd = pJitter->qwCount > 1 ? sqrt(pJitter->dM2 / (pJitter->qwCount - 1))
+                                : 0.0;
+    PHX_LOG_INFO("JITTER: %s: %" PRIu64 " samples, mean %.1f us, std %.2f "
+                 "us, min %.1f us, max %.1f us, p-p %.1f us\n",
+                 pszName, pJitter->qwCount, pJitter->dMean / 1000.0,
+                 dStd / 1000.0, pJitter->qwMin / 1000.0,
+                 pJitter->qwMax / 1000.0,
+                 (pJitter->qwMax - pJitter->qwMin) / 1000.0);
+}
@@ -0,0 +1,402 @@
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "phx_log.h"
+
+#define PHX_LOG_IDLE_MS 10 /* Formatter poll interval when rings are empty */
+
+/* Single producer (the owning thread), single consumer (the formatter) */
+typedef struct _PhxLogRing
+{
+    struct _PhxLogRing *pNext;
+    ui32 dwHead;    /* Next record to write, producer only */
+    ui32 dwTail;    /* Next record to format, formatter only */
+    ui64 qwDropped; /* Records lost to a full ring */
+    PhxLogRecord records[PHX_LOG_RING];
+} PhxLogRing;
+
+static __thread PhxLogRing *s_pRing;
+static PhxLogRing *s_pRings;
+static ui64 s_qwStart;
+static pthread_t s_thread;
+static int s_bStarted;
+static int s_bRunning;
+
+ui64 PhxLog_Now(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (ui64)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static void PhxLog_SetEpoch(void)
+{
+    ui64 qwZero = 0;
+    __atomic_compare_exchange_n(&s_qwStart, &qwZero, PhxLog_Now(), 0,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+}
+
+/* The calling thread's ring, allocated and published on first use */
+static PhxLogRing *PhxLog_Ring(void)
+{
+    PhxLogRing *pRing = s_pRing;
+
+    if (pRing != NULL)
+        return pRing;
+
+    pRing = calloc(1, sizeof(PhxLogRing));
+    if (pRing == NULL)
+        return NULL;
+    PhxLog_SetEpoch();
+    pRing->pNext = __atomic_load_n(&s_pRings, __ATOMIC_ACQUIRE);
+    while (!__atomic_compare_exchange_n(&s_pRings, &pRing->pNext, pRing, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        ;
+    s_pRing = pRing;
+    return pRing;
+}
+
+/* PhxLog_Spec
+ * Parse one conversion specification, p pointing just past the '%'.
+ * Returns a pointer past the conversion character and reports the
+ * conversion, whether it has an l/ll/j/z/t modifier and how many '*'
+ * width/precision arguments precede the value.
+ */
+static const char *PhxLog_Spec(const char *p, char *pcConv, int *pbLong,
+                               int *pnStar)
+{
+    *pbLong = 0;
+    *pnStar = 0;
+
+    while (*p && strchr("-+ #0'", *p))
+        p++;
+    if (*p == '*')
+    {
+        (*pnStar)++;
+        p++;
+    }
+    while (*p >= '0' && *p <= '9')
+        p++;
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*')
+        {
+            (*pnStar)++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+            p++;
+    }
+    while (*p && strchr("hlLqjzt", *p))
+    {
+        if (*p != 'h' && *p != 'L')
+            *pbLong = 1;
+        p++;
+    }
+    *pcConv = *p;
+    return *p ? p + 1 : p;
+}
+
+static void PhxLog_Capture(PhxLogRecord *pRec, const char *pszFmt, va_list ap)
+{
+    const char *p = pszFmt;
+    ui32 n = 0, s = 0;
+    char cConv;
+    int bLong, nStar;
+
+    while ((p = strchr(p, '%')) != NULL)
+    {
+        p = PhxLog_Spec(p + 1, &cConv, &bLong, &nStar);
+        if (cConv == '%')
+            continue;
+        if (n + nStar >= PHX_LOG_MAX_ARGS)
+            break;
+        while (nStar--)
+            pRec->args[n++].q = va_arg(ap, int);
+
+        switch (cConv)
+        {
+        case 'd':
+        case 'i':
+            pRec->args[n++].q = bLong ? va_arg(ap, long long) : va_arg(ap, int);
+            break;
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            pRec->args[n++].q =
+                bLong ? va_arg(ap, unsigned long long) : va_arg(ap, unsigned);
+            break;
+        case 'c':
+            pRec->args[n++].q = va_arg(ap, int);
+            break;
+        case 'p':
+            pRec->args[n++].q = (ui64)(uintptr_t)va_arg(ap, void *);
+            break;
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A':
+            pRec->args[n++].d = va_arg(ap, double);
+            break;
+        case 's':
+        {
+            const char *psz = va_arg(ap, const char *);
+            if (psz == NULL)
+                psz = "(null)";
+            pRec->args[n++].q =
+                s < PHX_LOG_STR_BYTES - 1 ? s : PHX_LOG_STR_BYTES - 1;
+            while (s < PHX_LOG_STR_BYTES - 2 && *psz)
+                pRec->str[s++] = *psz++;
+            if (s < PHX_LOG_STR_BYTES - 1)
+                pRec->str[s++] = '\0';
+            break;
+        }
+        default:
+            /* Unknown conversion, stop capturing */
+            pRec->dwArgs = n;
+            return;
+        }
+    }
+    pRec->dwArgs = n;
+}
+
+/* PhxLog_Write
+ * Hot path: copy the call into the thread's ring. Never blocks.
+ */
+void PhxLog_Write(ui32 dwLevel, const char *pszFmt, ...)
+{
+    PhxLogRing *pRing = PhxLog_Ring();
+    PhxLogRecord *pRec;
+    ui32 dwHead;
+    va_list ap;
+
+    if (pRing == NULL)
+        return;
+
+    dwHead = pRing->dwHead;
+    if (dwHead - __atomic_load_n(&pRing->dwTail, __ATOMIC_ACQUIRE) >=
+        PHX_LOG_RING)
+    {
+        __atomic_add_fetch(&pRing->qwDropped, 1, __ATOMIC_RELAXED);
+        return;
+    }
+
+    pRec          = &pRing->records[dwHead & (PHX_LOG_RING - 1)];
+    pRec->qwTime  = PhxLog_Now();
+    pRec->pszFmt  = pszFmt;
+    pRec->dwLevel = dwLevel;
+    pRec->str[PHX_LOG_STR_BYTES - 1] = '\0';
+    va_start(ap, pszFmt);
+    PhxLog_Capture(pRec, pszFmt, ap);
+    va_end(ap);
+
+    __atomic_store_n(&pRing->dwHead, dwHead + 1, __ATOMIC_RELEASE);
+}
+
+#define PHX_LOG_EMIT(fp, spec, w, nStar, val)                                  \
+    do                                                                         \
+    {                                                                          \
+        if ((nStar) == 0)                                                      \
+            fprintf(fp, spec, val);                                            \
+        else if ((nStar) == 1)                                                 \
+            fprintf(fp, spec, (w)[0], val);                                    \
+        else                                                                   \
+            fprintf(fp, spec, (w)[0], (w)[1], val);                            \
+    } while (0)
+
+/* Rebuild the message by replaying each conversion against its argument */
+static void PhxLog_Format(PhxLogRecord *pRec, FILE *fp)
+{
+    static const char cLevel[] = "EWID";
+    const char *p              = pRec->pszFmt;
+    ui32 n                     = 0;
+
+    fprintf(fp, "[%12.6f] %c ",
+            (double)(long long)(pRec->qwTime - s_qwStart) / 1.0e9,
+            cLevel[pRec->dwLevel & 3]);
+
+    while (*p)
+    {
+        const char *q = strchr(p, '%');
+        char spec[32];
+        char cConv;
+        int bLong, nStar, w[2] = {0, 0};
+        size_t i, len;
+
+        if (q == NULL)
+        {
+            fputs(p, fp);
+            break;
+        }
+        fwrite(p, 1, q - p, fp);
+        p = PhxLog_Spec(q + 1, &cConv, &bLong, &nStar);
+
+        /* Copy the specification, dropping L as values are stored as double */
+        for (i = 0, len = 0; q + i < p && len < sizeof(spec) - 1; i++)
+            if (q[i] != 'L')
+                spec[len++] = q[i];
+        spec[len] = '\0';
+
+        if (cConv == '%')
+        {
+            fputc('%', fp);
+            continue;
+        }
+        if (n + nStar + 1 > pRec->dwArgs)
+        {
+            fputs(spec, fp);
+            continue;
+        }
+        for (i = 0; i < (size_t)nStar; i++)
+            w[i] = (int)pRec->args[n++].q;
+
+        switch (cConv)
+        {
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o':
+            if (bLong)
+                PHX_LOG_EMIT(fp, spec, w, nStar, (long long)pRec->args[n].q);
+            else
+                PHX_LOG_EMIT(fp, spec, w, nStar, (int)pRec->args[n].q);
+            break;
+        case 'c':
+            PHX_LOG_EMIT(fp, spec, w, nStar, (int)pRec->args[n].q);
+            break;
+        case 'p':
+            PHX_LOG_EMIT(fp, spec, w, nStar,
+                         (void *)(uintptr_t)pRec->args[n].q);
+            break;
+        case 's':
+            PHX_LOG_EMIT(fp, spec, w, nStar, pRec->str + pRec->args[n].q);
+            break;
+        default:
+            PHX_LOG_EMIT(fp, spec, w, nStar, pRec->args[n].d);
+            break;
+        }
+        n++;
+    }
+}
+
+/* Format everything queued, oldest first across all rings */
+static void PhxLog_Drain(void)
+{
+    for (;;)
+    {
+        PhxLogRing *pRing, *pOldest = NULL;
+        ui64 qwOldest = 0;
+
+        for (pRing = __atomic_load_n(&s_pRings, __ATOMIC_ACQUIRE);
+             pRing != NULL; pRing = pRing->pNext)
+        {
+            ui32 dwTail = pRing->dwTail;
+            if (dwTail != __atomic_load_n(&pRing->dwHead, __ATOMIC_ACQUIRE))
+            {
+                ui64 qwTime =
+                    pRing->records[dwTail & (PHX_LOG_RING - 1)].qwTime;
+                if (pOldest == NULL || qwTime < qwOldest)
+                {
+                    pOldest  = pRing;
+                    qwOldest = qwTime;
+                }
+            }
+        }
+        if (pOldest == NULL)
+            break;
+
+        PhxLog_Format(&pOldest->records[pOldest->dwTail & (PHX_LOG_RING - 1)],
+                      stdout);
+        __atomic_store_n(&pOldest->dwTail, pOldest->dwTail + 1,
+                         __ATOMIC_RELEASE);
+    }
+    fflush(stdout);
+}
+
+static void *PhxLog_Thread(void *pvArg)
+{
+    struct timespec tIdle = {0, PHX_LOG_IDLE_MS * 1000000L};
+
+    while (__atomic_load_n(&s_bRunning, __ATOMIC_ACQUIRE))
+    {
+        PhxLog_Drain();
+        nanosleep(&tIdle, NULL);
+    }
+    PhxLog_Drain();
+    return NULL;
+}
+
+/* PhxLog_Start
+ * Start the formatter thread. PhxLog_Stop is registered with atexit so
+ * queued records are flushed on every exit path.
+ */
+etStat PhxLog_Start(void)
+{
+    if (s_bStarted)
+        return PHX_OK;
+
+    PhxLog_SetEpoch();
+    __atomic_store_n(&s_bRunning, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&s_thread, NULL, PhxLog_Thread, NULL))
+    {
+        s_bRunning = 0;
+        return PHX_ERROR_MALLOC_FAILED;
+    }
+    s_bStarted = 1;
+    atexit(PhxLog_Stop);
+    return PHX_OK;
+}
+
+/* Stop the formatter and flush what is left */
+void PhxLog_Stop(void)
+{
+    ui64 qwDropped;
+
+    if (s_bStarted)
+    {
+        __atomic_store_n(&s_bRunning, 0, __ATOMIC_RELEASE);
+        pthread_join(s_thread, NULL);
+        s_bStarted = 0;
+    }
+    else
+    {
+        PhxLog_Drain();
+    }
+
+    qwDropped = PhxLog_Dropped();
+    if (qwDropped)
+        printf("LOG: %llu records dropped\n", (unsigned long long)qwDropped);
+}
+
+/* The formatter thread, for PhxRt_Apply. Returns 0 if it is not running */
+int PhxLog_Writer(pthread_t *pThread)
+{
+    if (!s_bStarted)
+        return 0;
+    *pThread = s_thread;
+    return 1;
+}
+
+ui64 PhxLog_Dropped(void)
+{
+    PhxLogRing *pRing;
+    ui64 qwDropped = 0;
+
+    for (pRing = __atomic_load_n(&s_pRings, __ATOMIC_ACQUIRE); pRing != NULL;
+         pRing = pRing->pNext)
+        qwDropped += __atomic_load_n(&pRing->qwDropped, __ATOMIC_RELAXED);
+    return qwDropped;
+}
@@ -0,0 +1,268 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#if PICC_DIO_ENABLE
+#include <sys/io.h>
+#endif
+
+#include "phx_config.h"
+#include "phx_log.h"
+#include "phx_marker.h"
+
+static int PhxMarker_str_to_mode(char *str, PhxMarkerMode *peMode)
+{
+    if (strcmp(str, "PHX_MARKER_OFF") == 0)
+        *peMode = PHX_MARKER_OFF;
+    else if (strcmp(str, "PHX_MARKER_DIO") == 0)
+        *peMode = PHX_MARKER_DIO;
+    else if (strcmp(str, "PHX_MARKER_GPIO") == 0)
+        *peMode = PHX_MARKER_GPIO;
+    else if (strcmp(str, "PHX_MARKER_RING") == 0)
+        *peMode = PHX_MARKER_RING;
+    else
+        return 0;
+    return 1;
+}
+
+/* PhxMarker_LoadFile
+ * Read the PHX_SYS_MARKER* keys from the [system] section of a config file.
+ * The defaults are the SHK wiring: DIO board port C, bit C1.
+ */
+etStat PhxMarker_LoadFile(char *pszConfigFileName, PhxMarker *pMarker)
+{
+    etStat eStat = PHX_OK;
+
+    FILE *fp;
+    char strLine[PHX_CONFIG_MAX_LINE];
+    char delimit[] = "= \t\r\n\v\f";
+    char fsystem = 0;
+    char *strParam, *strParamValue;
+
+    memset(pMarker, 0, sizeof(PhxMarker));
+    pMarker->eMode     = PHX_MARKER_OFF;
+    pMarker->dwDioBase = PICC_DIO_BASE;
+    pMarker->dwDioPort = PICC_DIO_PORTC;
+    pMarker->dwBit     = 1;
+
+    fp = fopen(pszConfigFileName, "r");
+    if (fp == NULL)
+    {
+        PHX_LOG_ERROR("MARKER: Cannot open %s: %s\n", pszConfigFileName,
+                      strerror(errno));
+        eStat = PHX_ERROR_BAD_PARAM;
+        goto Error;
+    }
+
+    while (fgets(strLine, PHX_CONFIG_MAX_LINE, fp))
+    {
+        if (strLine[0] == '[')
+        {
+            fsystem = strstr(strLine, "[system]") != NULL;
+            continue;
+        }
+        if (!fsystem)
+            continue;
+
+        strParam      = strtok(strLine, delimit);
+        strParamValue = strtok(NULL, delimit);
+        if (strParam == NULL || strParamValue == NULL)
+            continue;
+
+        if (strcmp(strParam, "PHX_SYS_MARKER") == 0)
+        {
+            if (!PhxMarker_str_to_mode(strParamValue, &pMarker->eMode))
+                eStat = PHX_ERROR_BAD_PARAM_VALUE;
+        }
+        else if (strcmp(strParam, "PHX_SYS_MARKER_DIO") == 0)
+            pMarker->dwDioBase = strtoul(strParamValue, NULL, 0);
+        else if (strcmp(strParam, "PHX_SYS_MARKER_DIO_PORT") == 0)
+            pMarker->dwDioPort = strtoul(strParamValue, NULL, 0);
+        else if (strcmp(strParam, "PHX_SYS_MARKER_GPIO") == 0)
+            pMarker->qwGpioAddr = strtoull(strParamValue, NULL, 0);
+        else if (strcmp(strParam, "PHX_SYS_MARKER_BIT") == 0)
+            pMarker->dwBit = strtoul(strParamValue, NULL, 0) & 31;
+    }
+    fclose(fp);
+
+    if (pMarker->eMode == PHX_MARKER_GPIO && pMarker->qwGpioAddr == 0)
+    {
+        PHX_LOG_ERROR("MARKER: PHX_MARKER_GPIO needs PHX_SYS_MARKER_GPIO\n");
+        eStat = PHX_ERROR_BAD_PARAM_VALUE;
+    }
+Error:
+    return eStat;
+}
+
+/* PhxMarker_Open
+ * Get at the marker hardware and drive it low. Needs root for the DIO and
+ * GPIO modes.
+ */
+etStat PhxMarker_Open(PhxMarker *pMarker)
+{
+    etStat eStat = PHX_OK;
+
+    switch (pMarker->eMode)
+    {
+    case PHX_MARKER_DIO:
+#if PICC_DIO_ENABLE
+        if (ioperm(pMarker->dwDioBase, PICC_DIO_LENGTH, 1))
+        {
+            PHX_LOG_ERROR("MARKER: Failed to set ioperm: %s\n",
+                          strerror(errno));
+            eStat = PHX_ERROR_BAD_PARAM;
+            goto Error;
+        }
+        outb(0x01, pMarker->dwDioBase + PICC_DIO_PAGE); /* Page 1 */
+        outb(0x80, pMarker->dwDioBase + PICC_DIO_CTRL); /* Ports output */
+        PHX_LOG_INFO("MARKER: DIO 0x%x port %u bit %u\n", pMarker->dwDioBase,
+                     pMarker->dwDioPort, pMarker->dwBit);
+#else
+        PHX_LOG_ERROR("MARKER: Built without PICC_DIO_ENABLE\n");
+        eStat = PHX_ERROR_BAD_PARAM_VALUE;
+        goto Error;
+#endif
+        break;
+
+    case PHX_MARKER_GPIO:
+    {
+        long lPage = sysconf(_SC_PAGESIZE);
+        off_t offPage = pMarker->qwGpioAddr & ~(ui64)(lPage - 1);
+        int fd = open("/dev/mem", O_RDWR | O_SYNC);
+
+        if (fd < 0)
+        {
+            PHX_LOG_ERROR("MARKER: Cannot open /dev/mem: %s\n",
+                          strerror(errno));
+            eStat = PHX_ERROR_BAD_PARAM;
+            goto Error;
+        }
+        pMarker->lenMap = lPage;
+        pMarker->pvMap = mmap(NULL, pMarker->lenMap, PROT_READ | PROT_WRITE,
+                              MAP_SHARED, fd, offPage);
+        close(fd);
+        if (pMarker->pvMap == MAP_FAILED)
+        {
+            PHX_LOG_ERROR("MARKER: Cannot map GPIO: %s\n", strerror(errno));
+            pMarker->pvMap = NULL;
+            eStat = PHX_ERROR_BAD_PARAM;
+            goto Error;
+        }
+        pMarker->pdwGpio =
+            (volatile ui32 *)((char *)pMarker->pvMap +
+                              (pMarker->qwGpioAddr - offPage));
+        PHX_LOG_INFO("MARKER: GPIO 0x%" PRIx64 " bit %u\n",
+                     pMarker->qwGpioAddr, pMarker->dwBit);
+        break;
+    }
+
+    case PHX_MARKER_RING:
+        pMarker->pRing = calloc(PHX_MARKER_ENTRIES, sizeof(PhxMarkerEntry));
+        if (pMarker->pRing == NULL)
+        {
+            eStat = PHX_ERROR_MALLOC_FAILED;
+            goto Error;
+        }
+        /* Fault the pages in now rather than in the frame callback */
+        memset(pMarker->pRing, 0, PHX_MARKER_ENTRIES * sizeof(PhxMarkerEntry));
+        break;
+
+    default:
+        break;
+    }
+
+    PhxMarker_Set(pMarker, 0);
+    return eStat;
+
+Error:
+    pMarker->eMode = PHX_MARKER_OFF;
+    return eStat;
+}
+
+/* PhxMarker_Drive
+ * Called through PhxMarker_Set from the frame callback, so it never blocks.
+ * The DIO port is written whole, as before, the GPIO register is
+ * read-modify-written.
+ */
+void PhxMarker_Drive(PhxMarker *pMarker, int on)
+{
+    ui32 dwMask = 1u << pMarker->dwBit;
+
+    switch (pMarker->eMode)
+    {
+#if PICC_DIO_ENABLE
+    case PHX_MARKER_DIO:
+        outb(on ? dwMask : 0, pMarker->dwDioBase + pMarker->dwDioPort);
+        break;
+#endif
+
+    case PHX_MARKER_GPIO:
+        if (on)
+            *pMarker->pdwGpio |= dwMask;
+        else
+            *pMarker->pdwGpio &= ~dwMask;
+        break;
+
+    case PHX_MARKER_RING:
+    {
+        PhxMarkerEntry *pEntry =
+            &pMarker->pRing[pMarker->qwHead++ & (PHX_MARKER_ENTRIES - 1)];
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        pEntry->qwTimeNs = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        pEntry->dwOn     = on;
+        break;
+    }
+
+    default:
+        break;
+    }
+}
+
+/* PhxMarker_Close
+ * Drive the marker low and let go of it. In ring mode the entries still in
+ * the ring are written to szRingFile, oldest first, one "on time_ns" pair
+ * per line.
+ */
+void PhxMarker_Close(PhxMarker *pMarker)
+{
+    PhxMarker_Set(pMarker, 0);
+
+    if (pMarker->pRing)
+    {
+        FILE *fp = pMarker->szRingFile[0] ? fopen(pMarker->szRingFile, "w")
+                                          : NULL;
+        ui64 qw = pMarker->qwHead > PHX_MARKER_ENTRIES
+                      ? pMarker->qwHead - PHX_MARKER_ENTRIES
+                      : 0;
+
+        PHX_LOG_INFO("MARKER: %" PRIu64 " marks\n", pMarker->qwHead);
+        if (fp)
+        {
+            for (; qw < pMarker->qwHead; qw++)
+            {
+                PhxMarkerEntry *pEntry =
+                    &pMarker->pRing[qw & (PHX_MARKER_ENTRIES - 1)];
+                fprintf(fp, "%u %" PRIu64 "\n", pEntry->dwOn,
+                        pEntry->qwTimeNs);
+            }
+            fclose(fp);
+            PHX_LOG_INFO("MARKER: Saved marks to %s\n", pMarker->szRingFile);
+        }
+        free(pMarker->pRing);
+        pMarker->pRing = NULL;
+    }
+    if (pMarker->pvMap)
+    {
+        munmap(pMarker->pvMap, pMarker->lenMap);
+        pMarker->pvMap   = NULL;
+        pMarker->pdwGpio = NULL;
+    }
+    pMarker->eMode = PHX_MARKER_OFF;
+}
@@ -0,0 +1,253 @@
+#include <errno.h>
+#include <string.h>
+
+#include "phx_config.h"
+#include "phx_log.h"
+#include "phx_model.h"
+#include "phx_phoenix.h"
+#include "phx_phoenix_cheetah.h"
+
+static ui32 PhxModel_BytesPerPixel(etParamValue eDstFormat)
+{
+    switch (eDstFormat)
+    {
+    case PHX_DST_FORMAT_Y8:
+        return 1;
+    case PHX_DST_FORMAT_Y10:
+    case PHX_DST_FORMAT_Y12:
+    case PHX_DST_FORMAT_Y14:
+    case PHX_DST_FORMAT_Y16:
+        return 2;
+    case PHX_DST_FORMAT_Y32:
+        return 4;
+    default:
+        return 0;
+    }
+}
+
+/* PhxModel_LoadFile
+ * Fill the model inputs from a config file without touching the hardware.
+ * Only the keys that affect throughput are read, everything else is ignored.
+ * When no destination format is given in [phoenix] it is derived from
+ * PHX_CHEETAH_BIT_DEPTH the same way Phx_Cheetah_Configure does.
+ */
+etStat PhxModel_LoadFile(char *pszConfigFileName, PhxModel *pModel)
+{
+    etStat eStat = PHX_OK;
+
+    FILE *fp;
+    char strLine[PHX_CONFIG_MAX_LINE];
+
+    char delimit[] = "= \t\r\n\v\f";
+    char fphx = 0, fcheetah = 0, fsystem = 0;
+    char *strParam, *strParamValue;
+    ui32 bDstFormatSet = 0;
+
+    memset(pModel, 0, sizeof(PhxModel));
+    pModel->dwBitDepth = 8;
+    pModel->dwTaps     = 1;
+    pModel->eDstFormat = PHX_DST_FORMAT_Y8;
+
+    fp = fopen(pszConfigFileName, "r");
+    if (fp == NULL)
+    {
+        PHX_LOG_ERROR("MODEL: Cannot open %s: %s\n", pszConfigFileName,
+                      strerror(errno));
+        eStat = PHX_ERROR_BAD_PARAM;
+        goto Error;
+    }
+
+    while (fgets(strLine, PHX_CONFIG_MAX_LINE, fp))
+    {
+        if (strstr(strLine, "[phoenix]") != NULL)
+        {
+            fphx     = 1;
+            fcheetah = 0;
+            fsystem  = 0;
+            continue;
+        }
+        else if (strstr(strLine, "[system]") != NULL)
+        {
+            fphx     = 0;
+            fcheetah = 0;
+            fsystem  = 1;
+            continue;
+        }
+        else if (strstr(strLine, "[cheetah]") != NULL)
+        {
+            fphx     = 0;
+            fcheetah = 1;
+            fsystem  = 0;
+            continue;
+        }
+
+        strParam      = strtok(strLine, delimit);
+        strParamValue = strtok(NULL, delimit);
+        if (strParam == NULL || strParamValue == NULL)
+            continue;
+
+        if (fsystem)
+        {
+            PhxCheetahParam pbParam;
+            PhxCheetahParamValue pbParamValue;
+            if (!Phx_Cheetah_str_to_PhxCheetahParam(strParam, &pbParam))
+                continue;
+            if (pbParam == PHX_CHEETAH_ROI)
+            {
+                if (!PhxConfig_str_to_region(strParamValue, &pModel->roi))
+                    eStat = PHX_ERROR_BAD_PARAM_VALUE;
+            }
+            else if (Phx_Cheetah_str_to_PhxCheetahParamValue(strParamValue,
+                                                             &pbParamValue))
+            {
+                if (pbParam == PHX_CHEETAH_TAPS)
+                    pModel->dwTaps =
+                        pbParamValue == PHX_CHEETAH_DOUBLE_TAP ? 2 : 1;
+                else if (pbParamValue == PHX_CHEETAH_10BIT)
+                    pModel->dwBitDepth = 10;
+                else if (pbParamValue == PHX_CHEETAH_12BIT)
+                    pModel->dwBitDepth = 12;
+                else
+                    pModel->dwBitDepth = 8;
+            }
+        }
+        else if (fcheetah)
+        {
+            CheetahParam bParam;
+            CheetahParamValue bParamValue;
+            if (Cheetah_str_to_CheetahParam(strParam, &bParam) &&
+                bParam == CHEETAH_PRG_FRMTIME &&
+                Cheetah_str_to_CheetahParamValues(strParamValue, &bParamValue))
+                pModel->dwFrameTimeUs = bParamValue;
+        }
+        else if (fphx)
+        {
+            etParam pParam;
+            etParamValue pParamValue;
+            if (Phx_str_to_etParam(strParam, &pParam) &&
+                pParam == PHX_DST_FORMAT &&
+                PHX_str_to_etParamValues(strParamValue, &pParamValue))
+            {
+                pModel->eDstFormat = pParamValue;
+                bDstFormatSet      = 1;
+            }
+        }
+    }
+    fclose(fp);
+
+    if (!bDstFormatSet)
+    {
+        if (pModel->dwBitDepth == 10)
+            pModel->eDstFormat = PHX_DST_FORMAT_Y10;
+        else if (pModel->dwBitDepth == 12)
+            pModel->eDstFormat = PHX_DST_FORMAT_Y12;
+    }
+
+    PHX_LOG_DEBUG("MODEL: %s: %ux%u, %u bit, %u tap, frame time %u us\n",
+                  pszConfigFileName, pModel->roi.x_length,
+                  pModel->roi.y_length, pModel->dwBitDepth, pModel->dwTaps,
+                  pModel->dwFrameTimeUs);
+Error:
+    return eStat;
+}
+
+/* PhxModel_Compute
+ * Derive frame size, rates and per-frame costs from the model inputs.
+ * The expected frame rate is the programmed frame time, clipped to what the
+ * Camera Link taps can carry; line and frame blanking are not modelled, so
+ * the link figure is an upper bound.
+ */
+void PhxModel_Compute(PhxModel *pModel)
+{
+    double dPixels = (double)pModel->roi.x_length * pModel->roi.y_length;
+
+    pModel->dwBytesPerPixel = PhxModel_BytesPerPixel(pModel->eDstFormat);
+    pModel->qwBytesPerFrame = (ui64)dPixels * pModel->dwBytesPerPixel;
+
+    pModel->dLinkFrameRate = 0;
+    if (dPixels > 0)
+        pModel->dLinkFrameRate =
+            PHX_MODEL_CL_CLOCK_HZ * pModel->dwTaps / dPixels;
+
+    pModel->dFrameRate = pModel->dLinkFrameRate;
+    if (pModel->dwFrameTimeUs > 0 &&
+        1.0e6 / pModel->dwFrameTimeUs < pModel->dFrameRate)
+        pModel->dFrameRate = 1.0e6 / pModel->dwFrameTimeUs;
+
+    pModel->dFramePeriodUs = 0;
+    if (pModel->dFrameRate > 0)
+        pModel->dFramePeriodUs = 1.0e6 / pModel->dFrameRate;
+
+    pModel->dDmaBandwidth = pModel->qwBytesPerFrame * pModel->dFrameRate;
+    pModel->dDiskBandwidth = 0;
+    if (pModel->qwRecordBytes > 0 && pModel->dwRecordMs > 0)
+        pModel->dDiskBandwidth =
+            pModel->qwRecordBytes * 1000.0 / pModel->dwRecordMs;
+
+    pModel->dCallbackUs = PHX_MODEL_CALLBACK_US;
+    pModel->dProcUs =
+        dPixels * pModel->dwProcStages * PHX_MODEL_PROC_NS_PER_PIXEL / 1000.0;
+}
+
+/* PhxModel_Report
+ * Print the model and warn about every stage that cannot keep up with the
+ * expected frame rate. Returns the number of such stages.
+ */
+int PhxModel_Report(PhxModel *pModel)
+{
+    int nOver = 0;
+    double dCpuUs = pModel->dCallbackUs + pModel->dProcUs;
+
+    PHX_LOG_INFO("MODEL: %u x %u, %u bit, %u tap, %u byte/px, %llu "
+                 "byte/frame\n",
+                 pModel->roi.x_length, pModel->roi.y_length,
+                 pModel->dwBitDepth, pModel->dwTaps, pModel->dwBytesPerPixel,
+                 (unsigned long long)pModel->qwBytesPerFrame);
+    PHX_LOG_INFO("MODEL: Frame rate %.1f fps (link limit %.1f fps), period "
+                 "%.1f us\n",
+                 pModel->dFrameRate, pModel->dLinkFrameRate,
+                 pModel->dFramePeriodUs);
+    PHX_LOG_INFO("MODEL: PCIe DMA %.1f MB/s of %.1f MB/s\n",
+                 pModel->dDmaBandwidth / 1.0e6, PHX_MODEL_DMA_BPS / 1.0e6);
+    PHX_LOG_INFO("MODEL: Recorder %.1f MB/s of %.1f MB/s\n",
+                 pModel->dDiskBandwidth / 1.0e6, PHX_MODEL_DISK_BPS / 1.0e6);
+    PHX_LOG_INFO("MODEL: CPU per frame: callback %.1f us + processing %.1f "
+                 "us = %.1f us of %.1f us\n",
+                 pModel->dCallbackUs, pModel->dProcUs, dCpuUs,
+                 pModel->dFramePeriodUs);
+
+    if (pModel->dwBytesPerPixel == 0)
+    {
+        PHX_LOG_WARN("MODEL: Unknown destination format, frame size not "
+                     "modelled\n");
+        nOver++;
+    }
+    if (pModel->dwFrameTimeUs > 0 &&
+        1.0e6 / pModel->dwFrameTimeUs > pModel->dLinkFrameRate)
+    {
+        PHX_LOG_WARN("MODEL: Frame time %u us is shorter than the link can "
+                     "carry, camera will run at %.1f fps\n",
+                     pModel->dwFrameTimeUs, pModel->dLinkFrameRate);
+        nOver++;
+    }
+    if (pModel->dDmaBandwidth > PHX_MODEL_DMA_BPS)
+    {
+        PHX_LOG_WARN("MODEL: DMA cannot keep up, expect FIFO overflows\n");
+        nOver++;
+    }
+    if (pModel->dDiskBandwidth > PHX_MODEL_DISK_BPS)
+    {
+        PHX_LOG_WARN("MODEL: Recorder cannot keep up, a dump takes %.1f s "
+                     "instead of %u ms\n",
+                     pModel->qwRecordBytes / PHX_MODEL_DISK_BPS,
+                     pModel->dwRecordMs);
+        nOver++;
+    }
+    if (pModel->dFramePeriodUs > 0 && dCpuUs > pModel->dFramePeriodUs)
+    {
+        PHX_LOG_WARN("MODEL: Per-frame CPU cost exceeds the frame period, "
+                     "frames will be dropped\n");
+        nOver++;
+    }
+    return nOver;
+}
@@ -1,6 +1,7 @@
 #include <phx_api.h>
 
 #include "phx_cheetah.h"
+#include "phx_log.h"
 #include "phx_phoenix.h"
 #include "phx_phoenix_cheetah.h"
 
@@ -171,7 +172,7 @@ etStat Phx_Cheetah_Configure(tHandle hpb, PhxCheetahParam parameter,
                                            (etParamValue *)&(eParamValue));
             if (eStat != PHX_OK)
             {
-                printf("PHX: Error setting number of horizontal taps\n");
+                PHX_LOG_ERROR("PHX: Error setting number of horizontal taps\n");
                 goto Error;
             }
             eParamValue = 2;
@@ -179,7 +180,7 @@ etStat Phx_Cheetah_Configure(tHandle hpb, PhxCheetahParam parameter,
                                            (etParamValue *)&(eParamValue));
             if (eStat != PHX_OK)
             {
-                printf("PHX: Error setting number of vertical taps\n");
+                PHX_LOG_ERROR("PHX: Error setting number of vertical taps\n");
                 goto Error;
             }
             eParamValue = PHX_CAM_HTAP_LEFT;
@@ -187,35 +188,35 @@ etStat Phx_Cheetah_Configure(tHandle hpb, PhxCheetahParam parameter,
                                            (etParamValue *)&(eParamValue));
             if (eStat != PHX_OK)
             {
-                printf("PHX: Error setting htap direction\n");
+                PHX_LOG_ERROR("PHX: Error setting htap direction\n");
                 goto Error;
             }
             eParamValue = PHX_CAM_HTAP_LINEAR;
             eStat = PHX_ParameterSet(hpb, PHX_CAM_HTAP_TYPE, &eParamValue);
             if (eStat != PHX_OK)
             {
-                printf("PHX: Error setting htap type\n");
+                PHX_LOG_ERROR("PHX: Error setting htap type\n");
                 goto Error;
             }
             eParamValue = PHX_CAM_HTAP_ASCENDING;
             eStat = PHX_ParameterSet(hpb, PHX_CAM_HTAP_ORDER, &eParamValue);
             if (eStat != PHX_OK)
             {
-                printf("PHX: Error setting htap order\n");
+                PHX_LOG_ERROR("PHX: Error setting htap order\n");
                 goto Error;
             }
             eParamValue = PHX_CAM_VTAP_TOP;
             eStat       = PHX_ParameterSet(hpb, PHX_CAM_VTAP_DIR, &eParamValue);
             if (eStat != PHX_OK)
             {
-                printf("PHX: Error setting vtap direction\n");
+                PHX_LOG_ERROR("PHX: Error setting vtap direction\n");
                 goto Error;
             }
             eParamValue = PHX_CAM_VTAP_OFFSET;
             eStat = PHX_ParameterSet(hpb, PHX_CAM_VTAP_TYPE, &eParamValue);
             if (eStat != PHX_OK)
             {
-                printf("PHX: Error setting vtap type\n");
+                PHX_LOG_ERROR("PHX: Error setting vtap type\n");
                 goto Error;
             }
             bParamValue = CHEETAHPARAM_TAPS_BASE2;
@@ -0,0 +1,127 @@
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#include <errno.h>
+#include <inttypes.h>
+#include <sched.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "phx_log.h"
+#include "phx_poll.h"
+
+static void PhxPoll_Relax(void)
+{
+#if defined __x86_64__ || defined __i386__
+    __asm__ __volatile__("pause");
+#endif
+}
+
+static void *PhxPoll_Thread(void *pv)
+{
+    PhxPoll *pPoll = (PhxPoll *)pv;
+
+    while (!__atomic_load_n(&pPoll->bStop, __ATOMIC_ACQUIRE))
+    {
+        ui32 dwReady = 0;
+        ui32 i;
+
+        pPoll->qwPolls++;
+        if (PHX_OK != PHX_ParameterGet(pPoll->hCamera, PHX_BUFFER_READY_COUNT,
+                                       &dwReady) ||
+            0 == dwReady)
+        {
+            PhxPoll_Relax();
+            continue;
+        }
+        if (dwReady > pPoll->dwMaxReady)
+            pPoll->dwMaxReady = dwReady;
+
+        for (i = 0; i < dwReady; i++)
+        {
+            stImageBuff stBuffer;
+            struct timespec ts;
+            etStat eStat =
+                PHX_StreamRead(pPoll->hCamera, PHX_BUFFER_GET, &stBuffer);
+
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            (*pPoll->pfnFrame)(pPoll->hCamera,
+                               PHX_OK == eStat ? &stBuffer : NULL,
+                               PHX_INTRPT_BUFFER_READY,
+                               ts.tv_sec * 1000000000ull + ts.tv_nsec,
+                               pPoll->pvParams);
+            PHX_StreamRead(pPoll->hCamera, PHX_BUFFER_RELEASE, NULL);
+            pPoll->qwFrames++;
+        }
+    }
+    return NULL;
+}
+
+/* PhxPoll_Start
+ * Start the poll thread on nCpu (-1 = the last online CPU) at SCHED_FIFO
+ * nPriority. Without the privilege for SCHED_FIFO the thread still runs,
+ * at normal priority, with a warning.
+ */
+etStat PhxPoll_Start(PhxPoll *pPoll, tHandle hCamera, int nCpu, int nPriority,
+                     PhxBatchFrameFn pfnFrame, void *pvParams)
+{
+    pthread_attr_t attr;
+    struct sched_param param;
+    cpu_set_t cpus;
+    int nErr;
+
+    memset(pPoll, 0, sizeof(PhxPoll));
+    if (nCpu < 0)
+        nCpu = sysconf(_SC_NPROCESSORS_ONLN) - 1;
+    pPoll->hCamera   = hCamera;
+    pPoll->nCpu      = nCpu;
+    pPoll->nPriority = nPriority;
+    pPoll->pfnFrame  = pfnFrame;
+    pPoll->pvParams  = pvParams;
+
+    pthread_attr_init(&attr);
+    CPU_ZERO(&cpus);
+    CPU_SET(nCpu, &cpus);
+    pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+    if (nPriority > 0)
+    {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = nPriority;
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+
+    nErr = pthread_create(&pPoll->thread, &attr, PhxPoll_Thread, pPoll);
+    if (EPERM == nErr && nPriority > 0)
+    {
+        PHX_LOG_WARN("POLL: No permission for SCHED_FIFO, polling at normal "
+                     "priority\n");
+        pthread_attr_setinheritsched(&attr, PTHREAD_INHERIT_SCHED);
+        pPoll->nPriority = 0;
+        nErr = pthread_create(&pPoll->thread, &attr, PhxPoll_Thread, pPoll);
+    }
+    pthread_attr_destroy(&attr);
+    if (nErr)
+    {
+        PHX_LOG_ERROR("POLL: Cannot start poll thread: %s\n", strerror(nErr));
+        return PHX_ERROR_MALLOC_FAILED;
+    }
+    pPoll->bRunning = 1;
+    PHX_LOG_INFO("POLL: Polling on CPU %d, priority %d\n", pPoll->nCpu,
+                 pPoll->nPriority);
+    return PHX_OK;
+}
+
+void PhxPoll_Stop(PhxPoll *pPoll)
+{
+    if (!pPoll->bRunning)
+        return;
+
+    __atomic_store_n(&pPoll->bStop, 1, __ATOMIC_RELEASE);
+    pthread_join(pPoll->thread, NULL);
+    pPoll->bRunning = 0;
+
+    PHX_LOG_INFO("POLL: %" PRIu64 " frames in %" PRIu64 " polls, most ready "
+                 "at once %u\n",
+                 pPoll->qwFrames, pPoll->qwPolls, pPoll->dwMaxReady);
+}
@@ -0,0 +1,178 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <libbmp/libbmp.h>
+
+#include "phx_log.h"
+#include "phx_proc.h"
+
+/* Pixel i of an image, for either destination width */
+#define PHX_PROC_PIXEL(img, i)                                                 \
+    ((img)->dwBytesPerPixel == 1 ? ((uint8_t *)(img)->pvData)[i]               \
+                                 : ((uint16_t *)(img)->pvData)[i])
+
+/* PhxProc_Stats
+ * Minimum, maximum, mean and number of saturated pixels of a frame.
+ */
+void PhxProc_Stats(PhxImage *pImage, PhxFrameStats *pStats)
+{
+    ui32 dwFull    = (1u << pImage->dwBits) - 1;
+    ui32 dwPixels  = pImage->dwWidth * pImage->dwHeight;
+    ui32 dwMin     = dwFull, dwMax = 0, dwSaturated = 0;
+    uint64_t qwSum = 0;
+    ui32 i;
+
+    if (pImage->dwBytesPerPixel == 1)
+    {
+        uint8_t *pb = (uint8_t *)pImage->pvData;
+        for (i = 0; i < dwPixels; i++)
+        {
+            ui32 v = pb[i];
+            dwMin  = v < dwMin ? v : dwMin;
+            dwMax  = v > dwMax ? v : dwMax;
+            dwSaturated += v >= dwFull;
+            qwSum += v;
+        }
+    }
+    else
+    {
+        uint16_t *pw = (uint16_t *)pImage->pvData;
+        for (i = 0; i < dwPixels; i++)
+        {
+            ui32 v = pw[i];
+            dwMin  = v < dwMin ? v : dwMin;
+            dwMax  = v > dwMax ? v : dwMax;
+            dwSaturated += v >= dwFull;
+            qwSum += v;
+        }
+    }
+
+    pStats->dwMin       = dwMin;
+    pStats->dwMax       = dwMax;
+    pStats->dMean       = dwPixels ? (double)qwSum / dwPixels : 0;
+    pStats->dwSaturated = dwSaturated;
+}
+
+/* PhxProc_Centroids
+ * Split the frame into dwGrid x dwGrid pixel cells (the -d option) and
+ * compute the centre of mass of each cell after subtracting dwThreshold
+ * (the -h option). Partial cells at the right and bottom edges are skipped.
+ */
+void PhxProc_Centroids(PhxImage *pImage, ui32 dwGrid, ui32 dwThreshold,
+                       PhxCentroids *pCent)
+{
+    ui32 cx, cy, x, y, n;
+
+    pCent->dwCellsX = dwGrid ? pImage->dwWidth / dwGrid : 0;
+    pCent->dwCellsY = dwGrid ? pImage->dwHeight / dwGrid : 0;
+    while (pCent->dwCellsX * pCent->dwCellsY > PHX_PROC_MAX_CELLS)
+        pCent->dwCellsY--;
+    pCent->dwValid = 0;
+
+    for (cy = 0; cy < pCent->dwCellsY; cy++)
+    {
+        for (cx = 0; cx < pCent->dwCellsX; cx++)
+        {
+            uint64_t qwSum = 0, qwSumX = 0, qwSumY = 0;
+            for (y = cy * dwGrid; y < (cy + 1) * dwGrid; y++)
+            {
+                for (x = cx * dwGrid; x < (cx + 1) * dwGrid; x++)
+                {
+                    ui32 v = PHX_PROC_PIXEL(pImage, x + y * pImage->dwWidth);
+                    if (v > dwThreshold)
+                    {
+                        v -= dwThreshold;
+                        qwSum += v;
+                        qwSumX += (uint64_t)v * x;
+                        qwSumY += (uint64_t)v * y;
+                    }
+                }
+            }
+            n = cx + cy * pCent->dwCellsX;
+            if (qwSum)
+            {
+                pCent->fX[n] = (float)qwSumX / qwSum;
+                pCent->fY[n] = (float)qwSumY / qwSum;
+                pCent->dwValid++;
+            }
+            else
+            {
+                pCent->fX[n] = -1;
+                pCent->fY[n] = -1;
+            }
+        }
+    }
+}
+
+/* PhxProc_SaveBmp
+ * Write a frame as a greyscale BMP, keeping the top 8 significant bits.
+ * Returns the bm_save result (non-zero on success), 0 on failure.
+ */
+int PhxProc_SaveBmp(PhxImage *pImage, char *pszFileName)
+{
+    ui32 dwShift = pImage->dwBits > 8 ? pImage->dwBits - 8 : 0;
+    ui32 i, j;
+    int ret;
+
+    Bitmap *img = bm_create(pImage->dwWidth, pImage->dwHeight);
+    if (img == NULL)
+    {
+        PHX_LOG_ERROR("SHK: Failed to create image\n");
+        return 0;
+    }
+    for (j = 0; j < pImage->dwHeight; j++)
+    {
+        for (i = 0; i < pImage->dwWidth; i++)
+        {
+            ui32 val = PHX_PROC_PIXEL(pImage, i + j * pImage->dwWidth) >>
+                       dwShift;
+            uint32_t argb = 0xff000000;
+            argb |= (0x000000ff & val);
+            argb |= (0x000000ff & val) << 8;
+            argb |= (0x000000ff & val) << 16;
+            bm_set(img, i, j, argb);
+        }
+    }
+    ret = bm_save(img, pszFileName);
+    bm_free(img);
+    return ret;
+}
+
+/* Comma separated stage names, e.g. "stats,cent". "all" and "none" are
+ * accepted too. Returns 0 on an unknown name. */
+int PhxProc_str_to_stages(char *str, ui32 *pdwStages)
+{
+    char strStages[128];
+    char *token;
+
+    strncpy(strStages, str, sizeof(strStages) - 1);
+    strStages[sizeof(strStages) - 1] = '\0';
+    *pdwStages                       = 0;
+
+    for (token = strtok(strStages, ","); token != NULL;
+         token = strtok(NULL, ","))
+    {
+        if (strcmp(token, "stats") == 0)
+        {
+            *pdwStages |= PHX_STAGE_STATS;
+        }
+        else if (strcmp(token, "cent") == 0)
+        {
+            *pdwStages |= PHX_STAGE_CENT;
+        }
+        else if (strcmp(token, "bmp") == 0)
+        {
+            *pdwStages |= PHX_STAGE_BMP;
+        }
+        else if (strcmp(token, "all") == 0)
+        {
+            *pdwStages |= PHX_STAGE_ALL;
+        }
+        else if (strcmp(token, "none") != 0)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
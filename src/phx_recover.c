@@ -0,0 +1,400 @@
+#define _GNU_SOURCE /* fmemopen */
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "phx_config.h"
+#include "phx_log.h"
+#include "phx_recover.h"
+
+static const char *s_pszStep[PHX_RECOVER_STEPS] = {
+    "none", "buffer abort", "stream restart", "camera reset", "giving up"};
+
+static ui64 PhxRecover_Now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/* PhxRecover_LoadFile
+ * Read the PHX_SYS_RECOVER* keys from the [system] section of a config
+ * file and keep a copy of the whole file for PhxRecover_Reapply.
+ */
+etStat PhxRecover_LoadFile(char *pszConfigFileName, PhxRecover *pRec)
+{
+    etStat eStat = PHX_OK;
+
+    FILE *fp;
+    char strLine[PHX_CONFIG_MAX_LINE];
+    char delimit[] = "= \t\r\n\v\f";
+    char fsystem = 0;
+    char *strParam, *strParamValue;
+    long lLength;
+
+    memset(pRec, 0, sizeof(PhxRecover));
+    pRec->bEnabled  = 1;
+    pRec->dwWaitMs  = PHX_RECOVER_WAIT_MS;
+    pRec->dwStallMs = PHX_RECOVER_STALL_MS;
+    pRec->dwRetries = PHX_RECOVER_RETRIES;
+    PhxJitter_Init(&pRec->ttr);
+
+    fp = fopen(pszConfigFileName, "r");
+    if (fp == NULL)
+    {
+        PHX_LOG_ERROR("RECOVER: Cannot open %s: %s\n", pszConfigFileName,
+                      strerror(errno));
+        eStat = PHX_ERROR_BAD_PARAM;
+        goto Error;
+    }
+
+    /* The copy reapplied after a reset */
+    if (fseek(fp, 0, SEEK_END) || (lLength = ftell(fp)) < 0 ||
+        fseek(fp, 0, SEEK_SET))
+    {
+        eStat = PHX_ERROR_BAD_PARAM;
+        goto Close;
+    }
+    pRec->pszConfig = malloc(lLength + 1);
+    if (pRec->pszConfig == NULL)
+    {
+        eStat = PHX_ERROR_MALLOC_FAILED;
+        goto Close;
+    }
+    pRec->lenConfig = fread(pRec->pszConfig, 1, lLength, fp);
+    pRec->pszConfig[pRec->lenConfig] = '\0';
+    rewind(fp);
+
+    while (fgets(strLine, PHX_CONFIG_MAX_LINE, fp))
+    {
+        if (strLine[0] == '[')
+        {
+            fsystem = strstr(strLine, "[system]") != NULL;
+            continue;
+        }
+        if (!fsystem)
+            continue;
+
+        strParam      = strtok(strLine, delimit);
+        strParamValue = strtok(NULL, delimit);
+        if (strParam == NULL || strParamValue == NULL)
+            continue;
+
+        if (strcmp(strParam, "PHX_SYS_RECOVER") == 0)
+            pRec->bEnabled = strtoul(strParamValue, NULL, 0) != 0;
+        else if (strcmp(strParam, "PHX_SYS_RECOVER_WAIT_MS") == 0)
+            pRec->dwWaitMs = strtoul(strParamValue, NULL, 0);
+        else if (strcmp(strParam, "PHX_SYS_RECOVER_STALL_MS") == 0)
+            pRec->dwStallMs = strtoul(strParamValue, NULL, 0);
+        else if (strcmp(strParam, "PHX_SYS_RECOVER_RETRIES") == 0)
+            pRec->dwRetries = strtoul(strParamValue, NULL, 0);
+    }
+Close:
+    fclose(fp);
+Error:
+    return eStat;
+}
+
+/* PhxRecover_Subscribe
+ * Enable the fault interrupts on top of what the config enabled. Needed
+ * again after the config is reapplied.
+ */
+etStat PhxRecover_Subscribe(tHandle handle)
+{
+    etParamValue eMask = (etParamValue)PHX_RECOVER_FAULTS;
+    etStat eStat       = PHX_ParameterSet(handle, PHX_INTRPT_SET, &eMask);
+
+    if (PHX_OK != eStat)
+        PHX_LOG_WARN("RECOVER: Cannot enable the fault interrupts [%d]\n",
+                     eStat);
+    return eStat;
+}
+
+/* PhxRecover_Reapply
+ * Apply the config cached by PhxRecover_LoadFile, with acquisition
+ * stopped.
+ */
+etStat PhxRecover_Reapply(PhxRecover *pRec, tHandle handle)
+{
+    etStat eStat;
+    FILE *fp;
+
+    if (pRec->pszConfig == NULL || pRec->lenConfig == 0)
+        return PHX_ERROR_BAD_PARAM;
+    fp = fmemopen(pRec->pszConfig, pRec->lenConfig, "r");
+    if (fp == NULL)
+        return PHX_ERROR_MALLOC_FAILED;
+    eStat = PhxConfig_RunStream(handle, fp);
+    fclose(fp);
+    if (PHX_OK == eStat)
+        eStat = PhxRecover_Subscribe(handle);
+    return eStat;
+}
+
+/* PhxRecover_WaitFrame
+ * Wait until a frame delivered after qwSinceNs comes through, the deadline
+ * passes or the thread is stopped. Only runs during a recovery, so a 1 ms
+ * poll keeps the frame path free of any lock.
+ */
+static int PhxRecover_WaitFrame(PhxRecover *pRec, ui64 qwSinceNs,
+                                ui64 qwDeadlineNs)
+{
+    struct timespec ts = {0, 1000000};
+
+    while (!__atomic_load_n(&pRec->bStop, __ATOMIC_RELAXED))
+    {
+        ui64 qwFirstNs = __atomic_load_n(&pRec->qwFirstNs, __ATOMIC_ACQUIRE);
+
+        /* A batch consumer may still be draining frames from before */
+        if (qwFirstNs && qwFirstNs < qwSinceNs)
+            __atomic_store_n(&pRec->qwFirstNs, 0, __ATOMIC_RELAXED);
+        else if (qwFirstNs)
+            return 1;
+        if (PhxRecover_Now() >= qwDeadlineNs)
+            return 0;
+        nanosleep(&ts, NULL);
+    }
+    return 0;
+}
+
+/* PhxRecover_Incident
+ * Escalate through the steps until a frame comes through or the resets
+ * run out.
+ */
+static void PhxRecover_Incident(PhxRecover *pRec, ui32 dwMask,
+                                ui64 qwFaultNs)
+{
+    PhxRecoverStep eStep = PHX_RECOVER_ABORT;
+    ui32 dwResets        = 0;
+    etStat eStat;
+
+    /* Faulted again right after recovering, that step was not enough */
+    if (pRec->eLast != PHX_RECOVER_NONE &&
+        qwFaultNs - pRec->qwRecoveredNs < pRec->dwWaitMs * 1000000ull)
+        eStep = pRec->eLast < PHX_RECOVER_RESET ? pRec->eLast + 1
+                                                : PHX_RECOVER_RESET;
+    pRec->qwIncidents++;
+    PHX_LOG_WARN("%s: Stream fault 0x%x%s%s%s, starting with %s\n",
+                 pRec->pszName, dwMask,
+                 dwMask & PHX_INTRPT_SYNC_LOST ? " sync lost" : "",
+                 dwMask & PHX_INTRPT_TIMEOUT ? " timeout" : "",
+                 dwMask & PHX_INTRPT_FIFO_OVERFLOW ? " FIFO overflow" : "",
+                 s_pszStep[eStep]);
+
+    while (!__atomic_load_n(&pRec->bStop, __ATOMIC_RELAXED))
+    {
+        if (eStep == PHX_RECOVER_RESET && dwResets++ == pRec->dwRetries)
+            eStep = PHX_RECOVER_FAILED;
+
+        __atomic_store_n(&pRec->qwFirstNs, 0, __ATOMIC_RELEASE);
+        pRec->qwSteps[eStep]++;
+        eStat = (*pRec->pfnStep)(eStep, pRec->pvParams);
+        if (eStep == PHX_RECOVER_FAILED)
+        {
+            PHX_LOG_ERROR("%s: Stream not recovered after %u resets, "
+                          "stopping\n",
+                          pRec->pszName, pRec->dwRetries);
+            pRec->eLast = PHX_RECOVER_NONE;
+            return;
+        }
+        if (PHX_OK != eStat)
+            PHX_LOG_WARN("%s: %s failed [%d]\n", pRec->pszName,
+                         s_pszStep[eStep], eStat);
+        else if (PhxRecover_WaitFrame(pRec, qwFaultNs,
+                                      PhxRecover_Now() +
+                                          pRec->dwWaitMs * 1000000ull))
+        {
+            ui64 qwFirstNs = pRec->qwFirstNs;
+
+            PhxJitter_Sample(&pRec->ttr, qwFirstNs - qwFaultNs);
+            PHX_LOG_INFO("%s: Recovered by %s in %.3f ms\n", pRec->pszName,
+                         s_pszStep[eStep], (qwFirstNs - qwFaultNs) / 1e6);
+            pRec->eLast         = eStep;
+            pRec->qwRecoveredNs = qwFirstNs;
+
+            /* Faults raised by the recovery itself are over */
+            pthread_mutex_lock(&pRec->lock);
+            if (pRec->dwFaults && pRec->qwFaultNs <= qwFirstNs)
+                pRec->dwFaults = 0;
+            pthread_mutex_unlock(&pRec->lock);
+            return;
+        }
+        if (eStep < PHX_RECOVER_RESET)
+            eStep++;
+    }
+}
+
+static void *PhxRecover_Thread(void *pv)
+{
+    PhxRecover *pRec = (PhxRecover *)pv;
+    ui64 qwSeen      = 0;
+
+    pthread_mutex_lock(&pRec->lock);
+    while (!pRec->bStop)
+    {
+        ui32 dwMask;
+        ui64 qwFaultNs;
+
+        if (!pRec->dwFaults)
+        {
+            int ret = 0;
+
+            if (pRec->dwStallMs)
+            {
+                struct timespec tDeadline;
+                clock_gettime(CLOCK_MONOTONIC, &tDeadline);
+                tDeadline.tv_sec += pRec->dwStallMs / 1000;
+                tDeadline.tv_nsec += (pRec->dwStallMs % 1000) * 1000000;
+                if (tDeadline.tv_nsec >= 1000000000)
+                {
+                    tDeadline.tv_sec++;
+                    tDeadline.tv_nsec -= 1000000000;
+                }
+                ret = pthread_cond_timedwait(&pRec->cond, &pRec->lock,
+                                             &tDeadline);
+            }
+            else
+                pthread_cond_wait(&pRec->cond, &pRec->lock);
+            if (pRec->bStop)
+                break;
+
+            /* No frames and no interrupt for a whole stall period */
+            if (!pRec->dwFaults && ret == ETIMEDOUT)
+            {
+                ui64 qwFrames =
+                    __atomic_load_n(&pRec->qwFrames, __ATOMIC_RELAXED);
+                if (qwFrames == qwSeen)
+                {
+                    pRec->dwFaults  = PHX_INTRPT_TIMEOUT;
+                    pRec->qwFaultNs = PhxRecover_Now();
+                }
+                qwSeen = qwFrames;
+            }
+            if (!pRec->dwFaults)
+                continue;
+        }
+
+        dwMask         = pRec->dwFaults;
+        qwFaultNs      = pRec->qwFaultNs;
+        pRec->dwFaults = 0;
+        pthread_mutex_unlock(&pRec->lock);
+
+        PhxRecover_Incident(pRec, dwMask, qwFaultNs);
+
+        pthread_mutex_lock(&pRec->lock);
+        qwSeen = __atomic_load_n(&pRec->qwFrames, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&pRec->lock);
+    return NULL;
+}
+
+/* PhxRecover_Start
+ * Start the recovery thread once acquisition has started. pfnStep carries
+ * out the steps for the camera. The waits are stretched to cover at least
+ * four frames of dwFramePeriodUs, for slow triggers.
+ */
+etStat PhxRecover_Start(PhxRecover *pRec, char *pszName, ui32 dwFramePeriodUs,
+                        PhxRecoverFn pfnStep, void *pvParams)
+{
+    pthread_condattr_t attr;
+    ui32 dwFrameMs = (dwFramePeriodUs * 4ull + 999) / 1000;
+
+    if (!pRec->bEnabled || pRec->bRunning)
+        return PHX_OK;
+    pRec->pszName  = pszName;
+    pRec->pfnStep  = pfnStep;
+    pRec->pvParams = pvParams;
+    pRec->bStop    = 0;
+    pRec->dwFaults = 0;
+    if (pRec->dwWaitMs < dwFrameMs)
+        pRec->dwWaitMs = dwFrameMs;
+    if (pRec->dwStallMs && pRec->dwStallMs < dwFrameMs)
+        pRec->dwStallMs = dwFrameMs;
+
+    if (pthread_mutex_init(&pRec->lock, NULL))
+        return PHX_ERROR_MALLOC_FAILED;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&pRec->cond, &attr))
+    {
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_destroy(&pRec->lock);
+        return PHX_ERROR_MALLOC_FAILED;
+    }
+    pthread_condattr_destroy(&attr);
+
+    if (pthread_create(&pRec->thread, NULL, PhxRecover_Thread, pRec))
+    {
+        pthread_cond_destroy(&pRec->cond);
+        pthread_mutex_destroy(&pRec->lock);
+        return PHX_ERROR_MALLOC_FAILED;
+    }
+    pRec->bRunning = 1;
+    PHX_LOG_INFO("%s: Recovery on, %u ms per step, %u ms stall, %u resets\n",
+                 pszName, pRec->dwWaitMs, pRec->dwStallMs, pRec->dwRetries);
+    return PHX_OK;
+}
+
+/* PhxRecover_Fault
+ * Called from the event callback with the fault bits of dwInterruptMask.
+ */
+void PhxRecover_Fault(PhxRecover *pRec, ui32 dwMask)
+{
+    if (!pRec->bRunning)
+        return;
+
+    pthread_mutex_lock(&pRec->lock);
+    if (!pRec->dwFaults)
+        pRec->qwFaultNs = PhxRecover_Now();
+    pRec->dwFaults |= dwMask;
+    pthread_cond_signal(&pRec->cond);
+    pthread_mutex_unlock(&pRec->lock);
+}
+
+/* PhxRecover_Stop
+ * Stop and join the thread, after the step in progress, before the
+ * acquisition is stopped for good.
+ */
+void PhxRecover_Stop(PhxRecover *pRec)
+{
+    char szLabel[64];
+    ui32 i;
+
+    if (!pRec->bRunning)
+        return;
+
+    pthread_mutex_lock(&pRec->lock);
+    __atomic_store_n(&pRec->bStop, 1, __ATOMIC_RELAXED);
+    pthread_cond_signal(&pRec->cond);
+    pthread_mutex_unlock(&pRec->lock);
+    pthread_join(pRec->thread, NULL);
+    pRec->bRunning = 0;
+    pthread_cond_destroy(&pRec->cond);
+    pthread_mutex_destroy(&pRec->lock);
+
+    if (pRec->qwIncidents == 0)
+        return;
+    PHX_LOG_INFO("%s: %" PRIu64 " stream faults\n", pRec->pszName,
+                 pRec->qwIncidents);
+    for (i = PHX_RECOVER_ABORT; i < PHX_RECOVER_STEPS; i++)
+    {
+        if (pRec->qwSteps[i])
+            PHX_LOG_INFO("%s: %s %" PRIu64 " times\n", pRec->pszName,
+                         s_pszStep[i], pRec->qwSteps[i]);
+    }
+    snprintf(szLabel, sizeof(szLabel), "%s time to recover", pRec->pszName);
+    if (pRec->ttr.qwCount)
+        PhxJitter_Report(&pRec->ttr, szLabel);
+}
+
+/* Free the cached config, after PhxRecover_Stop */
+void PhxRecover_Destroy(PhxRecover *pRec)
+{
+    PhxRecover_Stop(pRec);
+    free(pRec->pszConfig);
+    pRec->pszConfig = NULL;
+    pRec->lenConfig = 0;
+}
@@ -0,0 +1,346 @@
+#define _GNU_SOURCE /* pthread_setaffinity_np */
+#include <errno.h>
+#include <malloc.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#include "phx_config.h"
+#include "phx_log.h"
+#include "phx_rt.h"
+
+static const char *s_pszThread[PHX_RT_THREADS] = {
+    "CALLBACK", "PROC", "WRITER", "TELEMETRY", "TRIGGER", "RECOVER"};
+
+static int PhxRt_str_to_policy(char *str, int *pnPolicy)
+{
+    if (strcmp(str, "SCHED_OTHER") == 0)
+        *pnPolicy = SCHED_OTHER;
+    else if (strcmp(str, "SCHED_FIFO") == 0)
+        *pnPolicy = SCHED_FIFO;
+    else if (strcmp(str, "SCHED_RR") == 0)
+        *pnPolicy = SCHED_RR;
+    else
+        return 0;
+    return 1;
+}
+
+static const char *PhxRt_PolicyName(int nPolicy)
+{
+    switch (nPolicy)
+    {
+    case SCHED_FIFO:
+        return "SCHED_FIFO";
+    case SCHED_RR:
+        return "SCHED_RR";
+    case SCHED_OTHER:
+        return "SCHED_OTHER";
+    default:
+        return "other";
+    }
+}
+
+/* PhxRt_str_to_cpus
+ * Parse a CPU list such as "2", "2,3" or "0-1,4" into a mask.
+ */
+static int PhxRt_str_to_cpus(char *str, ui64 *pqwCpus)
+{
+    ui64 qwCpus = 0;
+    char *p     = str;
+
+    while (*p)
+    {
+        char *pEnd;
+        unsigned long ulFirst = strtoul(p, &pEnd, 10);
+        unsigned long ulLast  = ulFirst;
+
+        if (pEnd == p)
+            return 0;
+        if (*pEnd == '-')
+        {
+            p      = pEnd + 1;
+            ulLast = strtoul(p, &pEnd, 10);
+            if (pEnd == p)
+                return 0;
+        }
+        if (ulLast < ulFirst || ulLast >= PHX_RT_MAX_CPUS)
+            return 0;
+        for (; ulFirst <= ulLast; ulFirst++)
+            qwCpus |= 1ull << ulFirst;
+        if (*pEnd == ',')
+            pEnd++;
+        else if (*pEnd)
+            return 0;
+        p = pEnd;
+    }
+    *pqwCpus = qwCpus;
+    return qwCpus != 0;
+}
+
+static void PhxRt_CpusName(ui64 qwCpus, char *psz, size_t len)
+{
+    size_t n = 0;
+    int i;
+
+    psz[0] = '\0';
+    for (i = 0; i < PHX_RT_MAX_CPUS && n < len; i++)
+    {
+        int j = i;
+
+        if (!(qwCpus & (1ull << i)))
+            continue;
+        while (j + 1 < PHX_RT_MAX_CPUS && (qwCpus & (1ull << (j + 1))))
+            j++;
+        n += snprintf(psz + n, len - n, j > i ? "%s%d-%d" : "%s%d",
+                      n ? "," : "", i, j);
+        i = j;
+    }
+}
+
+/* PhxRt_LoadFile
+ * Read the PHX_SYS_RT_* keys from the [system] section of a config file.
+ */
+etStat PhxRt_LoadFile(char *pszConfigFileName, PhxRt *pRt)
+{
+    etStat eStat = PHX_OK;
+
+    FILE *fp;
+    char strLine[PHX_CONFIG_MAX_LINE];
+    char delimit[] = "= \t\r\n\v\f";
+    char fsystem = 0;
+    char *strParam, *strParamValue;
+    int i;
+
+    memset(pRt, 0, sizeof(PhxRt));
+
+    fp = fopen(pszConfigFileName, "r");
+    if (fp == NULL)
+    {
+        PHX_LOG_ERROR("RT: Cannot open %s: %s\n", pszConfigFileName,
+                      strerror(errno));
+        eStat = PHX_ERROR_BAD_PARAM;
+        goto Error;
+    }
+
+    while (fgets(strLine, PHX_CONFIG_MAX_LINE, fp))
+    {
+        if (strLine[0] == '[')
+        {
+            fsystem = strstr(strLine, "[system]") != NULL;
+            continue;
+        }
+        if (!fsystem)
+            continue;
+
+        strParam      = strtok(strLine, delimit);
+        strParamValue = strtok(NULL, delimit);
+        if (strParam == NULL || strParamValue == NULL ||
+            strncmp(strParam, "PHX_SYS_RT_", 11) != 0)
+            continue;
+        strParam += 11;
+
+        if (strcmp(strParam, "LOCK") == 0)
+        {
+            pRt->bLock = strtoul(strParamValue, NULL, 0) != 0;
+            continue;
+        }
+        for (i = 0; i < PHX_RT_THREADS; i++)
+        {
+            size_t len        = strlen(s_pszThread[i]);
+            PhxRtSched *pSched = &pRt->threads[i];
+
+            if (strncmp(strParam, s_pszThread[i], len) != 0 ||
+                strParam[len] != '_')
+                continue;
+            if (strcmp(strParam + len, "_CPUS") == 0)
+            {
+                if (!PhxRt_str_to_cpus(strParamValue, &pSched->qwCpus))
+                    eStat = PHX_ERROR_BAD_PARAM_VALUE;
+            }
+            else if (strcmp(strParam + len, "_POLICY") == 0)
+            {
+                if (!PhxRt_str_to_policy(strParamValue, &pSched->nPolicy))
+                    eStat = PHX_ERROR_BAD_PARAM_VALUE;
+                pSched->bPolicy = 1;
+            }
+            else if (strcmp(strParam + len, "_PRIORITY") == 0)
+            {
+                pSched->nPriority = strtol(strParamValue, NULL, 0);
+            }
+            break;
+        }
+    }
+    fclose(fp);
+
+    /* A priority only means something to the real-time policies */
+    for (i = 0; i < PHX_RT_THREADS; i++)
+    {
+        PhxRtSched *pSched = &pRt->threads[i];
+
+        if (pSched->nPolicy == SCHED_OTHER)
+            pSched->nPriority = 0;
+        else if (pSched->nPriority == 0)
+            pSched->nPriority = PHX_RT_PRIORITY;
+    }
+    if (PHX_OK != eStat)
+        PHX_LOG_ERROR("RT: Bad PHX_SYS_RT_ value in %s\n", pszConfigFileName);
+Error:
+    return eStat;
+}
+
+/* PhxRt_Lock
+ * Lock all current and future pages and stop malloc from handing memory
+ * back to the kernel or getting new mappings for large blocks, which would
+ * fault again on their next use. Failing is not fatal, the run just loses
+ * the guarantee.
+ */
+etStat PhxRt_Lock(PhxRt *pRt)
+{
+    if (!pRt->bLock)
+        return PHX_OK;
+
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE))
+    {
+        PHX_LOG_WARN("RT: mlockall failed: %s, memory is not locked\n",
+                     strerror(errno));
+        return PHX_ERROR_BAD_PARAM;
+    }
+    pRt->bLocked = 1;
+    PHX_LOG_INFO("RT: Memory locked\n");
+    return PHX_OK;
+}
+
+/* PhxRt_Prefault
+ * Touch every page of a buffer, writing back what is there, so none of it
+ * faults in the frame path. Also does the job when mlockall was refused.
+ */
+void PhxRt_Prefault(void *pv, size_t len)
+{
+    volatile ui8 *pb = (volatile ui8 *)pv;
+    long lPage      = sysconf(_SC_PAGESIZE);
+    size_t off;
+
+    if (pv == NULL)
+        return;
+    for (off = 0; off < len; off += lPage)
+        pb[off] = pb[off];
+    if (len)
+        pb[len - 1] = pb[len - 1];
+}
+
+/* PhxRt_Apply
+ * Give thread the CPU set and policy of its class, then read both back and
+ * report what the thread actually got.
+ */
+etStat PhxRt_Apply(PhxRt *pRt, PhxRtThread eThread, pthread_t thread)
+{
+    PhxRtSched *pSched = &pRt->threads[eThread];
+    etStat eStat      = PHX_OK;
+    struct sched_param param;
+    cpu_set_t cpus;
+    ui64 qwCpus = 0;
+    char szCpus[32];
+    int nPolicy, nErr, i;
+
+    if (pSched->qwCpus)
+    {
+        CPU_ZERO(&cpus);
+        for (i = 0; i < PHX_RT_MAX_CPUS; i++)
+            if (pSched->qwCpus & (1ull << i))
+                CPU_SET(i, &cpus);
+        nErr = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+        if (nErr)
+        {
+            PHX_LOG_WARN("RT: %s: Cannot set affinity: %s\n",
+                         s_pszThread[eThread], strerror(nErr));
+            eStat = PHX_ERROR_BAD_PARAM;
+        }
+    }
+    if (pSched->bPolicy)
+    {
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = pSched->nPriority;
+        nErr = pthread_setschedparam(thread, pSched->nPolicy, &param);
+        if (nErr)
+        {
+            PHX_LOG_WARN("RT: %s: Cannot set %s %d: %s\n", s_pszThread[eThread],
+                         PhxRt_PolicyName(pSched->nPolicy), pSched->nPriority,
+                         strerror(nErr));
+            eStat = PHX_ERROR_BAD_PARAM;
+        }
+    }
+    if (!pSched->qwCpus && !pSched->bPolicy)
+        return eStat;
+
+    /* Verify */
+    if (0 == pthread_getaffinity_np(thread, sizeof(cpus), &cpus))
+        for (i = 0; i < PHX_RT_MAX_CPUS; i++)
+            if (CPU_ISSET(i, &cpus))
+                qwCpus |= 1ull << i;
+    if (pthread_getschedparam(thread, &nPolicy, &param))
+    {
+        nPolicy              = -1;
+        param.sched_priority = 0;
+    }
+    PhxRt_CpusName(qwCpus, szCpus, sizeof(szCpus));
+    if ((pSched->qwCpus && qwCpus != pSched->qwCpus) ||
+        (pSched->bPolicy && (nPolicy != pSched->nPolicy ||
+                             param.sched_priority != pSched->nPriority)))
+    {
+        PHX_LOG_WARN("RT: %s: Running on CPUs %s, %s %d, not as configured\n",
+                     s_pszThread[eThread], szCpus, PhxRt_PolicyName(nPolicy),
+                     param.sched_priority);
+        eStat = PHX_ERROR_BAD_PARAM;
+    }
+    else
+    {
+        PHX_LOG_INFO("RT: %s: CPUs %s, %s %d\n", s_pszThread[eThread], szCpus,
+                     PhxRt_PolicyName(nPolicy), param.sched_priority);
+    }
+    return eStat;
+}
+
+/* PhxRt_ApplySelf
+ * PhxRt_Apply for the calling thread, for threads the application did not
+ * create, and prefault its stack.
+ */
+etStat PhxRt_ApplySelf(PhxRt *pRt, PhxRtThread eThread)
+{
+    volatile ui8 bStack[PHX_RT_STACK];
+
+    PhxRt_Prefault((void *)bStack, sizeof(bStack));
+    return PhxRt_Apply(pRt, eThread, pthread_self());
+}
+
+/* PhxRt_FaultsStart
+ * Note the page faults so far, call once everything is prefaulted.
+ */
+void PhxRt_FaultsStart(PhxRt *pRt)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    pRt->lMinFlt = usage.ru_minflt;
+    pRt->lMajFlt = usage.ru_majflt;
+}
+
+/* PhxRt_FaultsReport
+ * Log the page faults of the whole process since PhxRt_FaultsStart. A few
+ * come from the first frame on each thread, more point at a buffer that
+ * is not prefaulted or at memory that is not locked.
+ */
+void PhxRt_FaultsReport(PhxRt *pRt)
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    PHX_LOG_INFO("RT: %ld minor, %ld major page faults while capturing%s\n",
+                 usage.ru_minflt - pRt->lMinFlt, usage.ru_majflt - pRt->lMajFlt,
+                 pRt->bLocked ? "" : ", memory not locked");
+}
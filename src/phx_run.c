@@ -0,0 +1,137 @@
+#include <errno.h>
+#include <string.h>
+
+#include "phx_run.h"
+
+/* PhxRun_Init
+ * Set up a run of dwFrames frames or dwSeconds seconds, whichever comes
+ * first. Zero disables a limit; with both zero the run lasts until
+ * PhxRun_Stop. The condition variable waits on CLOCK_MONOTONIC so the
+ * deadline is immune to wall clock steps.
+ */
+etStat PhxRun_Init(PhxRun *pRun, ui32 dwFrames, ui32 dwSeconds)
+{
+    pthread_condattr_t attr;
+
+    memset(pRun, 0, sizeof(PhxRun));
+    pRun->qwFrameLimit = dwFrames;
+    pRun->dwSeconds    = dwSeconds;
+
+    if (pthread_mutex_init(&pRun->lock, NULL))
+        return PHX_ERROR_MALLOC_FAILED;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    if (pthread_cond_init(&pRun->cond, &attr))
+    {
+        pthread_condattr_destroy(&attr);
+        pthread_mutex_destroy(&pRun->lock);
+        return PHX_ERROR_MALLOC_FAILED;
+    }
+    pthread_condattr_destroy(&attr);
+    return PHX_OK;
+}
+
+static void PhxRun_End(PhxRun *pRun, PhxRunStop eStop)
+{
+    pthread_mutex_lock(&pRun->lock);
+    if (!pRun->eStop)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &pRun->tStop);
+        __atomic_store_n(&pRun->eStop, eStop, __ATOMIC_RELEASE);
+        pthread_cond_broadcast(&pRun->cond);
+    }
+    pthread_mutex_unlock(&pRun->lock);
+}
+
+/* Call right before PHX_START so the deadline counts from acquisition */
+void PhxRun_Start(PhxRun *pRun)
+{
+    clock_gettime(CLOCK_MONOTONIC, &pRun->tStart);
+}
+
+/* PhxRun_Frame
+ * Called from the frame path for every buffer. Returns the frame number
+ * (1-based) if the frame belongs to the run, or 0 once the frame limit has
+ * been reached or the run has ended, in which case the caller should just
+ * release the buffer. Only the frame that hits the limit takes the lock.
+ */
+ui64 PhxRun_Frame(PhxRun *pRun)
+{
+    ui64 qwFrame;
+
+    if (__atomic_load_n(&pRun->eStop, __ATOMIC_ACQUIRE))
+        return 0;
+    qwFrame = __atomic_add_fetch(&pRun->qwFrames, 1, __ATOMIC_ACQ_REL);
+    if (pRun->qwFrameLimit)
+    {
+        if (qwFrame > pRun->qwFrameLimit)
+            return 0;
+        if (qwFrame == pRun->qwFrameLimit)
+            PhxRun_End(pRun, PHX_RUN_FRAMES);
+    }
+    return qwFrame;
+}
+
+void PhxRun_Stop(PhxRun *pRun)
+{
+    PhxRun_End(pRun, PHX_RUN_STOPPED);
+}
+
+/* PhxRun_Request
+ * Make PhxRun_Wait return without ending the run, so frames still in
+ * flight are accepted until the caller has stopped acquisition and calls
+ * PhxRun_Stop.
+ */
+void PhxRun_Request(PhxRun *pRun)
+{
+    pthread_mutex_lock(&pRun->lock);
+    pRun->bRequested = 1;
+    pthread_cond_broadcast(&pRun->cond);
+    pthread_mutex_unlock(&pRun->lock);
+}
+
+/* PhxRun_Wait
+ * Block until the frame limit is signalled, the duration elapses,
+ * PhxRun_Stop is called or a stop is requested. Returns 0 for a request,
+ * the run is still going.
+ */
+PhxRunStop PhxRun_Wait(PhxRun *pRun)
+{
+    struct timespec tDeadline = pRun->tStart;
+    int ret                   = 0;
+
+    tDeadline.tv_sec += pRun->dwSeconds;
+
+    pthread_mutex_lock(&pRun->lock);
+    while (!pRun->eStop && !pRun->bRequested && ret != ETIMEDOUT)
+    {
+        if (pRun->dwSeconds)
+            ret = pthread_cond_timedwait(&pRun->cond, &pRun->lock, &tDeadline);
+        else
+            ret = pthread_cond_wait(&pRun->cond, &pRun->lock);
+    }
+    if (!pRun->eStop && !pRun->bRequested)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &pRun->tStop);
+        __atomic_store_n(&pRun->eStop, PHX_RUN_TIMEOUT, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&pRun->lock);
+    return pRun->eStop;
+}
+
+/* Seconds from PhxRun_Start to the end of the run (or now, if running) */
+double PhxRun_Elapsed(PhxRun *pRun)
+{
+    struct timespec tEnd = pRun->tStop;
+
+    if (!__atomic_load_n(&pRun->eStop, __ATOMIC_ACQUIRE))
+        clock_gettime(CLOCK_MONOTONIC, &tEnd);
+    return (tEnd.tv_sec - pRun->tStart.tv_sec) +
+           (tEnd.tv_nsec - pRun->tStart.tv_nsec) * 1e-9;
+}
+
+void PhxRun_Destroy(PhxRun *pRun)
+{
+    pthread_cond_destroy(&pRun->cond);
+    pthread_mutex_destroy(&pRun->lock);
+}
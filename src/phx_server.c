@@ -0,0 +1,654 @@
+#define _GNU_SOURCE /* accept4 */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "phx_log.h"
+#include "phx_server.h"
+
+/* epoll tags, clients use their index */
+#define PHX_SERVER_TAG_LISTEN PHX_SERVER_CLIENTS
+#define PHX_SERVER_TAG_EVENT  (PHX_SERVER_CLIENTS + 1)
+
+typedef struct
+{
+    ui32 dwType;  /* PHX_SERVER_RAW/QUICK/CENT/STATS */
+    ui32 dwIndex; /* Pool entry */
+    ui32 dwGen;   /* Pool generation when queued */
+    ui64 qwFrame;
+} PhxServerRef;
+
+struct _PhxServerClient
+{
+    int fd;
+    ui32 dwSubs;
+    char rx[64];
+    ui32 dwRx;
+    PhxServerRef queue[PHX_SERVER_QUEUE];
+    ui32 dwHead;
+    ui32 dwTail;
+    ui32 dwDropped;
+    int bPollOut;
+
+    /* Message being sent */
+    int bBusy;
+    PhxServerRef ref;
+    PhxServerMsg msg;
+    const void *pvPayload;
+    PhxShmFrame frame;
+    ui32 dwTrailer;
+    size_t sent;
+};
+
+static void PhxServer_Close(PhxServer *pServer, PhxServerClient *pClient)
+{
+    ui32 i, dwSubs = 0;
+
+    epoll_ctl(pServer->fdEpoll, EPOLL_CTL_DEL, pClient->fd, NULL);
+    close(pClient->fd);
+    PHX_LOG_INFO("SERVER: Client %d closed, %u messages dropped\n",
+                 pClient->fd, pClient->dwDropped);
+    memset(pClient, 0, sizeof(PhxServerClient));
+    pClient->fd = -1;
+
+    for (i = 0; i < PHX_SERVER_CLIENTS; i++)
+        if (pServer->pClients[i].fd >= 0)
+            dwSubs |= pServer->pClients[i].dwSubs;
+    __atomic_store_n(&pServer->dwSubs, dwSubs, __ATOMIC_RELEASE);
+}
+
+/* Drop-oldest: a full queue loses its oldest message, never the new one */
+static void PhxServer_Queue(PhxServerClient *pClient, PhxServerRef *pRef)
+{
+    if (pClient->dwHead - pClient->dwTail >= PHX_SERVER_QUEUE)
+    {
+        pClient->dwTail++;
+        pClient->dwDropped++;
+    }
+    pClient->queue[pClient->dwHead++ % PHX_SERVER_QUEUE] = *pRef;
+}
+
+/* Set up the next queued message that still has valid data */
+static int PhxServer_Next(PhxServer *pServer, PhxServerClient *pClient)
+{
+    while (pClient->dwTail != pClient->dwHead)
+    {
+        PhxServerRef *pRef =
+            &pClient->queue[pClient->dwTail++ % PHX_SERVER_QUEUE];
+        PhxServerEvent *pEntry = &pServer->pPool[pRef->dwIndex];
+        PhxServerMsg *pMsg     = &pClient->msg;
+
+        memset(pMsg, 0, sizeof(PhxServerMsg));
+        pMsg->dwMagic  = PHX_SERVER_MAGIC;
+        pMsg->dwType   = pRef->dwType;
+        pMsg->qwFrame  = pRef->qwFrame;
+        pMsg->qwTimeNs = pEntry->qwTimeNs;
+        pMsg->dwSeq    = pRef->dwGen;
+
+        if (pRef->dwType == PHX_SERVER_RAW)
+        {
+            PhxShmHeader *pHeader = pServer->pShm->pHeader;
+            if (PhxShm_Get(pServer->pShm, pRef->qwFrame, &pClient->frame) <=
+                0)
+            {
+                pClient->dwDropped++;
+                continue;
+            }
+            pMsg->qwTimeNs        = pClient->frame.qwTimeNs;
+            pMsg->dwSeq           = pClient->frame.dwSeq;
+            pMsg->dwWidth         = pHeader->dwWidth;
+            pMsg->dwHeight        = pHeader->dwHeight;
+            pMsg->dwBytesPerPixel = pHeader->dwBytesPerPixel;
+            pMsg->dwLength        = pHeader->dwStride * pHeader->dwHeight;
+            pClient->pvPayload    = pClient->frame.image.pvData;
+        }
+        else if (pEntry->dwGen != pRef->dwGen)
+        {
+            /* Pool entry reused by a newer frame */
+            pClient->dwDropped++;
+            continue;
+        }
+        else if (pRef->dwType == PHX_SERVER_QUICK)
+        {
+            pMsg->dwWidth         = pServer->dwQuickWidth;
+            pMsg->dwHeight        = pServer->dwQuickHeight;
+            pMsg->dwBytesPerPixel = 1;
+            pMsg->dwLength = pServer->dwQuickWidth * pServer->dwQuickHeight;
+            pClient->pvPayload = pServer->pbQuick + pRef->dwIndex * pMsg->dwLength;
+        }
+        else if (pRef->dwType == PHX_SERVER_CENT)
+        {
+            pMsg->dwWidth      = pEntry->dwCellsX;
+            pMsg->dwHeight     = pEntry->dwCellsY;
+            pMsg->dwLength     = 2 * sizeof(float) * pEntry->dwCellsX *
+                             pEntry->dwCellsY;
+            pClient->pvPayload = pEntry->fXY;
+        }
+        else
+        {
+            pMsg->dwLength     = sizeof(PhxFrameStats);
+            pClient->pvPayload = &pEntry->stats;
+        }
+        pMsg->dwDropped = pClient->dwDropped;
+        pClient->ref    = *pRef;
+        pClient->sent   = 0;
+        pClient->bBusy  = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/* Trailer for a fully sent payload: dwSeq if the source was not reused
+ * while the payload was in flight, its complement otherwise */
+static ui32 PhxServer_Trailer(PhxServer *pServer, PhxServerClient *pClient)
+{
+    int bIntact;
+
+    if (pClient->ref.dwType == PHX_SERVER_RAW)
+        bIntact = PhxShm_Valid(pServer->pShm, &pClient->frame) > 0;
+    else
+        bIntact =
+            pServer->pPool[pClient->ref.dwIndex].dwGen == pClient->ref.dwGen;
+    return bIntact ? pClient->msg.dwSeq : ~pClient->msg.dwSeq;
+}
+
+static void PhxServer_PollOut(PhxServer *pServer, PhxServerClient *pClient,
+                              int bPollOut)
+{
+    struct epoll_event ev;
+
+    if (pClient->bPollOut == bPollOut)
+        return;
+    ev.events   = EPOLLIN | (bPollOut ? EPOLLOUT : 0);
+    ev.data.u32 = pClient - pServer->pClients;
+    epoll_ctl(pServer->fdEpoll, EPOLL_CTL_MOD, pClient->fd, &ev);
+    pClient->bPollOut = bPollOut;
+}
+
+/* PhxServer_Flush
+ * Send as much as the socket takes without blocking. Header and payload go
+ * out in one gather write straight from the frame ring or pool; the trailer
+ * is sent on its own once the payload is out, so it reflects whether the
+ * source changed during the copy. Returns -1 if the client must be closed.
+ */
+static int PhxServer_Flush(PhxServer *pServer, PhxServerClient *pClient)
+{
+    for (;;)
+    {
+        size_t lenMsg = sizeof(PhxServerMsg) + pClient->msg.dwLength;
+        struct iovec iov[2];
+        struct msghdr mh;
+        ssize_t ret;
+        int n = 0;
+
+        if (!pClient->bBusy && !PhxServer_Next(pServer, pClient))
+            break;
+
+        if (pClient->sent < lenMsg)
+        {
+            if (pClient->sent < sizeof(PhxServerMsg))
+            {
+                iov[n].iov_base = (ui8 *)&pClient->msg + pClient->sent;
+                iov[n].iov_len  = sizeof(PhxServerMsg) - pClient->sent;
+                n++;
+                iov[n].iov_base = (void *)pClient->pvPayload;
+                iov[n].iov_len  = pClient->msg.dwLength;
+            }
+            else
+            {
+                size_t off      = pClient->sent - sizeof(PhxServerMsg);
+                iov[n].iov_base = (ui8 *)pClient->pvPayload + off;
+                iov[n].iov_len  = pClient->msg.dwLength - off;
+            }
+            n++;
+        }
+        else
+        {
+            size_t off = pClient->sent - lenMsg;
+            if (off == 0)
+                pClient->dwTrailer = PhxServer_Trailer(pServer, pClient);
+            iov[n].iov_base = (ui8 *)&pClient->dwTrailer + off;
+            iov[n].iov_len  = sizeof(ui32) - off;
+            n++;
+        }
+
+        memset(&mh, 0, sizeof(mh));
+        mh.msg_iov    = iov;
+        mh.msg_iovlen = n;
+        ret           = sendmsg(pClient->fd, &mh, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (ret < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+            {
+                PhxServer_PollOut(pServer, pClient, 1);
+                return 0;
+            }
+            return -1;
+        }
+        pClient->sent += ret;
+        if (pClient->sent == lenMsg + sizeof(ui32))
+            pClient->bBusy = 0;
+    }
+    PhxServer_PollOut(pServer, pClient, 0);
+    return 0;
+}
+
+/* Subscription words, one per line */
+static int PhxServer_Command(PhxServer *pServer, PhxServerClient *pClient,
+                             char *str)
+{
+    int bRemove = (*str == '-');
+    ui32 dwSubs, i;
+
+    if (bRemove)
+        str++;
+    if (strcmp(str, "raw") == 0)
+        dwSubs = PHX_SERVER_RAW;
+    else if (strcmp(str, "quick") == 0)
+        dwSubs = PHX_SERVER_QUICK;
+    else if (strcmp(str, "cent") == 0)
+        dwSubs = PHX_SERVER_CENT;
+    else if (strcmp(str, "stats") == 0)
+        dwSubs = PHX_SERVER_STATS;
+    else if (strcmp(str, "none") == 0)
+    {
+        dwSubs  = PHX_SERVER_RAW | PHX_SERVER_QUICK | PHX_SERVER_CENT |
+                 PHX_SERVER_STATS;
+        bRemove = 1;
+    }
+    else if (*str == '\0')
+        return 1;
+    else
+        return 0;
+
+    if ((dwSubs & (PHX_SERVER_RAW | PHX_SERVER_QUICK)) && !pServer->pShm &&
+        !bRemove)
+        PHX_LOG_WARN("SERVER: No shared frame ring, %s not available\n", str);
+
+    if (bRemove)
+        pClient->dwSubs &= ~dwSubs;
+    else
+        pClient->dwSubs |= dwSubs;
+
+    dwSubs = 0;
+    for (i = 0; i < PHX_SERVER_CLIENTS; i++)
+        if (pServer->pClients[i].fd >= 0)
+            dwSubs |= pServer->pClients[i].dwSubs;
+    __atomic_store_n(&pServer->dwSubs, dwSubs, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int PhxServer_Read(PhxServer *pServer, PhxServerClient *pClient)
+{
+    char *pLine, *pEnd;
+    ssize_t ret;
+
+    ret = recv(pClient->fd, pClient->rx + pClient->dwRx,
+               sizeof(pClient->rx) - 1 - pClient->dwRx, MSG_DONTWAIT);
+    if (ret == 0)
+        return -1;
+    if (ret < 0)
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    pClient->dwRx += ret;
+    pClient->rx[pClient->dwRx] = '\0';
+
+    pLine = pClient->rx;
+    while ((pEnd = strpbrk(pLine, "\r\n")) != NULL)
+    {
+        *pEnd = '\0';
+        if (!PhxServer_Command(pServer, pClient, pLine))
+            PHX_LOG_WARN("SERVER: Client %d: unknown request '%s'\n",
+                         pClient->fd, pLine);
+        pLine = pEnd + 1;
+    }
+    pClient->dwRx = strlen(pLine);
+    memmove(pClient->rx, pLine, pClient->dwRx + 1);
+    if (pClient->dwRx == sizeof(pClient->rx) - 1)
+        return -1; /* line too long */
+    return 0;
+}
+
+static void PhxServer_Accept(PhxServer *pServer)
+{
+    struct epoll_event ev;
+    int fd, i;
+
+    while ((fd = accept4(pServer->fdListen, NULL, NULL, SOCK_NONBLOCK)) >= 0)
+    {
+        for (i = 0; i < PHX_SERVER_CLIENTS; i++)
+            if (pServer->pClients[i].fd < 0)
+                break;
+        if (i == PHX_SERVER_CLIENTS)
+        {
+            PHX_LOG_WARN("SERVER: Too many clients, refusing\n");
+            close(fd);
+            continue;
+        }
+        pServer->pClients[i].fd = fd;
+        ev.events               = EPOLLIN;
+        ev.data.u32             = i;
+        epoll_ctl(pServer->fdEpoll, EPOLL_CTL_ADD, fd, &ev);
+        PHX_LOG_INFO("SERVER: Client %d connected\n", fd);
+    }
+}
+
+/* Average PHX_SERVER_QUICK_BIN^2 pixels down to one 8 bit pixel */
+static int PhxServer_Quick(PhxServer *pServer, ui64 qwFrame, ui8 *pbOut)
+{
+    PhxShmFrame frame;
+    PhxImage *pImage = &frame.image;
+    ui32 dwStride     = pServer->pShm->pHeader->dwStride;
+    ui32 dwShift, x, y, i, j;
+
+    if (PhxShm_Get(pServer->pShm, qwFrame, &frame) <= 0)
+        return 0;
+    dwShift = pImage->dwBits > 8 ? pImage->dwBits - 8 : 0;
+    for (y = 0; y < pServer->dwQuickHeight; y++)
+    {
+        for (x = 0; x < pServer->dwQuickWidth; x++)
+        {
+            ui32 dwSum = 0;
+            for (j = 0; j < PHX_SERVER_QUICK_BIN; j++)
+            {
+                /* Lines are dwStride bytes apart, maybe padded */
+                ui8 *pbRow = (ui8 *)pImage->pvData +
+                             (size_t)(y * PHX_SERVER_QUICK_BIN + j) * dwStride;
+                ui32 dwCol = x * PHX_SERVER_QUICK_BIN;
+                for (i = 0; i < PHX_SERVER_QUICK_BIN; i++)
+                    dwSum += pImage->dwBytesPerPixel == 1
+                                 ? pbRow[dwCol + i]
+                                 : ((ui16 *)pbRow)[dwCol + i];
+            }
+            pbOut[x + y * pServer->dwQuickWidth] =
+                (dwSum / (PHX_SERVER_QUICK_BIN * PHX_SERVER_QUICK_BIN)) >>
+                dwShift;
+        }
+    }
+    return PhxShm_Valid(pServer->pShm, &frame) > 0;
+}
+
+/* Move posted frames into the pool and queue them to subscribers */
+static void PhxServer_Events(PhxServer *pServer)
+{
+    ui64 qwCount;
+    ui32 dwHead = __atomic_load_n(&pServer->dwEventHead, __ATOMIC_ACQUIRE);
+    ui32 i;
+
+    if (read(pServer->fdEvent, &qwCount, sizeof(qwCount)) < 0 &&
+        errno != EAGAIN)
+        PHX_LOG_WARN("SERVER: eventfd read: %s\n", strerror(errno));
+
+    while (pServer->dwEventTail != dwHead)
+    {
+        PhxServerEvent *pEvent =
+            &pServer->pEvents[pServer->dwEventTail & (PHX_SERVER_EVENTS - 1)];
+        ui32 dwIndex = pServer->dwPoolNext++ % PHX_SERVER_POOL;
+        PhxServerEvent *pEntry = &pServer->pPool[dwIndex];
+        PhxServerRef ref;
+
+        pEntry->qwFrame  = pEvent->qwFrame;
+        pEntry->qwTimeNs = pEvent->qwTimeNs;
+        pEntry->dwFlags  = pEvent->dwFlags;
+        pEntry->dwGen    = ++pServer->dwGen;
+        if (pEvent->dwFlags & PHX_SERVER_STATS)
+            pEntry->stats = pEvent->stats;
+        if (pEvent->dwFlags & PHX_SERVER_CENT)
+        {
+            pEntry->dwCellsX = pEvent->dwCellsX;
+            pEntry->dwCellsY = pEvent->dwCellsY;
+            memcpy(pEntry->fXY, pEvent->fXY,
+                   2 * sizeof(float) * pEvent->dwCellsX * pEvent->dwCellsY);
+        }
+        __atomic_store_n(&pServer->dwEventTail, pServer->dwEventTail + 1,
+                         __ATOMIC_RELEASE);
+
+        if (pServer->pShm && (pServer->dwSubs & PHX_SERVER_QUICK) &&
+            pEntry->qwFrame % pServer->dwDecimation == 0 &&
+            PhxServer_Quick(pServer, pEntry->qwFrame,
+                            pServer->pbQuick +
+                                dwIndex * pServer->dwQuickWidth *
+                                    pServer->dwQuickHeight))
+            pEntry->dwFlags |= PHX_SERVER_QUICK;
+        if (pServer->pShm)
+            pEntry->dwFlags |= PHX_SERVER_RAW;
+
+        ref.dwIndex = dwIndex;
+        ref.dwGen   = pEntry->dwGen;
+        ref.qwFrame = pEntry->qwFrame;
+        for (i = 0; i < PHX_SERVER_CLIENTS; i++)
+        {
+            PhxServerClient *pClient = &pServer->pClients[i];
+            ui32 dwType;
+            if (pClient->fd < 0)
+                continue;
+            for (dwType = PHX_SERVER_RAW; dwType <= PHX_SERVER_STATS;
+                 dwType <<= 1)
+            {
+                if (pClient->dwSubs & pEntry->dwFlags & dwType)
+                {
+                    ref.dwType = dwType;
+                    PhxServer_Queue(pClient, &ref);
+                }
+            }
+        }
+        dwHead = __atomic_load_n(&pServer->dwEventHead, __ATOMIC_ACQUIRE);
+    }
+
+    for (i = 0; i < PHX_SERVER_CLIENTS; i++)
+        if (pServer->pClients[i].fd >= 0 && !pServer->pClients[i].bPollOut &&
+            PhxServer_Flush(pServer, &pServer->pClients[i]) < 0)
+            PhxServer_Close(pServer, &pServer->pClients[i]);
+}
+
+static void *PhxServer_Thread(void *pvArg)
+{
+    PhxServer *pServer = (PhxServer *)pvArg;
+    struct epoll_event events[PHX_SERVER_CLIENTS + 2];
+    int n, i;
+
+    while (__atomic_load_n(&pServer->bRunning, __ATOMIC_ACQUIRE))
+    {
+        n = epoll_wait(pServer->fdEpoll, events, PHX_SERVER_CLIENTS + 2, -1);
+        for (i = 0; i < n; i++)
+        {
+            ui32 tag = events[i].data.u32;
+            if (tag == PHX_SERVER_TAG_LISTEN)
+            {
+                PhxServer_Accept(pServer);
+            }
+            else if (tag == PHX_SERVER_TAG_EVENT)
+            {
+                PhxServer_Events(pServer);
+            }
+            else
+            {
+                PhxServerClient *pClient = &pServer->pClients[tag];
+                if (pClient->fd < 0)
+                    continue;
+                if (((events[i].events & (EPOLLERR | EPOLLHUP)) ||
+                     ((events[i].events & EPOLLIN) &&
+                      PhxServer_Read(pServer, pClient) < 0) ||
+                     ((events[i].events & EPOLLOUT) &&
+                      PhxServer_Flush(pServer, pClient) < 0)))
+                    PhxServer_Close(pServer, pClient);
+            }
+        }
+    }
+    return NULL;
+}
+
+/* PhxServer_Start
+ * Listen on PHX_SERVER_ADDR:dwPort and start the server thread. pShm may
+ * be NULL, in which case only centroids and stats are served.
+ */
+etStat PhxServer_Start(PhxServer *pServer, ui32 dwPort, PhxShm *pShm,
+                       ui32 dwDecimation)
+{
+    struct sockaddr_in addr;
+    struct epoll_event ev;
+    int one = 1;
+    ui32 i;
+
+    memset(pServer, 0, sizeof(PhxServer));
+    pServer->fdListen     = -1;
+    pServer->fdEpoll      = -1;
+    pServer->fdEvent      = -1;
+    pServer->dwPort       = dwPort;
+    pServer->dwDecimation = dwDecimation ? dwDecimation : 1;
+    pServer->pShm         = pShm;
+
+    pServer->pEvents  = calloc(PHX_SERVER_EVENTS, sizeof(PhxServerEvent));
+    pServer->pPool    = calloc(PHX_SERVER_POOL, sizeof(PhxServerEvent));
+    pServer->pClients = calloc(PHX_SERVER_CLIENTS, sizeof(PhxServerClient));
+    if (!pServer->pEvents || !pServer->pPool || !pServer->pClients)
+        goto Error;
+    for (i = 0; i < PHX_SERVER_CLIENTS; i++)
+        pServer->pClients[i].fd = -1;
+    if (pShm)
+    {
+        pServer->dwQuickWidth =
+            pShm->pHeader->dwWidth / PHX_SERVER_QUICK_BIN;
+        pServer->dwQuickHeight =
+            pShm->pHeader->dwHeight / PHX_SERVER_QUICK_BIN;
+        pServer->pbQuick = calloc(PHX_SERVER_POOL, pServer->dwQuickWidth *
+                                                       pServer->dwQuickHeight);
+        if (!pServer->pbQuick)
+            goto Error;
+    }
+    /* Fault the pages in now rather than in the frame path */
+    memset(pServer->pEvents, 0, PHX_SERVER_EVENTS * sizeof(PhxServerEvent));
+    memset(pServer->pPool, 0, PHX_SERVER_POOL * sizeof(PhxServerEvent));
+    if (pServer->pbQuick)
+        memset(pServer->pbQuick, 0, PHX_SERVER_POOL * pServer->dwQuickWidth *
+                                        pServer->dwQuickHeight);
+
+    pServer->fdListen = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    if (pServer->fdListen < 0)
+        goto Error;
+    setsockopt(pServer->fdListen, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(dwPort);
+    inet_pton(AF_INET, PHX_SERVER_ADDR, &addr.sin_addr);
+    if (bind(pServer->fdListen, (struct sockaddr *)&addr, sizeof(addr)) ||
+        listen(pServer->fdListen, PHX_SERVER_CLIENTS))
+        goto Error;
+
+    pServer->fdEvent = eventfd(0, EFD_NONBLOCK);
+    pServer->fdEpoll = epoll_create1(0);
+    if (pServer->fdEvent < 0 || pServer->fdEpoll < 0)
+        goto Error;
+    ev.events   = EPOLLIN;
+    ev.data.u32 = PHX_SERVER_TAG_LISTEN;
+    epoll_ctl(pServer->fdEpoll, EPOLL_CTL_ADD, pServer->fdListen, &ev);
+    ev.data.u32 = PHX_SERVER_TAG_EVENT;
+    epoll_ctl(pServer->fdEpoll, EPOLL_CTL_ADD, pServer->fdEvent, &ev);
+
+    pServer->bRunning = 1;
+    if (pthread_create(&pServer->thread, NULL, PhxServer_Thread, pServer))
+    {
+        pServer->bRunning = 0;
+        goto Error;
+    }
+    PHX_LOG_INFO("SERVER: Listening on %s:%u\n", PHX_SERVER_ADDR, dwPort);
+    return PHX_OK;
+
+Error:
+    PHX_LOG_ERROR("SERVER: Cannot start on port %u: %s\n", dwPort,
+                  strerror(errno));
+    PhxServer_Stop(pServer);
+    return PHX_ERROR_MALLOC_FAILED;
+}
+
+/* PhxServer_Frame
+ * Frame path: post frame qwFrame to the server. stats and cent may be NULL
+ * when those stages are off. Copies only what clients subscribed to and
+ * drops the frame if the server is behind.
+ */
+void PhxServer_Frame(PhxServer *pServer, ui64 qwFrame, ui64 qwTimeNs,
+                     PhxFrameStats *pStats, PhxCentroids *pCent)
+{
+    ui32 dwSubs = __atomic_load_n(&pServer->dwSubs, __ATOMIC_ACQUIRE);
+    ui32 dwHead = pServer->dwEventHead;
+    PhxServerEvent *pEvent;
+    ui64 qwOne = 1;
+
+    if (!dwSubs || !pServer->bRunning)
+        return;
+    if (dwHead - __atomic_load_n(&pServer->dwEventTail, __ATOMIC_ACQUIRE) >=
+        PHX_SERVER_EVENTS)
+    {
+        pServer->qwEventDrops++;
+        return;
+    }
+
+    pEvent           = &pServer->pEvents[dwHead & (PHX_SERVER_EVENTS - 1)];
+    pEvent->qwFrame  = qwFrame;
+    pEvent->qwTimeNs = qwTimeNs;
+    pEvent->dwFlags  = 0;
+    if (pStats && (dwSubs & PHX_SERVER_STATS))
+    {
+        pEvent->stats = *pStats;
+        pEvent->dwFlags |= PHX_SERVER_STATS;
+    }
+    if (pCent && (dwSubs & PHX_SERVER_CENT))
+    {
+        ui32 i, n = pCent->dwCellsX * pCent->dwCellsY;
+        for (i = 0; i < n; i++)
+        {
+            pEvent->fXY[2 * i]     = pCent->fX[i];
+            pEvent->fXY[2 * i + 1] = pCent->fY[i];
+        }
+        pEvent->dwCellsX = pCent->dwCellsX;
+        pEvent->dwCellsY = pCent->dwCellsY;
+        pEvent->dwFlags |= PHX_SERVER_CENT;
+    }
+    __atomic_store_n(&pServer->dwEventHead, dwHead + 1, __ATOMIC_RELEASE);
+    if (write(pServer->fdEvent, &qwOne, sizeof(qwOne)) < 0)
+        pServer->qwEventDrops++;
+}
+
+void PhxServer_Stop(PhxServer *pServer)
+{
+    ui64 qwOne = 1;
+    ui32 i;
+
+    if (pServer->bRunning)
+    {
+        __atomic_store_n(&pServer->bRunning, 0, __ATOMIC_RELEASE);
+        if (write(pServer->fdEvent, &qwOne, sizeof(qwOne)) < 0)
+            PHX_LOG_WARN("SERVER: eventfd write: %s\n", strerror(errno));
+        pthread_join(pServer->thread, NULL);
+        PHX_LOG_INFO("SERVER: Stopped, %llu frames not posted\n",
+                     (unsigned long long)pServer->qwEventDrops);
+    }
+    if (pServer->pClients)
+        for (i = 0; i < PHX_SERVER_CLIENTS; i++)
+            if (pServer->pClients[i].fd >= 0)
+                close(pServer->pClients[i].fd);
+    if (pServer->fdListen >= 0)
+        close(pServer->fdListen);
+    if (pServer->fdEpoll >= 0)
+        close(pServer->fdEpoll);
+    if (pServer->fdEvent >= 0)
+        close(pServer->fdEvent);
+    free(pServer->pEvents);
+    free(pServer->pPool);
+    free(pServer->pClients);
+    free(pServer->pbQuick);
+    pServer->pEvents  = NULL;
+    pServer->pPool    = NULL;
+    pServer->pClients = NULL;
+    pServer->pbQuick  = NULL;
+    pServer->fdListen = pServer->fdEpoll = pServer->fdEvent = -1;
+}
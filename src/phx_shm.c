@@ -0,0 +1,379 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "phx_log.h"
+#include "phx_shm.h"
+
+#define PHX_SHM_PAGE 4096
+#define PHX_SHM_ROUND(x) (((x) + PHX_SHM_PAGE - 1) & ~(size_t)(PHX_SHM_PAGE - 1))
+
+/* PhxShm_Retire
+ * Bump the generation of the object mapped at pHeader, so its readers
+ * get PHX_SHM_REOPEN.
+ */
+static void PhxShm_Retire(PhxShmHeader *pHeader)
+{
+    __atomic_store_n(&pHeader->qwGeneration, pHeader->qwGeneration + 1,
+                     __ATOMIC_RELEASE);
+}
+
+/* PhxShm_Create
+ * Create (or recreate) the segment for dwSlots frames of the given image
+ * geometry; dwStride is PHX_BUF_DST_XLENGTH, the destination line length
+ * in bytes. A segment left under the same name is retired and unlinked,
+ * its readers keep their mapping of it and see the generation change.
+ */
+etStat PhxShm_Create(PhxShm *pShm, char *pszName, ui32 dwSlots,
+                     PhxImage *pImage, ui32 dwStride)
+{
+    PhxShmHeader *pHeader;
+    size_t lenHeader = PHX_SHM_ROUND(sizeof(PhxShmHeader));
+    size_t lenSlot   = PHX_SHM_ROUND((size_t)dwStride * pImage->dwHeight);
+    ui64 qwGeneration = 0;
+    ui32 i;
+
+    memset(pShm, 0, sizeof(PhxShm));
+    pShm->fd = -1;
+    if (dwSlots < PHX_SHM_GUARD + 2 || dwSlots > PHX_SHM_MAX_SLOTS)
+        return PHX_ERROR_BAD_PARAM_VALUE;
+
+    strncpy(pShm->szName, pszName, sizeof(pShm->szName) - 1);
+    pShm->len     = lenHeader + lenSlot * dwSlots;
+    pShm->bWriter = 1;
+
+    /* Carry the generation over from a previous writer, and never resize
+     * an object readers may have mapped */
+    pShm->fd = shm_open(pszName, O_RDWR, 0);
+    if (pShm->fd >= 0)
+    {
+        struct stat st;
+        PhxShmHeader *pOld;
+
+        if (fstat(pShm->fd, &st) == 0 &&
+            st.st_size >= (off_t)sizeof(PhxShmHeader))
+        {
+            pOld = mmap(NULL, sizeof(PhxShmHeader), PROT_READ | PROT_WRITE,
+                        MAP_SHARED, pShm->fd, 0);
+            if (pOld != MAP_FAILED)
+            {
+                if (pOld->dwMagic == PHX_SHM_MAGIC)
+                {
+                    PhxShm_Retire(pOld);
+                    qwGeneration = pOld->qwGeneration;
+                }
+                munmap(pOld, sizeof(PhxShmHeader));
+            }
+        }
+        close(pShm->fd);
+        shm_unlink(pszName);
+    }
+
+    pShm->fd = shm_open(pszName, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (pShm->fd < 0)
+        goto Error;
+    if (ftruncate(pShm->fd, pShm->len))
+        goto Error;
+
+    pHeader = mmap(NULL, pShm->len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   pShm->fd, 0);
+    if (pHeader == MAP_FAILED)
+        goto Error;
+    pShm->pHeader = pHeader;
+
+    /* Invalidate before touching the layout so readers back off */
+    __atomic_store_n(&pHeader->dwMagic, 0, __ATOMIC_RELEASE);
+    memset(pHeader->slots, 0, sizeof(pHeader->slots));
+    pHeader->dwVersion       = PHX_SHM_VERSION;
+    pHeader->dwSlots         = dwSlots;
+    pHeader->dwGuard         = PHX_SHM_GUARD;
+    pHeader->dwWidth         = pImage->dwWidth;
+    pHeader->dwHeight        = pImage->dwHeight;
+    pHeader->dwStride        = dwStride;
+    pHeader->dwBytesPerPixel = pImage->dwBytesPerPixel;
+    pHeader->dwBits          = pImage->dwBits;
+    pHeader->dwSlotBytes     = lenSlot;
+    pHeader->qwDataOffset    = lenHeader;
+    pHeader->qwHead          = 0;
+    pHeader->dwHeadSlot      = 0;
+    pHeader->nWriterPid      = getpid();
+    for (i = 0; i < dwSlots; i++)
+    {
+        pHeader->slots[i].dwSeq    = 1;
+        pHeader->slots[i].qwOffset = lenHeader + lenSlot * i;
+    }
+    pShm->qwGeneration = qwGeneration + 1;
+    __atomic_store_n(&pHeader->qwGeneration, pShm->qwGeneration,
+                     __ATOMIC_RELEASE);
+    __atomic_store_n(&pHeader->dwMagic, PHX_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    PHX_LOG_INFO("SHM: %s: %u slots of %u bytes, generation %llu\n", pszName,
+                 dwSlots, (ui32)lenSlot, (unsigned long long)qwGeneration + 1);
+    return PHX_OK;
+
+Error:
+    PHX_LOG_ERROR("SHM: Cannot create %s: %s\n", pszName, strerror(errno));
+    PhxShm_Destroy(pShm);
+    return PHX_ERROR_MALLOC_FAILED;
+}
+
+/* PhxShm_Attach
+ * Hand the slots to the Phoenix as user destination buffers. Each buffer's
+ * context is its slot, which comes back in stImageBuff.pvContext from
+ * PHX_BUFFER_GET and is what PhxShm_Publish expects. PHX_ACQ_BLOCKING is
+ * left to the config. Call with acquisition stopped.
+ */
+etStat PhxShm_Attach(PhxShm *pShm, tHandle handle)
+{
+    PhxShmHeader *pHeader = pShm->pHeader;
+    etStat eStat          = PHX_OK;
+    etParamValue eParamValue;
+    ui32 dwSlots = pHeader->dwSlots;
+    ui32 i;
+
+    pShm->pBuffers = calloc(dwSlots + 1, sizeof(stImageBuff));
+    if (pShm->pBuffers == NULL)
+        return PHX_ERROR_MALLOC_FAILED;
+    for (i = 0; i < dwSlots; i++)
+    {
+        pShm->pBuffers[i].pvAddress =
+            (ui8 *)pHeader + pHeader->slots[i].qwOffset;
+        pShm->pBuffers[i].pvContext = &pHeader->slots[i];
+    }
+    /* The list is terminated by a NULL entry */
+
+    eStat = PHX_ParameterSet(handle, PHX_ACQ_NUM_IMAGES, &dwSlots);
+    if (PHX_OK != eStat)
+        goto Error;
+    eStat = PHX_ParameterSet(handle, PHX_DST_PTRS_VIRT, pShm->pBuffers);
+    if (PHX_OK != eStat)
+        goto Error;
+    eParamValue = PHX_DST_PTR_USER_VIRT;
+    eStat       = PHX_ParameterSet(
+        handle,
+        (etParam)(PHX_DST_PTR_TYPE | PHX_CACHE_FLUSH | PHX_FORCE_REWRITE),
+        &eParamValue);
+    if (PHX_OK != eStat)
+        goto Error;
+    return PHX_OK;
+
+Error:
+    PHX_LOG_ERROR("SHM: Cannot use %s as destination buffers [%d]\n",
+                  pShm->szName, eStat);
+    free(pShm->pBuffers);
+    pShm->pBuffers = NULL;
+    return eStat;
+}
+
+/* PhxShm_Publish
+ * Called from the frame path with the pvContext of the buffer just
+ * received and dwAhead, the frames the board has captured that are not
+ * published yet (PHX_BUFFER_READY_COUNT). Invalidates those slots and the
+ * PHX_SHM_GUARD the board may be filling next, completes this slot's
+ * metadata and moves the head. Never blocks.
+ */
+void PhxShm_Publish(PhxShm *pShm, void *pvContext, ui64 qwFrame,
+                    ui64 qwTimeNs, ui32 dwStatus, ui32 dwAhead)
+{
+    PhxShmHeader *pHeader = pShm->pHeader;
+    PhxShmSlot *pSlot     = (PhxShmSlot *)pvContext;
+    ui32 dwSlot           = pSlot - pHeader->slots;
+    ui32 dwInvalid        = dwAhead + PHX_SHM_GUARD;
+    ui32 i;
+
+    if (dwInvalid > pHeader->dwSlots - 1)
+        dwInvalid = pHeader->dwSlots - 1;
+    for (i = 1; i <= dwInvalid; i++)
+    {
+        PhxShmSlot *pNext = &pHeader->slots[(dwSlot + i) % pHeader->dwSlots];
+        ui32 dwSeq        = pNext->dwSeq;
+        if (!(dwSeq & 1))
+            __atomic_store_n(&pNext->dwSeq, dwSeq + 1, __ATOMIC_RELEASE);
+    }
+    /* Not yet odd on the first lap, or after PhxShm_Invalidate */
+    if (!(pSlot->dwSeq & 1))
+        __atomic_store_n(&pSlot->dwSeq, pSlot->dwSeq + 1, __ATOMIC_RELEASE);
+
+    pSlot->qwFrame  = qwFrame;
+    pSlot->qwTimeNs = qwTimeNs;
+    pSlot->dwStatus = dwStatus;
+    __atomic_store_n(&pSlot->dwSeq, pSlot->dwSeq + 1, __ATOMIC_RELEASE);
+
+    pHeader->dwHeadSlot = dwSlot;
+    __atomic_store_n(&pHeader->qwHead, qwFrame, __ATOMIC_RELEASE);
+}
+
+/* PhxShm_Invalidate
+ * Writer, with acquisition stopped: make every slot odd, for a restart
+ * after which the board fills the slots from the first one again.
+ * Readers get nothing until frames are published again.
+ */
+void PhxShm_Invalidate(PhxShm *pShm)
+{
+    PhxShmHeader *pHeader = pShm->pHeader;
+    ui32 i;
+
+    for (i = 0; i < pHeader->dwSlots; i++)
+    {
+        ui32 dwSeq = pHeader->slots[i].dwSeq;
+        if (!(dwSeq & 1))
+            __atomic_store_n(&pHeader->slots[i].dwSeq, dwSeq + 1,
+                             __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&pHeader->qwHead, 0, __ATOMIC_RELEASE);
+}
+
+/* Writer: retire, unmap and remove the name. Readers get PHX_SHM_REOPEN
+ * from then on. */
+void PhxShm_Destroy(PhxShm *pShm)
+{
+    int bWriter = pShm->bWriter;
+
+    if (bWriter && pShm->pHeader)
+        PhxShm_Retire(pShm->pHeader);
+    PhxShm_Close(pShm);
+    if (bWriter && pShm->szName[0])
+        shm_unlink(pShm->szName);
+}
+
+etStat PhxShm_Open(PhxShm *pShm, char *pszName)
+{
+    struct stat st;
+
+    memset(pShm, 0, sizeof(PhxShm));
+    strncpy(pShm->szName, pszName, sizeof(pShm->szName) - 1);
+    pShm->fd = shm_open(pszName, O_RDONLY, 0);
+    if (pShm->fd < 0)
+        goto Error;
+    if (fstat(pShm->fd, &st) || st.st_size < (off_t)sizeof(PhxShmHeader))
+        goto Error;
+    pShm->len     = st.st_size;
+    pShm->pHeader = mmap(NULL, pShm->len, PROT_READ, MAP_SHARED, pShm->fd, 0);
+    if (pShm->pHeader == MAP_FAILED)
+    {
+        pShm->pHeader = NULL;
+        goto Error;
+    }
+    if (__atomic_load_n(&pShm->pHeader->dwMagic, __ATOMIC_ACQUIRE) !=
+            PHX_SHM_MAGIC ||
+        pShm->pHeader->dwVersion != PHX_SHM_VERSION)
+    {
+        errno = EPROTO;
+        goto Error;
+    }
+    pShm->qwGeneration =
+        __atomic_load_n(&pShm->pHeader->qwGeneration, __ATOMIC_ACQUIRE);
+    return PHX_OK;
+
+Error:
+    PhxShm_Close(pShm);
+    return PHX_ERROR_BAD_PARAM;
+}
+
+/* Snapshot slot dwSlot; returns 0 if it is being written */
+static int PhxShm_Read(PhxShm *pShm, ui32 dwSlot, PhxShmFrame *pFrame)
+{
+    PhxShmHeader *pHeader = pShm->pHeader;
+    PhxShmSlot *pSlot     = &pHeader->slots[dwSlot];
+
+    pFrame->dwSeq = __atomic_load_n(&pSlot->dwSeq, __ATOMIC_ACQUIRE);
+    if (pFrame->dwSeq & 1)
+        return 0;
+    pFrame->qwFrame               = pSlot->qwFrame;
+    pFrame->qwTimeNs              = pSlot->qwTimeNs;
+    pFrame->dwStatus              = pSlot->dwStatus;
+    pFrame->dwSlot                = dwSlot;
+    pFrame->image.pvData          = (ui8 *)pHeader + pSlot->qwOffset;
+    pFrame->image.dwWidth         = pHeader->dwWidth;
+    pFrame->image.dwHeight        = pHeader->dwHeight;
+    pFrame->image.dwBytesPerPixel = pHeader->dwBytesPerPixel;
+    pFrame->image.dwBits          = pHeader->dwBits;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&pSlot->dwSeq, __ATOMIC_RELAXED) == pFrame->dwSeq;
+}
+
+/* The object was retired since it was opened */
+static int PhxShm_Stale(PhxShm *pShm)
+{
+    return __atomic_load_n(&pShm->pHeader->qwGeneration, __ATOMIC_ACQUIRE) !=
+           pShm->qwGeneration;
+}
+
+/* PhxShm_Latest
+ * Newest published frame. Returns 0 if there is none (yet) or the writer
+ * was busy with it; just retry. PHX_SHM_REOPEN if the ring was retired.
+ */
+int PhxShm_Latest(PhxShm *pShm, PhxShmFrame *pFrame)
+{
+    PhxShmHeader *pHeader = pShm->pHeader;
+    ui64 qwHead = __atomic_load_n(&pHeader->qwHead, __ATOMIC_ACQUIRE);
+
+    if (PhxShm_Stale(pShm))
+        return PHX_SHM_REOPEN;
+    if (qwHead == 0)
+        return 0;
+    return PhxShm_Read(pShm, pHeader->dwHeadSlot, pFrame) &&
+           pFrame->qwFrame == qwHead && !PhxShm_Stale(pShm);
+}
+
+/* PhxShm_Get
+ * Frame qwFrame from the history. Frames are delivered into consecutive
+ * slots, so it is found by stepping back from the head. Returns 0 if it
+ * has been overwritten or is not published yet, PHX_SHM_REOPEN if the
+ * ring was retired.
+ */
+int PhxShm_Get(PhxShm *pShm, ui64 qwFrame, PhxShmFrame *pFrame)
+{
+    PhxShmHeader *pHeader = pShm->pHeader;
+    ui64 qwHead = __atomic_load_n(&pHeader->qwHead, __ATOMIC_ACQUIRE);
+    ui32 dwBack, dwSlot;
+
+    if (PhxShm_Stale(pShm))
+        return PHX_SHM_REOPEN;
+    if (qwFrame == 0 || qwFrame > qwHead ||
+        qwHead - qwFrame >= pHeader->dwSlots - pHeader->dwGuard)
+        return 0;
+    dwBack = qwHead - qwFrame;
+    dwSlot = (pHeader->dwHeadSlot + pHeader->dwSlots - dwBack) %
+             pHeader->dwSlots;
+    if (!PhxShm_Read(pShm, dwSlot, pFrame) || pFrame->qwFrame != qwFrame)
+        return 0;
+    return PhxShm_Valid(pShm, pFrame);
+}
+
+/* PhxShm_Valid
+ * Call after using pFrame->image.pvData in place. Returns 0 if the slot
+ * may have been refilled meanwhile and the data must be discarded,
+ * PHX_SHM_REOPEN if the ring was retired.
+ */
+int PhxShm_Valid(PhxShm *pShm, PhxShmFrame *pFrame)
+{
+    PhxShmHeader *pHeader = pShm->pHeader;
+    PhxShmSlot *pSlot     = &pHeader->slots[pFrame->dwSlot];
+    ui64 qwHead;
+
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (PhxShm_Stale(pShm))
+        return PHX_SHM_REOPEN;
+    if (__atomic_load_n(&pSlot->dwSeq, __ATOMIC_ACQUIRE) != pFrame->dwSeq)
+        return 0;
+    qwHead = __atomic_load_n(&pHeader->qwHead, __ATOMIC_ACQUIRE);
+    return qwHead - pFrame->qwFrame < pHeader->dwSlots - pHeader->dwGuard;
+}
+
+void PhxShm_Close(PhxShm *pShm)
+{
+    if (pShm->pHeader != NULL)
+        munmap(pShm->pHeader, pShm->len);
+    if (pShm->fd >= 0)
+        close(pShm->fd);
+    free(pShm->pBuffers);
+    pShm->pHeader  = NULL;
+    pShm->pBuffers = NULL;
+    pShm->fd       = -1;
+}
@@ -0,0 +1,142 @@
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "phx_log.h"
+#include "phx_shutdown.h"
+
+/* Shared with the handlers, so file scope */
+static int s_fdEvent = -1;
+static ui32 s_dwPending;   /* 1 << signal, set by the handlers */
+static int s_nRequests;    /* SIGINT and SIGTERM received */
+static int s_bStop;
+static int s_bRunning;
+static pthread_t s_thread;
+static PhxShutdownFn s_pfnSignal;
+static void *s_pvParams;
+
+static const int s_nSignals[] = {SIGINT, SIGTERM, SIGUSR1};
+#define PHX_SHUTDOWN_SIGNALS (sizeof(s_nSignals) / sizeof(s_nSignals[0]))
+
+static void PhxShutdown_SignalSet(sigset_t *pSet)
+{
+    ui32 i;
+
+    sigemptyset(pSet);
+    for (i = 0; i < PHX_SHUTDOWN_SIGNALS; i++)
+        sigaddset(pSet, s_nSignals[i]);
+}
+
+/* PhxShutdown_Handler
+ * Async-signal-safe: atomics, write and _exit only.
+ */
+static void PhxShutdown_Handler(int sig)
+{
+    static const char szForced[] = "SHK: Forced exit\n";
+    uint64_t qwOne               = 1;
+    int nSaved                   = errno;
+
+    if (sig != SIGUSR1 &&
+        __atomic_fetch_add(&s_nRequests, 1, __ATOMIC_RELAXED) > 0)
+    {
+        write(STDERR_FILENO, szForced, sizeof(szForced) - 1);
+        _exit(128 + sig);
+    }
+    __atomic_fetch_or(&s_dwPending, 1u << sig, __ATOMIC_RELEASE);
+    write(s_fdEvent, &qwOne, sizeof(qwOne));
+    errno = nSaved;
+}
+
+static void *PhxShutdown_Thread(void *pv)
+{
+    sigset_t set;
+
+    /* The one thread the signals are delivered to */
+    PhxShutdown_SignalSet(&set);
+    pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+
+    while (!__atomic_load_n(&s_bStop, __ATOMIC_ACQUIRE))
+    {
+        uint64_t qwCount;
+        ui32 dwPending, i;
+
+        if (read(s_fdEvent, &qwCount, sizeof(qwCount)) < 0 && errno != EINTR)
+            break;
+        dwPending = __atomic_exchange_n(&s_dwPending, 0, __ATOMIC_ACQUIRE);
+        for (i = 0; i < PHX_SHUTDOWN_SIGNALS; i++)
+        {
+            if (dwPending & (1u << s_nSignals[i]))
+                (*s_pfnSignal)(s_nSignals[i], s_pvParams);
+        }
+    }
+    return NULL;
+}
+
+/* PhxShutdown_Init
+ * Install the handlers and block the signals in the calling thread. Call
+ * first thing in main, before any thread is created.
+ */
+etStat PhxShutdown_Init(void)
+{
+    struct sigaction sa;
+    sigset_t set;
+    ui32 i;
+
+    s_fdEvent = eventfd(0, EFD_CLOEXEC);
+    if (s_fdEvent < 0)
+        return PHX_ERROR_MALLOC_FAILED;
+
+    PhxShutdown_SignalSet(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = PhxShutdown_Handler;
+    sa.sa_flags   = SA_RESTART;
+    sigfillset(&sa.sa_mask);
+    for (i = 0; i < PHX_SHUTDOWN_SIGNALS; i++)
+    {
+        if (sigaction(s_nSignals[i], &sa, NULL))
+            return PHX_ERROR_BAD_PARAM;
+    }
+    return PHX_OK;
+}
+
+/* PhxShutdown_Start
+ * Start the coordinator, which calls pfnSignal for each signal. Signals
+ * received since PhxShutdown_Init are delivered now.
+ */
+etStat PhxShutdown_Start(PhxShutdownFn pfnSignal, void *pvParams)
+{
+    s_pfnSignal = pfnSignal;
+    s_pvParams  = pvParams;
+    if (pthread_create(&s_thread, NULL, PhxShutdown_Thread, NULL))
+        return PHX_ERROR_MALLOC_FAILED;
+    s_bRunning = 1;
+    return PHX_OK;
+}
+
+/* Nonzero once SIGINT or SIGTERM has been received */
+int PhxShutdown_Requested(void)
+{
+    return __atomic_load_n(&s_nRequests, __ATOMIC_RELAXED) != 0;
+}
+
+/* PhxShutdown_Stop
+ * Stop the coordinator. Not from pfnSignal, which runs on it.
+ */
+void PhxShutdown_Stop(void)
+{
+    uint64_t qwOne = 1;
+
+    if (s_bRunning)
+    {
+        __atomic_store_n(&s_bStop, 1, __ATOMIC_RELEASE);
+        write(s_fdEvent, &qwOne, sizeof(qwOne));
+        pthread_join(s_thread, NULL);
+        s_bRunning = 0;
+    }
+}
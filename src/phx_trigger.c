@@ -0,0 +1,225 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include "phx_cheetah.h"
+#include "phx_log.h"
+#include "phx_trigger.h"
+
+#define CC1 0x1 /* Bit of CC1 in PHX_IO_CCIO */
+
+static ui64 PhxTrigger_Now(clockid_t clock)
+{
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+int PhxTrigger_str_to_path(char *str, PhxTriggerPath *pePath)
+{
+    if (strcmp(str, "PHX_TRIGGER_CC1") == 0)
+        *pePath = PHX_TRIGGER_CC1;
+    else if (strcmp(str, "PHX_TRIGGER_SERIAL") == 0)
+        *pePath = PHX_TRIGGER_SERIAL;
+    else
+        return 0;
+    return 1;
+}
+
+/* PhxTrigger_Setup
+ * Put a camera in trigger mode with the input ePath drives, and make CC1
+ * a board output held low. Call with acquisition stopped.
+ */
+etStat PhxTrigger_Setup(tHandle hCamera, PhxTriggerPath ePath)
+{
+    etStat eStat;
+    CheetahParamValue value;
+    ui32 dwCC;
+
+    if (ePath == PHX_TRIGGER_CC1)
+    {
+        dwCC  = PHX_IO_METHOD_BIT_SET | CC1;
+        eStat = PHX_ParameterSet(hCamera, PHX_IO_CCIO_OUT, &dwCC);
+        if (PHX_OK != eStat)
+            goto Error;
+        dwCC  = PHX_IO_METHOD_BIT_CLR | CC1;
+        eStat = PHX_ParameterSet(hCamera, PHX_IO_CCIO, &dwCC);
+        if (PHX_OK != eStat)
+            goto Error;
+    }
+
+    value = ePath == PHX_TRIGGER_CC1 ? CHEETAHPARAM_TRIG_COMPUTER
+                                     : CHEETAHPARAM_TRIG_SOFT;
+    eStat = Cheetah_ParameterSet(hCamera, CHEETAH_TRGIN_SEL, &value);
+    if (PHX_OK != eStat)
+        goto Error;
+    value = CHEETAHPARAM_ENABLE;
+    eStat = Cheetah_ParameterSet(hCamera, CHEETAH_TRGMODE_EN, &value);
+    if (PHX_OK != eStat)
+        goto Error;
+    return PHX_OK;
+
+Error:
+    PHX_LOG_ERROR("TRIGGER: Cannot set up %s triggering\n",
+                  ePath == PHX_TRIGGER_CC1 ? "CC1" : "serial");
+    return eStat;
+}
+
+void PhxTrigger_Init(PhxTrigger *pTrig)
+{
+    memset(pTrig, 0, sizeof(PhxTrigger));
+}
+
+/* Add a camera to be triggered, before PhxTrigger_Start */
+etStat PhxTrigger_Add(PhxTrigger *pTrig, tHandle hCamera, PhxTriggerPath ePath)
+{
+    if (pTrig->dwCameras == PHX_MAX_CAMERAS)
+        return PHX_ERROR_BAD_PARAM;
+    pTrig->hCameras[pTrig->dwCameras] = hCamera;
+    pTrig->ePaths[pTrig->dwCameras]   = ePath;
+    pTrig->dwCameras++;
+    return PHX_OK;
+}
+
+static void PhxTrigger_Issue(PhxTrigger *pTrig)
+{
+    ui32 dwCC;
+    ui32 i;
+
+    pTrig->qwTimeNs[pTrig->qwIssued & (PHX_TRIGGER_RING - 1)] =
+        PhxTrigger_Now(CLOCK_MONOTONIC);
+    __atomic_store_n(&pTrig->qwIssued, pTrig->qwIssued + 1, __ATOMIC_RELEASE);
+
+    /* CC1 first, all of them within microseconds */
+    for (i = 0; i < pTrig->dwCameras; i++)
+    {
+        if (pTrig->ePaths[i] != PHX_TRIGGER_CC1)
+            continue;
+        dwCC = PHX_IO_METHOD_BIT_SET | CC1;
+        PHX_ParameterSet(pTrig->hCameras[i], PHX_IO_CCIO, &dwCC);
+    }
+    for (i = 0; i < pTrig->dwCameras; i++)
+    {
+        if (pTrig->ePaths[i] != PHX_TRIGGER_CC1)
+            continue;
+        dwCC = PHX_IO_METHOD_BIT_CLR | CC1;
+        PHX_ParameterSet(pTrig->hCameras[i], PHX_IO_CCIO, &dwCC);
+    }
+    for (i = 0; i < pTrig->dwCameras; i++)
+    {
+        if (pTrig->ePaths[i] == PHX_TRIGGER_SERIAL)
+            Cheetah_SoftwareTriggerStart(pTrig->hCameras[i]);
+    }
+}
+
+static void *PhxTrigger_Thread(void *pv)
+{
+    PhxTrigger *pTrig = (PhxTrigger *)pv;
+    ui64 qwPeriod     = pTrig->qwPeriodNs;
+    ui64 qwReal       = PhxTrigger_Now(CLOCK_REALTIME);
+    ui64 qwMono       = PhxTrigger_Now(CLOCK_MONOTONIC);
+    ui64 qwDeadline;
+
+    /* First whole period of CLOCK_REALTIME at least a period away */
+    qwDeadline = (qwReal / qwPeriod + 2) * qwPeriod - qwReal + qwMono;
+
+    while (!__atomic_load_n(&pTrig->bStop, __ATOMIC_ACQUIRE))
+    {
+        struct timespec ts;
+        ui64 qwNow;
+
+        ts.tv_sec  = qwDeadline / 1000000000ull;
+        ts.tv_nsec = qwDeadline % 1000000000ull;
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL))
+            continue;
+        if (__atomic_load_n(&pTrig->bStop, __ATOMIC_ACQUIRE))
+            break;
+
+        PhxTrigger_Issue(pTrig);
+
+        qwNow = PhxTrigger_Now(CLOCK_MONOTONIC);
+        if (qwNow - qwDeadline > pTrig->qwLateNs)
+            pTrig->qwLateNs = qwNow - qwDeadline;
+        qwDeadline += qwPeriod;
+        /* Keep to the grid rather than trigger late */
+        while (qwDeadline <= qwNow)
+        {
+            qwDeadline += qwPeriod;
+            pTrig->qwMissed++;
+        }
+    }
+    return NULL;
+}
+
+/* PhxTrigger_Start
+ * Trigger the cameras every dwPeriodUs from a new thread. Start the
+ * acquisition first, a trigger the board is not ready for is lost.
+ */
+etStat PhxTrigger_Start(PhxTrigger *pTrig, ui32 dwPeriodUs)
+{
+    ui32 i;
+
+    if (dwPeriodUs == 0 || pTrig->dwCameras == 0)
+        return PHX_ERROR_BAD_PARAM_VALUE;
+    for (i = 0; i < pTrig->dwCameras; i++)
+    {
+        if (pTrig->ePaths[i] == PHX_TRIGGER_SERIAL &&
+            dwPeriodUs < PHX_TRIGGER_SERIAL_US)
+        {
+            PHX_LOG_WARN("TRIGGER: %u us is too short for serial triggers, "
+                         "using %u us\n",
+                         dwPeriodUs, PHX_TRIGGER_SERIAL_US);
+            dwPeriodUs = PHX_TRIGGER_SERIAL_US;
+        }
+    }
+    pTrig->qwPeriodNs = dwPeriodUs * 1000ull;
+    pTrig->bStop      = 0;
+    pTrig->qwIssued   = 0;
+
+    if (pthread_create(&pTrig->thread, NULL, PhxTrigger_Thread, pTrig))
+        return PHX_ERROR_MALLOC_FAILED;
+    pTrig->bRunning = 1;
+    PHX_LOG_INFO("TRIGGER: %u cameras every %u us\n", pTrig->dwCameras,
+                 dwPeriodUs);
+    return PHX_OK;
+}
+
+/* PhxTrigger_Before
+ * CLOCK_MONOTONIC of the last trigger issued at least qwMinNs before
+ * qwTimeNs, for the frame path, or 0 if there is none left in the ring.
+ * The slot the timer thread may be writing is never read.
+ */
+ui64 PhxTrigger_Before(PhxTrigger *pTrig, ui64 qwTimeNs, ui64 qwMinNs)
+{
+    ui64 qwIssued = __atomic_load_n(&pTrig->qwIssued, __ATOMIC_ACQUIRE);
+    ui64 qwTrigger;
+
+    if (qwTimeNs < qwMinNs)
+        return 0;
+    qwTimeNs -= qwMinNs;
+    for (qwTrigger = qwIssued;
+         qwTrigger > 0 && qwIssued - qwTrigger < PHX_TRIGGER_RING - 1;
+         qwTrigger--)
+    {
+        ui64 qwTrigNs =
+            pTrig->qwTimeNs[(qwTrigger - 1) & (PHX_TRIGGER_RING - 1)];
+        if (qwTrigNs <= qwTimeNs)
+            return qwTrigNs;
+    }
+    return 0;
+}
+
+void PhxTrigger_Stop(PhxTrigger *pTrig)
+{
+    if (!pTrig->bRunning)
+        return;
+
+    __atomic_store_n(&pTrig->bStop, 1, __ATOMIC_RELEASE);
+    pthread_join(pTrig->thread, NULL);
+    pTrig->bRunning = 0;
+
+    PHX_LOG_INFO("TRIGGER: %" PRIu64 " triggers, %" PRIu64 " missed, worst "
+                 "wakeup %.1f us late\n",
+                 pTrig->qwIssued, pTrig->qwMissed, pTrig->qwLateNs / 1000.0);
+}